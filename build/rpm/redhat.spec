@@ -247,6 +247,7 @@ BuildRequires: systemtap-sdt-devel
 %endif
 %if !%{disable_libuv}
 BuildRequires: libuv-devel >= 1.0
+BuildRequires: libzstd-devel >= 1.4.0
 %endif
 %if !%{disable_openssl}
 BuildRequires: openssl-devel >= 1.1.1
@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ * HTTP/1.1 load generator for pmproxy REST APIs - drives a set of URLs
+ * over several keep-alive connections, optionally pipelining requests,
+ * and reports throughput and latency percentiles.  With -C, a "client"
+ * parameter is added to each request and checked in the JSON responses
+ * to verify pipelined responses are returned in request order.
+ */
+
+#include <pcp/pmapi.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+
+typedef struct request {
+    unsigned int	seq;		/* request sequence number */
+    unsigned int	url;		/* index into URL list */
+    double		sent;		/* time request was written */
+} request;
+
+typedef struct conn {
+    int			fd;
+    unsigned int	count;		/* requests in flight */
+    request		*inflight;	/* ring of requests, oldest first */
+    unsigned int	head;
+    char		*buffer;	/* partial response data */
+    size_t		length;
+    size_t		size;
+} conn;
+
+static char		*host = "localhost";
+static char		*port = "44322";
+static char		**urls;
+static int		nurls;
+static int		check;
+static int		verbose;
+static unsigned int	depth = 1;
+
+static unsigned int	nextseq;	/* next new request sequence */
+static unsigned int	total;		/* requests to complete */
+static unsigned int	*retries;	/* requests to resend */
+static unsigned int	nretries;
+
+static unsigned int	completed, success, failures, misordered, reconnects;
+static double		*latency;
+
+static double
+now(void)
+{
+    struct timeval	tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int
+connect_server(void)
+{
+    struct addrinfo	hints = { 0 }, *res, *ai;
+    int			fd = -1, one = 1;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+	fprintf(stderr, "%s: cannot resolve %s:%s\n", pmGetProgname(), host, port);
+	exit(1);
+    }
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+	if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+	    continue;
+	if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+	    break;
+	close(fd);
+	fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+	fprintf(stderr, "%s: cannot connect to %s:%s: %s\n",
+			pmGetProgname(), host, port, strerror(errno));
+	exit(1);
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static int
+send_request(conn *c)
+{
+    request		*rp;
+    unsigned int	seq;
+    char		buf[8192];
+    int			bytes;
+
+    if (nretries > 0)
+	seq = retries[--nretries];
+    else if (nextseq < total)
+	seq = nextseq++;
+    else
+	return 0;
+
+    rp = &c->inflight[(c->head + c->count) % depth];
+    rp->seq = seq;
+    rp->url = seq % nurls;
+    if (check)
+	bytes = pmsprintf(buf, sizeof(buf),
+		"GET %s%cclient=%u HTTP/1.1\r\nHost: %s\r\n\r\n", urls[rp->url],
+		strchr(urls[rp->url], '?') ? '&' : '?', seq, host);
+    else
+	bytes = pmsprintf(buf, sizeof(buf),
+		"GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", urls[rp->url], host);
+    rp->sent = now();
+    if (write(c->fd, buf, bytes) != bytes)
+	return -1;
+    c->count++;
+    return 1;
+}
+
+static void
+reconnect(conn *c)
+{
+    /* requests not yet answered are sent again on the new connection */
+    while (c->count > 0) {
+	retries[nretries++] = c->inflight[c->head].seq;
+	c->head = (c->head + 1) % depth;
+	c->count--;
+    }
+    close(c->fd);
+    c->fd = connect_server();
+    c->head = 0;
+    c->length = 0;
+    reconnects++;
+}
+
+static char *
+find_header(const char *headers, const char *end, const char *name)
+{
+    size_t		length = strlen(name);
+    const char		*p;
+
+    for (p = headers; p < end; p++) {
+	if ((p = strstr(p, "\r\n")) == NULL || p >= end)
+	    break;
+	if (strncasecmp(p + 2, name, length) == 0)
+	    return (char *)p + 2 + length;
+    }
+    return NULL;
+}
+
+/*
+ * Returns the length of the complete response at the start of the
+ * buffer, else zero if more data is needed.
+ */
+static size_t
+response_length(conn *c, int *status, int *closing, size_t *bodyp)
+{
+    char		*end, *p, *body, *limit = c->buffer + c->length;
+    size_t		chunk;
+
+    c->buffer[c->length] = '\0';
+    if ((end = strstr(c->buffer, "\r\n\r\n")) == NULL)
+	return 0;
+    body = end + 4;
+    *bodyp = body - c->buffer;
+    *status = (int)strtol(c->buffer + 9, NULL, 10);
+    *closing = ((p = find_header(c->buffer, end, "Connection:")) != NULL &&
+		strncasecmp(p + strspn(p, " "), "close", 5) == 0);
+
+    if ((p = find_header(c->buffer, end, "Content-Length:")) != NULL) {
+	chunk = strtoul(p, NULL, 10);
+	return (body + chunk <= limit) ? body + chunk - c->buffer : 0;
+    }
+    /* chunked transfer encoding - walk the chunks to the terminator */
+    for (p = body; p < limit; ) {
+	chunk = strtoul(p, &end, 16);
+	if ((end = strstr(end, "\r\n")) == NULL)
+	    return 0;
+	p = end + 2 + chunk + 2;
+	if (p > limit)
+	    return 0;
+	if (chunk == 0)
+	    return p - c->buffer;
+    }
+    return 0;
+}
+
+static int
+process_responses(conn *c)
+{
+    request		*rp;
+    size_t		length, body;
+    char		tag[64];
+    int			status, closing;
+
+    while ((length = response_length(c, &status, &closing, &body)) > 0) {
+	if (c->count == 0) {
+	    fprintf(stderr, "%s: unexpected response\n", pmGetProgname());
+	    return -1;
+	}
+	rp = &c->inflight[c->head];
+	c->head = (c->head + 1) % depth;
+	c->count--;
+
+	latency[completed++] = now() - rp->sent;
+	if (status >= 200 && status < 300)
+	    success++;
+	else {
+	    failures++;
+	    if (verbose)
+		fprintf(stderr, "request seq=%u url=%s failed:\n%.*s\n",
+			rp->seq, urls[rp->url], (int)length, c->buffer);
+	}
+	if (check) {
+	    pmsprintf(tag, sizeof(tag), "\"client\":\"%u\"", rp->seq);
+	    if (strstr(c->buffer + body, tag) == NULL ||
+		strstr(c->buffer + body, tag) >= c->buffer + length)
+		misordered++;
+	}
+	if (verbose > 1)
+	    fprintf(stderr, "response seq=%u status=%d length=%lu\n",
+			rp->seq, status, (unsigned long)length);
+
+	memmove(c->buffer, c->buffer + length, c->length - length);
+	c->length -= length;
+	if (closing) {
+	    reconnect(c);
+	    return 0;
+	}
+    }
+    return 0;
+}
+
+static int
+compare(const void *a, const void *b)
+{
+    double	x = *(double *)a, y = *(double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double
+percentile(double pct)
+{
+    unsigned int	i;
+
+    if (completed == 0)
+	return 0.0;
+    i = (unsigned int)(pct / 100.0 * (completed - 1) + 0.5);
+    return latency[i] * 1000.0;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct pollfd	*fds;
+    conn		*conns;
+    double		start, elapsed;
+    ssize_t		bytes;
+    int			c, i, sts, nconns = 1, errflag = 0;
+    static const char	*usage = "[-Cv] [-c conns] [-d depth] [-h host] "
+				 "[-n requests] [-p port] url ...";
+
+    pmSetProgname(argv[0]);
+    total = 1000;
+    while ((c = getopt(argc, argv, "Cc:d:h:n:p:v?")) != EOF) {
+	switch (c) {
+	case 'C':	/* verify response ordering */
+	    check = 1;
+	    break;
+	case 'c':	/* concurrent connections */
+	    nconns = atoi(optarg);
+	    break;
+	case 'd':	/* pipelined requests per connection */
+	    depth = atoi(optarg);
+	    break;
+	case 'h':
+	    host = optarg;
+	    break;
+	case 'n':	/* total requests */
+	    total = atoi(optarg);
+	    break;
+	case 'p':
+	    port = optarg;
+	    break;
+	case 'v':
+	    verbose++;
+	    break;
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+    if (errflag || optind == argc || nconns < 1 || depth < 1) {
+	fprintf(stderr, "Usage: %s %s\n", pmGetProgname(), usage);
+	exit(1);
+    }
+    urls = &argv[optind];
+    nurls = argc - optind;
+
+    latency = calloc(total, sizeof(double));
+    retries = calloc(total, sizeof(unsigned int));
+    conns = calloc(nconns, sizeof(conn));
+    fds = calloc(nconns, sizeof(struct pollfd));
+    if (!latency || !retries || !conns || !fds) {
+	fprintf(stderr, "%s: out of memory\n", pmGetProgname());
+	exit(1);
+    }
+    for (i = 0; i < nconns; i++) {
+	conns[i].fd = connect_server();
+	conns[i].inflight = calloc(depth, sizeof(request));
+	conns[i].size = 64 * 1024;
+	conns[i].buffer = malloc(conns[i].size + 1);
+    }
+
+    start = now();
+    while (completed < total) {
+	for (i = 0; i < nconns; i++) {
+	    while (conns[i].count < depth) {
+		if ((sts = send_request(&conns[i])) == 0)
+		    break;
+		if (sts < 0)
+		    reconnect(&conns[i]);
+	    }
+	    fds[i].fd = conns[i].fd;
+	    fds[i].events = POLLIN;
+	    fds[i].revents = 0;
+	}
+	if (poll(fds, nconns, 10000) <= 0) {
+	    fprintf(stderr, "%s: timed out waiting for responses\n",
+			pmGetProgname());
+	    break;
+	}
+	for (i = 0; i < nconns; i++) {
+	    if (fds[i].revents == 0)
+		continue;
+	    if (conns[i].size - conns[i].length < 16 * 1024) {
+		conns[i].size *= 2;
+		conns[i].buffer = realloc(conns[i].buffer, conns[i].size + 1);
+	    }
+	    bytes = read(conns[i].fd, conns[i].buffer + conns[i].length,
+			 conns[i].size - conns[i].length);
+	    if (bytes <= 0) {
+		reconnect(&conns[i]);
+		continue;
+	    }
+	    conns[i].length += bytes;
+	    if (process_responses(&conns[i]) < 0)
+		reconnect(&conns[i]);
+	}
+    }
+    elapsed = now() - start;
+
+    qsort(latency, completed, sizeof(double), compare);
+    printf("requests: %u\n", completed);
+    printf("success: %u\n", success);
+    printf("failures: %u\n", failures);
+    if (check)
+	printf("misordered: %u\n", misordered);
+    printf("reconnects: %u\n", reconnects);
+    printf("elapsed: %.3f sec\n", elapsed);
+    printf("throughput: %.1f req/s\n", elapsed > 0 ? completed / elapsed : 0.0);
+    printf("latency: p50 %.3f p90 %.3f p99 %.3f max %.3f msec\n",
+		percentile(50), percentile(90), percentile(99), percentile(100));
+
+    for (i = 0; i < nconns; i++)
+	close(conns[i].fd);
+    exit(completed == total && failures == 0 && misordered == 0 ? 0 : 1);
+}
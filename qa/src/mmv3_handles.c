@@ -0,0 +1,143 @@
+/*
+ * Exercise MMV name lookups and value handles, with concurrent
+ * updates through handles and by name from several threads.
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/mmv_stats.h>
+#include <pthread.h>
+
+#define NTHREADS	4
+#define NUPDATES	100000
+
+static mmv_handle_t	counter;
+static mmv_handle_t	total;
+static void		*map;
+
+static void *
+update(void *arg)
+{
+    int		i;
+
+    (void)arg;
+    for (i = 0; i < NUPDATES; i++) {
+	mmv_handle_inc(&counter);
+	mmv_handle_add(&total, 0.5);
+    }
+    return NULL;
+}
+
+static void *
+update_named(void *arg)
+{
+    int		i;
+
+    (void)arg;
+    for (i = 0; i < NUPDATES; i++)
+	mmv_stats_inc(map, "handles.m5", NULL);
+    return NULL;
+}
+
+static void
+lookup(void *map, const char *metric, const char *instance)
+{
+    pmAtomValue	*value = mmv_lookup_value_desc(map, metric, instance);
+
+    printf("lookup %s[%s]: %s\n", metric, instance ? instance : "NULL",
+		value ? "found" : "not found");
+}
+
+int
+main(int argc, char **argv)
+{
+    int			i, sts;
+    char		name[64];
+    pthread_t		threads[NTHREADS * 2];
+    mmv_registry_t	*registry;
+    pmUnits		count = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE);
+
+    if (argc != 2) {
+	fprintf(stderr, "Usage: %s mmvfile\n", argv[0]);
+	return 1;
+    }
+
+    registry = mmv_stats_registry(argv[1], 323, 0);
+    if (!registry) {
+	fprintf(stderr, "mmv_stats_registry: %s - %s\n", argv[1], strerror(errno));
+	return 1;
+    }
+    mmv_stats_add_indom(registry, 1, "disks", "disk names");
+    mmv_stats_add_instance(registry, 1, 0, "sda");
+    mmv_stats_add_instance(registry, 1, 1, "sdb");
+    for (i = 0; i < 100; i++) {
+	/* names are kept by the registry until mmv_stats_start */
+	char *metric = malloc(32);
+	pmsprintf(metric, 32, "handles.m%d", i);
+	mmv_stats_add_metric(registry, metric, i + 1,
+		(i % 2) ? MMV_TYPE_U64 : MMV_TYPE_DOUBLE, MMV_SEM_COUNTER,
+		count, (i % 3) ? 0 : 1,
+		"short", "long");
+    }
+
+    map = mmv_stats_start(registry);
+    if (!map) {
+	fprintf(stderr, "mmv_stats_start: %s - %s\n", argv[1], strerror(errno));
+	return 1;
+    }
+
+    lookup(map, "handles.m1", NULL);
+    lookup(map, "handles.m1", "sda");
+    lookup(map, "handles.m0", NULL);
+    lookup(map, "handles.m0", "sda");
+    lookup(map, "handles.m99", "sdb");
+    lookup(map, "handles.m99", "sdc");
+    lookup(map, "handles.m100", NULL);
+
+    for (i = 0; i < 100; i++) {
+	pmsprintf(name, sizeof(name), "handles.m%d", i);
+	mmv_stats_add(map, name, (i % 3) ? NULL : "sdb", i);
+    }
+    for (i = 0; i < 100; i++) {
+	pmsprintf(name, sizeof(name), "handles.m%d", i);
+	if (mmv_lookup_value_desc(map, name, "sdb")->ull == 0 && i > 0)
+	    printf("%s: value not updated\n", name);
+    }
+
+    sts = mmv_stats_handle(map, "handles.m0", NULL, &total);
+    printf("handle handles.m0[NULL]: %s\n", sts < 0 ? pmErrStr(-oserror()) : "ok");
+    sts = mmv_stats_handle(map, "handles.m0", "sda", &total);
+    printf("handle handles.m0[sda]: %s\n", sts < 0 ? pmErrStr(-oserror()) : "ok");
+    sts = mmv_stats_handle(map, "handles.m1", NULL, &counter);
+    printf("handle handles.m1[NULL]: %s\n", sts < 0 ? pmErrStr(-oserror()) : "ok");
+
+    for (i = 0; i < NTHREADS; i++) {
+	pthread_create(&threads[i], NULL, update, NULL);
+	pthread_create(&threads[NTHREADS + i], NULL, update_named, NULL);
+    }
+    for (i = 0; i < NTHREADS * 2; i++)
+	pthread_join(threads[i], NULL);
+    printf("handles.m1 = %llu\n", (unsigned long long)counter.value->ull);
+    printf("handles.m0[sda] = %.1f\n", total.value->d);
+    printf("handles.m5 = %llu\n", (unsigned long long)
+		mmv_lookup_value_desc(map, "handles.m5", NULL)->ull);
+
+    mmv_handle_set(&counter, 42);
+    mmv_stats_inc(map, "handles.m1", NULL);
+    printf("handles.m1 = %llu\n", (unsigned long long)counter.value->ull);
+
+    /* a restarted mapping is indexed again */
+    mmv_stats_stop(argv[1], map);
+    map = mmv_stats_start(registry);
+    if (!map) {
+	fprintf(stderr, "mmv_stats_start: %s - %s\n", argv[1], strerror(errno));
+	return 1;
+    }
+    lookup(map, "handles.m1", NULL);
+    lookup(map, "handles.m99", "sdb");
+    mmv_stats_inc(map, "handles.m1", NULL);
+    mmv_stats_set(map, "handles.m0", "sda", 0.5);
+    mmv_stats_stop(argv[1], map);
+    return 0;
+}
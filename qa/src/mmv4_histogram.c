@@ -0,0 +1,101 @@
+/*
+ * Exercise MMV histogram values - samples from several threads,
+ * bucketing, reset, and rejection of invalid histogram metrics.
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/mmv_stats.h>
+#include <pthread.h>
+
+#define NTHREADS	4
+#define NSAMPLES	1000
+
+static mmv_handle_t	latency;
+
+static void *
+update(void *arg)
+{
+    int		i;
+
+    (void)arg;
+    for (i = 0; i < NSAMPLES; i++)
+	mmv_handle_add(&latency, i);
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    int			i, sts;
+    void		*map;
+    pthread_t		threads[NTHREADS];
+    mmv_registry_t	*registry;
+    pmUnits		usec = MMV_UNITS(0,1,0,0,PM_TIME_USEC,0);
+    pmUnits		bytes = MMV_UNITS(1,0,0,PM_SPACE_BYTE,0,0);
+
+    if (argc != 2) {
+	fprintf(stderr, "Usage: %s mmvfile\n", argv[0]);
+	return 1;
+    }
+
+    /* histograms cannot have their own instance domain */
+    registry = mmv_stats_registry(argv[1], 325, 0);
+    mmv_stats_add_indom(registry, 1, "disks", "disk names");
+    mmv_stats_add_instance(registry, 1, 0, "sda");
+    mmv_stats_add_metric(registry, "histogram.bad", 1,
+		MMV_TYPE_HISTOGRAM, MMV_SEM_COUNTER, usec, 1, "", "");
+    map = mmv_stats_start(registry);
+    printf("histogram with indom: %s\n", map ? "ok" : pmErrStr(-oserror()));
+    mmv_stats_free(registry);
+
+    registry = mmv_stats_registry(argv[1], 325, 0);
+    if (!registry) {
+	fprintf(stderr, "mmv_stats_registry: %s - %s\n", argv[1], strerror(errno));
+	return 1;
+    }
+    mmv_stats_add_metric(registry, "histogram.latency", 1,
+		MMV_TYPE_HISTOGRAM, MMV_SEM_COUNTER, usec, 0,
+		"request latency", "");
+    mmv_stats_add_metric(registry, "histogram.size", 2,
+		MMV_TYPE_HISTOGRAM, MMV_SEM_COUNTER, bytes, 0,
+		"request size", "");
+    mmv_stats_add_metric(registry, "histogram.reset", 3,
+		MMV_TYPE_HISTOGRAM, MMV_SEM_COUNTER, bytes, 0,
+		"reset histogram", "");
+    sts = mmv_stats_add_metric_flags(registry, 1, MMV_METRIC_SHARDED);
+    printf("sharded histogram: %s\n", sts < 0 ? pmErrStr(-oserror()) : "ok");
+
+    map = mmv_stats_start(registry);
+    if (!map) {
+	fprintf(stderr, "mmv_stats_start: %s - %s\n", argv[1], strerror(errno));
+	return 1;
+    }
+
+    sts = mmv_stats_handle(map, "histogram.latency", NULL, &latency);
+    printf("handle histogram.latency: %s\n", sts < 0 ? pmErrStr(-oserror()) : "ok");
+    for (i = 0; i < NTHREADS; i++)
+	pthread_create(&threads[i], NULL, update, NULL);
+    for (i = 0; i < NTHREADS; i++)
+	pthread_join(threads[i], NULL);
+    printf("expect histogram.latency count=%d sum=%d\n",
+		NTHREADS * NSAMPLES, NTHREADS * (NSAMPLES * (NSAMPLES - 1) / 2));
+
+    /* bucket boundaries, negative samples are counted as zero */
+    mmv_stats_add(map, "histogram.size", NULL, -1);
+    mmv_stats_add(map, "histogram.size", NULL, 0);
+    mmv_stats_add(map, "histogram.size", NULL, 7);
+    mmv_stats_add(map, "histogram.size", NULL, 8);
+    mmv_stats_add(map, "histogram.size", NULL, 9);
+    mmv_stats_add(map, "histogram.size", NULL, 1023);
+    mmv_stats_add(map, "histogram.size", NULL, 1024);
+    mmv_stats_add(map, "histogram.size", NULL, 1e18);
+
+    mmv_stats_add(map, "histogram.reset", NULL, 100);
+    mmv_stats_set(map, "histogram.reset", NULL, 0);
+    mmv_stats_inc(map, "histogram.reset", NULL);
+
+    mmv_stats_stop(argv[1], map);
+    return 0;
+}
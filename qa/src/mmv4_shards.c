@@ -0,0 +1,143 @@
+/*
+ * Exercise sharded MMV counters - concurrent updates from many threads
+ * to plain and sharded values, reporting the elapsed time for each.
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/mmv_stats.h>
+#include <pthread.h>
+
+#define NTHREADS	64
+#define NUPDATES	20000
+
+static int		nupdates = NUPDATES;
+static void		*map;
+static mmv_handle_t	plain;
+static mmv_handle_t	sharded;
+static mmv_handle_t	total;
+
+static void *
+update(void *arg)
+{
+    mmv_handle_t	*handle = (mmv_handle_t *)arg;
+    int			i;
+
+    for (i = 0; i < nupdates; i++)
+	mmv_handle_inc(handle);
+    return NULL;
+}
+
+static void *
+update_names(void *arg)
+{
+    int			i;
+
+    (void)arg;
+    for (i = 0; i < nupdates / 10; i++) {
+	mmv_stats_inc(map, "shards.sharded", NULL);
+	mmv_stats_add(map, "shards.total", "sdb", 0.5);
+    }
+    return NULL;
+}
+
+static double
+run(int nthreads, void *(*func)(void *), void *arg)
+{
+    int			i;
+    pthread_t		*threads;
+    struct timeval	start, end;
+
+    threads = calloc(nthreads, sizeof(pthread_t));
+    pmtimevalNow(&start);
+    for (i = 0; i < nthreads; i++)
+	pthread_create(&threads[i], NULL, func, arg);
+    for (i = 0; i < nthreads; i++)
+	pthread_join(threads[i], NULL);
+    pmtimevalNow(&end);
+    free(threads);
+    return pmtimevalSub(&end, &start);
+}
+
+static void
+flags(mmv_registry_t *registry, int item, mmv_metric_flags_t flags)
+{
+    int		sts;
+
+    sts = mmv_stats_add_metric_flags(registry, item, flags);
+    printf("flags item %d: %s\n", item, sts < 0 ? pmErrStr(-oserror()) : "ok");
+}
+
+int
+main(int argc, char **argv)
+{
+    int			nthreads = NTHREADS;
+    mmv_registry_t	*registry;
+    pmUnits		count = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE);
+    pmUnits		none = MMV_UNITS(0,0,0,0,0,0);
+
+    if (argc < 2 || argc > 4) {
+	fprintf(stderr, "Usage: %s mmvfile [threads [updates]]\n", argv[0]);
+	return 1;
+    }
+    if (argc > 2)
+	nthreads = atoi(argv[2]);
+    if (argc > 3)
+	nupdates = atoi(argv[3]);
+
+    registry = mmv_stats_registry(argv[1], 324, 0);
+    if (!registry) {
+	fprintf(stderr, "mmv_stats_registry: %s - %s\n", argv[1], strerror(errno));
+	return 1;
+    }
+    mmv_stats_add_indom(registry, 1, "disks", "disk names");
+    mmv_stats_add_instance(registry, 1, 0, "sda");
+    mmv_stats_add_instance(registry, 1, 1, "sdb");
+    mmv_stats_add_metric(registry, "shards.plain", 1,
+		MMV_TYPE_U64, MMV_SEM_COUNTER, count, 0, "plain", "");
+    mmv_stats_add_metric(registry, "shards.sharded", 2,
+		MMV_TYPE_U64, MMV_SEM_COUNTER, count, 0, "sharded", "");
+    mmv_stats_add_metric(registry, "shards.total", 3,
+		MMV_TYPE_DOUBLE, MMV_SEM_COUNTER, count, 1, "total", "");
+    mmv_stats_add_metric(registry, "shards.name", 4,
+		MMV_TYPE_STRING, MMV_SEM_DISCRETE, none, 0, "name", "");
+
+    flags(registry, 2, MMV_METRIC_SHARDED);
+    flags(registry, 3, MMV_METRIC_SHARDED);
+    flags(registry, 4, MMV_METRIC_SHARDED);
+    flags(registry, 5, MMV_METRIC_SHARDED);
+    flags(registry, 1, 0x100);
+
+    map = mmv_stats_start(registry);
+    if (!map) {
+	fprintf(stderr, "mmv_stats_start: %s - %s\n", argv[1], strerror(errno));
+	return 1;
+    }
+    mmv_stats_handle(map, "shards.plain", NULL, &plain);
+    mmv_stats_handle(map, "shards.sharded", NULL, &sharded);
+    mmv_stats_handle(map, "shards.total", "sda", &total);
+    printf("shards.plain sharded: %s\n", plain.shards ? "yes" : "no");
+    printf("shards.sharded sharded: %s\n", sharded.shards ? "yes" : "no");
+    printf("shards.total[sda] sharded: %s\n", total.shards ? "yes" : "no");
+
+    /* timings vary with the platform, report them on stderr */
+    fprintf(stderr, "%d threads x %d updates\n", nthreads, nupdates);
+    fprintf(stderr, "plain:   %.3f sec\n", run(nthreads, update, &plain));
+    fprintf(stderr, "sharded: %.3f sec\n", run(nthreads, update, &sharded));
+    fprintf(stderr, "double:  %.3f sec\n", run(nthreads, update, &total));
+    fprintf(stderr, "names:   %.3f sec\n", run(nthreads, update_names, NULL));
+
+    printf("expect shards.plain = %llu\n",
+		(unsigned long long)nthreads * nupdates);
+    printf("expect shards.sharded = %llu\n",
+		(unsigned long long)nthreads * nupdates + nthreads * (nupdates / 10));
+    printf("expect shards.total[sdb] = %.1f\n", 0.5 * nthreads * (nupdates / 10));
+
+    /* setting a sharded value resets all of its shards */
+    mmv_handle_set(&total, 42);
+    mmv_stats_add(map, "shards.total", "sda", 0.5);
+
+    mmv_stats_stop(argv[1], map);
+    return 0;
+}
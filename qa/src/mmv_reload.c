@@ -0,0 +1,146 @@
+/*
+ * Exercise incremental reloading of MMV files by pmdammv - files are
+ * added, removed and replaced between fetches through a local context,
+ * metrics from unchanged files must keep their identifiers and values.
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/mmv_stats.h>
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    PMOPT_SPECLOCAL,
+    PMOPT_LOCALPMDA,
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "D:K:L?",
+    .long_options = longopts,
+    .short_usage = "[options] file1 file2",
+};
+
+static char	*names[5];
+
+static void *
+start(const char *file, int cluster, const char *metric, int value)
+{
+    mmv_registry_t	*registry;
+    pmUnits		count = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE);
+    void		*map;
+
+    registry = mmv_stats_registry(file, cluster, MMV_FLAG_PROCESS);
+    if (!registry) {
+	fprintf(stderr, "mmv_stats_registry: %s - %s\n", file, strerror(errno));
+	exit(1);
+    }
+    mmv_stats_add_indom(registry, 1, "things", "");
+    mmv_stats_add_instance(registry, 1, 0, "x");
+    mmv_stats_add_instance(registry, 1, 1, "y");
+    mmv_stats_add_metric(registry, metric, 1,
+		MMV_TYPE_U32, MMV_SEM_INSTANT, count, 0, "", "");
+    mmv_stats_add_metric(registry, "inst", 2,
+		MMV_TYPE_U32, MMV_SEM_INSTANT, count, 1, "", "");
+    if ((map = mmv_stats_start(registry)) == NULL) {
+	fprintf(stderr, "mmv_stats_start: %s - %s\n", file, strerror(errno));
+	exit(1);
+    }
+    mmv_stats_set(map, metric, NULL, value);
+    mmv_stats_set(map, "inst", "x", value + 1);
+    mmv_stats_set(map, "inst", "y", value + 2);
+    return map;
+}
+
+static void
+report(const char *msg)
+{
+    pmID	pmid;
+    pmDesc	desc;
+    pmResult	*rp;
+    char	*inst;
+    int		i, j, sts;
+
+    /* directory changes are noticed at one-second granularity */
+    sleep(1);
+    printf("\n=== %s ===\n", msg);
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+	if ((sts = pmLookupName(1, (const char **)&names[i], &pmid)) < 0) {
+	    printf("%s: %s\n", names[i], pmErrStr(sts));
+	    continue;
+	}
+	if ((sts = pmLookupDesc(pmid, &desc)) < 0 ||
+	    (sts = pmFetch(1, &pmid, &rp)) < 0) {
+	    printf("%s: %s\n", names[i], pmErrStr(sts));
+	    continue;
+	}
+	printf("%s (%s):", names[i], pmIDStr(pmid));
+	if (rp->vset[0]->numval < 0)
+	    printf(" %s", pmErrStr(rp->vset[0]->numval));
+	for (j = 0; j < rp->vset[0]->numval; j++) {
+	    pmValue	*vp = &rp->vset[0]->vlist[j];
+
+	    if (desc.indom == PM_INDOM_NULL)
+		printf(" %d", vp->value.lval);
+	    else if (pmNameInDom(desc.indom, vp->inst, &inst) >= 0) {
+		printf(" [%s] %d", inst, vp->value.lval);
+		free(inst);
+	    }
+	}
+	putchar('\n');
+	pmFreeResult(rp);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    char	*a, *b;
+    void	*amap, *bmap;
+    int		sts;
+
+    pmGetOptions(argc, argv, &opts);
+    if (opts.errors || opts.optind != argc - 2 ||
+	opts.context != PM_CONTEXT_LOCAL) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+    a = argv[opts.optind];
+    b = argv[opts.optind + 1];
+
+    if ((sts = pmNewContext(PM_CONTEXT_LOCAL, NULL)) < 0) {
+	fprintf(stderr, "pmNewContext: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+
+    pmsprintf(names[0] = malloc(MAXPATHLEN), MAXPATHLEN, "mmv.%s.one", a);
+    pmsprintf(names[1] = malloc(MAXPATHLEN), MAXPATHLEN, "mmv.%s.inst", a);
+    pmsprintf(names[2] = malloc(MAXPATHLEN), MAXPATHLEN, "mmv.%s.one", b);
+    pmsprintf(names[3] = malloc(MAXPATHLEN), MAXPATHLEN, "mmv.%s.two", b);
+    pmsprintf(names[4] = malloc(MAXPATHLEN), MAXPATHLEN, "mmv.%s.inst", b);
+
+    amap = start(a, 401, "one", 10);
+    bmap = start(b, 402, "one", 20);
+    report("two files");
+
+    mmv_stats_stop(b, bmap);
+    report("second file removed");
+
+    mmv_stats_inc(amap, "one", NULL);
+    bmap = start(b, 402, "two", 30);
+    report("second file replaced");
+
+    mmv_stats_stop(b, bmap);
+    bmap = start(b, 403, "one", 40);
+    report("second file replaced, new cluster");
+
+    mmv_stats_stop(a, amap);
+    mmv_stats_stop(b, bmap);
+    report("both files removed");
+
+    pmDestroyContext(sts);
+    return 0;
+}
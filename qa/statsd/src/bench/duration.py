@@ -0,0 +1,88 @@
+#!/usr/bin/env pmpython
+# -*- coding: utf-8 -*-
+
+# Compares duration aggregation types - basic (exact), hdr histogram and quantile sketch
+# Same log-normally distributed durations are sent to agent configured with each of them, reported are
+# aggregation time per value, resident memory of the agent and relative error of percentiles.
+# Not a QA test, run manually from statsd/src directory of testsuite as root:
+#     pmpython bench/duration.py [count of values] [count of metrics]
+# Since agent works with UDP datagrams, values are sent at a limited rate, errors are relative to all values sent.
+
+import sys
+import socket
+import os
+import time
+import random
+
+utils_path = os.path.abspath(os.path.join("utils"))
+sys.path.append(utils_path)
+
+import pmdastatsd_test_utils as utils
+
+ip = "0.0.0.0"
+port = 8125
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+
+value_count = int(sys.argv[1]) if len(sys.argv) > 1 else 1000000
+metric_count = int(sys.argv[2]) if len(sys.argv) > 2 else 10
+batch_size = 1000 # datagrams sent before pausing, so that agent keeps up
+
+names = ["basic", "hdr", "sketch"]
+percentiles = [("/median", 50), ("/percentile90", 90), ("/percentile95", 95), ("/percentile99", 99)]
+
+def get_value(metric_name):
+    output = utils.request_metric(metric_name)
+    return float(output.split("value ")[-1])
+
+def get_rss_kbytes():
+    pid = utils.get_pmdastatsd_pids()[0]
+    with open("/proc/{}/status".format(pid)) as f:
+        for line in f:
+            if line.startswith("VmRSS:"):
+                return int(line.split()[1])
+    return 0
+
+def wait_for_aggregation():
+    previous = -1
+    current = get_value("statsd.pmda.aggregated")
+    while current != previous:
+        time.sleep(1)
+        previous = current
+        current = get_value("statsd.pmda.aggregated")
+    return current
+
+def exact_percentile(values, percentile):
+    return values[max(int(round(percentile / 100.0 * len(values))) - 1, 0)]
+
+def run_benchmark():
+    random.seed(1)
+    values = [int(random.lognormvariate(8, 1.5)) for i in range(value_count)]
+    expected = [sorted(values[m::metric_count]) for m in range(metric_count)]
+    print("{} values over {} metrics".format(value_count, metric_count))
+    print("{:8} {:>12} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}".format(
+        "type", "aggregated", "ns/value", "rss kB", "median", "p90", "p95", "p99"))
+    for i in range(len(names)):
+        utils.set_config(utils.configs["duration_aggregation_type"][i], False)
+        utils.pmdastatsd_install()
+        rss_before = get_rss_kbytes()
+        for j in range(value_count):
+            sock.sendto("bench_duration_{}:{}|ms".format(j % metric_count, values[j]).encode("utf-8"), (ip, port))
+            if j % batch_size == 0:
+                time.sleep(0.001)
+        aggregated = wait_for_aggregation()
+        time_spent = get_value("statsd.pmda.time_spent_aggregating")
+        rss = get_rss_kbytes() - rss_before
+        instances = [utils.get_instances(utils.request_metric("statsd.bench_duration_{}".format(m))) for m in range(metric_count)]
+        errors = []
+        for instance, percentile in percentiles:
+            error = 0
+            for m in range(metric_count):
+                exact = exact_percentile(expected[m], percentile)
+                error += abs(float(instances[m][instance]) - exact) / exact
+            errors.append("{:.2%}".format(error / metric_count))
+        print("{:8} {:>12.0f} {:>10.0f} {:>10} {:>10} {:>10} {:>10} {:>10}".format(
+            names[i], aggregated, time_spent / max(aggregated, 1), rss, *errors))
+        utils.pmdastatsd_remove()
+    utils.restore_config()
+
+run_benchmark()
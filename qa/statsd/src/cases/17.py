@@ -0,0 +1,61 @@
+#!/usr/bin/env pmpython
+# -*- coding: utf-8 -*-
+
+# Exercises batched receive of datagrams by one or several listener threads
+# Datagrams are sent from several sockets, so the kernel spreads them across listener sockets.
+# Since agent works with UDP datagrams, we have to take into account the fact that not all payloads will get processed and will get lost.
+# Following test assumes that at least 10% of datagrams gets processed
+
+import sys
+import socket
+import glob
+import os
+
+utils_path = os.path.abspath(os.path.join("utils"))
+sys.path.append(utils_path)
+
+import pmdastatsd_test_utils as utils
+
+utils.print_test_file_separator()
+print(os.path.basename(__file__))
+
+ip = "0.0.0.0"
+port = 8125
+socks = [socket.socket(socket.AF_INET, socket.SOCK_DGRAM) for i in range(0, 4)]
+
+sent = 100000
+expected_count_max = sent # since we use UDP not all datagrams are expected to be processed
+expected_count_min = sent * 0.1 # assume that at least 10 % of all send datagrams gets processed
+
+configs = [
+    utils.configs["listener_threads"][0],
+    utils.configs["listener_threads"][1]
+]
+
+def check_value(name, output):
+    value = float(output.split("value ")[-1])
+    sys.stderr.write(name + ' = ' + str(value) + '\n')
+    if utils.check_is_in_range(expected_count_max, expected_count_min, value):
+        print(name, "OK")
+    else:
+        print(name, value)
+
+def exercise_config(config):
+    utils.print_test_section_separator()
+    utils.pmdastatsd_install(config)
+    utils.print_metric("statsd.pmda.settings.listener_threads")
+    for i in range(0, sent // len(socks)):
+        for sock in socks:
+            sock.sendto("test_listener:1|c".encode("utf-8"), (ip, port))
+    output = utils.get_instances(utils.request_metric("statsd.test_listener"))
+    for k, v in output.items():
+        check_value(k, v)
+    check_value("received", utils.request_metric("statsd.pmda.received"))
+    utils.pmdastatsd_remove()
+    utils.restore_config()
+
+def run_test():
+    for config in configs:
+        exercise_config(config)
+
+run_test()
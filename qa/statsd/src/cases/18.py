@@ -0,0 +1,64 @@
+#!/usr/bin/env pmpython
+# -*- coding: utf-8 -*-
+
+# Exercises aggregation of metrics sharded by name across one or several aggregator threads
+# Since agent works with UDP datagrams, we have to take into account the fact that not all payloads will get processed and will get lost.
+# Following test assumes that at least 10% of datagrams gets processed for every metric
+
+import sys
+import socket
+import glob
+import os
+
+utils_path = os.path.abspath(os.path.join("utils"))
+sys.path.append(utils_path)
+
+import pmdastatsd_test_utils as utils
+
+utils.print_test_file_separator()
+print(os.path.basename(__file__))
+
+ip = "0.0.0.0"
+port = 8125
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+
+metric_count = 32
+sent = 1000
+expected_count_max = sent # since we use UDP not all datagrams are expected to be processed
+expected_count_min = sent * 0.1 # assume that at least 10 % of all send datagrams gets processed
+
+configs = [
+    utils.configs["aggregator_threads"][0],
+    utils.configs["aggregator_threads"][1]
+]
+
+def exercise_config(config):
+    utils.print_test_section_separator()
+    utils.pmdastatsd_install(config)
+    utils.print_metric("statsd.pmda.settings.aggregator_threads")
+    for i in range(0, sent):
+        for m in range(0, metric_count):
+            sock.sendto("test_shard_{}:1|c".format(m).encode("utf-8"), (ip, port))
+    failed = 0
+    for m in range(0, metric_count):
+        output = utils.get_instances(utils.request_metric("statsd.test_shard_{}".format(m)))
+        for k, v in output.items():
+            number_value = float(v)
+            sys.stderr.write("test_shard_{}".format(m) + k + ' = ' + str(number_value) + '\n')
+            if not utils.check_is_in_range(expected_count_max, expected_count_min, number_value):
+                print("test_shard_{}".format(m), k, v)
+                failed += 1
+        if len(output) == 0:
+            print("test_shard_{}".format(m), "missing")
+            failed += 1
+    if failed == 0:
+        print(metric_count, "metrics OK")
+    utils.print_metric("statsd.pmda.metrics_tracked")
+    utils.pmdastatsd_remove()
+    utils.restore_config()
+
+def run_test():
+    for config in configs:
+        exercise_config(config)
+
+run_test()
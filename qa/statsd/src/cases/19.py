@@ -0,0 +1,71 @@
+#!/usr/bin/env pmpython
+# -*- coding: utf-8 -*-
+
+# Exercises parsing of more distinct strings than fit in one table of interned strings, with both parsers -
+# full tables are retired and metrics named before and after keep aggregating
+# Distinct tags of one metric are used, as each distinct metric name would also grow the PMNS
+# Since agent works with UDP datagrams, we have to take into account the fact that not all payloads will get processed and will get lost.
+# Following test assumes that at least 10% of datagrams gets processed
+
+import sys
+import socket
+import glob
+import os
+
+utils_path = os.path.abspath(os.path.join("utils"))
+sys.path.append(utils_path)
+
+import pmdastatsd_test_utils as utils
+
+utils.print_test_file_separator()
+print(os.path.basename(__file__))
+
+ip = "0.0.0.0"
+port = 8125
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+
+distinct_count = 40000
+lines_per_payload = 40
+sent = 200
+expected_count_max = sent # since we use UDP not all datagrams are expected to be processed
+expected_count_min = sent * 0.1 # assume that at least 10 % of all send datagrams gets processed
+
+configs = [
+    utils.configs["parser_type"][0],
+    utils.configs["parser_type"][1]
+]
+
+def send_known(count):
+    for i in range(0, count):
+        sock.sendto("test_intern:1|c".encode("utf-8"), (ip, port))
+
+def send_distinct():
+    for i in range(0, distinct_count, lines_per_payload):
+        lines = ["test_intern_tagged,n={}:1|c".format(n) for n in range(i, i + lines_per_payload)]
+        sock.sendto("\n".join(lines).encode("utf-8"), (ip, port))
+
+def exercise_config(config):
+    utils.print_test_section_separator()
+    utils.pmdastatsd_install(config)
+    send_known(sent // 2)
+    send_distinct()
+    send_known(sent // 2)
+    output = utils.get_instances(utils.request_metric("statsd.test_intern"))
+    for k, v in output.items():
+        number_value = float(v)
+        sys.stderr.write("test_intern" + k + ' = ' + str(number_value) + '\n')
+        status = utils.check_is_in_range(expected_count_max, expected_count_min, number_value)
+        print("test_intern", k, "OK" if status else "FAIL")
+    if len(output) == 0:
+        print("test_intern missing")
+    tracked = utils.get_instances(utils.request_metric("statsd.pmda.metrics_tracked"))
+    sys.stderr.write("metrics_tracked = " + str(tracked) + '\n')
+    utils.print_metric("statsd.pmda.settings.parser_type")
+    utils.pmdastatsd_remove()
+    utils.restore_config()
+
+def run_test():
+    for config in configs:
+        exercise_config(config)
+
+run_test()
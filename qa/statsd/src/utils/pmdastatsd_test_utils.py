@@ -53,6 +53,10 @@ duration_aggregation_type = 0
 """
 [global]
 duration_aggregation_type = 1
+""",
+"""
+[global]
+duration_aggregation_type = 2
 """],
 	"max_udp_packet_size": [
 """
@@ -93,6 +97,26 @@ port = 8125
 """
 [global]
 port = 8126
+"""],
+	"aggregator_threads": [
+"""
+[global]
+aggregator_threads = 1
+""",
+"""
+[global]
+aggregator_threads = 4
+"""],
+	"listener_threads": [
+"""
+[global]
+listener_threads = 1
+receive_batch_size = 1
+""",
+"""
+[global]
+listener_threads = 4
+receive_batch_size = 16
 """],
 	"verbose": [
 """
@@ -1,7 +1,7 @@
 /*
  * Copyright (C) 2001,2009 Silicon Graphics, Inc.  All Rights Reserved.
  * Copyright (C) 2009 Aconex.  All Rights Reserved.
- * Copyright (C) 2016 Red Hat.
+ * Copyright (C) 2016,2026 Red Hat.
  *
  * This library is free software; you can redistribute it and/or modify it
  * under the terms of the GNU Lesser General Public License as published
@@ -19,6 +19,7 @@
 #define MMV_VERSION1	1	/* original on-disk format */
 #define MMV_VERSION2	2	/* + mmv_disk_{metric2,instance2}_t */
 #define MMV_VERSION3	3	/* + labels support */
+#define MMV_VERSION4	4	/* + sharded values, histograms */
 #define MMV_VERSION     1	/* default, upgrading to v3 only if needed */
 
 typedef enum mmv_toc_type {
@@ -28,6 +29,8 @@ typedef enum mmv_toc_type {
     MMV_TOC_VALUES	= 4,	/* mmv_disk_value_t */
     MMV_TOC_STRINGS	= 5,	/* mmv_disk_string_t */
     MMV_TOC_LABELS	= 6,	/* mmv_disk_label_t */
+    MMV_TOC_SHARDS	= 7,	/* mmv_disk_shard_t */
+    MMV_TOC_HISTOGRAMS	= 8,	/* mmv_disk_histogram_t */
 } mmv_toc_type_t;
 
 /* The way the Table Of Contents is written into the file */
@@ -89,18 +92,51 @@ typedef struct mmv_disk_metric2 {
     mmv_metric_sem_t	semantics;
     pmUnits		dimension;
     __int32_t		indom;		/* Instance domain number */
-    __uint32_t		padding;	/* zero filled, alignment bits */
+    __uint32_t		shards;		/* v4 shards per value, else zero */
     __uint64_t		shorttext;	/* Offset of short help text string */
     __uint64_t		helptext;	/* Offset of long help text string */
 } mmv_disk_metric2_t;
 
 typedef struct mmv_disk_value {
     pmAtomValue		value;		/* Union of all possible value types */
-    __int64_t		extra;		/* INTEGRAL(starttime)/STRING(offset) */
+    __int64_t		extra;		/* INTEGRAL(starttime)/STRING(offset)/
+					   SHARDS(offset of first shard)/
+					   HISTOGRAM(offset of buckets) */
     __uint64_t		metric;		/* Offset into the metric section */
     __uint64_t		instance;	/* Offset into the instance section */
 } mmv_disk_value_t;
 
+/*
+ * Sharded values are the sum of the value and each of its shards.
+ * Shards are updated by different threads, each in its own cache line.
+ */
+#define MMV_SHARDSIZE	64
+#define MMV_SHARDMAX	1024	/* upper limit on shards per value */
+
+typedef struct mmv_disk_shard {
+    pmAtomValue		value;		/* Partial value, as the value type */
+    char		padding[MMV_SHARDSIZE - sizeof(pmAtomValue)];
+} mmv_disk_shard_t;
+
+/*
+ * Histogram values count samples in fixed log-linear buckets - values
+ * below MMV_HISTOGRAM_SUB have a bucket each, then each power of two
+ * is split into MMV_HISTOGRAM_SUB equal width buckets, up to 2^64-1.
+ */
+#define MMV_HISTOGRAM_SUB	4
+#define MMV_HISTOGRAM_BUCKETS	252
+#define MMV_HISTOGRAM_LOWER(b)	((b) < MMV_HISTOGRAM_SUB ? (__uint64_t)(b) : \
+	(__uint64_t)(MMV_HISTOGRAM_SUB + (b) % MMV_HISTOGRAM_SUB) << \
+	((b) / MMV_HISTOGRAM_SUB - 1))
+#define MMV_HISTOGRAM_UPPER(b)	((b) < MMV_HISTOGRAM_SUB ? (__uint64_t)(b) : \
+	MMV_HISTOGRAM_LOWER(b) + ((__uint64_t)1 << ((b) / MMV_HISTOGRAM_SUB - 1)) - 1)
+
+typedef struct mmv_disk_histogram {
+    __uint64_t		sum;		/* Sum of all samples */
+    __uint64_t		buckets[MMV_HISTOGRAM_BUCKETS];	/* Sample counts */
+    __uint64_t		padding[3];	/* zero filled, cache line multiple */
+} mmv_disk_histogram_t;
+
 typedef struct mmv_disk_header {
     char		magic[4];	/* MMV\0 */
     __int32_t		version;	/* version */
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2013,2016,2018 Red Hat.
+ * Copyright (C) 2013,2016,2018,2026 Red Hat.
  * Copyright (C) 2009 Aconex.  All Rights Reserved.
  * Copyright (C) 2001,2009 Silicon Graphics, Inc.  All Rights Reserved.
  *
@@ -34,6 +34,7 @@ typedef enum mmv_metric_type {
     MMV_TYPE_DOUBLE    = PM_TYPE_DOUBLE,/* 64-bit floating point */
     MMV_TYPE_STRING    = PM_TYPE_STRING,/* NULL-terminate string */
     MMV_TYPE_ELAPSED   = 9,		/* 64-bit elapsed time */
+    MMV_TYPE_HISTOGRAM = 10,		/* Log-linear histogram of samples */
 } mmv_metric_type_t;
 
 typedef enum mmv_metric_sem {
@@ -107,6 +108,10 @@ typedef enum mmv_stats_flags {
     MMV_FLAG_SENTINEL  = 0x4,  /* Sentinel values == no-value-available */ 
 } mmv_stats_flags_t;
 
+typedef enum mmv_metric_flags {
+    MMV_METRIC_SHARDED	= 0x1,  /* Per-thread shards, summed when read */
+} mmv_metric_flags_t;
+
 typedef enum mmv_value_type {
     MMV_STRING_TYPE 	= 0x1,	
     MMV_NUMBER_TYPE   	= 0x2,	
@@ -116,6 +121,14 @@ typedef enum mmv_value_type {
     MMV_MAP_TYPE   	= 0x6,	
 } mmv_value_type_t;
 
+typedef struct mmv_handle {
+    void *		addr;		/* Mapping holding the value */
+    pmAtomValue *	value;		/* Value resolved by name */
+    mmv_metric_type_t	type;		/* Type of the metric value */
+    __uint32_t		shards;		/* Number of shards, if sharded */
+    void *		shard;		/* First shard of a sharded value */
+} mmv_handle_t;
+
 #ifdef HAVE_BITFIELDS_LTOR
 #define MMV_UNITS(a,b,c,d,e,f)	{a,b,c,d,e,f,0}
 #else
@@ -133,6 +146,8 @@ extern int mmv_stats_add_metric(mmv_registry_t *, const char *, int,
 		mmv_metric_type_t, mmv_metric_sem_t, pmUnits,
 		int, const char *, const char *);
 extern int mmv_stats_add_instance(mmv_registry_t *, int, int, const char *);
+extern int mmv_stats_add_metric_flags(mmv_registry_t *, int,
+		mmv_metric_flags_t);
 
 extern int mmv_stats_add_registry_label(mmv_registry_t *,
 		const char *, const char *, mmv_value_type_t, int);
@@ -166,6 +181,12 @@ extern void mmv_stats_set_string(void *, const char *,
 extern void mmv_stats_set_strlen(void *, const char *,
 				const char *, const char *, size_t);
 
+extern int mmv_stats_handle(void *, const char *, const char *,
+				mmv_handle_t *);
+extern void mmv_handle_add(const mmv_handle_t *, double);
+extern void mmv_handle_inc(const mmv_handle_t *);
+extern void mmv_handle_set(const mmv_handle_t *, double);
+
 /* Deprecated init and stop routines - use a registry instead */
 extern void * mmv_stats_init(const char *, int, mmv_stats_flags_t,
 				const mmv_metric_t *, int,
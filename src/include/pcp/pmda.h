@@ -811,6 +811,7 @@ PMDA_CALL extern int pmdaEventQueueClients(int, pmAtomValue *);
 PMDA_CALL extern int pmdaEventQueueCounter(int, pmAtomValue *);
 PMDA_CALL extern int pmdaEventQueueBytes(int, pmAtomValue *);
 PMDA_CALL extern int pmdaEventQueueMemory(int, pmAtomValue *);
+PMDA_CALL extern int pmdaEventQueueDropped(int, pmAtomValue *);
 
 typedef int (*pmdaEventDecodeCallBack)(int,
 		void *, size_t, struct timeval *, void *);
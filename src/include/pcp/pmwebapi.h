@@ -70,6 +70,7 @@ typedef enum pmSeriesFlags {
     PM_SERIES_FLAG_METADATA	= (1 << 0),	/* only load metric metadata */
     PM_SERIES_FLAG_ACTIVE	= (1 << 1),	/* continual source updates */
     PM_SERIES_FLAG_TEXT		= (1 << 2),	/* load metric & indom help */
+    PM_SERIES_FLAG_SUMMARY	= (1 << 3),	/* report values & load rate */
     PM_SERIES_FLAG_ALL		= ((unsigned int)~PM_SERIES_FLAG_NONE)
 } pmSeriesFlags;
 
@@ -116,6 +117,33 @@ typedef struct pmSeriesTimeWindow {
     sds		zone;		/* timezone of time strings */
 } pmSeriesTimeWindow;
 
+/*
+ * Pushed samples (e.g. Prometheus remote-write) - one source per name,
+ * with metrics and instances created on first use from pushed names
+ * and labels.  Labels are JSON strings, as in pmLabelSet json fields.
+ */
+typedef struct pmSeriesSample {
+    double	value;		/* sampled value */
+    __int64_t	timestamp;	/* milliseconds since the epoch */
+} pmSeriesSample;
+
+typedef struct pmSeriesPushed {
+    sds		name;		/* metric name */
+    sds		instance;	/* instance name or NULL (singular) */
+    sds		labels;		/* instance labels or NULL */
+    int		semantics;	/* PM_SEM_COUNTER or PM_SEM_INSTANT */
+    unsigned int nsamples;	/* count of samples for this series */
+    pmSeriesSample *samples;	/* samples in time order */
+} pmSeriesPushed;
+
+typedef struct pmSeriesPush {
+    sds		source;		/* name of source pushing the samples */
+    sds		hostname;	/* host name of source */
+    sds		labels;		/* source context labels */
+    unsigned int nseries;	/* count of entries in series array */
+    pmSeriesPushed *series;	/* series and their sampled values */
+} pmSeriesPush;
+
 typedef void (*pmSeriesSetupCallBack)(void *);
 typedef int (*pmSeriesMatchCallBack)(pmSID, void *);
 typedef int (*pmSeriesStringCallBack)(pmSID, sds, void *);
@@ -125,6 +153,8 @@ typedef int (*pmSeriesInstCallBack)(pmSID, pmSeriesInst *, void *);
 typedef int (*pmSeriesValueCallBack)(pmSID, pmSeriesValue *, void *);
 typedef int (*pmSeriesLabelCallBack)(pmSID, pmSeriesLabel *, void *);
 typedef void (*pmSeriesDoneCallBack)(int, void *);
+typedef int (*pmSeriesBacklogCallBack)(void *);
+typedef void (*pmSeriesPausedCallBack)(void *);
 
 typedef struct pmSeriesCallBacks {
     pmSeriesMatchCallBack	on_match;	/* one series identifier */
@@ -138,6 +168,8 @@ typedef struct pmSeriesCallBacks {
     pmSeriesStringCallBack	on_label;	/* one label name */
     pmSeriesValueCallBack	on_value;	/* timestamped value */
     pmSeriesDoneCallBack	on_done;	/* request completed */
+    pmSeriesBacklogCallBack	on_backlog;	/* values pending (optional) */
+    pmSeriesPausedCallBack	on_paused;	/* awaiting pmSeriesResume */
 } pmSeriesCallBacks;
 
 typedef struct pmSeriesModule {
@@ -168,6 +200,8 @@ extern int pmSeriesSources(pmSeriesSettings *, int, sds *, void *);
 extern int pmSeriesValues(pmSeriesSettings *, pmSeriesTimeWindow *, int, sds *, void *);
 extern int pmSeriesQuery(pmSeriesSettings *, sds, pmSeriesFlags, void *);
 extern int pmSeriesLoad(pmSeriesSettings *, sds, pmSeriesFlags, void *);
+extern void pmSeriesResume(void *);	/* continue after on_paused */
+extern int pmSeriesPushSamples(pmSeriesSettings *, pmSeriesPush *, void *);
 
 /* libpcp_web timer list interface - global, thread-safe */
 typedef void (*pmWebTimerCallBack)(void *);
@@ -234,6 +268,7 @@ extern int pmDiscoverSetSlots(pmDiscoverModule *, void *);
 extern int pmDiscoverSetEventLoop(pmDiscoverModule *, void *);
 extern int pmDiscoverSetConfiguration(pmDiscoverModule *, struct dict *);
 extern int pmDiscoverSetMetricRegistry(pmDiscoverModule *, struct mmv_registry *);
+extern int pmDiscoverSetShard(pmDiscoverModule *, unsigned int, unsigned int);
 extern void pmDiscoverClose(pmDiscoverModule *);
 
 /*
@@ -307,12 +342,21 @@ typedef struct pmWebChildren {
     sds			*nonleaf;
 } pmWebChildren;
 
+/*
+ * Scrape callbacks may keep precompiled exposition text in the header
+ * (per metric name) and prefix (per metric name and instance) slots.
+ * These are owned by the library, persist across scrapes of a context
+ * and are released (reset to NULL) whenever the underlying descriptor,
+ * help text, labels or instance domain change.
+ */
 typedef struct pmWebScrape {
     pmWebMetric		metric;
     pmWebInstance	instance;
     pmWebValue		value;
     long long		seconds;
     long long		nanoseconds;
+    sds			*header;	/* cached metric exposition header */
+    sds			*prefix;	/* cached series exposition prefix */
 } pmWebScrape;
 
 typedef struct pmWebLabelSet {
@@ -375,6 +419,7 @@ extern int pmWebGroupSetup(pmWebGroupModule *);
 extern int pmWebGroupSetEventLoop(pmWebGroupModule *, void *);
 extern int pmWebGroupSetConfiguration(pmWebGroupModule *, struct dict *);
 extern int pmWebGroupSetMetricRegistry(pmWebGroupModule *, struct mmv_registry *);
+extern int pmWebGroupSetWorker(pmWebGroupModule *, unsigned int, unsigned int);
 extern void pmWebGroupClose(pmWebGroupModule *);
 
 /*
@@ -30,6 +30,8 @@ extern "C" {
 #define TRACE_ENV_NOAGENT	"PCP_TRACE_NOAGENT"
 #define TRACE_ENV_REQTIMEOUT	"PCP_TRACE_REQTIMEOUT"
 #define TRACE_ENV_RECTIMEOUT	"PCP_TRACE_RECONNECT"
+#define TRACE_ENV_SHM		"PCP_TRACE_SHM"
+#define TRACE_ENV_RINGSIZE	"PCP_TRACE_RINGSIZE"
 #define TRACE_PORT		4323
 #define TRACE_PDU_VERSION	1
 
@@ -85,6 +87,61 @@ extern int __pmtracedecodedata(__pmTracePDU *, char **, int *, int *, int *, dou
 
 extern int __pmtraceprotocol(int);
 
+/*
+ * Shared memory transport - each process maps a file named by its PID
+ * below $PCP_TMP_DIR/trace, holding a table of tags and a ring of events
+ * which the trace PMDA drains in batches.  Producers claim ring slots by
+ * advancing head, and each slot carries a sequence number so that slots
+ * are only consumed once completely written (seq == pos + 1), and only
+ * reused once consumed (seq == pos + ringsize).
+ */
+#define TRACE_SHM_DIR		"trace"
+#define TRACE_SHM_MAGIC		0x54504350	/* "PCPT" */
+#define TRACE_SHM_VERSION	1
+#define TRACE_SHM_RINGSIZE	65536	/* default, always a power of two */
+#define TRACE_SHM_MAXRING	(1<<24)
+#define TRACE_SHM_MAXTAGS	1024
+#define TRACE_SHM_CACHELINE	64
+
+typedef struct {
+    __uint32_t	magic;		/* TRACE_SHM_MAGIC */
+    __uint32_t	version;	/* TRACE_SHM_VERSION */
+    __int32_t	pid;		/* process recording the events */
+    __uint32_t	ringsize;	/* number of event slots */
+    __uint32_t	maxtags;	/* number of tag table slots */
+    __uint32_t	ntags;		/* tag table slots in use */
+    __uint64_t	dropped;	/* events lost to a full ring or tag table */
+    char	pad0[TRACE_SHM_CACHELINE - 32];
+    __uint64_t	head;		/* next slot claimed by the process */
+    char	pad1[TRACE_SHM_CACHELINE - 8];
+    __uint64_t	tail;		/* next slot drained by the PMDA */
+    char	pad2[TRACE_SHM_CACHELINE - 8];
+} __pmTraceShmHdr;
+
+typedef struct {
+    __uint32_t	type;		/* TRACE_TYPE_* */
+    __uint32_t	length;		/* including the null terminator */
+    char	name[MAXTAGNAMELEN];
+} __pmTraceShmTag;
+
+typedef struct {
+    __uint64_t	seq;
+    __uint32_t	tag;		/* tag table slot */
+    __uint32_t	pad;
+    double	value;
+} __pmTraceShmEvent;
+
+#define TRACE_SHM_TAGS(h) \
+	((__pmTraceShmTag *)((char *)(h) + sizeof(__pmTraceShmHdr)))
+#define TRACE_SHM_EVENTS(h) \
+	((__pmTraceShmEvent *)(TRACE_SHM_TAGS(h) + (h)->maxtags))
+#define TRACE_SHM_SIZE(maxtags, ringsize) (sizeof(__pmTraceShmHdr) + \
+	(size_t)(maxtags) * sizeof(__pmTraceShmTag) + \
+	(size_t)(ringsize) * sizeof(__pmTraceShmEvent))
+
+extern int __pmtraceshmopen(void);
+extern int __pmtraceshmsend(const char *, int, int, double);
+
 extern int __pmstate;
 
 #ifdef __cplusplus
@@ -3,7 +3,7 @@
  *
  * Copyright (C) 2001,2009 Silicon Graphics, Inc.  All rights reserved.
  * Copyright (C) 2009 Aconex.  All rights reserved.
- * Copyright (C) 2013,2016,2018-2020 Red Hat.
+ * Copyright (C) 2013,2016,2018-2020,2026 Red Hat.
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU Lesser General Public License as published by
@@ -31,6 +31,7 @@ struct mmv_registry {
     __uint32_t		ninstances;
     mmv_label_t *	labels;
     __uint32_t		nlabels;
+    __uint32_t *	shards;		/* per metric, zero if not sharded */
     __uint32_t		version;
     const char *	file;
     __uint32_t		cluster;
@@ -128,6 +129,202 @@ mmv_generation(void)
     return (((__uint64_t)gen1 << 32) | (__uint64_t)gen2);
 }
 
+/*
+ * Index of values in each mapping created by this process, hashed on
+ * metric and instance names, so that the name based update routines
+ * need not search the whole values section on every call.  Built once
+ * the file is written (values never move afterward) and dropped when
+ * the mapping is stopped.
+ *
+ * Lookups walk the list without locking - nodes are only ever pushed
+ * on the head (published after being filled in) and never unlinked.
+ * A dropped index clears its addr, and its node is reused for the next
+ * mapping; the lock just serializes adding and dropping.
+ */
+typedef struct mmv_index_entry {
+    const char *	metric;		/* name in the mapping */
+    const char *	instance;	/* NULL for singular metrics */
+    pmAtomValue *	value;		/* NULL for an empty slot */
+} mmv_index_entry_t;
+
+typedef struct mmv_index {
+    struct mmv_index *	next;
+    void *		addr;		/* NULL once dropped */
+    __uint32_t		mask;		/* number of slots - 1 */
+    mmv_index_entry_t *	entries;
+} mmv_index_t;
+
+#ifdef PM_MULTI_THREAD
+static pthread_mutex_t	mmv_index_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+static void		*mmv_index_lock;
+#endif
+static mmv_index_t	*mmv_indexes;
+
+static __uint32_t
+mmv_index_hash(const char *metric, const char *instance)
+{
+    __uint32_t hash = 2166136261U;	/* FNV-1a */
+    const char *p;
+
+    for (p = metric; *p; p++)
+	hash = (hash ^ (unsigned char)*p) * 16777619U;
+    if (instance) {
+	hash = (hash ^ '\0') * 16777619U;
+	for (p = instance; *p; p++)
+	    hash = (hash ^ (unsigned char)*p) * 16777619U;
+    }
+    return hash;
+}
+
+static void
+mmv_value_names(void *addr, int version, mmv_disk_value_t *v,
+		const char **metric, const char **instance)
+{
+    mmv_disk_string_t *s;
+    __int32_t indom;
+
+    if (version == MMV_VERSION1) {
+	mmv_disk_metric_t *m = (mmv_disk_metric_t *)
+					((char *)addr + v->metric);
+	*metric = m->name;
+	indom = m->indom;
+    } else {
+	mmv_disk_metric2_t *m = (mmv_disk_metric2_t *)
+					((char *)addr + v->metric);
+	s = (mmv_disk_string_t *)((char *)addr + m->name);
+	*metric = s->payload;
+	indom = m->indom;
+    }
+    if (mmv_singular(indom))
+	*instance = NULL;
+    else if (version == MMV_VERSION1) {
+	mmv_disk_instance_t *in = (mmv_disk_instance_t *)
+					((char *)addr + v->instance);
+	*instance = in->external;
+    } else {
+	mmv_disk_instance2_t *in = (mmv_disk_instance2_t *)
+					((char *)addr + v->instance);
+	s = (mmv_disk_string_t *)((char *)addr + in->external);
+	*instance = s->payload;
+    }
+}
+
+static mmv_index_entry_t *
+mmv_index_slot(mmv_index_t *index, const char *metric, const char *instance)
+{
+    mmv_index_entry_t *entry;
+    __uint32_t slot = mmv_index_hash(metric, instance) & index->mask;
+
+    for (;; slot = (slot + 1) & index->mask) {
+	entry = &index->entries[slot];
+	if (entry->value == NULL)
+	    return entry;
+	if (strcmp(entry->metric, metric) != 0)
+	    continue;
+	if (instance == NULL && entry->instance == NULL)
+	    return entry;
+	if (instance && entry->instance && strcmp(entry->instance, instance) == 0)
+	    return entry;
+    }
+}
+
+static void
+mmv_index_add(void *addr, int version, mmv_disk_value_t *vlist, int nvalues)
+{
+    mmv_index_entry_t *entry;
+    mmv_index_t *index;
+    const char *metric, *instance;
+    mmv_index_entry_t *entries;
+    __uint32_t size = 16;
+    int i, reused = 1;
+
+    /* on failure, lookups just fall back to searching the values */
+    while (size < (__uint32_t)nvalues * 2)	/* at most half full */
+	size <<= 1;
+    if ((entries = (mmv_index_entry_t *)
+			calloc(size, sizeof(mmv_index_entry_t))) == NULL)
+	return;
+
+    PM_LOCK(mmv_index_lock);
+    for (index = mmv_indexes; index != NULL; index = index->next)
+	if (index->addr == NULL)
+	    break;
+    if (index == NULL) {
+	if ((index = (mmv_index_t *)calloc(1, sizeof(*index))) == NULL) {
+	    PM_UNLOCK(mmv_index_lock);
+	    free(entries);
+	    return;
+	}
+	index->next = mmv_indexes;
+	reused = 0;
+    }
+    index->entries = entries;
+    index->mask = size - 1;
+
+    for (i = 0; i < nvalues; i++) {
+	mmv_value_names(addr, version, &vlist[i], &metric, &instance);
+	entry = mmv_index_slot(index, metric, instance);
+	if (entry->value == NULL) {	/* first value wins, as when searching */
+	    entry->metric = metric;
+	    entry->instance = instance;
+	    entry->value = &vlist[i].value;
+	}
+    }
+
+    /* publish only once complete, for lookups without the lock */
+    __atomic_store_n(&index->addr, addr, __ATOMIC_RELEASE);
+    if (!reused)
+	__atomic_store_n(&mmv_indexes, index, __ATOMIC_RELEASE);
+    PM_UNLOCK(mmv_index_lock);
+}
+
+static void
+mmv_index_drop(void *addr)
+{
+    mmv_index_entry_t *entries = NULL;
+    mmv_index_t *index;
+
+    PM_LOCK(mmv_index_lock);
+    for (index = mmv_indexes; index != NULL; index = index->next) {
+	if (index->addr == addr) {
+	    __atomic_store_n(&index->addr, NULL, __ATOMIC_RELEASE);
+	    entries = index->entries;
+	    index->entries = NULL;
+	    break;
+	}
+    }
+    PM_UNLOCK(mmv_index_lock);
+    if (entries)
+	free(entries);
+}
+
+/*
+ * Returns 1 if addr has an index, with *value set to the value found,
+ * or 0 if the values section must be searched.
+ */
+static int
+mmv_index_lookup(void *addr, const char *metric, const char *inst,
+		pmAtomValue **value)
+{
+    mmv_index_entry_t *entry;
+    mmv_index_t *index;
+
+    index = __atomic_load_n(&mmv_indexes, __ATOMIC_ACQUIRE);
+    for (; index != NULL; index = index->next)
+	if (__atomic_load_n(&index->addr, __ATOMIC_ACQUIRE) == addr)
+	    break;
+    if (index == NULL)
+	return 0;
+
+    /* singular metrics match regardless of any instance name given */
+    entry = mmv_index_slot(index, metric, NULL);
+    if (entry->value == NULL && inst != NULL)
+	entry = mmv_index_slot(index, metric, inst);
+    *value = entry->value;
+    return 1;
+}
+
 static void * 
 mmv_init(const char *fname, int version,
 		int cluster, mmv_stats_flags_t fl,
@@ -135,7 +332,8 @@ mmv_init(const char *fname, int version,
 		const mmv_indom_t *in1, int nindom1,
 		const mmv_metric2_t *st2, int nmetric2,
 		const mmv_indom2_t *in2, int nindom2,
-		const mmv_label_t *lb, int nlabels)
+		const mmv_label_t *lb, int nlabels,
+		const __uint32_t *sh2)
 {
     mmv_disk_instance2_t *inlist2;
     mmv_disk_instance_t *inlist1;
@@ -155,13 +353,17 @@ mmv_init(const char *fname, int version,
     __uint64_t values_offset;		/* anchor start of values section */
     __uint64_t strings_offset;		/* anchor start of any/all strings */
     __uint64_t labels_offset;		/* anchor start of any/all labels */
+    __uint64_t shards_offset;		/* anchor start of sharded values */
+    __uint64_t histograms_offset;	/* anchor start of histogram values */
     void *addr;
     size_t size;
     __uint64_t offset;
-    int i, j, k, tocidx, stridx;
+    int i, j, k, tocidx, stridx, shardidx = 0, histidx = 0;
     int ninstances = 0;
     int nstrings = 0;
     int nvalues = 0;
+    int nshards = 0;
+    int nhistograms = 0;
 
     for (i = 0; i < nindom1; i++) {
 	ninstances += in1[i].count;
@@ -172,7 +374,7 @@ mmv_init(const char *fname, int version,
     }
     for (i = 0; i < nindom2; i++) {
 	ninstances += in2[i].count;
-	if (version == MMV_VERSION2 || version == MMV_VERSION3)
+	if (version >= MMV_VERSION2)
 	    nstrings += in2[i].count;	/* instance names */
 	if (in2[i].shorttext)
 	    nstrings++;
@@ -198,7 +400,7 @@ mmv_init(const char *fname, int version,
 	}
     }
     for (i = 0; i < nmetric2; i++) {
-	if (version == MMV_VERSION2 || version == MMV_VERSION3)
+	if (version >= MMV_VERSION2)
 	    nstrings++;		/* metric name */
 	if (st2[i].helptext)
 	    nstrings++;
@@ -210,15 +412,22 @@ mmv_init(const char *fname, int version,
 	    if (st2[i].type == MMV_TYPE_STRING)
 		nstrings += mi2->count;
 	    nvalues += mi2->count;
+	    if (sh2)
+		nshards += sh2[i] * mi2->count;
 	} else {
 	    if (st2[i].type == MMV_TYPE_STRING)
 		nstrings++;
+	    if (st2[i].type == MMV_TYPE_HISTOGRAM)
+		nhistograms++;
 	    nvalues++;
+	    if (sh2)
+		nshards += sh2[i];
 	}
     }
     
     /* TOC follows header, with enough entries to hold */
-    /* indoms, instances, metrics, values, strings, and labels */
+    /* indoms, instances, metrics, values, strings, labels, shards */
+    /* and histograms */
     size = sizeof(mmv_disk_toc_t) * 2;
     if (nindom1 || nindom2)
 	size += sizeof(mmv_disk_toc_t) * 2;
@@ -227,6 +436,10 @@ mmv_init(const char *fname, int version,
     if (nlabels) {
 	size += sizeof(mmv_disk_toc_t) * 1;
     }
+    if (nshards)
+	size += sizeof(mmv_disk_toc_t) * 1;
+    if (nhistograms)
+	size += sizeof(mmv_disk_toc_t) * 1;
     indoms_offset = sizeof(mmv_disk_header_t) + size;
 
     /* Following the indom definitions are the actual instances */
@@ -271,8 +484,18 @@ mmv_init(const char *fname, int version,
     size = nstrings * sizeof(mmv_disk_string_t);
     labels_offset = strings_offset + size;
 
-    /* End of file follows all of the actual strings */
+    /* Following the labels are the shards, each in its own cache line */
     size = labels_offset + nlabels * sizeof(mmv_disk_label_t);
+    shards_offset = (size + MMV_SHARDSIZE - 1) & ~(MMV_SHARDSIZE - 1);
+
+    /* Following the shards are the histograms, also cache aligned */
+    if (nshards)
+	size = shards_offset + nshards * sizeof(mmv_disk_shard_t);
+    histograms_offset = (size + MMV_SHARDSIZE - 1) & ~(MMV_SHARDSIZE - 1);
+
+    /* End of file follows all of the histograms */
+    if (nhistograms)
+	size = histograms_offset + nhistograms * sizeof(mmv_disk_histogram_t);
 
     if ((addr = mmv_mapping_init(fname, size)) == NULL)
 	return NULL;
@@ -300,6 +523,10 @@ mmv_init(const char *fname, int version,
 	hdr->tocs += 1;
     if (nlabels)
 	hdr->tocs += 1;    
+    if (nshards)
+	hdr->tocs += 1;
+    if (nhistograms)
+	hdr->tocs += 1;
     hdr->flags = fl;
     hdr->cluster = cluster;
     hdr->process = (__int32_t)getpid();
@@ -337,6 +564,18 @@ mmv_init(const char *fname, int version,
 	toc[tocidx].offset = labels_offset;
 	tocidx++;
     }
+    if (nshards) {
+	toc[tocidx].type = MMV_TOC_SHARDS;
+	toc[tocidx].count = nshards;
+	toc[tocidx].offset = shards_offset;
+	tocidx++;
+    }
+    if (nhistograms) {
+	toc[tocidx].type = MMV_TOC_HISTOGRAMS;
+	toc[tocidx].count = nhistograms;
+	toc[tocidx].offset = histograms_offset;
+	tocidx++;
+    }
 
     /* Indom section */
     domlist = (mmv_disk_indom_t *)((char *)addr + indoms_offset);
@@ -430,7 +669,7 @@ mmv_init(const char *fname, int version,
 	    mlist2[i].semantics = st2[i].semantics;
 	    mlist2[i].shorttext = 0;	/* filled in later */
 	    mlist2[i].helptext = 0;	/* filled in later */
-	    mlist2[i].padding = 0;
+	    mlist2[i].shards = sh2 ? sh2[i] : 0;
 	}
     }
 
@@ -466,6 +705,15 @@ mmv_init(const char *fname, int version,
 	if (mmv_singular(st2[i].indom)) {
 	    memset(&vlist[j], 0, sizeof(mmv_disk_value_t));
 	    vlist[j].metric = offset;
+	    if (sh2 && sh2[i]) {
+		vlist[j].extra = shards_offset + shardidx * sizeof(mmv_disk_shard_t);
+		shardidx += sh2[i];
+	    }
+	    if (st2[i].type == MMV_TYPE_HISTOGRAM) {
+		vlist[j].extra = histograms_offset +
+				histidx * sizeof(mmv_disk_histogram_t);
+		histidx++;
+	    }
 	    j++;
 	} else {
 	    __uint64_t ioff;
@@ -480,6 +728,10 @@ mmv_init(const char *fname, int version,
 		memset(&vlist[j], 0, sizeof(mmv_disk_value_t));
 		vlist[j].metric = offset;
 		vlist[j].instance = ioff;
+		if (sh2 && sh2[i]) {
+		    vlist[j].extra = shards_offset + shardidx * sizeof(mmv_disk_shard_t);
+		    shardidx += sh2[i];
+		}
 		j++;
 	    }
 	}
@@ -493,7 +745,7 @@ mmv_init(const char *fname, int version,
      * 6 phases: v2 instance names, v2 metric names, all string values,
      *	   any metric help, any indom help, v3 metric labels.
      */
-    if (version == MMV_VERSION2 || version == MMV_VERSION3) {
+    if (version >= MMV_VERSION2) {
 	inlist2 = (mmv_disk_instance2_t *)((char *)addr + instances_offset);
 	for (i = 0; i < nindom2; i++) {
 	    mmv_instances2_t *insts = in2[i].instances;
@@ -525,7 +777,7 @@ mmv_init(const char *fname, int version,
 	    mmv_disk_metric_t *m1 = (mmv_disk_metric_t *)
 			((char *)(addr + vlist[i].metric));
 	    type = m1->type;
-	} else if (version == MMV_VERSION2 || version == MMV_VERSION3) {
+	} else if (version >= MMV_VERSION2) {
 	    mmv_disk_metric2_t *m2 = (mmv_disk_metric2_t *)
 			((char *)(addr + vlist[i].metric));
 	    type = m2->type;
@@ -617,6 +869,8 @@ mmv_init(const char *fname, int version,
 	memcpy(lblist[i].payload, lb[i].payload, MMV_LABELMAX);
     }
 
+    mmv_index_add(addr, version, vlist, nvalues);
+
     /* Complete - unlock the header, PMDA can read now */
     hdr->g2 = hdr->g1;
 
@@ -688,7 +942,7 @@ mmv_stats_init(const char *fname,
 
     return mmv_init(fname, version, cluster, flags,
 		    st, nmetrics, in, nindoms, 
-		    NULL, 0, NULL, 0, NULL, 0);
+		    NULL, 0, NULL, 0, NULL, 0, NULL);
 }
 
 static int
@@ -699,7 +953,7 @@ mmv_check2(const mmv_metric2_t *st, int nmetrics,
     const mmv_metric2_t *metric;
     const mmv_indom2_t *indom;
     size_t size;
-    int i, j, version = MMV_VERSION1;
+    int i, j, histograms = 0, version = MMV_VERSION1;
 
     for (i = 0; i < nindoms; i++) {
 	indom = &in[i];
@@ -741,7 +995,7 @@ mmv_check2(const mmv_metric2_t *st, int nmetrics,
 	metric = &st[i];
 	size = strlen(metric->name);
 	if (metric->type < MMV_TYPE_NOSUPPORT ||
-	    metric->type > MMV_TYPE_ELAPSED || size == 0) {
+	    metric->type > MMV_TYPE_HISTOGRAM || size == 0) {
 	    setoserror(EINVAL);
 	    return -1;
 	}
@@ -751,13 +1005,21 @@ mmv_check2(const mmv_metric2_t *st, int nmetrics,
 	}
 	if (size >= MMV_NAMEMAX)
 	    version = MMV_VERSION2;
+	if (metric->type == MMV_TYPE_HISTOGRAM) {
+	    /* histogram buckets are exported as the instances */
+	    if (!mmv_singular(metric->indom)) {
+		setoserror(EINVAL);
+		return -1;
+	    }
+	    histograms++;
+	}
 	if (!mmv_singular(metric->indom) &&
 	    !mmv_lookup_indom2(metric->indom, in, nindoms)) {
 	    setoserror(ESRCH);
 	    return -1;
 	}
     }
-    return version;
+    return histograms ? MMV_VERSION4 : version;
 }
 
 void * 
@@ -772,7 +1034,7 @@ mmv_stats2_init(const char *fname,
 	return NULL;
 
     return mmv_init(fname, version, cluster, flags,
-		    NULL, 0, NULL, 0, st, nmetrics, in, nindoms, NULL, 0);
+		    NULL, 0, NULL, 0, st, nmetrics, in, nindoms, NULL, 0, NULL);
 }
 
 mmv_registry_t *
@@ -807,6 +1069,7 @@ mmv_stats_add_metric(mmv_registry_t *registry, const char *name, int item,
 		     int serial, const char *shorthelp, const char *longhelp)
 {
     mmv_metric2_t * metric;
+    __uint32_t * shards;
     size_t bytes;
 
     if (registry == NULL) {
@@ -822,6 +1085,15 @@ mmv_stats_add_metric(mmv_registry_t *registry, const char *name, int item,
     }
 
     registry->metrics = metric;
+
+    bytes = (registry->nmetrics + 1) * sizeof(__uint32_t);
+    shards = (__uint32_t *) realloc(registry->shards, bytes);
+    if (shards == NULL) {
+	setoserror(ENOMEM);
+	return -1;
+    }
+    registry->shards = shards;
+    shards[registry->nmetrics] = 0;
     
     metric[registry->nmetrics].name = (char *)name;
     metric[registry->nmetrics].item = item;
@@ -838,6 +1110,68 @@ mmv_stats_add_metric(mmv_registry_t *registry, const char *name, int item,
     return 0;
 }
 
+/*
+ * Sharded values get a shard for each configured CPU, so that threads
+ * updating the same value concurrently write to separate cache lines.
+ */
+static __uint32_t
+mmv_shard_count(void)
+{
+    long	ncpus = 1;
+
+#ifdef _SC_NPROCESSORS_CONF
+    ncpus = sysconf(_SC_NPROCESSORS_CONF);
+#endif
+    if (ncpus < 1)
+	ncpus = 1;
+    if (ncpus > MMV_SHARDMAX)
+	ncpus = MMV_SHARDMAX;
+    return (__uint32_t)ncpus;
+}
+
+int
+mmv_stats_add_metric_flags(mmv_registry_t *registry, int item,
+			   mmv_metric_flags_t flags)
+{
+    mmv_metric2_t * metric = NULL;
+    int i;
+
+    if (registry == NULL) {
+	setoserror(EFAULT);
+	return -1;
+    }
+    for (i = 0; i < registry->nmetrics; i++) {
+	if (registry->metrics[i].item == item) {
+	    metric = &registry->metrics[i];
+	    break;
+	}
+    }
+    if (metric == NULL) {
+	setoserror(ESRCH);
+	return -1;
+    }
+    if (flags & ~MMV_METRIC_SHARDED) {
+	setoserror(EINVAL);
+	return -1;
+    }
+
+    if (flags & MMV_METRIC_SHARDED) {
+	/* only numeric values can be summed from shards */
+	if (metric->type == MMV_TYPE_STRING ||
+	    metric->type == MMV_TYPE_ELAPSED ||
+	    metric->type == MMV_TYPE_HISTOGRAM ||
+	    metric->type == MMV_TYPE_NOSUPPORT) {
+	    setoserror(EINVAL);
+	    return -1;
+	}
+	registry->shards[i] = mmv_shard_count();
+	registry->version = MMV_VERSION4;
+    } else {
+	registry->shards[i] = 0;
+    }
+    return 0;
+}
+
 int
 mmv_stats_add_indom(mmv_registry_t *registry, int serial, 
 		    const char *shorthelp, const char *longhelp) 
@@ -1048,7 +1382,8 @@ mmv_stats_add_registry_label(mmv_registry_t *registry,
 	return -1;
     }
 
-    registry->version = MMV_VERSION3;
+    if (registry->version < MMV_VERSION3)
+	registry->version = MMV_VERSION3;
     registry->labels = label;
 
     label[registry->nlabels].flags = flags;
@@ -1091,7 +1426,8 @@ mmv_stats_add_indom_label(mmv_registry_t *registry, int serial,
 	return -1;
     }
 
-    registry->version = MMV_VERSION3;
+    if (registry->version < MMV_VERSION3)
+	registry->version = MMV_VERSION3;
     registry->labels = label;
 
     label[registry->nlabels].flags = flags;
@@ -1134,7 +1470,8 @@ mmv_stats_add_metric_label(mmv_registry_t *registry, int item,
 	return -1;
     }
 
-    registry->version = MMV_VERSION3;
+    if (registry->version < MMV_VERSION3)
+	registry->version = MMV_VERSION3;
     registry->labels = label;
 
     label[registry->nlabels].flags = flags;
@@ -1177,7 +1514,8 @@ mmv_stats_add_instance_label(mmv_registry_t *registry, int serial, int instid,
 	return -1;
     }
 
-    registry->version = MMV_VERSION3;
+    if (registry->version < MMV_VERSION3)
+	registry->version = MMV_VERSION3;
     registry->labels = label;
 
     label[registry->nlabels].flags = flags;
@@ -1198,7 +1536,7 @@ mmv_stats_start(mmv_registry_t *registry)
 				registry->indoms, registry->nindoms)) < 0)
 	return NULL;
 
-    if (registry->version != MMV_VERSION3)
+    if (registry->version < version)
 	registry->version = version;
 
     registry->addr = mmv_init(registry->file,
@@ -1206,7 +1544,8 @@ mmv_stats_start(mmv_registry_t *registry)
 				registry->flags, NULL, 0, NULL, 0, 
 				registry->metrics, registry->nmetrics, 
 				registry->indoms, registry->nindoms,
-				registry->labels, registry->nlabels);
+				registry->labels, registry->nlabels,
+				registry->shards);
     return registry->addr;
 }
 
@@ -1231,8 +1570,10 @@ mmv_stats_stop(const char *fname, void *addr)
 	unlink(path);
     if (fd >= 0)
 	close(fd);
-    if (addr)
+    if (addr) {
+	mmv_index_drop(addr);
 	__pmMemoryUnmap(addr, sbuf.st_size);
+    }
 }
 
 void
@@ -1249,6 +1590,8 @@ mmv_stats_free(mmv_registry_t *registry)
 	free(registry->instances);
     if (registry->metrics)
 	free(registry->metrics);
+    if (registry->shards)
+	free(registry->shards);
     if (registry->labels)
 	free(registry->labels);
 
@@ -1331,7 +1674,10 @@ mmv_lookup_value_desc(void *addr, const char *metric, const char *inst)
 	mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
 	mmv_disk_toc_t *toc = (mmv_disk_toc_t *)
 			((char *)addr + sizeof(mmv_disk_header_t));
+	pmAtomValue *value;
 
+	if (mmv_index_lookup(addr, metric, inst, &value))
+	    return value;
 	if (hdr->version == MMV_VERSION1) {
 	    for (i = 0; i < hdr->tocs; i++)
 		if (toc[i].type == MMV_TOC_VALUES)
@@ -1345,12 +1691,115 @@ mmv_lookup_value_desc(void *addr, const char *metric, const char *inst)
     return NULL;
 }
 
+/*
+ * Each thread updates the shards at its own index (modulo the number
+ * of shards), handed out in order as threads first update a value.
+ */
+#ifdef HAVE___THREAD
+static __thread __uint32_t	mmv_thread_shard;	/* zero until assigned */
+#endif
+static __uint32_t		mmv_next_shard;
+
+static __uint32_t
+mmv_shard(__uint32_t shards)
+{
+#ifdef HAVE___THREAD
+    if (mmv_thread_shard == 0)
+	mmv_thread_shard = __atomic_add_fetch(&mmv_next_shard, 1,
+						__ATOMIC_RELAXED);
+    return (mmv_thread_shard - 1) % shards;
+#else
+    /* without thread private data, spread updates over the shards */
+    return __atomic_fetch_add(&mmv_next_shard, 1, __ATOMIC_RELAXED) % shards;
+#endif
+}
+
+static __uint32_t
+mmv_value_shards(void *addr, mmv_disk_value_t *v)
+{
+    mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
+
+    if (hdr->version < MMV_VERSION4)
+	return 0;
+    return ((mmv_disk_metric2_t *)((char *)addr + v->metric))->shards;
+}
+
+/*
+ * Atomically add to a numeric value, returns zero for other types.
+ */
+static int
+mmv_atomic_add(pmAtomValue *av, int type, double inc)
+{
+    pmAtomValue old, new;
+
+    switch (type) {
+    case MMV_TYPE_I32:
+	__atomic_fetch_add(&av->l, (__int32_t)inc, __ATOMIC_RELAXED);
+	break;
+    case MMV_TYPE_U32:
+	__atomic_fetch_add(&av->ul, (__uint32_t)inc, __ATOMIC_RELAXED);
+	break;
+    case MMV_TYPE_I64:
+	__atomic_fetch_add(&av->ll, (__int64_t)inc, __ATOMIC_RELAXED);
+	break;
+    case MMV_TYPE_U64:
+	__atomic_fetch_add(&av->ull, (__uint64_t)inc, __ATOMIC_RELAXED);
+	break;
+    case MMV_TYPE_FLOAT:
+	old.ul = __atomic_load_n(&av->ul, __ATOMIC_RELAXED);
+	do {
+	    new.f = old.f + (float)inc;
+	} while (!__atomic_compare_exchange_n(&av->ul, &old.ul, new.ul,
+			1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	break;
+    case MMV_TYPE_DOUBLE:
+	old.ull = __atomic_load_n(&av->ull, __ATOMIC_RELAXED);
+	do {
+	    new.d = old.d + inc;
+	} while (!__atomic_compare_exchange_n(&av->ull, &old.ull, new.ull,
+			1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	break;
+    default:
+	return 0;
+    }
+    return 1;
+}
+
+/*
+ * Histogram samples are counted in a fixed log-linear bucket, with
+ * separate atomic adds to the bucket and the sum of all samples.
+ */
+static void
+mmv_histogram_add(void *addr, mmv_disk_value_t *v, double sample)
+{
+    mmv_disk_histogram_t *hp;
+    __uint64_t value;
+    int bucket, shift;
+
+    if (v->extra <= 0)
+	return;
+    hp = (mmv_disk_histogram_t *)((char *)addr + v->extra);
+    value = sample > 0 ? (__uint64_t)sample : 0;
+    if (value < MMV_HISTOGRAM_SUB) {
+	bucket = (int)value;
+    } else {
+	/* log2(value) - log2(MMV_HISTOGRAM_SUB) */
+	shift = 63 - __builtin_clzll(value) - 2;
+	bucket = MMV_HISTOGRAM_SUB * (shift + 1) +
+		 (int)((value >> shift) & (MMV_HISTOGRAM_SUB - 1));
+    }
+    __atomic_fetch_add(&hp->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hp->sum, value, __ATOMIC_RELAXED);
+}
+
 void
 mmv_inc_value(void *addr, pmAtomValue *av, double inc)
 {
     if (av != NULL && addr != NULL) {
 	mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
 	mmv_disk_value_t *v = (mmv_disk_value_t *)av;
+	mmv_disk_shard_t *shard;
+	__uint32_t shards;
 	int type;
 
 	if (hdr->version == MMV_VERSION1) {
@@ -1361,6 +1810,11 @@ mmv_inc_value(void *addr, pmAtomValue *av, double inc)
 	    mmv_disk_metric2_t *m = (mmv_disk_metric2_t *)
 					((char *)addr + v->metric);
 	    type = m->type;
+	    if ((shards = mmv_value_shards(addr, v)) != 0) {
+		shard = (mmv_disk_shard_t *)((char *)addr + v->extra);
+		mmv_atomic_add(&shard[mmv_shard(shards)].value, type, inc);
+		return;
+	    }
 	}
 	switch (type) {
 	case MMV_TYPE_I32:
@@ -1389,6 +1843,9 @@ mmv_inc_value(void *addr, pmAtomValue *av, double inc)
 		v->extra = 0;
 	    }
 	    break;
+	case MMV_TYPE_HISTOGRAM:
+	    mmv_histogram_add(addr, v, inc);
+	    break;
 	default:
 	    break;
 	}
@@ -1401,6 +1858,8 @@ mmv_set_value(void *addr, pmAtomValue *av, double val)
     if (av != NULL && addr != NULL) {
 	mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
 	mmv_disk_value_t *v = (mmv_disk_value_t *)av;
+	mmv_disk_shard_t *shard;
+	__uint32_t i, shards;
 	int type;
 
 	if (hdr->version == MMV_VERSION1) {
@@ -1411,6 +1870,12 @@ mmv_set_value(void *addr, pmAtomValue *av, double val)
 	    mmv_disk_metric2_t *m = (mmv_disk_metric2_t *)
 					((char *)addr + v->metric);
 	    type = m->type;
+	    /* sharded values are the sum of value and shards, reset those */
+	    if ((shards = mmv_value_shards(addr, v)) != 0) {
+		shard = (mmv_disk_shard_t *)((char *)addr + v->extra);
+		for (i = 0; i < shards; i++)
+		    __atomic_store_n(&shard[i].value.ull, 0, __ATOMIC_RELAXED);
+	    }
 	}
 	switch (type) {
 	case MMV_TYPE_I32:
@@ -1435,6 +1900,15 @@ mmv_set_value(void *addr, pmAtomValue *av, double val)
 	    v->value.ll = (__int64_t)val;
 	    v->extra = 0;
 	    break;
+	case MMV_TYPE_HISTOGRAM:	/* reset, the value is not used */
+	    if (v->extra > 0) {
+		mmv_disk_histogram_t *hp = (mmv_disk_histogram_t *)
+					((char *)addr + v->extra);
+		for (i = 0; i < MMV_HISTOGRAM_BUCKETS; i++)
+		    __atomic_store_n(&hp->buckets[i], 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&hp->sum, 0, __ATOMIC_RELAXED);
+	    }
+	    break;
 	default:
 	    break;
 	}
@@ -1578,3 +2052,69 @@ mmv_stats_set_strlen(void *addr, const char *metric,
 	mmv_set_string(addr, mmv_metric, string, len);
     }
 }
+
+/*
+ * Handle routines - resolve a value once, then update it without any
+ * name lookups.  Integer values are updated with single atomic adds,
+ * so concurrent updates from several threads are not lost.
+ */
+
+int
+mmv_stats_handle(void *addr, const char *metric, const char *instance,
+	mmv_handle_t *handle)
+{
+    mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
+    mmv_disk_value_t *v;
+    pmAtomValue *value;
+
+    if (addr == NULL || metric == NULL || handle == NULL) {
+	setoserror(EFAULT);
+	return -1;
+    }
+    if ((value = mmv_lookup_value_desc(addr, metric, instance)) == NULL) {
+	setoserror(ESRCH);
+	return -1;
+    }
+    v = (mmv_disk_value_t *)value;
+    if (hdr->version == MMV_VERSION1)
+	handle->type = ((mmv_disk_metric_t *)((char *)addr + v->metric))->type;
+    else
+	handle->type = ((mmv_disk_metric2_t *)((char *)addr + v->metric))->type;
+    handle->addr = addr;
+    handle->value = value;
+    if ((handle->shards = mmv_value_shards(addr, v)) != 0)
+	handle->shard = (char *)addr + v->extra;
+    else
+	handle->shard = NULL;
+    return 0;
+}
+
+void
+mmv_handle_add(const mmv_handle_t *handle, double inc)
+{
+    mmv_disk_shard_t *shard;
+    pmAtomValue *av;
+
+    if (handle == NULL || (av = handle->value) == NULL)
+	return;
+    if (handle->shards) {
+	shard = (mmv_disk_shard_t *)handle->shard;
+	av = &shard[mmv_shard(handle->shards)].value;
+    }
+    /* elapsed time keeps interval state, strings are not added */
+    if (!mmv_atomic_add(av, handle->type, inc))
+	mmv_inc_value(handle->addr, handle->value, inc);
+}
+
+void
+mmv_handle_inc(const mmv_handle_t *handle)
+{
+    mmv_handle_add(handle, 1);
+}
+
+void
+mmv_handle_set(const mmv_handle_t *handle, double value)
+{
+    if (handle != NULL)
+	mmv_set_value(handle->addr, handle->value, value);
+}
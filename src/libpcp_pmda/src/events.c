@@ -17,6 +17,7 @@
 #include "pmapi.h"
 #include "libpcp.h"
 #include "pmda.h"
+#include "libdefs.h"
 
 typedef struct {
     char		*baddr;	/* base address of the buffer */
@@ -106,6 +107,18 @@ pmdaEventNewHighResArray(void)
     return sts;
 }
 
+/*
+ * make room for (at least) another "need" bytes of records, so that
+ * a batch of records can be added without growing the buffer again
+ */
+int
+__pmdaEventReserve(int idx, int need)
+{
+    if (idx < 0 || idx >= nbuf || bufs[idx].bstate == B_FREE)
+	return PM_ERR_NOCONTEXT;
+    return check_buf(&bufs[idx], need);
+}
+
 /* prepare to reuse an array */
 int
 pmdaEventResetArray(int idx)
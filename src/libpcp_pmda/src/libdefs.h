@@ -44,6 +44,8 @@ typedef struct {
  */
 extern __uint32_t hash(const signed char *, int, __uint32_t);
 
+extern int __pmdaEventReserve(int, int);
+
 /*
  * These ones escaped via the exports file, but are only used within
  * the libpcp_pmda library, so pull the definitions back from <pcp/pmda.h>
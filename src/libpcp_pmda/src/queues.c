@@ -1,7 +1,7 @@
 /*
  * Generic event queue support for PMDAs
  *
- * Copyright (c) 2011,2015-2016 Red Hat.
+ * Copyright (c) 2011,2015-2016,2026 Red Hat.
  * Copyright (c) 2011 Nathan Scott.  All rights reserved.
  * 
  * This library is free software; you can redistribute it and/or modify it
@@ -16,10 +16,25 @@
  */
 
 #include "pmapi.h"
+#include "libpcp.h"
 #include "pmda.h"
+#include "libdefs.h"
 #include "queues.h"
 #include <ctype.h>
 
+/*
+ * Events are packed into blocks of this size (or the queue memory
+ * limit, if smaller), each event padded for alignment and to allow
+ * for a terminating null byte after the event data.
+ */
+#define EVENT_BLOCKSIZE		(64 * 1024)
+#define EVENT_ALIGN		sizeof(__uint64_t)
+#define EVENT_STRIDE(bytes)	\
+	((sizeof(event_t) + (bytes) + EVENT_ALIGN) & ~(EVENT_ALIGN - 1))
+
+/* encoded size of one event record, beyond the event data itself */
+#define EVENT_RECORD_SIZE	(sizeof(pmEventRecord) + sizeof(__uint32_t))
+
 static event_queue_t *queues;
 static int numqueues;
 
@@ -44,50 +59,172 @@ queue_lookup(int handle)
 }
 
 /*
- * Drop an event after it has been queued (i.e. client was too slow)
+ * Oldest event still held in the queue, if any
  */
-static void
-queue_drop(event_clientq_t *clientq, event_queue_t *queue, void *data)
+static event_t *
+queue_first(event_queue_t *queue)
 {
-    event_t *event = (event_t *)data;
+    event_block_t *block = queue->first;
 
-    if (clientq->last != NULL && clientq->last == event) {
-	clientq->last = TAILQ_NEXT(event, events);
-	clientq->missed++;
+    if (queue->head == queue->tail)
+	return NULL;
+    return (event_t *)(block->data + block->start);
+}
 
-	if (pmDebugOptions.libpmda)
-	    pmNotifyErr(LOG_DEBUG, "Client missed queue %s event %p",
-			queue->name, event);
+/*
+ * Event following the given one, moving on to the next block as needed
+ */
+static event_t *
+queue_next(event_block_t **blockp, event_t *event)
+{
+    event_block_t *block = *blockp;
+    size_t offset = (char *)event - block->data + EVENT_STRIDE(event->size);
+
+    if (offset < block->used)
+	return (event_t *)(block->data + offset);
+    if ((block = block->next) == NULL || block->start >= block->used)
+	return NULL;
+    *blockp = block;
+    return (event_t *)(block->data + block->start);
+}
+
+/*
+ * Find the event with a given sequence number (a client cursor),
+ * skipping over entire blocks of events before it.
+ */
+static event_t *
+queue_seek(event_queue_t *queue, __uint64_t seqno, event_block_t **blockp)
+{
+    event_block_t *block;
+    event_t *event;
+
+    if (seqno < queue->head || seqno >= queue->tail)
+	return NULL;
+    for (block = queue->first; block != NULL; block = block->next)
+	if (seqno < block->seqno + block->count)
+	    break;
+    event = (event_t *)(block->data + block->start);
+    while (event->seqno < seqno)
+	event = (event_t *)((char *)event + EVENT_STRIDE(event->size));
+    *blockp = block;
+    return event;
+}
+
+/*
+ * Reserve space for a new event at the end of the queue.  Events are
+ * packed into blocks, so most events need no allocation of their own.
+ */
+static event_t *
+queue_alloc(event_queue_t *queue, size_t bytes)
+{
+    event_block_t *block = queue->last;
+    size_t stride = EVENT_STRIDE(bytes);
+    size_t size;
+    event_t *event;
+
+    if (block && block->count == 0 && block->size < stride) {
+	/* only (empty) block is too small for this event, replace it */
+	free(block);
+	queue->first = queue->last = block = NULL;
     }
+    if (block == NULL || block->used + stride > block->size) {
+	size = EVENT_BLOCKSIZE;
+	if (size > queue->maxmemory)
+	    size = queue->maxmemory;
+	if (size < stride)
+	    size = stride;
+	if ((block = malloc(sizeof(event_block_t) + size)) == NULL)
+	    return NULL;
+	block->next = NULL;
+	block->size = size;
+	block->used = block->start = 0;
+	block->count = 0;
+	if (queue->last)
+	    queue->last->next = block;
+	else
+	    queue->first = block;
+	queue->last = block;
+    }
+    if (block->count == 0)
+	block->seqno = queue->tail;
+    event = (event_t *)(block->data + block->used);
+    block->used += stride;
+    block->count++;
+    return event;
 }
 
+/*
+ * Remove the oldest event from the queue, freeing its block once empty
+ * (the last block is kept for reuse by subsequent events).
+ */
 static void
-queue_drop_bytes(int handle, event_queue_t *queue, size_t bytes)
+queue_pop(event_queue_t *queue, event_t *event)
 {
-    event_t *event, *next;
+    event_block_t *block = queue->first;
 
-    event = TAILQ_FIRST(&queue->tailq);
-    while (event) {
+    queue->qsize -= event->size;
+    queue->head++;
+    block->start += EVENT_STRIDE(event->size);
+    if (block->start < block->used)
+	return;
+    if (block->next == NULL) {
+	block->start = block->used = 0;
+	block->count = 0;
+	return;
+    }
+    queue->first = block->next;
+    free(block);
+}
+
+/*
+ * Drop events after they have been queued (i.e. a client was too slow)
+ * until there is room for the given number of bytes.  Clients missing
+ * these events find out when next they fetch from the queue.
+ */
+static void
+queue_drop_bytes(event_queue_t *queue, size_t bytes)
+{
+    event_t *event;
+
+    while ((event = queue_first(queue)) != NULL) {
 	if (bytes <= queue->maxmemory - queue->qsize)
 	    break;
-	next = TAILQ_NEXT(event, events);
 
 	if (pmDebugOptions.libpmda)
 	    pmNotifyErr(LOG_DEBUG, "Dropping %s: e=%p sz=%d max=%d qsz=%d",
 				    queue->name, event, (int)event->size,
 				    (int)queue->maxmemory, (int)queue->qsize);
 
-	/* Walk clients - if event last seen, drop it and bump missed count */
-	client_iterate(queue_drop, handle, queue, event);
+	queue->dropped++;
+	queue_pop(queue, event);
+    }
+}
+
+static void
+queue_cursor(event_clientq_t *clientq, event_queue_t *queue, void *data)
+{
+    __uint64_t *seqno = (__uint64_t *)data;
+
+    if (clientq->next < *seqno)
+	*seqno = clientq->next;
+}
 
+/*
+ * Release events from the front of the queue once every client with
+ * an interest in the queue has moved past them.
+ */
+static void
+queue_release_seen(int handle, event_queue_t *queue)
+{
+    __uint64_t seqno = queue->tail;
+    event_t *event;
+
+    client_iterate(queue_cursor, handle, queue, &seqno);
+    while (queue->head < seqno && (event = queue_first(queue)) != NULL) {
 	if (pmDebugOptions.libpmda)
 	    pmNotifyErr(LOG_DEBUG, "Removing %s event %p (%d bytes)",
 				    queue->name, event, (int)event->size);
-
-	TAILQ_REMOVE(&queue->tailq, event, events);
-	queue->qsize -= event->size;
-	free(event);
-	event = next;
+	queue_pop(queue, event);
     }
 }
 
@@ -109,28 +246,17 @@ pmdaEventNewActiveQueue(const char *name, size_t maxmemory, unsigned int numclie
 	if (queues[i].inuse == 0)
 	    break;
     if (i == numqueues) {
-	/*
-	 * No free slots - extend the available set.
-	  realloc potentially moves "queues" address, fix up 
-	 * must tear down existing queues which may have back
-	 * references and then re-initialise them afterward.
-	 */
-	for (i = 0; i < numqueues; i++)
-	    queue_drop_bytes(i, &queues[i], INT_MAX);
+	/* no free slots, extend the available set */
 	size = (numqueues + 1) * sizeof(event_queue_t);
 	queues = realloc(queues, size);
 	if (!queues)
 	    pmNoMem("pmdaEventNewQueue", size, PM_FATAL_ERR);
-	/* realloc moves tailq tqh_last pointer - reset 'em */
-	for (i = 0; i < numqueues; i++)
-	    TAILQ_INIT(&queues[i].tailq);
 	numqueues++;
     }
 
     /* "i" now indexes into a free slot */
     queue = &queues[i];
     memset(queue, 0, sizeof(*queue));
-    TAILQ_INIT(&queue->tailq); 
     queue->eventarray = pmdaEventNewArray();
     queue->numclients = numclients;
     queue->maxmemory = maxmemory;
@@ -200,6 +326,17 @@ pmdaEventQueueBytes(int handle, pmAtomValue *atom)
     return PMDA_FETCH_STATIC;
 }
 
+int
+pmdaEventQueueDropped(int handle, pmAtomValue *atom)
+{
+    event_queue_t *queue = queue_lookup(handle);
+
+    if (!queue)
+	return -EINVAL;
+    atom->ull = queue->dropped;
+    return PMDA_FETCH_STATIC;
+}
+
 int
 pmdaEventQueueAppend(int handle, void *data, size_t bytes, struct timeval *tv)
 {
@@ -220,33 +357,30 @@ pmdaEventQueueAppend(int handle, void *data, size_t bytes, struct timeval *tv)
     /*
      * We may need to make room in the event queue.  If so, start at the head
      * and madly drop events until sufficient space exists or all are freed.
-     * Bump the missed counter for each client who missed an event we had to
-     * throw away.
      */
-    queue_drop_bytes(handle, queue, bytes);
+    queue_drop_bytes(queue, bytes);
     if (queue->numclients == 0)
 	goto done;
 
-    if ((event = malloc(sizeof(event_t) + bytes + 1)) == NULL) {
+    if ((event = queue_alloc(queue, bytes)) == NULL) {
 	pmNotifyErr(LOG_ERR, "event allocation failure: %ld bytes",
-			(long)(bytes + 1));
+			(long)EVENT_STRIDE(bytes));
 	return -ENOMEM;
     }
 
-    /* Track the actual event data */
-    event->count = queue->numclients;
-    memcpy(event->buffer, data, bytes);
+    /* Track the actual event data, once for all clients */
+    event->seqno = queue->tail++;
+    event->offset = queue->bytes;
     memcpy(&event->time, tv, sizeof(*tv));
+    memcpy(event->buffer, data, bytes);
+    event->buffer[bytes] = '\0';
     event->size = bytes;
-
-    /* Finally, store the event in the queue */
-    TAILQ_INSERT_TAIL(&queue->tailq, event, events);
     queue->qsize += bytes;
 
     if (pmDebugOptions.libpmda)
 	pmNotifyErr(LOG_DEBUG,
 			"Inserted %s event %p (%ld bytes) clients = %d",
-			queue->name, event, (long)event->size, event->count);
+			queue->name, event, (long)event->size, queue->numclients);
 
 done:
     /* Update event queue tracking stats (even for no-clients case) */
@@ -274,32 +408,63 @@ queue_filter(event_clientq_t *clientq, void *data, size_t size)
 }
 
 static int
-queue_fetch(event_queue_t *queue, event_clientq_t *clientq, pmAtomValue *atom,
-	    pmdaEventDecodeCallBack queue_decoder, void *data)
+queue_fetch(int handle, event_queue_t *queue, event_clientq_t *clientq,
+	    pmAtomValue *atom, pmdaEventDecodeCallBack queue_decoder, void *data)
 {
-    event_t *event, *next;
+    event_block_t *block;
+    event_t *event;
+    __uint64_t missed = 0, need;
     int records, key, sts;
 
     /*
      * Ensure the way we keep track of which clients are interested
-     * in which queues is up to date.
+     * in which queues is up to date.  New clients start with the
+     * oldest event still queued.
      */
     if (clientq->active == 0) {
 	clientq->active = 1;
+	clientq->next = queue->head;
 	queue->numclients++;
     }
-    if (clientq->last == NULL)
-	clientq->last = TAILQ_FIRST(&queue->tailq);
-    event = clientq->last;
+
+    /* Did this client miss any events, dropped before it reached them? */
+    if (clientq->next < queue->head) {
+	missed = queue->head - clientq->next;
+	clientq->next = queue->head;
+    }
 
     if (pmDebugOptions.libpmda)
-	pmNotifyErr(LOG_DEBUG, "queue_fetch start, last event=%p", event);
+	pmNotifyErr(LOG_DEBUG, "queue_fetch start, next event=%" FMT_UINT64
+			" pending=%" FMT_UINT64 " missed=%" FMT_UINT64,
+			clientq->next, queue->tail - clientq->next, missed);
 
     sts = records = 0;
     key = queue->eventarray;
     pmdaEventResetArray(key);
 
-    while (event != NULL) {
+    if (missed > 0) {
+	struct timeval timestamp;
+	gettimeofday(&timestamp, NULL);
+	if (missed > INT_MAX)
+	    missed = INT_MAX;
+	sts = pmdaEventAddMissedRecord(key, &timestamp, (int)missed);
+	records++;
+    }
+
+    event = queue_seek(queue, clientq->next, &block);
+
+    /*
+     * Size the event array once for all pending events, rather than
+     * growing it repeatedly as the decoder adds each event record.
+     */
+    if (event != NULL) {
+	need = queue->bytes - event->offset;
+	need += (queue->tail - event->seqno) * EVENT_RECORD_SIZE;
+	if (need < INT_MAX / 2)
+	    __pmdaEventReserve(key, (int)need);
+    }
+
+    while (event != NULL && sts >= 0) {
 	char	message[64];
 
 	if (queue_filter(clientq, event->buffer, event->size)) {
@@ -321,42 +486,13 @@ queue_fetch(event_queue_t *queue, event_clientq_t *clientq, pmAtomValue *atom,
 	    sts = 0;
 	}
 
-	next = TAILQ_NEXT(event, events);
-
-	/* Remove the current one (if its use count hits zero) */
-	if (--event->count <= 0) {
-	    if (pmDebugOptions.libpmda)
-		pmNotifyErr(LOG_DEBUG, "Removing %s event %p in fetch",
-					queue->name, event);
-	    TAILQ_REMOVE(&queue->tailq, event, events);
-	    queue->qsize -= event->size;
-	    free(event);
-	}
-
-	/* Go on to the next event. */
-	event = next;
+	/* Move this clients cursor on to the next event. */
+	clientq->next = event->seqno + 1;
+	event = queue_next(&block, event);
     }
 
-    /*
-     * Did this client miss any events?  The "extra" one is the last previously
-     * observed event (pointed at by per-context last pointer) - so, event only
-     * missed once we move past *more* than just that last observed event.
-     */
-    if (sts == 0) {
-	sts = clientq->missed - 1;
-	clientq->missed = 0;
-	if (sts > 0) {
-	    struct timeval timestamp;
-	    gettimeofday(&timestamp, NULL);
-	    sts = pmdaEventAddMissedRecord(key, &timestamp, sts);
-	    records++;
-	} else {
-	    sts = 0;
-	}
-    }
-
-    /* Update queue tail pointer for this client. */
-    clientq->last = NULL;
+    /* Release any events that every client has now seen. */
+    queue_release_seen(handle, queue);
 
     atom->vbp = records ? (pmValueBlock *)pmdaEventGetAddr(key) : NULL;
     return sts;
@@ -406,7 +542,7 @@ pmdaEventQueueRecords(int handle, pmAtomValue *atom, int context,
     if (!queue || !clientq)
 	return -EINVAL;
 
-    sts = queue_fetch(queue, clientq, atom, queue_decoder, data);
+    sts = queue_fetch(handle, queue, clientq, atom, queue_decoder, data);
     if (sts != 0)
 	return sts;
     return (atom->vbp == NULL) ? PMDA_FETCH_NOVALUES : PMDA_FETCH_STATIC;
@@ -415,20 +551,25 @@ pmdaEventQueueRecords(int handle, pmAtomValue *atom, int context,
 static void
 queue_release(event_queue_t *queue)
 {
+    event_block_t *block, *next;
+
     /* free resources and mark as no longer inuse */
+    for (block = queue->first; block != NULL; block = next) {
+	next = block->next;
+	free(block);
+    }
     pmdaEventReleaseArray(queue->eventarray);
     memset(queue, 0, sizeof(*queue));
 }
 
 /*
  * We've lost a client (disconnected).
- * Cleanup any filter and any back references across the queues.
+ * Cleanup any filter and release events only this client was holding.
  */
 static void
 queue_cleanup(int handle, event_clientq_t *clientq)
 {
     event_queue_t *queue = queue_lookup(handle);
-    event_t *event, *next;
 
     if (clientq->release)
 	clientq->release(clientq->filter);
@@ -440,21 +581,8 @@ queue_cleanup(int handle, event_clientq_t *clientq)
 	pmNotifyErr(LOG_DEBUG, "queue_cleanup: %s numclients=%d",
 			queue->name, queue->numclients);
 
-    event = clientq->last;
-    while (event) {
-	next = TAILQ_NEXT(event, events);
-
-	/* Remove the current event (if use count hits zero) */
-	if (--event->count <= 0) {
-	    if (pmDebugOptions.libpmda)
-		pmNotifyErr(LOG_DEBUG, "Removing %s event %p",
-				queue->name, event);
-	    TAILQ_REMOVE(&queue->tailq, event, events);
-	    queue->qsize -= event->size;
-	    free(event);
-	}
-	event = next;
-    }
+    clientq->active = 0;
+    queue_release_seen(handle, queue);
 
     if (--queue->numclients <= 0) {
 	if (pmDebugOptions.libpmda)
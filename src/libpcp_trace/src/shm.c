@@ -0,0 +1,319 @@
+/*
+ * shm.c - shared memory event ring between traced processes and pmdatrace
+ *
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+#include "pmapi.h"
+#include "libpcp.h"
+#include "trace.h"
+#include "trace_dev.h"
+
+#if defined(HAVE_PTHREAD_MUTEX_T) && !defined(IS_MINGW)
+#include <pthread.h>
+#include <pwd.h>
+#include <grp.h>
+
+static __pmTraceShmHdr		*shm;
+static __pmTraceShmTag		*shmtags;
+static __pmTraceShmEvent	*shmevents;
+static __uint64_t		shmmask;
+static __uint32_t		shmntags;	/* never read back from the ring */
+static char			shmpath[MAXPATHLEN];
+
+/*
+ * Process-local index into the shared tag table, using open addressing
+ * on the tag name and type.  Slots hold a tag table slot number plus one
+ * (zero is empty), are only ever filled in under shmlock, and are read
+ * without locking by the recording routines.
+ */
+static __uint32_t		*shmindex;
+static __uint32_t		indexmask;
+static pthread_mutex_t		shmlock = PTHREAD_MUTEX_INITIALIZER;
+
+static __uint32_t
+shmhash(const char *tag, int taglength, int type)
+{
+    __uint32_t	hash = 2166136261U ^ type;
+    int		i;
+
+    for (i = 0; i < taglength; i++)
+	hash = (hash ^ (unsigned char)tag[i]) * 16777619U;
+    return hash;
+}
+
+static int
+shmtagmatch(__uint32_t slot, const char *tag, int taglength, int type)
+{
+    __pmTraceShmTag	*tp = &shmtags[slot];
+
+    return tp->type == type && tp->length == taglength &&
+	   memcmp(tp->name, tag, taglength) == 0;
+}
+
+/*
+ * Find the tag table slot for this tag and type, adding it to the table
+ * if this is the first time it has been seen.  The tag is published to
+ * the PMDA (via ntags) before any event can refer to it, but the count
+ * of tags used is kept here, as the ring is writable by the PMDA too.
+ */
+static int
+shmtag(const char *tag, int taglength, int type)
+{
+    __pmTraceShmTag	*tp;
+    __uint32_t		hash, i, n;
+    int			sts;
+
+    hash = shmhash(tag, taglength, type);
+    for (i = hash & indexmask; ; i = (i + 1) & indexmask) {
+	if ((n = __atomic_load_n(&shmindex[i], __ATOMIC_ACQUIRE)) == 0)
+	    break;
+	if (shmtagmatch(n - 1, tag, taglength, type))
+	    return n - 1;
+    }
+
+    pthread_mutex_lock(&shmlock);
+    for (i = hash & indexmask; (n = shmindex[i]) != 0; i = (i + 1) & indexmask) {
+	if (shmtagmatch(n - 1, tag, taglength, type)) {
+	    pthread_mutex_unlock(&shmlock);
+	    return n - 1;
+	}
+    }
+    if ((n = shmntags) >= TRACE_SHM_MAXTAGS)
+	sts = -ENOSPC;
+    else {
+	tp = &shmtags[n];
+	tp->type = type;
+	tp->length = taglength;
+	memcpy(tp->name, tag, taglength);
+	shmntags = n + 1;
+	__atomic_store_n(&shm->ntags, n + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&shmindex[i], n + 1, __ATOMIC_RELEASE);
+#ifdef PMTRACE_DEBUG
+	if (__pmstate & PMTRACE_STATE_API)
+	    fprintf(stderr, "__pmtraceshmsend: new tag '%s' (type=%d,slot=%u)\n",
+			tag, type, n);
+#endif
+	sts = n;
+    }
+    pthread_mutex_unlock(&shmlock);
+    return sts;
+}
+
+/*
+ * Record one event in the ring.  This never blocks - if the PMDA has
+ * fallen a full ring behind, the event is counted as dropped instead.
+ */
+int
+__pmtraceshmsend(const char *tag, int taglength, int type, double value)
+{
+    __pmTraceShmEvent	*ep;
+    __uint64_t		pos, seq, head;
+    int			slot;
+
+    if ((slot = shmtag(tag, taglength, type)) < 0) {
+	__atomic_fetch_add(&shm->dropped, 1, __ATOMIC_RELAXED);
+	return slot;
+    }
+
+    pos = __atomic_load_n(&shm->head, __ATOMIC_RELAXED);
+    for (;;) {
+	ep = &shmevents[pos & shmmask];
+	seq = __atomic_load_n(&ep->seq, __ATOMIC_ACQUIRE);
+	if (seq == pos) {
+	    if (__atomic_compare_exchange_n(&shm->head, &pos, pos + 1, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		break;
+	    /* lost the race for this slot, pos is now the current head */
+	}
+	else if ((__int64_t)(seq - pos) < 0) {
+	    /* slot still holds an event from the previous lap, ring is full */
+	    __atomic_fetch_add(&shm->dropped, 1, __ATOMIC_RELAXED);
+	    return 0;
+	}
+	else {
+	    /* slot already claimed, head must have moved on from pos */
+	    head = __atomic_load_n(&shm->head, __ATOMIC_RELAXED);
+	    if (head == pos) {
+		__atomic_fetch_add(&shm->dropped, 1, __ATOMIC_RELAXED);
+		return PMTRACE_ERR_IPC;
+	    }
+	    pos = head;
+	}
+    }
+    ep->tag = slot;
+    ep->value = value;
+    __atomic_store_n(&ep->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Remove the ring at exit if the PMDA has drained it, otherwise leave
+ * it to be drained and removed by the PMDA once this process has gone.
+ * Forked children share the ring, but only its creator removes it.
+ */
+static void
+shmexit(void)
+{
+    if (shm != NULL && shm->pid == (__int32_t)getpid() &&
+	__atomic_load_n(&shm->tail, __ATOMIC_ACQUIRE) ==
+	__atomic_load_n(&shm->head, __ATOMIC_ACQUIRE))
+	unlink(shmpath);
+}
+
+/*
+ * Only the PMDA may access the ring.  It runs as the PCP user, so the
+ * ring is private (0600) if this process runs as that user too, else
+ * it is shared with the PCP group only (0660).  When neither is allowed
+ * the ring is not created, and the PDU protocols are used instead.
+ */
+static int
+shmaccess(int fd)
+{
+    struct passwd	pw, *pwp = NULL;
+    struct group	gr, *grp = NULL;
+    char		buf[1024];
+    char		*name;
+
+    if ((name = pmGetConfig("PCP_USER")) == NULL || name[0] == '\0')
+	name = "pcp";
+    if (getpwnam_r(name, &pw, buf, sizeof(buf), &pwp) == 0 && pwp != NULL &&
+	pwp->pw_uid == geteuid())
+	return 0;
+
+    if ((name = pmGetConfig("PCP_GROUP")) == NULL || name[0] == '\0')
+	name = "pcp";
+    if (getgrnam_r(name, &gr, buf, sizeof(buf), &grp) != 0 || grp == NULL)
+	return -ENOENT;
+    if (fchown(fd, (uid_t)-1, grp->gr_gid) < 0 || fchmod(fd, 0660) < 0)
+	return -oserror();
+    return 0;
+}
+
+/*
+ * Create, initialise and publish the ring for this process.  The file
+ * is only renamed into place once complete, so the PMDA never attaches
+ * to a partially initialised ring.
+ */
+int
+__pmtraceshmopen(void)
+{
+    __pmTraceShmHdr	*hdr;
+    __pmTraceShmEvent	*events;
+    char		tmppath[MAXPATHLEN];
+    char		*sptr, *endnum;
+    __uint32_t		ringsize = TRACE_SHM_RINGSIZE;
+    __uint32_t		i, nindex;
+    size_t		size;
+    long		value;
+    pid_t		pid = getpid();
+    int			sep = pmPathSeparator();
+    int			fd, sts;
+
+    if (shm != NULL)
+	return 0;
+
+    if ((sptr = getenv(TRACE_ENV_RINGSIZE)) != NULL) {
+	value = strtol(sptr, &endnum, 0);
+	if (*endnum != '\0' || value <= 0 || value > TRACE_SHM_MAXRING)
+	    fprintf(stderr, "trace warning: bad PCP_TRACE_RINGSIZE ignored.\n");
+	else	/* power of two, and at least two slots for sequencing */
+	    for (ringsize = 16; ringsize < value; ringsize <<= 1)
+		;
+    }
+
+    pmsprintf(shmpath, sizeof(shmpath), "%s%c%s%c%" FMT_PID,
+		pmGetConfig("PCP_TMP_DIR"), sep, TRACE_SHM_DIR, sep, pid);
+    pmsprintf(tmppath, sizeof(tmppath), "%s%c%s%c.%" FMT_PID,
+		pmGetConfig("PCP_TMP_DIR"), sep, TRACE_SHM_DIR, sep, pid);
+
+#ifdef PMTRACE_DEBUG
+    if (__pmstate & PMTRACE_STATE_COMMS)
+	fprintf(stderr, "__pmtraceshmopen: creating %s (ringsize=%u)\n",
+		shmpath, ringsize);
+#endif
+
+    nindex = 2 * TRACE_SHM_MAXTAGS;
+    if ((shmindex = (__uint32_t *)calloc(nindex, sizeof(__uint32_t))) == NULL)
+	return -oserror();
+
+    size = TRACE_SHM_SIZE(TRACE_SHM_MAXTAGS, ringsize);
+    unlink(tmppath);
+    if ((fd = open(tmppath, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+	sts = -oserror();
+	goto fail;
+    }
+    /* the PMDA consumes events in place */
+    if ((sts = shmaccess(fd)) < 0) {
+	close(fd);
+	unlink(tmppath);
+	goto fail;
+    }
+    if (ftruncate(fd, size) < 0 ||
+	(hdr = (__pmTraceShmHdr *)__pmMemoryMap(fd, size, 1)) == NULL) {
+	sts = -oserror();
+	close(fd);
+	unlink(tmppath);
+	goto fail;
+    }
+    close(fd);
+
+    hdr->version = TRACE_SHM_VERSION;
+    hdr->pid = pid;
+    hdr->ringsize = ringsize;
+    hdr->maxtags = TRACE_SHM_MAXTAGS;
+    events = (__pmTraceShmEvent *)(TRACE_SHM_TAGS(hdr) + TRACE_SHM_MAXTAGS);
+    for (i = 0; i < ringsize; i++)
+	events[i].seq = i;
+    __atomic_store_n(&hdr->magic, TRACE_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    if (rename(tmppath, shmpath) < 0) {
+	sts = -oserror();
+	__pmMemoryUnmap(hdr, size);
+	unlink(tmppath);
+	goto fail;
+    }
+
+    shmtags = TRACE_SHM_TAGS(hdr);
+    shmevents = events;
+    shmmask = ringsize - 1;
+    indexmask = nindex - 1;
+    shm = hdr;
+    atexit(shmexit);
+    return 0;
+
+fail:
+#ifdef PMTRACE_DEBUG
+    if (__pmstate & PMTRACE_STATE_COMMS)
+	fprintf(stderr, "__pmtraceshmopen: %s: %s\n", shmpath, pmErrStr(sts));
+#endif
+    free(shmindex);
+    shmindex = NULL;
+    return sts;
+}
+
+#else
+
+int
+__pmtraceshmopen(void)
+{
+    return -EOPNOTSUPP;
+}
+
+int
+__pmtraceshmsend(const char *tag, int taglength, int type, double value)
+{
+    return -EOPNOTSUPP;
+}
+
+#endif
@@ -85,6 +85,7 @@ _pmlibdel(void *entry)
 
 static int		__pmfd;
 static __pmHashTable	_pmtable;
+static int		_pmtraceshm;	/* events go to the shared memory ring */
 
 #if defined(HAVE_PTHREAD_MUTEX_T)
 
@@ -233,25 +234,30 @@ pmtraceend(const char *tag)
 	hptr->inprogress = 0;
 	hptr->data = pmtimevalSub(&now, &hptr->start);
 
-	if (sts >= 0 && _pmtimedout) {
-	    sts = _pmtracereconnect();
-	    sts = _pmtraceremaperr(sts);
-	}
-
-	if (sts >= 0) {
-	    sts = __pmtracesenddata(__pmfd, hptr->tag, hptr->taglength,
+	if (_pmtraceshm)
+	    sts = __pmtraceshmsend(hptr->tag, hptr->taglength,
 					TRACE_TYPE_TRANSACT, hptr->data);
-	    sts = _pmtraceremaperr(sts);
-	}
+	else {
+	    if (sts >= 0 && _pmtimedout) {
+		sts = _pmtracereconnect();
+		sts = _pmtraceremaperr(sts);
+	    }
 
-	protocol = __pmtraceprotocol(TRACE_PROTOCOL_QUERY);
+	    if (sts >= 0) {
+		sts = __pmtracesenddata(__pmfd, hptr->tag, hptr->taglength,
+					    TRACE_TYPE_TRANSACT, hptr->data);
+		sts = _pmtraceremaperr(sts);
+	    }
 
-	if (sts >= 0 && protocol == TRACE_PROTOCOL_SYNC)
-	    sts = _pmtracegetack(sts, TRACE_TYPE_TRANSACT);
+	    protocol = __pmtraceprotocol(TRACE_PROTOCOL_QUERY);
 
-	if (sts == PMTRACE_ERR_IPC && protocol == TRACE_PROTOCOL_SYNC) {
-	    _pmtimedout = 1;	/* try reconnect */
-	    sts = 0;
+	    if (sts >= 0 && protocol == TRACE_PROTOCOL_SYNC)
+		sts = _pmtracegetack(sts, TRACE_TYPE_TRANSACT);
+
+	    if (sts == PMTRACE_ERR_IPC && protocol == TRACE_PROTOCOL_SYNC) {
+		_pmtimedout = 1;	/* try reconnect */
+		sts = 0;
+	    }
 	}
     }
 
@@ -337,6 +343,10 @@ _pmtracecommon(const char *label, double value, int type)
     }
     first = 0;
 
+    /* lock-free, the ring and its tag table do their own synchronisation */
+    if (_pmtraceshm)
+	return __pmtraceshmsend(label, taglength, type, value);
+
     TRACE_LOCK;
 
     if (sts >= 0 && _pmtimedout) {
@@ -468,11 +478,32 @@ _pmtraceremaperr(int sts)
 }
 
 
+/*
+ * getpid(2) is a system call on every begin/end, so the PID is cached
+ * and refreshed in the child after a fork.
+ */
+static pid_t	_pmtracepid;
+
+#if defined(HAVE_PTHREAD_H)
+static void
+_pmtraceforked(void)
+{
+    _pmtracepid = getpid();
+}
+#endif
+
 static __uint64_t
 _pmtraceid(void)
 {
     __uint64_t	myid = 0;
-    myid |= getpid();
+
+    if (_pmtracepid == 0) {
+	_pmtracepid = getpid();
+#if defined(HAVE_PTHREAD_H)
+	pthread_atfork(NULL, NULL, _pmtraceforked);
+#endif
+    }
+    myid |= _pmtracepid;
     return myid;
 }
 
@@ -661,8 +692,26 @@ _pmtraceconnect(int doit)
 	TRACE_LOCK;
 	sts = __pmhashinit(&_pmtable, 0, sizeof(_pmTraceLibdata),
 						_pmlibcmp, _pmlibdel);
-    if (TRACE_UNLOCK != 0)
-	return -oserror();
+	if (TRACE_UNLOCK != 0)
+	    return -oserror();
+
+	/* shared memory transport, falling back to PDUs if unavailable */
+	if (sts >= 0 && doit && ((__pmstate & PMTRACE_STATE_SHM) ||
+				 getenv(TRACE_ENV_SHM) != NULL)) {
+	    if (__pmtraceshmopen() == 0) {
+		__pmstate |= PMTRACE_STATE_SHM;
+		__pmtraceprotocol(TRACE_PROTOCOL_FINAL);
+		_pmtraceshm = 1;
+		_pmtimedout = 0;
+		return 0;
+	    }
+#ifdef PMTRACE_DEBUG
+	    if (__pmstate & PMTRACE_STATE_COMMS)
+		fprintf(stderr, "_pmtraceconnect: no shared memory ring, "
+				"using PDUs\n");
+#endif
+	    __pmstate &= ~PMTRACE_STATE_SHM;
+	}
     }
     else if (__pmtraceprotocol(TRACE_PROTOCOL_QUERY) == TRACE_PROTOCOL_ASYNC)
 	return PMTRACE_ERR_IPC;
@@ -14,6 +14,7 @@
 #include "discover.h"
 #include "slots.h"
 #include "util.h"
+#include <ctype.h>
 #include <dirent.h>
 #include <fnmatch.h>
 #include <sys/stat.h>
@@ -36,6 +37,32 @@ static pmDiscover *discover_hashtable[PM_DISCOVER_HASHTAB_SIZE];
 /* number of archives or directories currently being monitored */
 static int n_monitored = 0;
 
+/*
+ * Per-archive cursors - timestamp of the last logvol record processed.
+ * These are saved periodically so that after a restart each archive is
+ * resumed from where it left off, rather than from its current end.
+ * The archive size and modification time as of the cursor are saved
+ * too, so archives unchanged since then need not be opened at all.
+ */
+#define CURSOR_SAVE_INTERVAL	10	/* minimum seconds between saves */
+typedef struct cursor {
+    __pmTimestamp	stamp;
+    long long		size;
+    long long		mtime;
+} cursor_t;
+static dict		*cursors;	/* saved cursors, by archive name */
+static sds		cursorfile;	/* persistent cursor file, or NULL */
+static unsigned int	cursorsdirty;	/* cursors changed since last save */
+static time_t		cursorsaved;	/* time cursors last saved */
+static unsigned int	cursorspending;	/* archives to resume on next tick */
+static int		cursortimer = -1;
+
+/* archives with logvol reads paused due to key server request backlog */
+#define INGEST_RESUME_INTERVAL	100	/* msec between backlog checks */
+static unsigned int	ingest_paused;
+static unsigned int	ingest_timer_init;
+static uv_timer_t	ingest_timer;
+
 /* stats helpers */
 static void
 pmDiscoverStatsAdd(pmDiscoverModule *module, const char *name, const char *inst, double count)
@@ -84,6 +111,20 @@ strhash(const char *s, unsigned int limit)
     return h % limit;
 }
 
+/*
+ * Archives may be partitioned across several cooperating processes,
+ * in which case each one handles only those whose path hashes to it.
+ */
+static int
+in_shard(const char *path, pmDiscoverModule *module)
+{
+    discoverModuleData	*data = getDiscoverModuleData(module);
+
+    if (data == NULL || data->nshards <= 1)
+	return 1;
+    return strhash(path, data->nshards) == data->shard;
+}
+
 /* ctime string - note static buf is returned */
 static char *
 stamp(void)
@@ -172,6 +213,10 @@ pmDiscoverFree(pmDiscover *p)
 	free(p->event_handle);
 	p->event_handle = NULL;
     }
+    if (p->flags & PM_DISCOVER_FLAGS_PAUSED) {
+	ingest_paused--;
+	pmDiscoverStatsSet(p->module, "ingest.paused", NULL, ingest_paused);
+    }
 
     memset(p, 0, sizeof(*p));
     free(p);
@@ -278,6 +323,70 @@ strsuffix(char *s, const char *suffix)
     return ret;
 }
 
+/*
+ * Add or refresh a regular file found in a monitored directory - only
+ * uncompressed archive metadata and data volumes are of interest here.
+ * Note: path is modified in-place (archive suffixes are stripped).
+ * Return the (possibly new) archive entry, else NULL if not tracked.
+ */
+static pmDiscover *
+pmDiscoverArchiveFile(char *path, pmDiscoverModule *module, void *arg)
+{
+    pmDiscover		*a = NULL;
+    char		*suffix;
+    int			vol;
+
+    if ((suffix = strsuffix(path, ".meta")) != NULL) {
+	/*
+	 * An uncompressed PCP archive meta file. Track the meta
+	 * file - the matching logvol filename varies because logvols
+	 * are periodically rolled by pmlogger. Importantly, process all
+	 * available metadata to EOF before processing any logvol data.
+	 */
+	*suffix = '\0'; /* strip suffix from path giving archive name */
+	if (!in_shard(path, module)) {
+	    if (pmDebugOptions.discovery)
+		fprintf(stderr, "pmDiscoverArchiveFile: %s not in shard\n", path);
+	    return NULL;
+	}
+	a = pmDiscoverLookupAdd(path, module, arg);
+
+	/*
+	 * note: pmDiscoverLookupAdd sets PM_DISCOVER_FLAGS_NEW
+	 * if this is a newly discovered archive, otherwise we're
+	 * already tracking this archive.
+	 */
+	a->flags |= PM_DISCOVER_FLAGS_META;
+    }
+    else if ((suffix = __pmLogBaseNameVol(path, &vol)) != NULL && vol >= 0) {
+	/*
+	 * An archive logvol. This logvol may have been created since
+	 * the context was first opened. Update the context maxvol
+	 * to be sure pmFetchArchive can switch to it in due course.
+	 */
+	if ((a = pmDiscoverLookup(path)) != NULL) {
+	    a->flags |= PM_DISCOVER_FLAGS_DATAVOL;
+	    /* ensure archive context knows about this volume */
+	    if (pmDebugOptions.discovery)
+		fprintf(stderr, "pmDiscoverArchiveFile: found logvol %s %s vol=%d\n",
+		    a->context.name, pmDiscoverFlagsStr(a), vol);
+	    if (a->ctx >= 0 && vol >= 0) {
+		__pmContext *ctxp = __pmHandleToPtr(a->ctx);
+		__pmArchCtl *acp = ctxp->c_archctl;
+
+		__pmLogAddVolume(acp, vol);
+		PM_UNLOCK(ctxp->c_lock);
+	    }
+	    if (pmDebugOptions.discovery)
+		fprintf(stderr, "pmDiscoverArchiveFile: added logvol %s %s vol=%d\n",
+		    a->context.name, pmDiscoverFlagsStr(a), vol);
+	}
+    } else if (pmDebugOptions.discovery) {
+	fprintf(stderr, "pmDiscoverArchiveFile: ignored regular file %s\n", path);
+    }
+    return a;
+}
+
 /*
  * Discover dirs and archives - add new entries or refresh existing.
  * Call this for each top-level directory. Discovered paths are not
@@ -289,13 +398,11 @@ pmDiscoverArchives(const char *dir, pmDiscoverModule *module, void *arg)
 {
     DIR			*dirp;
     struct dirent	*dent;
-    struct stat		*s;
     struct stat		statbuf;
     pmDiscover		*a;
-    char		*suffix;
+    mode_t		mode;
     char		path[MAXNAMELEN];
     int			sep = pmPathSeparator();
-    int			vol;
 
     /*
      * note: pmDiscoverLookupAdd sets PM_DISCOVER_FLAGS_NEW
@@ -318,59 +425,27 @@ pmDiscoverArchives(const char *dir, pmDiscoverModule *module, void *arg)
 	if (pmDebugOptions.discovery)
 	    fprintf(stderr, "pmDiscoverArchives: readdir found %s\n", path);
 
-	if (stat(path, &statbuf) < 0) {
-	    if (pmDebugOptions.discovery)
-		fprintf(stderr, "pmDiscoverArchives: stat failed %s, err %d\n", path, errno);
-	    continue;
+	mode = 0;
+#ifdef _DIRENT_HAVE_D_TYPE
+	/* avoid a stat(2) per entry when the filesystem reports the type */
+	if (dent->d_type == DT_REG)
+	    mode = S_IFREG;
+	else if (dent->d_type == DT_DIR)
+	    mode = S_IFDIR;
+#endif
+	if (mode == 0) {
+	    if (stat(path, &statbuf) < 0) {
+		if (pmDebugOptions.discovery)
+		    fprintf(stderr, "pmDiscoverArchives: stat failed %s, err %d\n", path, errno);
+		continue;
+	    }
+	    mode = statbuf.st_mode;
 	}
 
-	s = &statbuf;
-	if (S_ISREG(s->st_mode)) {
-	    if ((suffix = strsuffix(path, ".meta")) != NULL) {
-		/*
-		 * An uncompressed PCP archive meta file. Track the meta
-		 * file - the matching logvol filename varies because logvols
-		 * are periodically rolled by pmlogger. Importantly, process all
-		 * available metadata to EOF before processing any logvol data.
-		 */
-		*suffix = '\0'; /* strip suffix from path giving archive name */
-		a = pmDiscoverLookupAdd(path, module, arg);
-
-		/*
-		 * note: pmDiscoverLookupAdd sets PM_DISCOVER_FLAGS_NEW
-		 * if this is a newly discovered archive, otherwise we're
-		 * already tracking this archive.
-		 */
-		a->flags |= PM_DISCOVER_FLAGS_META;
-	    }
-	    else if ((suffix = __pmLogBaseNameVol(path, &vol)) != NULL && vol >= 0) {
-		/*
-		 * An archive logvol. This logvol may have been created since
-		 * the context was first opened. Update the context maxvol
-		 * to be sure pmFetchArchive can switch to it in due course.
-		 */
-		if ((a = pmDiscoverLookup(path)) != NULL) {
-		    a->flags |= PM_DISCOVER_FLAGS_DATAVOL;
-		    /* ensure archive context knows about this volume */
-		    if (pmDebugOptions.discovery)
-			fprintf(stderr, "pmDiscoverArchives: found logvol %s %s vol=%d\n",
-			    a->context.name, pmDiscoverFlagsStr(a), vol);
-		    if (a->ctx >= 0 && vol >= 0) {
-			__pmContext *ctxp = __pmHandleToPtr(a->ctx);
-			__pmArchCtl *acp = ctxp->c_archctl;
-
-		    	__pmLogAddVolume(acp, vol);
-			PM_UNLOCK(ctxp->c_lock);
-		    }
-		    if (pmDebugOptions.discovery)
-			fprintf(stderr, "pmDiscoverArchives: added logvol %s %s vol=%d\n",
-			    a->context.name, pmDiscoverFlagsStr(a), vol);
-		}
-	    } else if (pmDebugOptions.discovery) {
-		fprintf(stderr, "pmDiscoverArchives: ignored regular file %s\n", path);
-	    }
+	if (S_ISREG(mode)) {
+	    pmDiscoverArchiveFile(path, module, arg);
 	}
-	else if (S_ISDIR(s->st_mode)) {
+	else if (S_ISDIR(mode)) {
 	    /*
 	     * Recurse into subdir
 	     */
@@ -384,6 +459,55 @@ pmDiscoverArchives(const char *dir, pmDiscoverModule *module, void *arg)
     return 0;
 }
 
+/*
+ * Total size and latest modification time of an archive - metadata
+ * plus all data volumes.  Any change to an archive changes these.
+ */
+static int
+archive_state(const char *name, long long *size, long long *mtime)
+{
+    DIR			*dirp;
+    struct dirent	*dent;
+    struct stat		statbuf;
+    const char		*base;
+    char		dir[MAXPATHLEN], path[MAXPATHLEN];
+    size_t		length;
+    int			sep = pmPathSeparator();
+
+    pmsprintf(path, sizeof(path), "%s.meta", name);
+    if (stat(path, &statbuf) < 0)
+	return -errno;
+    *size = statbuf.st_size;
+    *mtime = statbuf.st_mtime;
+
+    if ((base = strrchr(name, sep)) != NULL) {
+	pmsprintf(dir, sizeof(dir), "%.*s", (int)(base - name), name);
+	base++;
+    } else {
+	pmsprintf(dir, sizeof(dir), ".");
+	base = name;
+    }
+    length = strlen(base);
+
+    if ((dirp = opendir(dir)) == NULL)
+	return -errno;
+    while ((dent = readdir(dirp)) != NULL) {
+	/* data volumes are <base>.N (possibly with a compression suffix) */
+	if (strncmp(dent->d_name, base, length) != 0 ||
+	    dent->d_name[length] != '.' ||
+	    !isdigit((int)dent->d_name[length + 1]))
+	    continue;
+	pmsprintf(path, sizeof(path), "%s%c%s", dir, sep, dent->d_name);
+	if (stat(path, &statbuf) < 0)
+	    continue;
+	*size += statbuf.st_size;
+	if (*mtime < statbuf.st_mtime)
+	    *mtime = statbuf.st_mtime;
+    }
+    closedir(dirp);
+    return 0;
+}
+
 /*
  * Return 1 if monitored path has been deleted.
  * For archives, we only check the meta file because
@@ -432,6 +556,8 @@ check_deleted(pmDiscover *p)
     	p->flags |= PM_DISCOVER_FLAGS_DELETED;
 }
 
+static void entry_changed_callback(pmDiscover *, const char *); /* fwd decl */
+
 static void
 fs_change_callBack(uv_fs_event_t *handle, const char *filename, int events, int status)
 {
@@ -484,9 +610,14 @@ fs_change_callBack(uv_fs_event_t *handle, const char *filename, int events, int
 
     /*
      * Something in the directory changed - new or deleted archive, or
-     * a tracked archive meta data file or logvolume grew
+     * a tracked archive meta data file or logvolume grew.  When the name
+     * of the directory entry is known only that entry is examined, else
+     * fallback to rescanning the whole directory.
      */
-    if (p)
+    if (p && !(p->flags & PM_DISCOVER_FLAGS_DELETED) &&
+	(p->flags & PM_DISCOVER_FLAGS_DIRECTORY) && filename && *filename)
+	entry_changed_callback(p, filename);
+    else if (p)
 	p->changed(p); /* returns immediately if PM_DISCOVER_FLAGS_DELETED */
 
     sdsfree(path);
@@ -595,6 +726,7 @@ static struct {
     { PM_DISCOVER_FLAGS_MONITORED, "monitored|" },
     { PM_DISCOVER_FLAGS_DATAVOL_READY, "datavol-ready|" },
     { PM_DISCOVER_FLAGS_META_IN_PROGRESS, "metavol-in-progress|" },
+    { PM_DISCOVER_FLAGS_PAUSED, "paused|" },
     { 0, NULL }
 };
 
@@ -1234,9 +1366,171 @@ bump_logvol_decode_stats(pmDiscover *p, pmResult *r)
     }
 }
 
+static double
+ingest_now(void)
+{
+    struct timeval	now;
+
+    pmtimevalNow(&now);
+    return pmtimevalToReal(&now);
+}
+
+static void
+ingest_unpause(pmDiscover *p)
+{
+    double		stalled = ingest_now() - p->paused;
+
+    p->flags &= ~PM_DISCOVER_FLAGS_PAUSED;
+    ingest_paused--;
+    pmDiscoverStatsAdd(p->module, "ingest.stall_time", NULL, stalled * 1000);
+    pmDiscoverStatsSet(p->module, "ingest.paused", NULL, ingest_paused);
+}
+
+typedef struct ingestList {
+    unsigned int	count;
+    unsigned int	size;
+    pmDiscover		**archives;
+} ingestList;
+
+static void
+ingest_collect(pmDiscover *p, void *arg)
+{
+    ingestList		*list = (ingestList *)arg;
+
+    if (list->count < list->size)
+	list->archives[list->count++] = p;
+}
+
+/* order paused archives with the most recent data first */
+static int
+ingest_compare(const void *a, const void *b)
+{
+    pmDiscover		*pa = *(pmDiscover **)a;
+    pmDiscover		*pb = *(pmDiscover **)b;
+
+    if (pa->timestamp.sec != pb->timestamp.sec)
+	return pa->timestamp.sec < pb->timestamp.sec ? 1 : -1;
+    if (pa->timestamp.nsec != pb->timestamp.nsec)
+	return pa->timestamp.nsec < pb->timestamp.nsec ? 1 : -1;
+    return 0;
+}
+
+static void pmDiscoverInvokeCallBacks(pmDiscover *); /* fwd decl */
+
+/*
+ * Once the key server backlog drains below the low watermark resume
+ * paused archives, those closest to live first so that current data
+ * is preferred over catching up on older data (e.g. after a restart).
+ */
+static void
+ingest_resume_timer(uv_timer_t *timer)
+{
+    pmDiscoverModule	*module = (pmDiscoverModule *)timer->data;
+    discoverModuleData	*data = getDiscoverModuleData(module);
+    ingestList		list;
+    unsigned int	i;
+    int			depth;
+
+    depth = pmDiscoverGetInflightRedisRequests(module);
+    pmDiscoverStatsSet(module, "ingest.depth", NULL, depth);
+    if (ingest_paused == 0) {
+	uv_timer_stop(timer);
+	return;
+    }
+    if (depth > data->ingest_low)
+	return;
+
+    list.count = 0;
+    list.size = ingest_paused;
+    if ((list.archives = calloc(list.size, sizeof(pmDiscover *))) == NULL)
+	return;
+    pmDiscoverTraverseArg(PM_DISCOVER_FLAGS_PAUSED, ingest_collect, &list);
+    qsort(list.archives, list.count, sizeof(pmDiscover *), ingest_compare);
+
+    for (i = 0; i < list.count; i++) {
+	if (pmDiscoverGetInflightRedisRequests(module) >= data->ingest_high)
+	    break;
+	ingest_unpause(list.archives[i]);
+	pmDiscoverInvokeCallBacks(list.archives[i]);
+    }
+    free(list.archives);
+
+    if (ingest_paused == 0)
+	uv_timer_stop(timer);
+}
+
+/*
+ * Check the key server request backlog before reading more logvol data.
+ * Return non-zero if reads from this archive must stop for now - either
+ * paused (and resumed later from the same point) or, if so configured,
+ * with any unread data dropped by skipping ahead to the end of archive.
+ */
+static int
+ingest_backlogged(pmDiscover *p)
+{
+    discoverModuleData	*data = getDiscoverModuleData(p->module);
+    struct timeval	end;
+    int			depth;
+
+    if (data == NULL || data->ingest_high == 0)
+	return 0;
+
+    depth = pmDiscoverGetInflightRedisRequests(p->module);
+    pmDiscoverStatsSet(p->module, "ingest.depth", NULL, depth);
+    if (depth < data->ingest_high) {
+	if (p->flags & PM_DISCOVER_FLAGS_PAUSED)
+	    ingest_unpause(p);
+	return 0;
+    }
+    if (p->flags & PM_DISCOVER_FLAGS_PAUSED)
+	return 1;	/* already waiting to be resumed */
+
+    if (data->ingest_drop) {
+	if (pmGetArchiveEnd(&end) == 0) {
+	    pmSetMode(PM_MODE_FORW, &end, 1);
+	    p->timestamp.sec = end.tv_sec;
+	    p->timestamp.nsec = end.tv_usec * 1000;
+	    cursorsdirty = 1;
+	}
+	pmDiscoverStatsAdd(p->module, "ingest.drops", NULL, 1);
+	return 1;
+    }
+
+    if (pmDebugOptions.discovery)
+	fprintf(stderr, "%s: pausing %s with %d requests in-flight\n",
+			"ingest_backlogged", p->context.name, depth);
+    p->flags |= PM_DISCOVER_FLAGS_PAUSED;
+    p->paused = ingest_now();
+    ingest_paused++;
+    pmDiscoverStatsAdd(p->module, "ingest.stalls", NULL, 1);
+    pmDiscoverStatsSet(p->module, "ingest.paused", NULL, ingest_paused);
+
+    if (!ingest_timer_init) {
+	uv_timer_init(data->events, &ingest_timer);
+	ingest_timer.data = p->module;
+	ingest_timer_init = 1;
+    }
+    if (!uv_is_active((uv_handle_t *)&ingest_timer))
+	uv_timer_start(&ingest_timer, ingest_resume_timer,
+			INGEST_RESUME_INTERVAL, INGEST_RESUME_INTERVAL);
+    return 1;
+}
+
+void
+pmDiscoverIngestClose(pmDiscoverModule *module)
+{
+    (void)module;
+    if (ingest_timer_init) {
+	uv_timer_stop(&ingest_timer);
+	uv_close((uv_handle_t *)&ingest_timer, NULL);
+	ingest_timer_init = 0;
+    }
+}
+
 /*
  * Fetch metric values to EOF and call all registered callbacks.
  * Always process metadata thru to EOF before any logvol data.
+ * Stop early if the key server request backlog is too large.
  */
 static void
 process_logvol(pmDiscover *p)
@@ -1244,18 +1538,26 @@ process_logvol(pmDiscover *p)
     int			sts;
     pmResult		*r = NULL;
     __pmTimestamp	stamp;
-    int			oldcurvol;
+    int			oldcurvol, atend = 0;
     __pmContext		*ctxp;
     __pmArchCtl		*acp;
     char		*lock_path;
+    long long		size, mtime;
 
     pmDiscoverStatsAdd(p->module, "logvol.callbacks", NULL, 1);
     lock_path = archive_dir_lock_path(p);
+
+    /* archive state before reading - anything written later changes it */
+    if (archive_state(p->context.name, &size, &mtime) < 0)
+	size = mtime = -1;
+
     for (;;) {
 	if (lock_path && access(lock_path, F_OK) == 0)
 	    break;
 	pmDiscoverStatsAdd(p->module, "logvol.loops", NULL, 1);
 	pmUseContext(p->ctx);
+	if (ingest_backlogged(p))
+	    break;
 	ctxp = __pmHandleToPtr(p->ctx);
 	acp = ctxp->c_archctl;
 	oldcurvol = acp->ac_curvol;
@@ -1279,6 +1581,7 @@ process_logvol(pmDiscover *p)
 		    	p->context.name);
 
 		/* succesfully processed to current end of log */
+		atend = 1;
 		break;
 	    } else {
 		/* 
@@ -1308,16 +1611,16 @@ process_logvol(pmDiscover *p)
 		    r->numpmid);
 	}
 
-	/*
-	 * TODO (perhaps): persistently save current timestamp, so after being
-	 * restarted, pmproxy can resume where it left off for each archive.
-	 */
 	stamp.sec = r->timestamp.tv_sec;
 	stamp.nsec = r->timestamp.tv_usec * 1000;
 	bump_logvol_decode_stats(p, r);
 	pmDiscoverInvokeValuesCallBack(p, &stamp, r);
 	pmFreeResult(r);
 	r = NULL;
+
+	/* advance the cursor, persisted so a restart resumes from here */
+	p->timestamp = stamp;
+	cursorsdirty = 1;
     }
 
     if (r) {
@@ -1331,10 +1634,258 @@ process_logvol(pmDiscover *p)
     /* datavol is now up-to-date and at EOF */
     p->flags &= ~PM_DISCOVER_FLAGS_DATAVOL_READY;
 
+    /* the cursor covers the whole archive as it was before reading */
+    if (atend && (p->archsize != size || p->archmtime != mtime)) {
+	p->archsize = size;
+	p->archmtime = mtime;
+	cursorsdirty = 1;
+    }
+
     if (lock_path)
     	free(lock_path);
 }
 
+static void
+cursor_save_callback(pmDiscover *p, void *arg)
+{
+    if (p->timestamp.sec == 0 || (p->flags & PM_DISCOVER_FLAGS_DELETED))
+	return;
+    fprintf((FILE *)arg, "%lld %d %lld %lld %s\n", (long long)p->timestamp.sec,
+		p->timestamp.nsec, p->archsize, p->archmtime, p->context.name);
+}
+
+/*
+ * Write cursors for all tracked archives to a temporary file, then
+ * rename it into place so that a crash never leaves a partial file.
+ */
+static void
+cursors_save(pmDiscoverModule *module)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+    cursor_t		*cp;
+    FILE		*fp;
+    sds			name, tmpname, msg;
+
+    if (cursorfile == NULL)
+	return;
+
+    tmpname = sdscatfmt(sdsempty(), "%S.tmp", cursorfile);
+    if ((fp = fopen(tmpname, "w")) == NULL) {
+	infofmt(msg, "failed to save archive cursors to %s: %s\n",
+			tmpname, osstrerror());
+	moduleinfo(module, PMLOG_WARNING, msg, NULL);
+	goto done;
+    }
+    pmDiscoverTraverseArg(PM_DISCOVER_FLAGS_DATAVOL|PM_DISCOVER_FLAGS_META,
+			cursor_save_callback, fp);
+
+    /* carry over cursors for tracked archives that are yet to resume */
+    iterator = dictGetIterator(cursors);
+    while ((entry = dictNext(iterator)) != NULL) {
+	name = (sds)dictGetKey(entry);
+	cp = (cursor_t *)dictGetVal(entry);
+	if (pmDiscoverLookup(name) != NULL)
+	    fprintf(fp, "%lld %d %lld %lld %s\n", (long long)cp->stamp.sec,
+			cp->stamp.nsec, cp->size, cp->mtime, name);
+    }
+    dictReleaseIterator(iterator);
+
+    if (fclose(fp) != 0 || rename(tmpname, cursorfile) != 0) {
+	infofmt(msg, "failed to save archive cursors to %s: %s\n",
+			cursorfile, osstrerror());
+	moduleinfo(module, PMLOG_WARNING, msg, NULL);
+	unlink(tmpname);
+    } else {
+	pmDiscoverStatsAdd(module, "cursors.saved", NULL, 1);
+    }
+
+done:
+    cursorsdirty = 0;
+    cursorsaved = time(NULL);
+    sdsfree(tmpname);
+}
+
+/*
+ * Catch up an archive with a saved cursor, unless it is unchanged since
+ * that cursor was saved - then it is left unopened until it next grows.
+ */
+static void
+cursor_resume_callback(pmDiscover *p)
+{
+    dictEntry		*entry;
+    cursor_t		*cp;
+    long long		size, mtime;
+
+    if (p->ctx >= 0 || (p->flags & PM_DISCOVER_FLAGS_DELETED) ||
+	(entry = dictFind(cursors, p->context.name)) == NULL)
+	return;
+    cp = (cursor_t *)dictGetVal(entry);
+    if (archive_state(p->context.name, &size, &mtime) == 0 &&
+	size == cp->size && mtime == cp->mtime) {
+	if (pmDebugOptions.discovery)
+	    fprintf(stderr, "%s: %s unchanged since cursor saved\n",
+			"cursor_resume_callback", p->context.name);
+	pmDiscoverStatsAdd(p->module, "cursors.unchanged", NULL, 1);
+	return;
+    }
+    pmDiscoverInvokeCallBacks(p);
+}
+
+static void
+cursors_timer(void *arg)
+{
+    pmDiscoverModule	*module = (pmDiscoverModule *)arg;
+
+    /*
+     * Archives with saved cursors are caught up on the first timer
+     * tick (once setup is complete) instead of waiting for pmlogger
+     * to write to them again - which may never happen.
+     */
+    if (cursorspending) {
+	cursorspending = 0;
+	pmDiscoverTraverse(PM_DISCOVER_FLAGS_META, cursor_resume_callback);
+    }
+
+    if (cursorsdirty && time(NULL) - cursorsaved >= CURSOR_SAVE_INTERVAL)
+	cursors_save(module);
+}
+
+/*
+ * Load any cursors saved by an earlier process, and arrange for them
+ * to be saved periodically as archive logvols are processed.
+ */
+void
+pmDiscoverCursorsSetup(pmDiscoverModule *module)
+{
+    discoverModuleData	*data = getDiscoverModuleData(module);
+    cursor_t		*cp;
+    long long		sec, size, mtime;
+    char		buffer[MAXPATHLEN+64], path[MAXPATHLEN];
+    FILE		*fp;
+    sds			option, name;
+    int			nsec, sep = pmPathSeparator();
+
+    if (data == NULL || cursors != NULL)
+	return;
+    if ((option = pmIniFileLookup(data->config, "discover", "cursors")) &&
+	strcasecmp(option, "false") == 0)
+	return;
+
+    if ((option = pmIniFileLookup(data->config, "discover", "cursors.path")))
+	cursorfile = sdsdup(option);
+    else
+	cursorfile = sdscatprintf(sdsempty(), "%s%cpmproxy%cdiscover.cursors",
+			pmGetConfig("PCP_TMP_DIR"), sep, sep);
+    if (data->nshards > 1)	/* separate cursors for each partition */
+	cursorfile = sdscatfmt(cursorfile, ".%u", data->shard);
+
+    if ((cursors = dictCreate(&sdsKeyDictCallBacks, NULL)) == NULL) {
+	sdsfree(cursorfile);
+	cursorfile = NULL;
+	return;
+    }
+
+    if ((fp = fopen(cursorfile, "r")) != NULL) {
+	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+	    if (sscanf(buffer, "%lld %d %lld %lld %[^\n]",
+			&sec, &nsec, &size, &mtime, path) != 5) {
+		/* older format, no archive state - always resumed */
+		if (sscanf(buffer, "%lld %d %[^\n]", &sec, &nsec, path) != 3)
+		    continue;
+		size = mtime = -1;
+	    }
+	    if ((cp = malloc(sizeof(*cp))) == NULL)
+		break;
+	    cp->stamp.sec = sec;
+	    cp->stamp.nsec = nsec;
+	    cp->size = size;
+	    cp->mtime = mtime;
+	    name = sdsnew(path);
+	    if (dictAdd(cursors, name, cp) != DICT_OK)
+		free(cp);
+	    sdsfree(name);
+	}
+	fclose(fp);
+	cursorspending = (dictSize(cursors) > 0);
+	if (pmDebugOptions.discovery)
+	    fprintf(stderr, "%s: loaded %lu cursors from %s\n",
+		    "pmDiscoverCursorsSetup", dictSize(cursors), cursorfile);
+    }
+
+    cursortimer = pmWebTimerRegister(cursors_timer, module);
+}
+
+void
+pmDiscoverCursorsClose(pmDiscoverModule *module)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+
+    if (cursors == NULL)
+	return;
+    if (cursortimer >= 0)
+	pmWebTimerRelease(cursortimer);
+    cursortimer = -1;
+    if (cursorsdirty)
+	cursors_save(module);
+
+    iterator = dictGetIterator(cursors);
+    while ((entry = dictNext(iterator)) != NULL)
+	free(dictGetVal(entry));
+    dictReleaseIterator(iterator);
+    dictRelease(cursors);
+    cursors = NULL;
+    sdsfree(cursorfile);
+    cursorfile = NULL;
+}
+
+/*
+ * Find the position from which to start processing logvol data for a
+ * newly opened archive - after its saved cursor if one is available
+ * (and it falls within this archive), else the current end of archive.
+ */
+static void
+cursor_resume(pmDiscover *p, struct timeval *end)
+{
+    dictEntry		*entry;
+    pmLogLabel		label;
+    __pmTimestamp	*tsp;
+    cursor_t		*cp;
+    struct timeval	tv;
+
+    p->timestamp.sec = end->tv_sec;
+    p->timestamp.nsec = end->tv_usec * 1000;
+    cursorsdirty = 1;
+
+    if (cursors == NULL ||
+	(entry = dictFind(cursors, p->context.name)) == NULL)
+	return;
+    cp = (cursor_t *)dictGetVal(entry);
+    tsp = &cp->stamp;
+    tv.tv_sec = tsp->sec;
+    tv.tv_usec = tsp->nsec / 1000;
+
+    /* a cursor earlier than the archive start is from an older archive */
+    if (pmGetArchiveLabel(&label) == 0 &&
+	pmtimevalSub(&tv, &label.ll_start) >= 0 &&
+	pmtimevalSub(&tv, end) < 0) {
+	if (pmDebugOptions.discovery)
+	    fprintf(stderr, "%s: %s resuming after %lld.%09d\n", "cursor_resume",
+		    p->context.name, (long long)tsp->sec, tsp->nsec);
+	p->timestamp = *tsp;
+	tv.tv_usec++;	/* first record after the cursor */
+	if (tv.tv_usec >= 1000000) {
+	    tv.tv_sec++;
+	    tv.tv_usec -= 1000000;
+	}
+	*end = tv;
+	pmDiscoverStatsAdd(p->module, "cursors.resumed", NULL, 1);
+    }
+    free(cp);
+    dictDelete(cursors, p->context.name);
+}
+
 static void
 pmDiscoverInvokeCallBacks(pmDiscover *p)
 {
@@ -1389,19 +1940,22 @@ pmDiscoverInvokeCallBacks(pmDiscover *p)
 		return;
 	    }
 
+	    /* start after any saved cursor, else from the end of archive */
+	    cursor_resume(p, &tvp);
+
 	    /*
 	     * We have a valid pmapi context. Initialize context state
 	     * and invoke registered source callbacks.
 	     */
 	    pmDiscoverNewSource(p, p->ctx);
 
-	    /* seek to end of archive for logvol data - see also TODO in process_logvol() */
+	    /* seek to starting point for logvol data */
 	    pmSetMode(PM_MODE_FORW, &tvp, 1);
 
 	    /*
 	     * For archive meta files, p->fd is the direct file descriptor
 	     * and we pre-scan all existing metadata. Note: we do NOT scan
-	     * pre-existing logvol data (see pmSetMode above)
+	     * pre-existing logvol data before the starting point (above).
 	     */
 	    metaname = sdsnew(p->context.name);
 	    metaname = sdscat(metaname, ".meta");
@@ -1498,25 +2052,46 @@ directory_changed_cb(pmDiscover *p, void *arg)
     }
 }
 
-static void
-changed_callback(pmDiscover *p)
+/*
+ * Dynamic callback throttle - to improve scaling.  Returns non-zero
+ * if change processing for this path should be skipped for now.
+ */
+static int
+changed_throttled(pmDiscover *p)
 {
-    time_t		now;
+    time_t		now = time(NULL);
     int			throttle;
-    int			n_purged;
 
-    /* dynamic callback throttle - to improve scaling */
     if ((throttle = n_monitored / 40) < 1)
 	throttle = 1;
     pmDiscoverStatsSet(p->module, "throttle", NULL, throttle);
     if ((p->flags & PM_DISCOVER_FLAGS_NEW) == 0) {
-	if (time(&now) - p->lastcb < throttle || 
-	    pmDiscoverGetInflightRedisRequests(p->module) > 1000000) {
+	if (now - p->lastcb < throttle) {
 	    pmDiscoverStatsAdd(p->module, "throttled_changed_callbacks", NULL, 1);
-	    return; /* throttled */
+	    return 1; /* throttled */
 	}
     }
     p->lastcb = now;
+    return 0;
+}
+
+/* purge deleted entries (globally), if any */
+static void
+purge_deleted(pmDiscoverModule *module)
+{
+    int			n_purged;
+
+    n_purged = pmDiscoverPurgeDeleted();
+    pmDiscoverStatsAdd(module, "purged", NULL, n_purged);
+    n_monitored -= n_purged;
+    pmDiscoverStatsSet(module, "monitored", NULL, n_monitored);
+}
+
+static void
+changed_callback(pmDiscover *p)
+{
+    if (changed_throttled(p))
+	return;
 
     pmDiscoverStatsAdd(p->module, "changed_callbacks", NULL, 1);
     if (pmDebugOptions.discovery)
@@ -1546,6 +2121,7 @@ changed_callback(pmDiscover *p)
 	    	stamp(), p->context.name, pmDiscoverFlagsStr(p));
 	}
 
+	pmDiscoverStatsAdd(p->module, "rescans", NULL, 1);
 	pmDiscoverArchives(p->context.name, p->module, p->data);
 	pmDiscoverTraverse(PM_DISCOVER_FLAGS_NEW, created_callback);
 
@@ -1556,11 +2132,7 @@ changed_callback(pmDiscover *p)
 	pmDiscoverTraverseArg(PM_DISCOVER_FLAGS_DATAVOL|PM_DISCOVER_FLAGS_META,
 	    directory_changed_cb, (void *)p->context.name);
 
-	/* finally, purge deleted entries (globally), if any */
-	n_purged = pmDiscoverPurgeDeleted();
-	pmDiscoverStatsAdd(p->module, "purged", NULL, n_purged);
-	n_monitored -= n_purged;
-	pmDiscoverStatsSet(p->module, "monitored", NULL, n_monitored);
+	purge_deleted(p->module);
     }
 
     if (pmDebugOptions.discovery) {
@@ -1570,6 +2142,63 @@ changed_callback(pmDiscover *p)
     }
 }
 
+/*
+ * A named entry in a monitored directory changed.  Rather than rescan
+ * the directory and visit every tracked archive, examine just this one
+ * entry - so the cost of each event is independent of the number of
+ * archives being tracked.
+ */
+static void
+entry_changed_callback(pmDiscover *dir, const char *filename)
+{
+    pmDiscover		*a;
+    struct stat		sbuf;
+    char		path[MAXNAMELEN];
+    char		*suffix;
+
+    if (filename[0] == '.')
+	return;
+    pmsprintf(path, sizeof(path), "%s%c%s",
+		dir->context.name, pmPathSeparator(), filename);
+
+    pmDiscoverStatsAdd(dir->module, "changed_entries", NULL, 1);
+    if (pmDebugOptions.discovery)
+	fprintf(stderr, "%s ENTRY CHANGED %s\n", stamp(), path);
+
+    if (stat(path, &sbuf) < 0) {
+	/* removed (or compressed) - an archive or subdirectory may be gone */
+	if ((suffix = strsuffix(path, ".meta")) != NULL)
+	    *suffix = '\0';
+	if ((a = pmDiscoverLookup(path)) != NULL) {
+	    check_deleted(a);
+	    if (a->flags & PM_DISCOVER_FLAGS_DELETED)
+		purge_deleted(dir->module);
+	}
+	return;
+    }
+
+    if (S_ISDIR(sbuf.st_mode)) {
+	if ((a = pmDiscoverLookup(path)) == NULL ||
+	    (a->flags & PM_DISCOVER_FLAGS_NEW)) {
+	    /* new subdirectory - discover and monitor everything below it */
+	    pmDiscoverArchives(path, dir->module, dir->data);
+	    pmDiscoverTraverse(PM_DISCOVER_FLAGS_NEW, created_callback);
+	}
+	return;
+    }
+
+    if (!S_ISREG(sbuf.st_mode) ||
+	(a = pmDiscoverArchiveFile(path, dir->module, dir->data)) == NULL)
+	return;
+    if (a->flags & PM_DISCOVER_FLAGS_NEW)
+	created_callback(a);	/* clears PM_DISCOVER_FLAGS_NEW */
+    else if (changed_throttled(a))
+	return;
+
+    pmDiscoverStatsAdd(dir->module, "changed_callbacks", NULL, 1);
+    pmDiscoverInvokeCallBacks(a);
+}
+
 static void
 dir_callback(pmDiscover *p)
 {
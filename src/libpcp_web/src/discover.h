@@ -44,6 +44,11 @@ typedef void uv_loop_t;
  * PM_DISCOVER_FLAGS_META_IN_PROGRESS is set, set PM_DISCOVER_FLAGS_DATAVOL_READY
  * so we know to process the log volume callback once the metadata read has
  * completed.
+ *
+ * The PM_DISCOVER_FLAGS_PAUSED flag indicates logvol reads for an archive
+ * have been suspended because too many key server requests are in-flight
+ * (above the ingest high watermark).  Paused archives are resumed, most
+ * recent data first, once the backlog drains below the low watermark.
  */
 
 /*
@@ -62,6 +67,7 @@ typedef enum pmDiscoverFlags {
     PM_DISCOVER_FLAGS_META			= (1 << 7), /* archive metadata */
     PM_DISCOVER_FLAGS_DATAVOL_READY		= (1 << 8), /* flag: datavol data available */
     PM_DISCOVER_FLAGS_META_IN_PROGRESS		= (1 << 9), /* flag: metadata read in progress */
+    PM_DISCOVER_FLAGS_PAUSED			= (1 << 10), /* flag: logvol reads paused (backlog) */
 
     PM_DISCOVER_FLAGS_ALL			= ((unsigned int)~PM_DISCOVER_FLAGS_NONE)
 } pmDiscoverFlags;
@@ -78,13 +84,16 @@ typedef struct pmDiscover {
     pmDiscoverContext		context;	/* metadata for metric source */
     pmDiscoverModule		*module;	/* global state from caller */
     pmDiscoverFlags		flags;		/* state for discovery process */
-    __pmTimestamp		timestamp;	
+    __pmTimestamp		timestamp;	/* cursor - last logvol record */
+    long long			archsize;	/* archive size at the cursor */
+    long long			archmtime;	/* archive mtime at the cursor */
     int				ctx;		/* PMAPI context handle */
     int				fd;		/* meta file descriptor */
 #ifdef HAVE_LIBUV
     uv_fs_event_t		*event_handle;	/* uv fs_notify event handle */ 
 #endif
     time_t			lastcb;		/* time last callback processed */
+    double			paused;		/* time logvol reads were paused */
     struct stat			statbuf;	/* stat buffer */
     void			*baton;		/* private internal lib data */
     void			*data;		/* opaque user data pointer */
@@ -127,6 +136,11 @@ typedef struct discoverModuleData {
     struct dict			*pmids;		/* dict of excluded PMIDs */
     unsigned int		exclude_indoms;	/* exclude instance domains */
     struct dict			*indoms;	/* dict of excluded InDoms */
+    unsigned int		shard;		/* archive partition served */
+    unsigned int		nshards;	/* count of archive partitions */
+    unsigned int		ingest_high;	/* pause logvol reads at this backlog */
+    unsigned int		ingest_low;	/* resume logvol reads at this backlog */
+    unsigned int		ingest_drop;	/* drop rather than pause on backlog */
     void			*data;		/* user-supplied pointer */
 } discoverModuleData;
 
@@ -136,4 +150,8 @@ extern int pmDiscoverRegister(const char *,
 		pmDiscoverModule *, pmDiscoverCallBacks *, void *);
 extern void pmDiscoverUnregister(int);
 
+extern void pmDiscoverCursorsSetup(pmDiscoverModule *);
+extern void pmDiscoverCursorsClose(pmDiscoverModule *);
+extern void pmDiscoverIngestClose(pmDiscoverModule *);
+
 #endif /* SERIES_DISCOVER_H */
@@ -59,6 +59,7 @@ base64_decode(const char *src, size_t len)
 	*(dest++) = ((c & 0x03) << 6) | d;
     }
     *dest = '\0';
+    sdssetlen(result, dest - result);	/* less any padding */
     return result;
 }
 
@@ -69,9 +70,9 @@ base64_encode(const char *src, size_t len)
     unsigned int	i, triple;
     unsigned char	a, b, c;
 
-    if ((result = dest = sdsnewlen(SDS_NOINIT, len * 4 / 3)) == NULL)
+    if ((result = dest = sdsnewlen(SDS_NOINIT, (len + 2) / 3 * 4)) == NULL)
 	return NULL;
-    for (i = 0; i < len; dest++) {
+    for (i = 0; i < len; ) {
 	a = i < len ? src[i++] : 0;
 	b = i < len ? src[i++] : 0;
 	c = i < len ? src[i++] : 0;
@@ -81,6 +82,11 @@ base64_encode(const char *src, size_t len)
 	*(dest)++ = base64_encoding_table[(triple >> 1 * 6) & 63];
 	*(dest)++ = base64_encoding_table[(triple >> 0 * 6) & 63];
     }
+    /* pad the final quantum */
+    if (len % 3)
+	dest[-1] = '=';
+    if (len % 3 == 1)
+	dest[-2] = '=';
     *dest = '\0';
     return result;
 }
@@ -0,0 +1,886 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#include <stdint.h>
+#include "pmapi.h"
+#include "libpcp.h"
+#include "pmwebapi.h"
+#include "private.h"
+#include "util.h"
+#include "index.h"
+
+#define ARRAY_MAXSIZE	4096		/* array container limit (8KB) */
+#define BITSET_WORDS	1024		/* 65536 bits in 64-bit words */
+#define BITSET_BYTES	(BITSET_WORDS * sizeof(uint64_t))
+
+/*
+ * Bitmap container helpers
+ */
+static int
+container_find(seriesBitmap *bitmap, unsigned short key, int *found)
+{
+    int			low = 0, high = (int)bitmap->ncontainers - 1, mid;
+
+    while (low <= high) {
+	mid = (low + high) / 2;
+	if (bitmap->containers[mid].key == key) {
+	    *found = 1;
+	    return mid;
+	}
+	if (bitmap->containers[mid].key < key)
+	    low = mid + 1;
+	else
+	    high = mid - 1;
+    }
+    *found = 0;
+    return low;			/* insertion point */
+}
+
+static bitmapContainer *
+container_insert(seriesBitmap *bitmap, int index, unsigned short key)
+{
+    bitmapContainer	*containers;
+    unsigned int	size;
+
+    if (bitmap->ncontainers == bitmap->size) {
+	size = bitmap->size ? bitmap->size * 2 : 4;
+	containers = realloc(bitmap->containers, size * sizeof(bitmapContainer));
+	if (containers == NULL)
+	    return NULL;
+	bitmap->containers = containers;
+	bitmap->size = size;
+    }
+    containers = bitmap->containers;
+    memmove(&containers[index + 1], &containers[index],
+	    (bitmap->ncontainers - index) * sizeof(bitmapContainer));
+    memset(&containers[index], 0, sizeof(bitmapContainer));
+    containers[index].key = key;
+    bitmap->ncontainers++;
+    return &containers[index];
+}
+
+static int
+array_find(const uint16_t *array, unsigned int count, uint16_t value, int *found)
+{
+    int			low = 0, high = (int)count - 1, mid;
+
+    while (low <= high) {
+	mid = (low + high) / 2;
+	if (array[mid] == value) {
+	    *found = 1;
+	    return mid;
+	}
+	if (array[mid] < value)
+	    low = mid + 1;
+	else
+	    high = mid - 1;
+    }
+    *found = 0;
+    return low;
+}
+
+static int
+array_to_bitset(bitmapContainer *cp)
+{
+    uint16_t		*array = (uint16_t *)cp->data;
+    uint64_t		*bitset;
+    unsigned int	i;
+
+    if ((bitset = calloc(BITSET_WORDS, sizeof(uint64_t))) == NULL)
+	return -ENOMEM;
+    for (i = 0; i < cp->cardinality; i++)
+	bitset[array[i] >> 6] |= (1ULL << (array[i] & 63));
+    free(array);
+    cp->data = bitset;
+    cp->size = 0;
+    cp->dense = 1;
+    return 0;
+}
+
+static int
+bitset_to_array(bitmapContainer *cp)
+{
+    uint64_t		*bitset = (uint64_t *)cp->data, word;
+    uint16_t		*array;
+    unsigned int	i, count = 0;
+
+    if ((array = malloc((cp->cardinality + 1) * sizeof(uint16_t))) == NULL)
+	return -ENOMEM;
+    for (i = 0; i < BITSET_WORDS; i++) {
+	for (word = bitset[i]; word; word &= word - 1)
+	    array[count++] = (i << 6) + __builtin_ctzll(word);
+    }
+    free(bitset);
+    cp->data = array;
+    cp->size = cp->cardinality + 1;
+    cp->dense = 0;
+    return 0;
+}
+
+static int
+container_add(bitmapContainer *cp, uint16_t value)
+{
+    uint64_t		*bitset, bit;
+    uint16_t		*array;
+    unsigned int	size;
+    int			index, found;
+
+    if (cp->dense) {
+	bitset = (uint64_t *)cp->data;
+	bit = 1ULL << (value & 63);
+	if ((bitset[value >> 6] & bit) == 0) {
+	    bitset[value >> 6] |= bit;
+	    cp->cardinality++;
+	}
+	return 0;
+    }
+
+    array = (uint16_t *)cp->data;
+    index = array_find(array, cp->cardinality, value, &found);
+    if (found)
+	return 0;
+    if (cp->cardinality == ARRAY_MAXSIZE) {
+	if (array_to_bitset(cp) < 0)
+	    return -ENOMEM;
+	return container_add(cp, value);
+    }
+    if (cp->cardinality == cp->size) {
+	size = cp->size ? cp->size * 2 : 4;
+	if (size > ARRAY_MAXSIZE)
+	    size = ARRAY_MAXSIZE;
+	if ((array = realloc(array, size * sizeof(uint16_t))) == NULL)
+	    return -ENOMEM;
+	cp->data = array;
+	cp->size = size;
+    }
+    memmove(&array[index + 1], &array[index],
+	    (cp->cardinality - index) * sizeof(uint16_t));
+    array[index] = value;
+    cp->cardinality++;
+    return 0;
+}
+
+static int
+container_contains(bitmapContainer *cp, uint16_t value)
+{
+    int			found;
+
+    if (cp->dense)
+	return (((uint64_t *)cp->data)[value >> 6] >> (value & 63)) & 1;
+    array_find((uint16_t *)cp->data, cp->cardinality, value, &found);
+    return found;
+}
+
+/*
+ * Form the intersection of two containers with the same key into
+ * the (empty) result container, choosing the cheapest algorithm
+ * for each combination of sparse and dense representations.
+ */
+static int
+container_and(bitmapContainer *result, bitmapContainer *a, bitmapContainer *b)
+{
+    bitmapContainer	*sparse, *dense;
+    uint64_t		*abits, *bbits, *bitset;
+    uint16_t		*aarray, *barray, *array;
+    unsigned int	i, j, count = 0;
+
+    if (a->dense && b->dense) {
+	if ((bitset = malloc(BITSET_BYTES)) == NULL)
+	    return -ENOMEM;
+	abits = (uint64_t *)a->data;
+	bbits = (uint64_t *)b->data;
+	for (i = 0; i < BITSET_WORDS; i++) {
+	    bitset[i] = abits[i] & bbits[i];
+	    count += __builtin_popcountll(bitset[i]);
+	}
+	result->data = bitset;
+	result->dense = 1;
+	result->cardinality = count;
+	if (count <= ARRAY_MAXSIZE)
+	    return bitset_to_array(result);
+	return 0;
+    }
+
+    if (a->dense || b->dense) {
+	sparse = a->dense ? b : a;
+	dense = a->dense ? a : b;
+	if ((array = malloc((sparse->cardinality + 1) * sizeof(uint16_t))) == NULL)
+	    return -ENOMEM;
+	aarray = (uint16_t *)sparse->data;
+	for (i = 0; i < sparse->cardinality; i++)
+	    if (container_contains(dense, aarray[i]))
+		array[count++] = aarray[i];
+    } else {
+	if ((array = malloc((MIN(a->cardinality, b->cardinality) + 1) *
+				sizeof(uint16_t))) == NULL)
+	    return -ENOMEM;
+	aarray = (uint16_t *)a->data;
+	barray = (uint16_t *)b->data;
+	for (i = j = 0; i < a->cardinality && j < b->cardinality; ) {
+	    if (aarray[i] < barray[j])
+		i++;
+	    else if (aarray[i] > barray[j])
+		j++;
+	    else {
+		array[count++] = aarray[i];
+		i++, j++;
+	    }
+	}
+    }
+    result->data = array;
+    result->size = count + 1;
+    result->dense = 0;
+    result->cardinality = count;
+    return 0;
+}
+
+/*
+ * Merge the members of container b into container a (union).
+ */
+static int
+container_or(bitmapContainer *a, bitmapContainer *b)
+{
+    uint64_t		*abits, *bbits;
+    uint16_t		*aarray, *barray, *array;
+    unsigned int	i, j, count = 0;
+
+    if (b->dense && !a->dense && array_to_bitset(a) < 0)
+	return -ENOMEM;
+
+    if (a->dense) {
+	abits = (uint64_t *)a->data;
+	if (b->dense) {
+	    bbits = (uint64_t *)b->data;
+	    for (i = 0; i < BITSET_WORDS; i++) {
+		abits[i] |= bbits[i];
+		count += __builtin_popcountll(abits[i]);
+	    }
+	    a->cardinality = count;
+	} else {
+	    barray = (uint16_t *)b->data;
+	    for (i = 0; i < b->cardinality; i++)
+		container_add(a, barray[i]);
+	}
+	return 0;
+    }
+
+    /* both sparse - merge the two sorted arrays */
+    if ((array = malloc((a->cardinality + b->cardinality) *
+				sizeof(uint16_t))) == NULL)
+	return -ENOMEM;
+    aarray = (uint16_t *)a->data;
+    barray = (uint16_t *)b->data;
+    for (i = j = 0; i < a->cardinality || j < b->cardinality; ) {
+	if (j == b->cardinality || (i < a->cardinality && aarray[i] < barray[j]))
+	    array[count++] = aarray[i++];
+	else if (i == a->cardinality || aarray[i] > barray[j])
+	    array[count++] = barray[j++];
+	else {
+	    array[count++] = aarray[i];
+	    i++, j++;
+	}
+    }
+    free(a->data);
+    a->data = array;
+    a->size = a->cardinality + b->cardinality;
+    a->cardinality = count;
+    if (count > ARRAY_MAXSIZE)
+	return array_to_bitset(a);
+    return 0;
+}
+
+static int
+container_copy(bitmapContainer *dest, bitmapContainer *src)
+{
+    size_t		bytes;
+
+    *dest = *src;
+    if (src->dense)
+	bytes = BITSET_BYTES;
+    else
+	bytes = (dest->size = src->cardinality) * sizeof(uint16_t);
+    if ((dest->data = malloc(bytes ? bytes : 1)) == NULL)
+	return -ENOMEM;
+    memcpy(dest->data, src->data, bytes);
+    return 0;
+}
+
+/*
+ * Public bitmap interfaces
+ */
+seriesBitmap *
+seriesBitmapCreate(void)
+{
+    return (seriesBitmap *)calloc(1, sizeof(seriesBitmap));
+}
+
+void
+seriesBitmapFree(seriesBitmap *bitmap)
+{
+    unsigned int	i;
+
+    if (bitmap == NULL)
+	return;
+    for (i = 0; i < bitmap->ncontainers; i++)
+	free(bitmap->containers[i].data);
+    free(bitmap->containers);
+    free(bitmap);
+}
+
+int
+seriesBitmapAdd(seriesBitmap *bitmap, unsigned int value)
+{
+    bitmapContainer	*cp;
+    unsigned short	key = value >> 16;
+    int			index, found;
+
+    index = container_find(bitmap, key, &found);
+    if (found)
+	cp = &bitmap->containers[index];
+    else if ((cp = container_insert(bitmap, index, key)) == NULL)
+	return -ENOMEM;
+    return container_add(cp, value & 0xffff);
+}
+
+int
+seriesBitmapContains(seriesBitmap *bitmap, unsigned int value)
+{
+    int			index, found;
+
+    if (bitmap == NULL)
+	return 0;
+    index = container_find(bitmap, value >> 16, &found);
+    if (!found)
+	return 0;
+    return container_contains(&bitmap->containers[index], value & 0xffff);
+}
+
+unsigned int
+seriesBitmapCardinality(seriesBitmap *bitmap)
+{
+    unsigned int	i, count = 0;
+
+    if (bitmap == NULL)
+	return 0;
+    for (i = 0; i < bitmap->ncontainers; i++)
+	count += bitmap->containers[i].cardinality;
+    return count;
+}
+
+/*
+ * Returns a newly allocated bitmap holding the intersection of a and b;
+ * only containers with matching keys in both inputs need be visited.
+ */
+seriesBitmap *
+seriesBitmapAnd(seriesBitmap *a, seriesBitmap *b)
+{
+    bitmapContainer	*ac, *bc, *cp;
+    seriesBitmap	*result;
+    unsigned int	i = 0, j = 0;
+
+    if ((result = seriesBitmapCreate()) == NULL)
+	return NULL;
+
+    while (i < a->ncontainers && j < b->ncontainers) {
+	ac = &a->containers[i];
+	bc = &b->containers[j];
+	if (ac->key < bc->key) {
+	    i++;
+	} else if (ac->key > bc->key) {
+	    j++;
+	} else {
+	    if ((cp = container_insert(result, result->ncontainers, ac->key)) == NULL)
+		goto fail;
+	    if (container_and(cp, ac, bc) < 0) {
+		result->ncontainers--;
+		goto fail;
+	    }
+	    if (cp->cardinality == 0) {	/* drop empty containers */
+		free(cp->data);
+		result->ncontainers--;
+	    }
+	    i++, j++;
+	}
+    }
+    return result;
+
+fail:
+    seriesBitmapFree(result);
+    return NULL;
+}
+
+/*
+ * Merges all members of bitmap b into bitmap a (in-place union).
+ */
+int
+seriesBitmapOr(seriesBitmap *a, seriesBitmap *b)
+{
+    bitmapContainer	*cp, *bc;
+    unsigned int	j;
+    int			index, found, sts;
+
+    for (j = 0; j < b->ncontainers; j++) {
+	bc = &b->containers[j];
+	index = container_find(a, bc->key, &found);
+	if (found) {
+	    if ((sts = container_or(&a->containers[index], bc)) < 0)
+		return sts;
+	} else {
+	    if ((cp = container_insert(a, index, bc->key)) == NULL)
+		return -ENOMEM;
+	    if ((sts = container_copy(cp, bc)) < 0) {
+		memmove(cp, cp + 1,
+			(a->ncontainers - index - 1) * sizeof(bitmapContainer));
+		a->ncontainers--;
+		return sts;
+	    }
+	}
+    }
+    return 0;
+}
+
+/*
+ * Visit each member of the bitmap in ascending order, stopping early
+ * if the callback returns a non-zero value (which is then returned).
+ */
+int
+seriesBitmapIterate(seriesBitmap *bitmap, seriesBitmapCallBack callback, void *arg)
+{
+    bitmapContainer	*cp;
+    uint64_t		*bitset, word;
+    uint16_t		*array;
+    unsigned int	i, j, base;
+    int			sts;
+
+    if (bitmap == NULL)
+	return 0;
+    for (i = 0; i < bitmap->ncontainers; i++) {
+	cp = &bitmap->containers[i];
+	base = (unsigned int)cp->key << 16;
+	if (cp->dense) {
+	    bitset = (uint64_t *)cp->data;
+	    for (j = 0; j < BITSET_WORDS; j++) {
+		for (word = bitset[j]; word; word &= word - 1) {
+		    sts = callback(base + (j << 6) + __builtin_ctzll(word), arg);
+		    if (sts)
+			return sts;
+		}
+	    }
+	} else {
+	    array = (uint16_t *)cp->data;
+	    for (j = 0; j < cp->cardinality; j++)
+		if ((sts = callback(base + array[j], arg)) != 0)
+		    return sts;
+	}
+    }
+    return 0;
+}
+
+/*
+ * Series index - identifier assignment, series sets and name maps
+ *
+ * Each pcp:series:* set and pcp:map:* map key indexed has an entry,
+ * noting when it was last merged with the key server (synced) and when
+ * it was last used.  Keys unused for index.expire seconds are dropped,
+ * and identifiers no longer in any set are then reclaimed once no query
+ * holds identifiers (in its bitmaps).  A set refreshed from the key
+ * server is replaced by the members of the reply - so series no longer
+ * in the set are removed - along with any series added by this process
+ * while the refresh was outstanding.
+ */
+typedef struct seriesIndexKey {
+    seriesBitmap	*members;	/* pcp:series:* set members */
+    seriesBitmap	*added;		/* members added during refresh */
+    dict		*names;		/* pcp:map:* hash -> name */
+    unsigned int	refreshing;	/* outstanding set refreshes */
+    time_t		synced;		/* last key server merge */
+    time_t		used;
+} seriesIndexKey;
+
+static int		indexing;	/* index.enabled configuration */
+static unsigned int	refresh = 10;	/* index.refresh configuration */
+static unsigned int	expire = 86400;	/* index.expire configuration */
+static dict		*identifiers;	/* SHA1 hash -> series identifier */
+static unsigned char	*hashes;	/* series identifier -> SHA1 hash */
+static unsigned int	nhashes;
+static unsigned int	maxhashes;
+static unsigned int	*freeids;	/* reclaimed series identifiers */
+static unsigned int	nfreeids;
+static unsigned int	maxfreeids;
+static dict		*indexkeys;	/* set or map key -> seriesIndexKey */
+static unsigned int	holds;		/* queries holding identifiers */
+static int		reclaim;	/* identifiers to reclaim on release */
+static time_t		lastprune;
+
+static dict *
+seriesIdentifiers(void)
+{
+    if (identifiers == NULL)
+	identifiers = dictCreate(&sdsKeyDictCallBacks, NULL);
+    return identifiers;
+}
+
+void
+seriesIndexInit(struct dict *config)
+{
+    sds			option;
+
+    if ((option = pmIniFileLookup(config, "pmseries", "index.enabled")))
+	indexing = (strcmp(option, "true") == 0);
+    if ((option = pmIniFileLookup(config, "pmseries", "index.refresh")))
+	refresh = strtoul(option, NULL, 10);
+    if ((option = pmIniFileLookup(config, "pmseries", "index.expire")))
+	expire = strtoul(option, NULL, 10);
+
+    if (indexing && indexkeys == NULL)
+	indexkeys = dictCreate(&sdsKeyDictCallBacks, NULL);
+}
+
+int
+seriesIndexEnabled(void)
+{
+    return indexing;
+}
+
+/*
+ * Map a 20-byte SHA1 series hash to its dense series identifier,
+ * assigning the next available identifier on first sight.
+ */
+int
+seriesIndexIdentifier(const unsigned char *hash, unsigned int *id)
+{
+    unsigned char	*table;
+    dictEntry		*entry;
+    unsigned int	size, next;
+    dict		*ids;
+    sds			key;
+
+    if ((ids = seriesIdentifiers()) == NULL)
+	return -ENOMEM;
+
+    key = sdsnewlen(hash, 20);
+    if ((entry = dictFind(ids, key)) != NULL) {
+	*id = (unsigned int)dictGetUnsignedIntegerVal(entry);
+	sdsfree(key);
+	return 0;
+    }
+
+    if (nfreeids == 0 && nhashes == maxhashes) {
+	size = maxhashes ? maxhashes * 2 : 1024;
+	if ((table = realloc(hashes, (size_t)size * 20)) == NULL) {
+	    sdsfree(key);
+	    return -ENOMEM;
+	}
+	hashes = table;
+	maxhashes = size;
+    }
+    if ((entry = dictAddRaw(ids, key, NULL)) == NULL) {
+	sdsfree(key);
+	return -ENOMEM;
+    }
+    sdsfree(key);	/* dictAddRaw duplicated the key */
+    next = nfreeids ? freeids[--nfreeids] : nhashes++;
+    memcpy(hashes + (size_t)next * 20, hash, 20);
+    dictSetUnsignedIntegerVal(entry, next);
+    *id = next;
+    return 0;
+}
+
+const unsigned char *
+seriesIndexHash(unsigned int id)
+{
+    if (id >= nhashes)
+	return NULL;
+    return hashes + (size_t)id * 20;
+}
+
+static seriesIndexKey *
+seriesIndexGetKey(sds key, int create)
+{
+    seriesIndexKey	*ip;
+    dictEntry		*entry;
+
+    if ((entry = dictFind(indexkeys, key)) != NULL) {
+	ip = (seriesIndexKey *)dictGetVal(entry);
+    } else {
+	if (!create || (ip = calloc(1, sizeof(seriesIndexKey))) == NULL)
+	    return NULL;
+	dictAdd(indexkeys, key, ip);
+    }
+    ip->used = time(NULL);
+    return ip;
+}
+
+static void
+seriesIndexFreeKey(seriesIndexKey *ip)
+{
+    seriesBitmapFree(ip->members);
+    seriesBitmapFree(ip->added);
+    if (ip->names)
+	dictRelease(ip->names);
+    free(ip);
+}
+
+/*
+ * Record membership of a series in a pcp:series:* set key, mirroring
+ * the SADD sent to the key server.
+ */
+void
+seriesIndexAddSeries(sds key, const unsigned char *hash)
+{
+    seriesIndexKey	*ip;
+    unsigned int	id;
+
+    if (!indexing || seriesIndexIdentifier(hash, &id) < 0 ||
+	(ip = seriesIndexGetKey(key, 1)) == NULL)
+	return;
+
+    if (ip->members == NULL && (ip->members = seriesBitmapCreate()) == NULL)
+	return;
+    seriesBitmapAdd(ip->members, id);
+    if (ip->added)
+	seriesBitmapAdd(ip->added, id);
+}
+
+/*
+ * Record a hash to name mapping of a pcp:map:<map> key, mirroring
+ * the HSET sent to the key server.
+ */
+void
+seriesIndexAddName(const char *map, const unsigned char *hash, sds name)
+{
+    seriesIndexKey	*ip;
+    sds			key, mapkey;
+
+    if (!indexing)
+	return;
+
+    mapkey = sdscatfmt(sdsempty(), "pcp:map:%s", map);
+    ip = seriesIndexGetKey(mapkey, 1);
+    sdsfree(mapkey);
+    if (ip == NULL)
+	return;
+    if (ip->names == NULL &&
+	(ip->names = dictCreate(&sdsDictCallBacks, NULL)) == NULL)
+	return;
+
+    key = sdsnewlen(hash, 20);
+    if (dictFind(ip->names, key) == NULL)
+	dictAdd(ip->names, key, sdsdup(name));
+    sdsfree(key);
+}
+
+/*
+ * Record that the index now holds all members of a series set or name
+ * map key known to the key server, after merging in a complete reply
+ * (SMEMBERS or HSCAN) for the key.  Other processes may load series
+ * too, so keys are only answered from the index alone for index.refresh
+ * seconds after this merge - thereafter queries go to the key server
+ * again and the reply is merged in once more.
+ */
+void
+seriesIndexSynced(sds key)
+{
+    seriesIndexKey	*ip;
+
+    if (indexing && (ip = seriesIndexGetKey(key, 1)) != NULL)
+	ip->synced = time(NULL);
+}
+
+/*
+ * A series set is being requested from the key server - series added
+ * by this process until the reply arrives are kept when the reply
+ * replaces the set members.
+ */
+void
+seriesIndexRefreshStart(sds key)
+{
+    seriesIndexKey	*ip;
+
+    if (!indexing || (ip = seriesIndexGetKey(key, 1)) == NULL)
+	return;
+    if (ip->added == NULL && (ip->added = seriesBitmapCreate()) == NULL)
+	return;
+    ip->refreshing++;
+}
+
+/*
+ * Replace the members of a series set with those of a complete key
+ * server reply (a bitmap, now owned by the index), or with NULL just
+ * end the refresh after a failed request.
+ */
+void
+seriesIndexRefreshDone(sds key, seriesBitmap *members)
+{
+    seriesIndexKey	*ip;
+
+    if (!indexing || (ip = seriesIndexGetKey(key, 0)) == NULL) {
+	seriesBitmapFree(members);
+	return;
+    }
+    if (members) {
+	if (ip->added && seriesBitmapOr(members, ip->added) < 0) {
+	    seriesBitmapFree(members);
+	    members = NULL;
+	} else {
+	    seriesBitmapFree(ip->members);
+	    ip->members = members;
+	    ip->synced = time(NULL);
+	}
+    }
+    if (ip->refreshing && --ip->refreshing == 0) {
+	seriesBitmapFree(ip->added);
+	ip->added = NULL;
+    }
+}
+
+static int
+seriesIndexMark(unsigned int id, void *arg)
+{
+    seriesBitmapAdd((seriesBitmap *)arg, id);
+    return 0;
+}
+
+/*
+ * Reclaim identifiers of series in no indexed set - only done while
+ * no query holds identifiers, as they are then reassigned.
+ */
+static void
+seriesIndexReclaim(void)
+{
+    seriesBitmap	*inuse;
+    seriesIndexKey	*ip;
+    dictIterator	*iterator;
+    dictEntry		*entry;
+    unsigned int	*table, id;
+    sds			key;
+
+    reclaim = 0;
+    if ((inuse = seriesBitmapCreate()) == NULL)
+	return;
+    iterator = dictGetIterator(indexkeys);
+    while ((entry = dictNext(iterator)) != NULL) {
+	ip = (seriesIndexKey *)dictGetVal(entry);
+	if (ip->members)
+	    seriesBitmapIterate(ip->members, seriesIndexMark, inuse);
+    }
+    dictReleaseIterator(iterator);
+    for (id = 0; id < nfreeids; id++)
+	seriesBitmapAdd(inuse, freeids[id]);
+
+    for (id = 0; id < nhashes; id++) {
+	if (seriesBitmapContains(inuse, id))
+	    continue;
+	if (nfreeids == maxfreeids) {
+	    maxfreeids = maxfreeids ? maxfreeids * 2 : 1024;
+	    if ((table = realloc(freeids, maxfreeids * sizeof(*table))) == NULL) {
+		maxfreeids = nfreeids;
+		break;
+	    }
+	    freeids = table;
+	}
+	key = sdsnewlen(hashes + (size_t)id * 20, 20);
+	dictDelete(identifiers, key);
+	sdsfree(key);
+	freeids[nfreeids++] = id;
+    }
+    seriesBitmapFree(inuse);
+}
+
+/*
+ * Drop keys unused for index.expire seconds, at most once every
+ * index.refresh seconds.
+ */
+static void
+seriesIndexPrune(void)
+{
+    seriesIndexKey	*ip;
+    dictIterator	*iterator;
+    dictEntry		*entry;
+    time_t		now = time(NULL);
+    int			dropped = 0;
+
+    if (now - lastprune < refresh)
+	return;
+    lastprune = now;
+
+    iterator = dictGetSafeIterator(indexkeys);
+    while ((entry = dictNext(iterator)) != NULL) {
+	ip = (seriesIndexKey *)dictGetVal(entry);
+	if (ip->refreshing || now - ip->used < expire)
+	    continue;
+	if (pmDebugOptions.series)
+	    fprintf(stderr, "series index: expired %s\n",
+			(sds)dictGetKey(entry));
+	dictDelete(indexkeys, dictGetKey(entry));
+	seriesIndexFreeKey(ip);
+	dropped++;
+    }
+    dictReleaseIterator(iterator);
+
+    if (dropped) {
+	if (holds)
+	    reclaim = 1;
+	else
+	    seriesIndexReclaim();
+    }
+}
+
+/*
+ * Queries hold the index while they have bitmaps of identifiers.
+ */
+void
+seriesIndexHold(void)
+{
+    holds++;
+}
+
+void
+seriesIndexRelease(void)
+{
+    if (holds && --holds == 0 && reclaim)
+	seriesIndexReclaim();
+}
+
+static seriesIndexKey *
+seriesIndexCurrent(sds key)
+{
+    seriesIndexKey	*ip;
+
+    seriesIndexPrune();
+    if ((ip = seriesIndexGetKey(key, 0)) == NULL)
+	return NULL;
+    if (time(NULL) - ip->synced >= refresh)
+	return NULL;
+    return ip;
+}
+
+seriesBitmap *
+seriesIndexLookup(sds key)
+{
+    seriesIndexKey	*ip;
+
+    if (!indexing || (ip = seriesIndexCurrent(key)) == NULL)
+	return NULL;
+    return ip->members;
+}
+
+dict *
+seriesIndexNames(sds mapkey)
+{
+    seriesIndexKey	*ip;
+
+    if (!indexing || (ip = seriesIndexCurrent(mapkey)) == NULL)
+	return NULL;
+    return ip->names;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#ifndef SERIES_INDEX_H
+#define SERIES_INDEX_H
+
+#include "sds.h"
+#include "dict.h"
+
+/*
+ * Compressed bitmaps of (32-bit) series identifiers, in the style of
+ * roaring bitmaps - the high 16 bits of each identifier select a
+ * container, which holds the low 16 bits either as a sorted array
+ * (sparse) or as a fixed-size bitset (dense, over 4096 entries).
+ */
+typedef struct bitmapContainer {
+    unsigned short	key;		/* high 16 bits of all members */
+    unsigned short	dense;		/* bitset (1) or sorted array (0) */
+    unsigned int	cardinality;	/* number of members */
+    unsigned int	size;		/* allocated array entries */
+    void		*data;		/* uint16_t array or uint64_t bitset */
+} bitmapContainer;
+
+typedef struct seriesBitmap {
+    unsigned int	ncontainers;
+    unsigned int	size;		/* allocated containers */
+    bitmapContainer	*containers;	/* sorted by container key */
+} seriesBitmap;
+
+typedef int (*seriesBitmapCallBack)(unsigned int, void *);
+
+extern seriesBitmap *seriesBitmapCreate(void);
+extern void seriesBitmapFree(seriesBitmap *);
+extern int seriesBitmapAdd(seriesBitmap *, unsigned int);
+extern int seriesBitmapContains(seriesBitmap *, unsigned int);
+extern unsigned int seriesBitmapCardinality(seriesBitmap *);
+extern seriesBitmap *seriesBitmapAnd(seriesBitmap *, seriesBitmap *);
+extern int seriesBitmapOr(seriesBitmap *, seriesBitmap *);
+extern int seriesBitmapIterate(seriesBitmap *, seriesBitmapCallBack, void *);
+
+/*
+ * In-memory inverted index of the series sets and name maps written
+ * to the key server (pcp:series:* and pcp:map:* keys), maintained as
+ * series are loaded by this process and merged with key server replies
+ * for series loaded elsewhere.  Series identifiers are assigned densely
+ * on first sight of each SHA1 series hash, and reclaimed once a series
+ * is in no indexed set.
+ */
+extern void seriesIndexInit(struct dict *);
+extern int seriesIndexEnabled(void);
+extern int seriesIndexIdentifier(const unsigned char *, unsigned int *);
+extern const unsigned char *seriesIndexHash(unsigned int);
+extern void seriesIndexAddSeries(sds, const unsigned char *);
+extern void seriesIndexAddName(const char *, const unsigned char *, sds);
+extern void seriesIndexSynced(sds);
+extern void seriesIndexRefreshStart(sds);
+extern void seriesIndexRefreshDone(sds, seriesBitmap *);
+extern void seriesIndexHold(void);
+extern void seriesIndexRelease(void);
+extern seriesBitmap *seriesIndexLookup(sds);
+extern dict *seriesIndexNames(sds);
+
+#endif	/* SERIES_INDEX_H */
@@ -446,6 +446,9 @@ series_cache_update(seriesLoadBaton *baton, struct dict *exclude)
     sds			timestamp;
     int			i, write_meta, write_inst, write_data;
 
+    /* other loads may share this thread, ensure our context is current */
+    pmUseContext(cp->context);
+
     timestamp = sdsnew(timeval_stream_str(&result->timestamp, ts, sizeof(ts)));
     write_data = (!(baton->flags & PM_SERIES_FLAG_METADATA));
 
@@ -472,6 +475,8 @@ series_cache_update(seriesLoadBaton *baton, struct dict *exclude)
 	    continue;
 
 	write_meta = write_inst = 0;
+	if (vsp->numval > 0)
+	    context->values += vsp->numval;
 
 	/* check if pmid already in hash list */
 	if ((metric = dictFetchValue(cp->pmids, &vsp->pmid)) == NULL) {
@@ -501,6 +506,10 @@ series_cache_update(seriesLoadBaton *baton, struct dict *exclude)
 	server_cache_metric(baton, metric, timestamp, write_meta, write_data);
     }
 
+    /* write any search documents queued while processing this result */
+    if (baton->search)
+	redis_search_text_flush(baton->slots, baton);
+
 out:
     sdsfree(timestamp);
     /* drop reference taken in server_cache_window */
@@ -517,6 +526,7 @@ server_cache_series(seriesLoadBaton *baton)
     if (baton->pmapi.context.type != PM_CONTEXT_ARCHIVE)
 	return -ENOTSUP;
 
+    pmUseContext(baton->pmapi.context.context);
     if ((sts = pmSetMode(PM_MODE_FORW, &baton->timing.start, 0)) < 0) {
 	infofmt(msg, "pmSetMode failed: %s",
 		pmErrStr_r(sts, pmmsg, sizeof(pmmsg)));
@@ -557,26 +567,13 @@ server_cache_update_done(void *arg)
     server_cache_window(baton);
 }
 
-void
-server_cache_window(void *arg)
+static void
+server_cache_fetched(seriesLoadBaton *baton, pmResult *result, int sts)
 {
-    seriesLoadBaton	*baton = (seriesLoadBaton *)arg;
     seriesGetContext	*context = &baton->pmapi;
     struct timeval	*finish = &baton->timing.end;
-    pmResult		*result;
-    int			sts;
-
-    seriesBatonCheckMagic(baton, MAGIC_LOAD, "server_cache_window");
-    seriesBatonCheckCount(context, "server_cache_window");
-    assert(context->result == NULL);
-
-    if (pmDebugOptions.series)
-	fprintf(stderr, "server_cache_window: fetching next result\n");
-
-    seriesBatonReference(context, "server_cache_window");
-    context->done = server_cache_series_finished;
 
-    if ((sts = pmFetchArchive(&result)) >= 0) {
+    if (sts >= 0) {
 	context->result = result;
 	if (finish->tv_sec > result->timestamp.tv_sec ||
 	    (finish->tv_sec == result->timestamp.tv_sec &&
@@ -601,6 +598,84 @@ server_cache_window(void *arg)
     }
 }
 
+#ifdef HAVE_LIBUV
+/*
+ * Archive records are read and decoded in the libuv threadpool, so
+ * that concurrent loads (each with its own PMAPI context) decode in
+ * parallel while the event loop thread issues key server requests.
+ */
+typedef struct seriesFetch {
+    uv_work_t		work;
+    seriesLoadBaton	*baton;
+    pmResult		*result;
+    int			context;
+    int			sts;
+} seriesFetch;
+
+static void
+server_fetch_work(uv_work_t *work)
+{
+    seriesFetch		*fetch = (seriesFetch *)work->data;
+
+    if ((fetch->sts = pmUseContext(fetch->context)) >= 0)
+	fetch->sts = pmFetchArchive(&fetch->result);
+}
+
+static void
+server_fetch_done(uv_work_t *work, int status)
+{
+    seriesFetch		*fetch = (seriesFetch *)work->data;
+
+    if (status < 0 && fetch->sts >= 0) {	/* cancelled */
+	if (fetch->result)
+	    pmFreeResult(fetch->result);
+	fetch->result = NULL;
+	fetch->sts = PM_ERR_EOL;
+    }
+    server_cache_fetched(fetch->baton, fetch->result, fetch->sts);
+    free(fetch);
+}
+#endif
+
+void
+server_cache_window(void *arg)
+{
+    seriesLoadBaton	*baton = (seriesLoadBaton *)arg;
+    seriesGetContext	*context = &baton->pmapi;
+    pmResult		*result;
+#ifdef HAVE_LIBUV
+    seriesModuleData	*data = getSeriesModuleData(baton->module);
+    seriesFetch		*fetch;
+#endif
+    int			sts;
+
+    seriesBatonCheckMagic(baton, MAGIC_LOAD, "server_cache_window");
+    seriesBatonCheckCount(context, "server_cache_window");
+    assert(context->result == NULL);
+
+    if (pmDebugOptions.series)
+	fprintf(stderr, "server_cache_window: fetching next result\n");
+
+    seriesBatonReference(context, "server_cache_window");
+    context->done = server_cache_series_finished;
+
+#ifdef HAVE_LIBUV
+    if (data && data->events &&
+	(fetch = calloc(1, sizeof(seriesFetch))) != NULL) {
+	fetch->baton = baton;
+	fetch->context = context->context.context;
+	fetch->work.data = fetch;
+	if (uv_queue_work(data->events, &fetch->work,
+			server_fetch_work, server_fetch_done) == 0)
+	    return;
+	free(fetch);
+    }
+#endif
+    pmUseContext(context->context.context);
+    sts = pmFetchArchive(&result);
+    server_cache_fetched(baton, result, sts);
+}
+
 static void
 set_context_source(seriesLoadBaton *baton, const char *source)
 {
@@ -809,9 +884,7 @@ doneSeriesGetContext(seriesGetContext *context, const char *caller)
     seriesBatonCheckMagic(context, MAGIC_CONTEXT, "doneSeriesGetContext");
     seriesBatonCheckMagic(baton, MAGIC_LOAD, "doneSeriesGetContext");
 
-    if (seriesBatonDereference(context, caller) && context->done != NULL)
-	context->done(baton);
-
+    /* report before the done callback, which may free the baton */
     if (context->error) {
 	char		pmmsg[PM_MAXERRMSGLEN];
 	sds		msg;
@@ -827,6 +900,9 @@ doneSeriesGetContext(seriesGetContext *context, const char *caller)
 	    batoninfo(baton, PMLOG_ERROR, msg);
 	}
     }
+
+    if (seriesBatonDereference(context, caller) && context->done != NULL)
+	context->done(baton);
 }
 
 void
@@ -962,17 +1038,38 @@ initSeriesLoadBaton(seriesLoadBaton *baton, void *module, pmSeriesFlags flags,
     baton->wanted = dictCreate(&intKeyDictCallBacks, baton);
 }
 
+/* report the number of values loaded and the load rate */
+static void
+series_load_summary(seriesLoadBaton *baton)
+{
+    struct timeval	now;
+    double		elapsed;
+    sds			msg;
+
+    gettimeofday(&now, NULL);
+    elapsed = pmtimevalSub(&now, &baton->started);
+    infofmt(msg, "loaded %llu values in %llu samples from %s in %.2f sec "
+		"(%.1f values/sec)", baton->pmapi.values, baton->pmapi.count,
+		baton->pmapi.context.name.sds, elapsed,
+		elapsed > 0 ? (double)baton->pmapi.values / elapsed : 0.0);
+    batoninfo(baton, PMLOG_INFO, msg);
+}
+
 void
 freeSeriesLoadBaton(seriesLoadBaton *baton)
 {
     seriesBatonCheckMagic(baton, MAGIC_LOAD, "freeSeriesLoadBaton");
 
+    if (baton->flags & PM_SERIES_FLAG_SUMMARY)
+	series_load_summary(baton);
     if (baton->done)
 	baton->done(baton->error, baton->userdata);
 
     freeSeriesGetContext(&baton->pmapi, 0);
     dictRelease(baton->errors);
     dictRelease(baton->wanted);
+    if (baton->search)
+	dictRelease(baton->search);
     free(baton->metrics);
 
     memset(baton, 0, sizeof(*baton));
@@ -988,22 +1085,21 @@ doneSeriesLoadBaton(seriesLoadBaton *baton, const char *caller)
 context_t *
 seriesLoadBatonContext(seriesLoadBaton *baton)
 {
+    if (baton->source)	/* pushed samples, written with the source context */
+	return &baton->source->pmapi.context;
     return &baton->pmapi.context;
 }
 
-int
-series_load(pmSeriesSettings *settings,
-	node_t *root, timing_t *timing, pmSeriesFlags flags, void *arg)
+static seriesLoadBaton *
+series_load_baton(pmSeriesSettings *settings, node_t *root,
+	timing_t *timing, pmSeriesFlags flags, void *arg)
 {
     seriesLoadBaton	*baton;
     seriesModuleData	*data = getSeriesModuleData(&settings->module);
     sds			msg;
-    int			i;
 
-    if (data == NULL)
-	return -ENOMEM;
     if ((baton = (seriesLoadBaton *)calloc(1, sizeof(seriesLoadBaton))) == NULL)
-	return -ENOMEM;
+	return NULL;
     initSeriesLoadBaton(baton, &settings->module, flags | PM_SERIES_FLAG_TEXT,
 			settings->module.on_info, settings->callbacks.on_done,
 			data->slots, arg);
@@ -1018,8 +1114,15 @@ series_load(pmSeriesSettings *settings,
 	infofmt(msg, "found no context to load");
 	batoninfo(baton, PMLOG_ERROR, msg);
 	freeSeriesLoadBaton(baton);
-	return -EINVAL;
+	return NULL;
     }
+    return baton;
+}
+
+static void
+series_load_start(seriesLoadBaton *baton)
+{
+    int			i;
 
     /* ordering of async operations */
     i = 0;
@@ -1036,6 +1139,21 @@ series_load(pmSeriesSettings *settings,
     baton->phases[i++].func = series_load_finished;
     assert(i <= LOAD_PHASES);
     seriesBatonPhases(baton->current, i, baton);
+}
+
+int
+series_load(pmSeriesSettings *settings, node_t *root, timing_t *timing,
+	pmSeriesFlags flags, void *arg)
+{
+    seriesLoadBaton	*baton;
+    seriesModuleData	*data = getSeriesModuleData(&settings->module);
+
+    if (data == NULL)
+	return -ENOMEM;
+    if ((baton = series_load_baton(settings, root, timing, flags, arg)) == NULL)
+	return -EINVAL;
+    gettimeofday(&baton->started, NULL);
+    series_load_start(baton);
     return 0;
 }
 
@@ -1132,6 +1250,10 @@ pmSeriesDiscoverClosed(pmDiscoverEvent *event, void *arg)
 
     (void)arg;
 
+    /* write any search documents queued since the last values arrived */
+    if (baton->search && baton->slots && baton->slots->setup)
+	redis_search_text_flush(baton->slots, baton);
+
     /* release pmSeriesDiscoverSource reference on load and context batons */
     doneSeriesLoadBaton(baton, "pmSeriesDiscoverSource");
 }
@@ -1385,3 +1507,539 @@ pmSeriesDiscoverText(pmDiscoverEvent *event,
 			"pmSeriesDiscoverText", ident, type, arg);
     (void)event;
 }
+
+/*
+ * Pushed samples - there is no PMAPI context behind these sources, so
+ * metric descriptors, instance domains and labels are built from the
+ * pushed names and labels rather than looked up.  A source is created
+ * on its first push and kept (by name) until the module is closed, or
+ * until evicted as the least recently pushed of push.sources sources;
+ * its values are written through the same schema interfaces as archives,
+ * each push with its own load baton (sharing the source context) so that
+ * completion is reported once all of its writes have been answered.
+ */
+#define PUSH_DOMAIN	144	/* same domain as pmdaopenmetrics(1) */
+#define PUSH_ITEMS	(1 << 10)
+#define PUSH_LIMIT	(1 << 22)
+#define PUSH_SOURCES	10000
+
+typedef struct pushMetric {
+    metric_t		*metric;
+    __int64_t		stamp;		/* time of last value written (msec) */
+    unsigned int	entries;	/* extra stream entries at that time */
+    unsigned int	nstamps;
+    __int64_t		*stamps;	/* last time written, per instance */
+    struct dict		*insts;		/* instance names to instance_t */
+} pushMetric;
+
+typedef struct pushSource {
+    seriesLoadBaton	*baton;
+    seriesLoadBaton	*setup;		/* push waiting on source setup */
+    struct dict		*metrics;	/* metric names to pushMetric */
+    unsigned int	count;		/* pmIDs and indoms allocated */
+    unsigned int	requests;	/* pushes with writes in progress */
+    unsigned int	closed;		/* module closed, free when idle */
+    time_t		used;		/* time of the most recent push */
+} pushSource;
+
+typedef struct pushValue {
+    pushMetric		*metric;
+    instance_t		*instance;	/* instance or NULL (singular) */
+    __int64_t		stamp;
+    double		value;
+} pushValue;
+
+static void
+push_source_free(pushSource *source)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+    pushMetric		*metric;
+
+    iterator = dictGetIterator(source->metrics);
+    while ((entry = dictNext(iterator)) != NULL) {
+	metric = (pushMetric *)dictGetVal(entry);
+	if (metric->insts)
+	    dictRelease(metric->insts);
+	free(metric->stamps);
+	free(metric);
+    }
+    dictReleaseIterator(iterator);
+    dictRelease(source->metrics);
+
+    if (source->baton)
+	freeSeriesLoadBaton(source->baton);
+    free(source);
+}
+
+static void
+push_source_ready(void *arg)
+{
+    seriesLoadBaton	*baton = (seriesLoadBaton *)arg;
+    pushSource		*source = (pushSource *)baton->arg;
+    seriesLoadBaton	*setup = source->setup;
+
+    seriesBatonCheckMagic(baton, MAGIC_LOAD, "push_source_ready");
+    /* take a reference to keep this load baton until closed or evicted */
+    seriesBatonReference(baton, "push_source_ready");
+
+    /* diagnostics were for the push creating this source, now completed */
+    baton->userdata = NULL;
+    source->setup = NULL;
+    doneSeriesLoadBaton(setup, "push_source_ready");
+}
+
+/*
+ * Make room for a new source by dropping the least recently pushed one
+ * that has been set up and has no writes in progress.
+ */
+static int
+push_source_evict(seriesModuleData *data)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+    pushSource		*source, *oldest = NULL;
+
+    iterator = dictGetIterator(data->pushed);
+    while ((entry = dictNext(iterator)) != NULL) {
+	source = (pushSource *)dictGetVal(entry);
+	if (source->setup || source->requests)
+	    continue;
+	if (oldest == NULL || source->used < oldest->used)
+	    oldest = source;
+    }
+    dictReleaseIterator(iterator);
+
+    if (oldest == NULL)
+	return -EAGAIN;
+    if (pmDebugOptions.series)
+	fprintf(stderr, "%s: evict source %s\n", "push_source_evict",
+			oldest->baton->pmapi.context.name.sds);
+    dictDelete(data->pushed, oldest->baton->pmapi.context.name.sds);
+    push_source_free(oldest);
+    return 0;
+}
+
+static pushSource *
+push_source(pmSeriesModule *module, pmSeriesPush *push,
+		seriesLoadBaton *request, int *sts)
+{
+    seriesModuleData	*data = getSeriesModuleData(module);
+    seriesLoadBaton	*baton;
+    pushSource		*source;
+    pmLabelSet		*set = NULL;
+    context_t		*cp;
+    sds			option;
+    int			i;
+
+    if (data->pushed == NULL) {
+	data->pushed = dictCreate(&sdsKeyDictCallBacks, NULL);
+	if (data->config &&
+	    (option = pmIniFileLookup(data->config, "pmseries", "push.sources")))
+	    data->pushlimit = strtoul(option, NULL, 0);
+	else
+	    data->pushlimit = PUSH_SOURCES;
+    } else if ((source = dictFetchValue(data->pushed, push->source)) != NULL) {
+	return source;
+    }
+
+    *sts = -EINVAL;
+    if (push->labels == NULL ||
+	__pmParseLabelSet(push->labels, sdslen(push->labels),
+			PM_LABEL_CONTEXT, &set) < 0 || set->nlabels <= 0) {
+	if (set)
+	    pmFreeLabelSets(set, 1);
+	return NULL;
+    }
+    if (data->pushlimit && dictSize(data->pushed) >= data->pushlimit &&
+	(*sts = push_source_evict(data)) < 0) {
+	pmFreeLabelSets(set, 1);
+	return NULL;
+    }
+    *sts = -ENOMEM;
+    if ((source = calloc(1, sizeof(pushSource))) == NULL ||
+	(baton = calloc(1, sizeof(seriesLoadBaton))) == NULL) {
+	pmFreeLabelSets(set, 1);
+	free(source);
+	return NULL;
+    }
+    source->baton = baton;
+    source->metrics = dictCreate(&sdsKeyDictCallBacks, NULL);
+
+    initSeriesLoadBaton(baton, module, 0 /*flags*/,
+			module->on_info, NULL, data->slots, request->userdata);
+    initSeriesGetContext(&baton->pmapi, baton);
+    baton->arg = source;
+
+    cp = &baton->pmapi.context;
+    cp->context = -1;	/* no PMAPI context */
+    cp->type = PM_CONTEXT_HOST;
+    cp->name.sds = sdsdup(push->source);
+    cp->host = sdsdup(push->hostname);
+    cp->labelset = set;
+
+    pmwebapi_source_hash(cp->name.hash, set->json, set->jsonlen);
+    pmwebapi_setup_context(cp);
+    set_source_origin(cp);
+
+    dictAdd(data->pushed, push->source, source);
+
+    if (pmDebugOptions.series)
+	fprintf(stderr, "%s: new source %s\n", "push_source", cp->name.sds);
+
+    /* the creating push completes only once the source is set up */
+    source->setup = request;
+    seriesBatonReference(request, "push_source");
+
+    /* ordering of async operations, as for discovered sources */
+    i = 0;
+    baton->current = &baton->phases[i];
+    baton->phases[i++].func = series_source_mapping;
+    baton->phases[i++].func = series_cache_source;
+    /* batons finally released in pmSeriesPushClose or on eviction */
+    baton->phases[i++].func = push_source_ready;
+    assert(i <= LOAD_PHASES);
+
+    seriesBatonPhases(baton->current, i, baton);
+    return source;
+}
+
+static pushMetric *
+push_metric(pushSource *source, pmSeriesPushed *series)
+{
+    context_t		*cp = &source->baton->pmapi.context;
+    pushMetric		*metric;
+    pmDesc		desc = {0};
+    char		*name = series->name;
+    unsigned int	count;
+
+    if ((metric = dictFetchValue(source->metrics, series->name)) != NULL) {
+	/* pushed with and without instance labels - cannot be both */
+	if ((metric->insts == NULL) != (series->instance == NULL))
+	    return NULL;
+	return metric;
+    }
+    if ((count = source->count) >= PUSH_LIMIT)
+	return NULL;
+    if ((metric = calloc(1, sizeof(pushMetric))) == NULL)
+	return NULL;
+
+    desc.pmid = pmID_build(PUSH_DOMAIN, count / PUSH_ITEMS, count % PUSH_ITEMS);
+    desc.indom = series->instance ?
+		pmInDom_build(PUSH_DOMAIN, count) : PM_INDOM_NULL;
+    desc.type = PM_TYPE_DOUBLE;
+    desc.sem = series->semantics ? series->semantics : PM_SEM_INSTANT;
+
+    if ((metric->metric = pmwebapi_new_metric(cp, NULL, &desc, 1, &name)) == NULL) {
+	free(metric);
+	return NULL;
+    }
+    pmwebapi_metric_hash(metric->metric);
+    if (series->instance)
+	metric->insts = dictCreate(&sdsKeyDictCallBacks, NULL);
+    dictAdd(source->metrics, series->name, metric);
+    source->count++;
+    return metric;
+}
+
+static instance_t *
+push_instance(pushMetric *metric, pmSeriesPushed *series)
+{
+    indom_t		*indom = metric->metric->indom;
+    instance_t		*instance;
+    pmLabelSet		*set = NULL;
+
+    if ((instance = dictFetchValue(metric->insts, series->instance)) != NULL)
+	return instance;
+
+    if (series->labels && sdslen(series->labels) &&
+	__pmParseLabelSet(series->labels, sdslen(series->labels),
+			PM_LABEL_INSTANCES, &set) < 0)
+	return NULL;
+
+    instance = pmwebapi_new_instance(indom, dictSize(metric->insts),
+				sdsdup(series->instance));
+    if (instance == NULL) {
+	if (set)
+	    pmFreeLabelSets(set, 1);
+	return NULL;
+    }
+    if (set) {	/* identify by the instance labels too */
+	instance->labelset = set;
+	sdsfree(instance->labels);
+	instance->labels = NULL;
+	pmwebapi_instance_hash(indom, instance);
+    }
+    dictAdd(metric->insts, series->instance, instance);
+    return instance;
+}
+
+static int
+push_value_compare(const void *a, const void *b)
+{
+    const pushValue	*pa = (const pushValue *)a;
+    const pushValue	*pb = (const pushValue *)b;
+    unsigned int	ia, ib;
+
+    if (pa->metric != pb->metric)
+	return pa->metric->metric->desc.pmid < pb->metric->metric->desc.pmid ?
+		-1 : 1;
+    if (pa->stamp != pb->stamp)
+	return pa->stamp < pb->stamp ? -1 : 1;
+    ia = pa->instance ? pa->instance->inst : 0;
+    ib = pb->instance ? pb->instance->inst : 0;
+    return (ia > ib) - (ia < ib);
+}
+
+/* last time a value was written for an instance of a pushed metric */
+static __int64_t *
+push_instance_stamp(pushMetric *push, unsigned int inst)
+{
+    __int64_t		*stamps;
+    unsigned int	i, size;
+
+    if (inst >= push->nstamps) {
+	size = inst < 16 ? 16 : inst * 2;
+	if ((stamps = realloc(push->stamps, size * sizeof(__int64_t))) == NULL)
+	    return NULL;
+	for (i = push->nstamps; i < size; i++)
+	    stamps[i] = -1;
+	push->stamps = stamps;
+	push->nstamps = size;
+    }
+    return &push->stamps[inst];
+}
+
+/*
+ * Write one stream entry for a metric from a run of values sharing
+ * the same sample time - all instances of a metric at a given time
+ * are written together, as stream entries are keyed by time.
+ *
+ * Values older than the last stream entry for the metric cannot be
+ * added to the stream and are dropped.  Instances first pushed (in a
+ * later request) at the time of the last entry are not dropped though,
+ * as the last time written is tracked per instance - these are written
+ * in an extra entry at that millisecond, with a sub-millisecond stream
+ * sequence number, as remote-write timestamps are in milliseconds.
+ */
+#define PUSH_MAX_ENTRIES	999	/* sub-millisecond stream sequence */
+
+static int
+push_values(seriesLoadBaton *baton, pushValue *values, int count)
+{
+    pushMetric		*push = values[0].metric;
+    metric_t		*metric = push->metric;
+    value_t		*value;
+    struct timeval	tv;
+    unsigned int	inst = 0, entry = 0;
+    __int64_t		stamp = values[0].stamp, *last;
+    char		ts[64];
+    sds			timestamp;
+    int			i, n = 0;
+
+    if (stamp < push->stamp)
+	return 0;	/* older than values already written */
+    if (stamp == push->stamp) {
+	if (metric->desc.indom == PM_INDOM_NULL ||
+	    push->entries >= PUSH_MAX_ENTRIES)
+	    return 0;	/* value already written at this time */
+	entry = push->entries + 1;
+    }
+
+    metric->updated = 1;
+    metric->error = 0;
+    if (metric->desc.indom == PM_INDOM_NULL) {
+	metric->u.atom.d = values[count - 1].value;
+	n = 1;
+    } else {
+	if (metric->u.vlist)
+	    metric->u.vlist->listcount = 0;
+	for (i = 0; i < count; i++) {
+	    if (n > 0 && values[i].instance->inst == inst)
+		continue;	/* duplicate series in this push */
+	    inst = values[i].instance->inst;
+	    if ((last = push_instance_stamp(push, inst)) == NULL)
+		break;
+	    if (*last >= stamp)
+		continue;	/* instance already written at this time */
+	    if (pmwebapi_add_value(metric, inst, n) < 0)
+		break;
+	    *last = stamp;
+	    value = &metric->u.vlist->value[n++];
+	    value->atom.d = values[i].value;
+	    value->updated = 1;
+	}
+	if (n == 0)
+	    return 0;
+    }
+
+    tv.tv_sec = stamp / 1000;
+    tv.tv_usec = (stamp % 1000) * 1000 + entry;
+    timestamp = sdsnew(timeval_stream_str(&tv, ts, sizeof(ts)));
+    server_cache_metric(baton, metric, timestamp, metric->cached == 0, 1);
+    sdsfree(timestamp);
+
+    push->stamp = stamp;
+    push->entries = entry;
+    return n;
+}
+
+static void
+push_request_start(void *arg)
+{
+    seriesLoadBaton	*baton = (seriesLoadBaton *)arg;
+
+    seriesBatonCheckMagic(baton, MAGIC_LOAD, "push_request_start");
+    /* held while writes are issued, dropped by pmSeriesPushSamples */
+    seriesBatonReference(baton, "push_request_start");
+}
+
+static void
+push_request_done(void *arg)
+{
+    seriesLoadBaton	*baton = (seriesLoadBaton *)arg;
+    pushSource		*source = (pushSource *)baton->arg;
+
+    seriesBatonCheckMagic(baton, MAGIC_LOAD, "push_request_done");
+    if (source && --source->requests == 0 && source->closed)
+	push_source_free(source);
+    freeSeriesLoadBaton(baton);
+}
+
+static seriesLoadBaton *
+push_request(pmSeriesSettings *settings, void *arg)
+{
+    seriesModuleData	*data = getSeriesModuleData(&settings->module);
+    seriesLoadBaton	*baton;
+    int			i;
+
+    if ((baton = calloc(1, sizeof(seriesLoadBaton))) == NULL)
+	return NULL;
+    initSeriesLoadBaton(baton, &settings->module, 0 /*flags*/,
+			settings->module.on_info, settings->callbacks.on_done,
+			data->slots, arg);
+    initSeriesGetContext(&baton->pmapi, baton);
+    baton->pmapi.context.context = -1;	/* no PMAPI context */
+
+    /* issue writes, then completion once all have been answered */
+    i = 0;
+    baton->current = &baton->phases[i];
+    baton->phases[i++].func = push_request_start;
+    baton->phases[i++].func = push_request_done;
+    assert(i <= LOAD_PHASES);
+
+    seriesBatonPhases(baton->current, i, baton);
+    return baton;
+}
+
+/*
+ * Write a batch of pushed samples for one source into the key server,
+ * creating the source, metrics and instances as needed.  The arg is
+ * passed to the module info callback for diagnostics about this push,
+ * and to the on_done callback once all of its writes have completed
+ * (which may be before this returns) - with a negative error code if
+ * any values could not be written.  Returns the count of samples
+ * accepted - samples older than those already written for a metric
+ * instance, or conflicting with earlier metadata, are skipped - else
+ * a negative error code, in which case on_done is not called.
+ */
+int
+pmSeriesPushSamples(pmSeriesSettings *settings, pmSeriesPush *push, void *arg)
+{
+    pmSeriesModule	*module = &settings->module;
+    seriesModuleData	*data = getSeriesModuleData(module);
+    seriesLoadBaton	*request;
+    pmSeriesPushed	*series;
+    pushSource		*source;
+    pushMetric		*metric;
+    pushValue		*values = NULL;
+    instance_t		*instance;
+    unsigned int	i, j, count = 0, total = 0;
+    int			sts;
+
+    if (data == NULL)
+	return -ENOMEM;
+    if (data->slots == NULL || data->slots->setup == 0)
+	return -ENOTCONN;
+    if (push->source == NULL || push->hostname == NULL)
+	return -EINVAL;
+    if ((request = push_request(settings, arg)) == NULL)
+	return -ENOMEM;
+    if ((source = push_source(module, push, request, &sts)) == NULL)
+	goto fail;
+    request->source = source->baton;
+    request->arg = source;
+    source->requests++;
+    source->used = time(NULL);
+
+    for (i = 0; i < push->nseries; i++)
+	total += push->series[i].nsamples;
+    if (total && (values = calloc(total, sizeof(pushValue))) == NULL) {
+	sts = -ENOMEM;
+	goto fail;
+    }
+
+    for (i = 0; i < push->nseries; i++) {
+	series = &push->series[i];
+	if (series->nsamples == 0)
+	    continue;
+	if ((metric = push_metric(source, series)) == NULL)
+	    continue;
+	instance = NULL;
+	if (metric->insts && (instance = push_instance(metric, series)) == NULL)
+	    continue;
+	for (j = 0; j < series->nsamples; j++) {
+	    values[count].metric = metric;
+	    values[count].instance = instance;
+	    values[count].stamp = series->samples[j].timestamp;
+	    values[count].value = series->samples[j].value;
+	    count++;
+	}
+    }
+
+    /* group values by metric then time, one stream entry per group */
+    if (count > 1)
+	qsort(values, count, sizeof(pushValue), push_value_compare);
+
+    sts = 0;
+    for (i = 0; i < count; i = j) {
+	for (j = i + 1; j < count; j++) {
+	    if (values[j].metric != values[i].metric ||
+		values[j].stamp != values[i].stamp)
+		break;
+	}
+	sts += push_values(request, &values[i], j - i);
+    }
+    free(values);
+    doneSeriesLoadBaton(request, "pmSeriesPushSamples");
+    return sts;
+
+fail:
+    request->done = NULL;	/* failure is reported by the return code */
+    doneSeriesLoadBaton(request, "pmSeriesPushSamples");
+    return sts;
+}
+
+void
+pmSeriesPushClose(pmSeriesModule *module)
+{
+    seriesModuleData	*data = (seriesModuleData *)module->privdata;
+    dictIterator	*iterator;
+    dictEntry		*entry;
+    pushSource		*source;
+
+    if (data == NULL || data->pushed == NULL)
+	return;
+
+    iterator = dictGetIterator(data->pushed);
+    while ((entry = dictNext(iterator)) != NULL) {
+	source = (pushSource *)dictGetVal(entry);
+	if (source->requests)	/* freed once its writes are answered */
+	    source->closed = 1;
+	else
+	    push_source_free(source);
+    }
+    dictReleaseIterator(iterator);
+    dictRelease(data->pushed);
+    data->pushed = NULL;
+}
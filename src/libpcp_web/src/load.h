@@ -49,11 +49,13 @@ typedef struct context {
     uv_timer_t		timer;
     int			context;	/* PMAPI context handle */
     int			randomid;	/* random number identifier */
+    struct upstream	*upstream;	/* shared PMAPI context, if any */
     struct dict		*pmids;		/* metric pmID to metric struct */
     struct dict		*metrics;	/* metric names to metric struct */
     struct dict		*indoms;	/* indom number to indom struct */
     struct dict		*domains;	/* domain number to domain struct */
     struct dict		*clusters;	/* domain+cluster to cluster struct */
+    unsigned int	version;	/* bumped on context metadata change */
     sds			labels;		/* context labelset as string */
     pmLabelSet		*labelset;	/* labelset at context level */
     void		*privdata;
@@ -94,6 +96,7 @@ typedef struct indom {
     unsigned int	cached : 1;	/* metadata written into cache */
     unsigned int	updated : 1;	/* instance labels are updated */
     unsigned int	padding : 30;	/* zero-fill structure padding */
+    unsigned int	version;	/* bumped on instance name/label change */
     sds			helptext;	/* indom help text (optional) */
     sds			oneline;	/* indom oneline text (optional) */
     sds			labels;		/* fully merged indom labelset */
@@ -108,10 +111,35 @@ typedef struct cluster {
     pmLabelSet		*labelset;
 } cluster_t;
 
+/*
+ * Precompiled scrape exposition for one metric name (or metric name and
+ * instance pair).  The series identifier and converted labels are built
+ * by the library, header and prefix are opaque text kept on behalf of the
+ * scrape callback.  Entries are valid only while the version (combined
+ * context and indom versions) matches the version recorded at build time.
+ */
+typedef struct exposition {
+    unsigned int	version;	/* metadata version when built */
+    unsigned int	indomversion;	/* instance domain version, values */
+    sds			series;		/* series identifier string */
+    sds			labels;		/* labels in scrape callback form */
+    sds			header;		/* callback metric header text */
+    sds			prefix;		/* callback series prefix text */
+} exposition_t;
+
+typedef struct scrape {
+    unsigned int	version;	/* metadata version when built */
+    sds			sem;		/* metric semantics string */
+    sds			type;		/* metric type string */
+    sds			units;		/* metric units string */
+    exposition_t	names[0];	/* one entry per metric name */
+} scrape_t;
+
 typedef struct value {
     int			inst;		/* internal instance identifier */
     unsigned int	updated;	/* last sample modified value */
     pmAtomValue		atom;		/* most recent sampled value */
+    exposition_t	*expose;	/* per-name scrape templates */
 } value_t;
 
 typedef struct valuelist {
@@ -135,6 +163,7 @@ typedef struct metric {
     unsigned int	updated : 1;	/* last sample returned success */
     unsigned int	cached : 1;	/* metadata written into cache */
     int			error;		/* a PMAPI negative error code */
+    scrape_t		*scrape;	/* cached scrape exposition */
     union {
 	pmAtomValue	atom;		/* singleton value (PM_IN_NULL) */
 	valuelist_t	*vlist;		/* instance values and metadata */
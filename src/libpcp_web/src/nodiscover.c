@@ -28,3 +28,21 @@ pmDiscoverUnregister(int handle)
 {
     (void)handle;
 }
+
+void
+pmDiscoverCursorsSetup(pmDiscoverModule *module)
+{
+    (void)module;
+}
+
+void
+pmDiscoverCursorsClose(pmDiscoverModule *module)
+{
+    (void)module;
+}
+
+void
+pmDiscoverIngestClose(pmDiscoverModule *module)
+{
+    (void)module;
+}
@@ -23,6 +23,8 @@
 #include "schema.h"
 #include "slots.h"
 #include "maps.h"
+#include "store.h"
+#include "index.h"
 #include <math.h>
 #include <fnmatch.h>
 
@@ -48,9 +50,22 @@ typedef struct seriesGetLookup {
     seriesGetSID	series[0];
 } seriesGetLookup;
 
+typedef struct seriesGetValues {
+    series_set_t	*result;	/* series to fetch values for */
+    sds			start;
+    sds			end;
+    char		count[16];	/* X[REV]RANGE COUNT parameter */
+    unsigned int	reverse;
+    unsigned int	next;		/* next series to be requested */
+    unsigned int	inflight;	/* outstanding value requests */
+    unsigned int	paused;		/* awaiting pmSeriesResume call */
+    struct seriesQueryBaton *nextpaused;
+} seriesGetValues;
+
 typedef struct seriesGetQuery {
     node_t		root;
     timing_t		timing;
+    seriesGetValues	values;
 } seriesGetQuery;
 
 typedef struct seriesQueryBaton {
@@ -63,6 +78,7 @@ typedef struct seriesQueryBaton {
     void		*userdata;
     redisSlots          *slots;
     int			error;
+    int			indexed;	/* holds series index identifiers */
     union {
 	seriesGetLookup	lookup;
 	seriesGetQuery	query;
@@ -72,6 +88,7 @@ typedef struct seriesQueryBaton {
 static void series_pattern_match(seriesQueryBaton *, node_t *);
 static int series_union(series_set_t *, series_set_t *);
 static int series_intersect(series_set_t *, series_set_t *);
+static int node_series_index_reply(seriesQueryBaton *, node_t *, sds, int, redisReply **);
 static int series_calculate(seriesQueryBaton *, node_t *, int);
 static void series_redis_hash_expression(seriesQueryBaton *, char *, int);
 static void series_node_get_metric_name(seriesQueryBaton *, seriesGetSID *, series_sample_set_t *);
@@ -81,8 +98,12 @@ static void series_lookup_mapping(void *);
 static void series_lookup_finished(void *);
 static void series_query_mapping(void *arg);
 static void series_instances_reply_callback(redisClusterAsyncContext *, void *, void *);
+static void series_values_request(seriesQueryBaton *);
 
 sds	cursorcount;	/* number of elements in each SCAN call */
+unsigned int	valueswindow;	/* outstanding value requests per query */
+
+static seriesQueryBaton	*pausedqueries;	/* awaiting pmSeriesResume */
 
 static void
 initSeriesGetQuery(seriesQueryBaton *baton, node_t *root, timing_t *timing)
@@ -144,6 +165,8 @@ freeSeriesGetQuery(seriesQueryBaton *baton)
     if (baton->error == 0) {
     	freeSeriesQueryNode(&baton->u.query.root, 0);
     }
+    if (baton->indexed)
+	seriesIndexRelease();
     memset(baton, 0, sizeof(seriesQueryBaton));
     free(baton);
 }
@@ -685,6 +708,8 @@ node_series_reply(seriesQueryBaton *baton, node_t *np, int nelements, redisReply
     sds			msg;
     int			i, sts = 0;
 
+    if (seriesIndexEnabled())
+	return node_series_index_reply(baton, np, NULL, nelements, elements);
     if (nelements <= 0)
 	return nelements;
 
@@ -696,6 +721,7 @@ node_series_reply(seriesQueryBaton *baton, node_t *np, int nelements, redisReply
     }
     set.series = series;
     set.nseries = nelements;
+    set.bitmap = NULL;
 
     for (i = 0; i < nelements; i++) {
 	reply = elements[i];
@@ -722,12 +748,154 @@ node_series_reply(seriesQueryBaton *baton, node_t *np, int nelements, redisReply
     return series_union(&np->result, &set);
 }
 
+/*
+ * As for node_series_reply, when the in-memory index is enabled - the
+ * series identifiers form a bitmap, and the (complete) set membership
+ * from Redis replaces the index members for the key of this request.
+ */
+static int
+node_series_index_reply(seriesQueryBaton *baton, node_t *np, sds key,
+		int nelements, redisReply **elements)
+{
+    seriesBitmap	*set, *members = NULL;
+    redisReply		*reply;
+    unsigned int	id;
+    char		hashbuf[42];
+    sds			msg;
+    int			i, sts = 0;
+
+    if (key && (members = seriesBitmapCreate()) == NULL)
+	goto nomem;
+    if (nelements <= 0) {
+	if (key)
+	    seriesIndexRefreshDone(key, members);
+	return nelements;
+    }
+
+    if ((set = np->result.bitmap) == NULL &&
+	(set = np->result.bitmap = seriesBitmapCreate()) == NULL)
+	goto nomem;
+
+    for (i = 0; i < nelements; i++) {
+	reply = elements[i];
+	if (reply->type == REDIS_REPLY_STRING) {
+	    if (pmDebugOptions.series) {
+		pmwebapi_hash_str((unsigned char *)reply->str,
+				hashbuf, sizeof(hashbuf));
+		fprintf(stderr, "    %s\n", hashbuf);
+	    }
+	    if (seriesIndexIdentifier((unsigned char *)reply->str, &id) < 0 ||
+		seriesBitmapAdd(set, id) < 0 ||
+		(members && seriesBitmapAdd(members, id) < 0))
+		goto nomem;
+	} else {
+	    infofmt(msg, "expected string in %s set \"%s\" (type=%s)",
+		    node_subtype(np->left), np->left->key,
+		    redis_reply_type(reply));
+	    batoninfo(baton, PMLOG_REQUEST, msg);
+	    sts = -EPROTO;
+	}
+    }
+    if (key) {
+	if (sts < 0) {
+	    seriesBitmapFree(members);
+	    members = NULL;
+	}
+	seriesIndexRefreshDone(key, members);
+    }
+    return sts;
+
+nomem:
+    if (key)
+	seriesIndexRefreshDone(key, NULL);
+    seriesBitmapFree(members);
+    infofmt(msg, "out of memory (%s, %d series)", "series reply", nelements);
+    batoninfo(baton, PMLOG_REQUEST, msg);
+    return -ENOMEM;
+}
+
+/*
+ * Resolve the series set for a key from the in-memory index, if
+ * the index is enabled and holds this key (recently merged with the
+ * Redis set) - otherwise returns zero and the caller must go to the
+ * key server for the set members.
+ */
+static int
+node_series_index(seriesQueryBaton *baton, node_t *np, sds key)
+{
+    seriesBitmap	*set;
+    sds			msg;
+
+    if ((set = seriesIndexLookup(key)) == NULL)
+	return 0;
+
+    if (pmDebugOptions.series)
+	fprintf(stderr, "%s %s (indexed, %u series)\n",
+		node_subtype(np->left), key, seriesBitmapCardinality(set));
+
+    if ((np->result.bitmap == NULL &&
+	(np->result.bitmap = seriesBitmapCreate()) == NULL) ||
+	seriesBitmapOr(np->result.bitmap, set) < 0) {
+	infofmt(msg, "out of memory (%s, %u series)", "series index",
+		seriesBitmapCardinality(set));
+	batoninfo(baton, PMLOG_REQUEST, msg);
+	baton->error = -ENOMEM;
+    }
+    return 1;
+}
+
 static int
 series_compare(const void *a, const void *b)
 {
     return memcmp(a, b, SHA1SZ);
 }
 
+static int
+series_report_hash(unsigned int id, void *arg)
+{
+    char		hashbuf[42];
+
+    pmwebapi_hash_str(seriesIndexHash(id), hashbuf, sizeof(hashbuf));
+    fprintf(stderr, "    %s\n", hashbuf);
+    return 0;
+}
+
+/*
+ * Form resulting set via intersection of two child sets, when
+ * the sets are bitmaps of series identifiers (in-memory index).
+ * This is a walk over the containers common to both sets, and a
+ * word-wise AND (or a merge of sparse containers) within each.
+ *
+ * The result replaces the first set, and the second set is
+ * freed on completion.
+ */
+static int
+series_bitmap_intersect(series_set_t *a, series_set_t *b)
+{
+    seriesBitmap	*result = NULL;
+
+    if (pmDebugOptions.series)
+	fprintf(stderr, "Intersect sets of (%u) and (%u) series\n",
+			seriesBitmapCardinality(a->bitmap),
+			seriesBitmapCardinality(b->bitmap));
+
+    if (a->bitmap && b->bitmap &&
+	(result = seriesBitmapAnd(a->bitmap, b->bitmap)) == NULL)
+	return -ENOMEM;
+
+    if (pmDebugOptions.series && pmDebugOptions.desperate) {
+	fprintf(stderr, "Intersect result set contains %u series:\n",
+			seriesBitmapCardinality(result));
+	seriesBitmapIterate(result, series_report_hash, NULL);
+    }
+
+    seriesBitmapFree(a->bitmap);
+    seriesBitmapFree(b->bitmap);
+    a->bitmap = result;
+    b->bitmap = NULL;
+    return 0;
+}
+
 /*
  * Form resulting set via intersection of two child sets.
  * Algorithm:
@@ -746,6 +914,9 @@ series_intersect(series_set_t *a, series_set_t *b)
     unsigned char	*small, *large, *saved, *cp;
     int			nsmall, nlarge, total, i;
 
+    if (seriesIndexEnabled())
+	return series_bitmap_intersect(a, b);
+
     if (a->nseries >= b->nseries) {
 	large = a->series;	nlarge = a->nseries;
 	small = b->series;	nsmall = b->nseries;
@@ -767,7 +938,11 @@ series_intersect(series_set_t *a, series_set_t *b)
 	saved += SHA1SZ;		/* stashed, advance cp & saved pointers */
     }
 
-    if ((total = (saved - small)/SHA1SZ) < nsmall) {
+    if ((total = (saved - small)/SHA1SZ) == 0) {
+	/* no series in common (realloc to zero size frees the set) */
+	free(small);
+	small = NULL;
+    } else if (total < nsmall) {
 	/* shrink the smaller set down further */
 	if ((small = realloc(small, total * SHA1SZ)) == NULL)
 	    return -ENOMEM;
@@ -801,9 +976,42 @@ node_series_intersect(node_t *np, node_t *left, node_t *right)
 
     /* finished with child leaves now, results percolated up */
     right->result.nseries = left->result.nseries = 0;
+    right->result.bitmap = left->result.bitmap = NULL;
     return sts;
 }
 
+/*
+ * Form the resulting set from union of two child bitmap sets.
+ * The containers of the second set are merged into the first
+ * (bitmap OR), and the second set is freed.
+ */
+static int
+series_bitmap_union(series_set_t *a, series_set_t *b)
+{
+    int			sts;
+
+    if (pmDebugOptions.series)
+	fprintf(stderr, "Union of sets of (%u) and (%u) series\n",
+			seriesBitmapCardinality(a->bitmap),
+			seriesBitmapCardinality(b->bitmap));
+
+    if (a->bitmap == NULL) {
+	a->bitmap = b->bitmap;
+    } else if (b->bitmap != NULL) {
+	if ((sts = seriesBitmapOr(a->bitmap, b->bitmap)) < 0)
+	    return sts;
+	seriesBitmapFree(b->bitmap);
+    }
+    b->bitmap = NULL;
+
+    if (pmDebugOptions.series && pmDebugOptions.desperate) {
+	fprintf(stderr, "Union result set contains %u series:\n",
+			seriesBitmapCardinality(a->bitmap));
+	seriesBitmapIterate(a->bitmap, series_report_hash, NULL);
+    }
+    return 0;
+}
+
 /*
  * Form the resulting set from union of two child sets.
  * The larger set is realloc-ated to form the result, if we
@@ -823,6 +1031,9 @@ series_union(series_set_t *a, series_set_t *b)
     unsigned char	*cp, *saved, *large, *small;
     int			nlarge, nsmall, total, need, i;
 
+    if (seriesIndexEnabled())
+	return series_bitmap_union(a, b);
+
     if (a->nseries >= b->nseries) {
 	large = a->series;	nlarge = a->nseries;
 	small = b->series;	nsmall = b->nseries;
@@ -884,9 +1095,49 @@ node_series_union(node_t *np, node_t *left, node_t *right)
 
     /* finished with child leaves now, results percolated up */
     right->result.nseries = left->result.nseries = 0;
+    right->result.bitmap = left->result.bitmap = NULL;
     return sts;
 }
 
+static int
+series_result_hash(unsigned int id, void *arg)
+{
+    series_set_t	*set = (series_set_t *)arg;
+
+    memcpy(set->series + (set->nseries++ * SHA1SZ), seriesIndexHash(id), SHA1SZ);
+    return 0;
+}
+
+/*
+ * Convert the bitmaps of series identifiers resolved at each node
+ * into arrays of 20-byte series hashes, as used from here onward.
+ */
+static int
+series_prepare_result(seriesQueryBaton *baton, node_t *np)
+{
+    series_set_t	*set;
+    unsigned int	count;
+    int			sts;
+
+    if (np == NULL)
+	return 0;
+
+    set = &np->result;
+    if (set->bitmap) {
+	count = seriesBitmapCardinality(set->bitmap);
+	if (count > 0 && (set->series = calloc(count, SHA1SZ)) == NULL)
+	    return -ENOMEM;
+	set->nseries = 0;
+	seriesBitmapIterate(set->bitmap, series_result_hash, set);
+	seriesBitmapFree(set->bitmap);
+	set->bitmap = NULL;
+    }
+
+    if ((sts = series_prepare_result(baton, np->left)) < 0)
+	return sts;
+    return series_prepare_result(baton, np->right);
+}
+
 static int
 string_pattern_match(node_t *np, sds pattern, char *string, int length)
 {
@@ -910,6 +1161,37 @@ string_pattern_match(node_t *np, sds pattern, char *string, int length)
     return 0;
 }
 
+/*
+ * Add the series set key for one pattern-matched name to a node.
+ */
+static int
+node_pattern_add(seriesQueryBaton *baton, node_t *np, const char *name,
+		const unsigned char *hash)
+{
+    sds			msg, key, *matches;
+    char		buffer[42];
+    size_t		bytes;
+
+    pmwebapi_hash_str(hash, buffer, sizeof(buffer));
+    key = sdsnew("pcp:series:");
+    key = sdscatfmt(key, "%s:%s", name, buffer);
+
+    if (pmDebugOptions.series)
+	fprintf(stderr, "adding pattern-matched result key: %s\n", key);
+
+    bytes = (np->nmatches + 1) * sizeof(sds);
+    if ((matches = (sds *)realloc(np->matches, bytes)) == NULL) {
+	infofmt(msg, "out of memory (%s, %" FMT_INT64 " bytes)",
+		    "pattern reply", (__int64_t)bytes);
+	batoninfo(baton, PMLOG_REQUEST, msg);
+	sdsfree(key); /* Coverity CID328038 */
+	return -ENOMEM;
+    }
+    matches[np->nmatches++] = key;
+    np->matches = matches;
+    return 0;
+}
+
 /*
  * Add a node subtree representing glob (N_GLOB) pattern matches.
  * Each of these matches are then further evaluated (as if N_EQ).
@@ -920,9 +1202,7 @@ node_pattern_reply(seriesQueryBaton *baton, node_t *np, const char *name, int ne
 		redisReply **elements)
 {
     redisReply		*reply, *r;
-    sds			msg, key, pattern, *matches;
-    char		buffer[42];
-    size_t		bytes;
+    sds			msg, pattern, value;
     unsigned int	i;
 
     if (nelements != 2) {
@@ -985,34 +1265,27 @@ node_pattern_reply(seriesQueryBaton *baton, node_t *np, const char *name, int ne
 
     for (i = 0; i < nelements; i++) {
 	r = reply->element[i*2+1];	/* string value */
+	if (seriesIndexEnabled()) {	/* merge into the in-memory index */
+	    value = sdsnewlen(r->str, r->len);
+	    seriesIndexAddName(name,
+			(unsigned char *)reply->element[i*2]->str, value);
+	    sdsfree(value);
+	}
 	if (!string_pattern_match(np, pattern, r->str, r->len))
 	    continue;
 
 	r = reply->element[i*2];	/* SHA1 hash */
-	pmwebapi_hash_str((const unsigned char *)r->str, buffer, sizeof(buffer));
-	key = sdsnew("pcp:series:");
-	key = sdscatfmt(key, "%s:%s", name, buffer);
-
-	if (pmDebugOptions.series)
-	    fprintf(stderr, "adding pattern-matched result key: %s\n", key);
-
-	bytes = (np->nmatches + 1) * sizeof(sds);
-	if ((matches = (sds *)realloc(np->matches, bytes)) == NULL) {
-	    infofmt(msg, "out of memory (%s, %" FMT_INT64 " bytes)",
-			"pattern reply", (__int64_t)bytes);
-	    batoninfo(baton, PMLOG_REQUEST, msg);
-	    sdsfree(key); /* Coverity CID328038 */
+	if (node_pattern_add(baton, np, name, (unsigned char *)r->str) < 0)
 	    return -ENOMEM;
-	}
-	matches[np->nmatches++] = key;
-	np->matches = matches;
     }
 
 out:
     if (np->cursor > 0)	/* still more to retrieve - kick off the next batch */
 	series_pattern_match(baton, np);
-    else
+    else {
 	regfree((regex_t *)&np->regex);
+	seriesIndexSynced(np->left->key);	/* whole map now merged */
+    }
 
     return nelements;
 }
@@ -1070,6 +1343,51 @@ series_pattern_match(seriesQueryBaton *baton, node_t *np)
     sdsfree(cmd);
 }
 
+/*
+ * Glob or regex match against the names of a map held in the
+ * in-memory index, avoiding the (cursored) HSCAN of the map key.
+ * Returns zero if the index does not hold this map.
+ */
+static int
+series_pattern_index(seriesQueryBaton *baton, node_t *np)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+    const char		*name;
+    dict		*names;
+    sds			msg, pattern, value;
+    int			sts = 0;
+
+    if ((names = seriesIndexNames(np->left->key)) == NULL)
+	return 0;
+
+    pattern = np->right->value;
+    if (np->type != N_GLOB &&
+	regcomp((regex_t *)&np->regex, pattern, REG_EXTENDED|REG_NOSUB) != 0) {
+	infofmt(msg, "invalid regular expression \"%s\"", pattern);
+	batoninfo(baton, PMLOG_REQUEST, msg);
+	baton->error = -EINVAL;
+	return 1;
+    }
+
+    name = np->left->key + sizeof("pcp:map:") - 1;
+    iterator = dictGetIterator(names);
+    while ((entry = dictNext(iterator)) != NULL && sts == 0) {
+	value = sdsdup((sds)dictGetVal(entry));	/* matching may modify */
+	if (string_pattern_match(np, pattern, value, sdslen(value)))
+	    sts = node_pattern_add(baton, np, name,
+				(unsigned char *)dictGetKey(entry));
+	sdsfree(value);
+    }
+    dictReleaseIterator(iterator);
+
+    if (np->type != N_GLOB)
+	regfree((regex_t *)&np->regex);
+    if (sts < 0)
+	baton->error = sts;
+    return 1;
+}
+
 /*
  * Map human names to internal Redis identifiers.
  */
@@ -1113,7 +1431,8 @@ series_prepare_maps(seriesQueryBaton *baton, node_t *np, int level)
     case N_REQ:
     case N_RNE:
 	np->baton = baton;
-	series_pattern_match(baton, np);
+	if (!series_pattern_index(baton, np))
+	    series_pattern_match(baton, np);
 	break;
 
     default:
@@ -1176,16 +1495,69 @@ series_prepare_smembers_reply(
     series_query_end_phase(baton);
 }
 
+typedef struct seriesIndexMembers {
+    node_t		*np;
+    sds			key;
+} seriesIndexMembers;
+
+static void
+series_prepare_smembers_index_reply(
+	redisClusterAsyncContext *c, void *r, void *arg)
+{
+    seriesIndexMembers	*members = (seriesIndexMembers *)arg;
+    node_t		*np = members->np;
+    seriesQueryBaton	*baton = (seriesQueryBaton *)np->baton;
+    redisReply		*reply = r;
+    sds			msg;
+    int			sts;
+
+    seriesBatonCheckMagic(baton, MAGIC_QUERY, "series_prepare_smembers_index_reply");
+
+    if (UNLIKELY(reply == NULL || reply->type != REDIS_REPLY_ARRAY)) {
+	infofmt(msg, "expected array for %s set \"%s\" (type=%s)",
+		node_subtype(np->left), np->right->value,
+		redis_reply_type(reply));
+	batoninfo(baton, PMLOG_CORRUPT, msg);
+	baton->error = -EPROTO;
+	seriesIndexRefreshDone(members->key, NULL);
+    } else {
+	if (pmDebugOptions.series)
+	    fprintf(stderr, "%s %s\n", node_subtype(np->left), members->key);
+	sts = node_series_index_reply(baton, np, members->key,
+				reply->elements, reply->element);
+	if (sts < 0)
+	    baton->error = sts;
+    }
+    sdsfree(members->key);
+    free(members);
+
+    if (np->nmatches)
+	np->nmatches--;	/* processed one more from this batch */
+
+    series_query_end_phase(baton);
+}
+
 static void
 series_prepare_smembers(seriesQueryBaton *baton, sds kp, node_t *np)
 {
+    seriesIndexMembers	*members;
     sds                 cmd;
 
     cmd = redis_command(2);
     cmd = redis_param_str(cmd, SMEMBERS, SMEMBERS_LEN);
     cmd = redis_param_sds(cmd, kp);
-    redisSlotsRequest(baton->slots, cmd,
+    if (seriesIndexEnabled() &&
+	(members = (seriesIndexMembers *)malloc(sizeof(*members))) != NULL) {
+	/* merge Redis set members into the index for this set key */
+	members->np = np;
+	members->key = sdsdup(kp);
+	seriesIndexRefreshStart(kp);
+	redisSlotsRequest(baton->slots, cmd,
+			series_prepare_smembers_index_reply, members);
+    } else {
+	redisSlotsRequest(baton->slots, cmd,
 			series_prepare_smembers_reply, np);
+    }
     sdsfree(cmd);
 }
 
@@ -1289,6 +1661,8 @@ series_prepare_eval(seriesQueryBaton *baton, node_t *np, int level)
 	np->key = sdscatfmt(np->key, "%s:%S", name, val);
 	sdsfree(val);
 	np->baton = baton;
+	if (node_series_index(baton, np, np->key))
+	    break;
 	seriesBatonReference(baton, "series_prepare_expr[direct]");
 	series_prepare_smembers(baton, np->key, np);
 	break;
@@ -1297,10 +1671,12 @@ series_prepare_eval(seriesQueryBaton *baton, node_t *np, int level)
     case N_REQ:
     case N_RNE:
 	np->baton = baton;
-	if (np->nmatches > 0)
-	    seriesBatonReferences(baton, np->nmatches, "series_prepare_eval[pattern]");
-	for (i = 0; i < np->nmatches; i++)
+	for (i = 0; i < np->nmatches; i++) {
+	    if (node_series_index(baton, np, np->matches[i]))
+		continue;
+	    seriesBatonReference(baton, "series_prepare_eval[pattern]");
 	    series_prepare_smembers(baton, np->matches[i], np);
+	}
 	break;
 
     default:
@@ -1561,6 +1937,8 @@ series_prepare_time_reply(
 	}
     }
     freeSeriesGetSID(sid);
+    baton->u.query.values.inflight--;
+    series_values_request(baton);
     series_query_end_phase(baton);
 }
 
@@ -1574,51 +1952,72 @@ series_value_count_only(timing_t *tp)
 }
 
 static void
-series_prepare_time(seriesQueryBaton *baton, series_set_t *result)
+series_values_pause(seriesQueryBaton *baton)
 {
-    timing_t		*tp = &baton->u.query.timing;
-    unsigned char	*series = result->series;
-    seriesGetSID	*sid;
-    char		buffer[64], revbuf[64];
-    sds			start, end, key, cmd;
-    unsigned int	i, revlen = 0, reverse = 0;
+    seriesGetValues	*values = &baton->u.query.values;
 
-    /* if only 'count' is requested, work back from most recent value */
-    if ((reverse = series_value_count_only(tp)) != 0) {
-	revlen = pmsprintf(revbuf, sizeof(revbuf), "%u", reverse);
-	start = sdsnew("+");
-    } else {
-	start = sdsnew(timeval_stream_str(&tp->start, buffer, sizeof(buffer)));
-    }
+    /* hold a reference until the caller is ready for more values */
+    seriesBatonReference(baton, "series_values_pause");
+    values->paused = 1;
+    values->nextpaused = pausedqueries;
+    pausedqueries = baton;
 
-    if (pmDebugOptions.series)
-	fprintf(stderr, "START: %s\n", start);
+    if (baton->callbacks->on_paused)
+	baton->callbacks->on_paused(baton->userdata);
+}
 
-    if (reverse)
-	end = sdsnew("-");
-    else if (tp->end.tv_sec)
-	end = sdsnew(timeval_stream_str(&tp->end, buffer, sizeof(buffer)));
-    else
-	end = sdsnew("+");	/* "+" means "no end" - to the most recent */
+/*
+ * Issue time series range requests for the next series in the result
+ * set, keeping at most valueswindow requests outstanding at any time.
+ * No further requests are made while the caller reports a backlog of
+ * unsent values - once nothing is outstanding at that point the query
+ * is paused until the caller drains its backlog and resumes it.  If
+ * the caller has gone away (a negative backlog) no further requests
+ * are made, and the query completes once those outstanding do.
+ */
+static void
+series_values_request(seriesQueryBaton *baton)
+{
+    seriesGetValues	*values = &baton->u.query.values;
+    series_set_t	*result = values->result;
+    pmSeriesBacklogCallBack on_backlog = baton->callbacks->on_backlog;
+    unsigned char	*series;
+    seriesGetSID	*sid;
+    char		buffer[64];
+    sds			key, cmd;
+    int			backlog;
 
-    if (pmDebugOptions.series)
-	fprintf(stderr, "END: %s\n", end);
+    while (values->next < result->nseries && baton->error == 0) {
+	if (values->inflight >= valueswindow)
+	    return;
+	if (on_backlog && (backlog = on_backlog(baton->userdata)) != 0) {
+	    if (backlog < 0) {
+		values->next = result->nseries;
+		break;
+	    }
+	    if (values->inflight == 0)
+		series_values_pause(baton);
+	    return;
+	}
 
-    /*
-     * Query cache for the time series range (groups of instance:value
-     * pairs, with an associated timestamp).
-     */
-    for (i = 0; i < result->nseries; i++, series += SHA1SZ) {
+	series = result->series + (values->next++ * SHA1SZ);
 	sid = calloc(1, sizeof(seriesGetSID));
 	pmwebapi_hash_str(series, buffer, sizeof(buffer));
 
 	initSeriesGetSID(sid, buffer, 1, baton);
-	seriesBatonReference(baton, "series_prepare_time");
+	seriesBatonReference(baton, "series_values_request");
+	values->inflight++;
+
+	if (seriesStoreEnabled()) {
+	    seriesStoreRange(baton->slots->events, sid->name, values->start,
+			values->end, values->reverse, series_prepare_time_reply, sid);
+	    continue;
+	}
 
 	key = sdscatfmt(sdsempty(), "pcp:values:series:%S", sid->name);
 
 	/* X[REV]RANGE key t1 t2 [count N] */
-	if (reverse) {
+	if (values->reverse) {
 	    cmd = redis_command(6);
 	    cmd = redis_param_str(cmd, XREVRANGE, XREVRANGE_LEN);
 	} else {
@@ -1626,19 +2025,81 @@ series_prepare_time(seriesQueryBaton *baton, series_set_t *result)
 	    cmd = redis_param_str(cmd, XRANGE, XRANGE_LEN);
 	}
 	cmd = redis_param_sds(cmd, key);
-	cmd = redis_param_sds(cmd, start);
-	cmd = redis_param_sds(cmd, end);
-	if (reverse) {
+	cmd = redis_param_sds(cmd, values->start);
+	cmd = redis_param_sds(cmd, values->end);
+	if (values->reverse) {
 	    cmd = redis_param_str(cmd, "COUNT", sizeof("COUNT")-1);
-	    cmd = redis_param_str(cmd, revbuf, revlen);
+	    cmd = redis_param_str(cmd, values->count, strlen(values->count));
 	}
 	sdsfree(key);
 	redisSlotsRequest(baton->slots, cmd,
 				series_prepare_time_reply, sid);
 	sdsfree(cmd);
     }
-    sdsfree(start);
-    sdsfree(end);
+
+    /* all requests issued (or failed), release the time window strings */
+    sdsfree(values->start);
+    values->start = NULL;
+    sdsfree(values->end);
+    values->end = NULL;
+}
+
+void
+pmSeriesResume(void *arg)
+{
+    seriesQueryBaton	*baton, *next, **prev = &pausedqueries;
+
+    for (baton = pausedqueries; baton != NULL; baton = next) {
+	next = baton->u.query.values.nextpaused;
+	if (baton->userdata != arg) {
+	    prev = &baton->u.query.values.nextpaused;
+	    continue;
+	}
+	*prev = next;
+	baton->u.query.values.nextpaused = NULL;
+	baton->u.query.values.paused = 0;
+
+	seriesBatonCheckMagic(baton, MAGIC_QUERY, "pmSeriesResume");
+	series_values_request(baton);
+	series_query_end_phase(baton);	/* drop series_values_pause ref */
+    }
+}
+
+static void
+series_prepare_time(seriesQueryBaton *baton, series_set_t *result)
+{
+    seriesGetValues	*values = &baton->u.query.values;
+    timing_t		*tp = &baton->u.query.timing;
+    char		buffer[64];
+
+    /* if only 'count' is requested, work back from most recent value */
+    if ((values->reverse = series_value_count_only(tp)) != 0) {
+	pmsprintf(values->count, sizeof(values->count), "%u", values->reverse);
+	values->start = sdsnew("+");
+    } else {
+	values->start = sdsnew(timeval_stream_str(&tp->start, buffer, sizeof(buffer)));
+    }
+
+    if (pmDebugOptions.series)
+	fprintf(stderr, "START: %s\n", values->start);
+
+    if (values->reverse)
+	values->end = sdsnew("-");
+    else if (tp->end.tv_sec)
+	values->end = sdsnew(timeval_stream_str(&tp->end, buffer, sizeof(buffer)));
+    else
+	values->end = sdsnew("+");	/* "+" means "no end" - to the most recent */
+
+    if (pmDebugOptions.series)
+	fprintf(stderr, "END: %s\n", values->end);
+
+    /*
+     * Query cache for the time series range (groups of instance:value
+     * pairs, with an associated timestamp), a window at a time.
+     */
+    values->result = result;
+    values->next = values->inflight = 0;
+    series_values_request(baton);
 }
 
 static void
@@ -1758,12 +2219,15 @@ static void
 series_query_expr(void *arg)
 {
     seriesQueryBaton	*baton = (seriesQueryBaton *)arg;
+    int			sts;
 
     seriesBatonCheckMagic(baton, MAGIC_QUERY, "series_query_expr");
     seriesBatonCheckCount(baton, "series_query_expr");
 
     seriesBatonReference(baton, "series_query_expr");
-    series_prepare_expr(baton, &baton->u.query.root, 0);
+    if ((sts = series_prepare_expr(baton, &baton->u.query.root, 0)) < 0 ||
+	(sts = series_prepare_result(baton, &baton->u.query.root)) < 0)
+	baton->error = sts;
     series_query_end_phase(baton);
 }
 
@@ -2234,6 +2698,14 @@ series_node_prepare_time(seriesQueryBaton *baton, series_set_t *query_series_set
 	initSeriesGetSID(sid, buffer, 1, baton);
 	seriesBatonReference(baton, "series_prepare_time");
 
+	np->value_set.series_values[i].baton = baton;
+	np->value_set.series_values[i].sid = sid;
+	if (seriesStoreEnabled()) {
+	    seriesStoreRange(baton->slots->events, sid->name, start, end, reverse,
+			series_node_prepare_time_reply, np);
+	    continue;
+	}
+
 	key = sdscatfmt(sdsempty(), "pcp:values:series:%S", sid->name);
 
 	/* X[REV]RANGE key t1 t2 [count N] */
@@ -2252,8 +2724,6 @@ series_node_prepare_time(seriesQueryBaton *baton, series_set_t *query_series_set
 	    cmd = redis_param_str(cmd, revbuf, revlen);
 	}
 	sdsfree(key);
-	np->value_set.series_values[i].baton = baton;
-	np->value_set.series_values[i].sid = sid;
 	/* Note: np->series_set.num_series is not equal to nseries in this function */
 	redisSlotsRequest(baton->slots, cmd,
 				series_node_prepare_time_reply, np);
@@ -4280,6 +4750,10 @@ series_solve(pmSeriesSettings *settings,
 	return -ENOMEM;
     initSeriesQueryBaton(baton, settings, arg);
     initSeriesGetQuery(baton, root, timing);
+    if (seriesIndexEnabled()) {
+	baton->indexed = 1;
+	seriesIndexHold();
+    }
 
     baton->current = &baton->phases[0];
     baton->phases[i++].func = series_query_services;
@@ -104,6 +104,7 @@ typedef struct meta {
 typedef struct series_set {
     unsigned char	*series;
     int			nseries;
+    struct seriesBitmap	*bitmap;	/* identifiers, while resolving */
 } series_set_t;
 
 typedef struct series_instance_set {
@@ -16,6 +16,8 @@
 #include "pmda.h"
 #include "search.h"
 #include "schema.h"
+#include "index.h"
+#include "store.h"
 #include "discover.h"
 #include "util.h"
 #include "sha1.h"
@@ -26,6 +28,7 @@
 #define SERVER_VERSION	5
 
 extern sds		cursorcount;
+extern unsigned int	valueswindow;
 static sds		maxstreamlen;
 static sds		streamexpire;
 
@@ -213,6 +216,7 @@ redisGetMap(redisSlots *slots, redisMap *mapping, unsigned char *hash, sds mapSt
 
     pmwebapi_string_hash(hash, mapStr, sdslen(mapStr));
     mapKey = sdsnewlen(hash, 20);
+    seriesIndexAddName(redisMapName(mapping), hash, mapStr);
 
     if ((entry = redisMapLookup(mapping, mapKey)) != NULL) {
 	sdsfree(mapKey);
@@ -395,9 +399,11 @@ redis_series_instance(redisSlots *slots, metric_t *metric, instance_t *instance,
     cmd = redis_command(2 + metric->numnames);
     cmd = redis_param_str(cmd, SADD, SADD_LEN);
     cmd = redis_param_sds(cmd, key);
-    sdsfree(key);
-    for (i = 0; i < metric->numnames; i++)
+    for (i = 0; i < metric->numnames; i++) {
 	cmd = redis_param_sha(cmd, metric->names[i].hash);
+	seriesIndexAddSeries(key, metric->names[i].hash);
+    }
+    sdsfree(key);
     redisSlotsRequest(slots, cmd, redis_series_inst_name_callback, arg);
     sdsfree(cmd);
 
@@ -641,9 +647,11 @@ redis_series_label(redisSlots *slots, metric_t *metric, char *hash,
     cmd = redis_command(2 + metric->numnames);
     cmd = redis_param_str(cmd, SADD, SADD_LEN);
     cmd = redis_param_sds(cmd, key);
-    sdsfree(key);
-    for (i = 0; i < metric->numnames; i++)
+    for (i = 0; i < metric->numnames; i++) {
 	cmd = redis_param_sha(cmd, metric->names[i].hash);
+	seriesIndexAddSeries(key, metric->names[i].hash);
+    }
+    sdsfree(key);
     redisSlotsRequest(slots, cmd,
 			redis_series_label_set_callback, arg);
     sdsfree(cmd);
@@ -774,7 +782,7 @@ redis_series_metric(redisSlots *slots, metric_t *metric,
 
     /* push the metric, instances and any label metadata into the cache */
     if (meta || data)
-	redis_series_metadata(&baton->pmapi.context, metric, baton);
+	redis_series_metadata(seriesLoadBatonContext(baton), metric, baton);
 
     /* push values for all instances, no-value or errors into the cache */
     if (data)
@@ -862,6 +870,7 @@ redis_series_metadata(context_t *context, metric_t *metric, void *arg)
 	cmd = redis_param_str(cmd, SADD, SADD_LEN);
 	cmd = redis_param_sds(cmd, key);
 	cmd = redis_param_sha(cmd, metric->names[i].hash);
+	seriesIndexAddSeries(key, metric->names[i].hash);
 	sdsfree(key);
 	redisSlotsRequest(slots, cmd,
 			redis_series_metric_name_callback, arg);
@@ -911,9 +920,11 @@ redis_series_metadata(context_t *context, metric_t *metric, void *arg)
     cmd = redis_command(2 + metric->numnames);
     cmd = redis_param_str(cmd, SADD, SADD_LEN);
     cmd = redis_param_sds(cmd, key);
-    sdsfree(key);
-    for (i = 0; i < metric->numnames; i++)
+    for (i = 0; i < metric->numnames; i++) {
 	cmd = redis_param_sha(cmd, metric->names[i].hash);
+	seriesIndexAddSeries(key, metric->names[i].hash);
+    }
+    sdsfree(key);
     redisSlotsRequest(slots, cmd, redis_series_source_callback, arg);
     sdsfree(cmd);
 
@@ -1065,10 +1076,14 @@ redis_series_stream_callback(
 	    batoninfo(baton, PMLOG_DEBUG, msg);
 	}
     }
-    else {
-        checkStreamReplyString(baton->info, baton->userdata, c, reply,
+    else if (checkStreamReplyString(baton->info, baton->userdata, c, reply,
 		baton->stamp, "stream %s status mismatch at time %s",
-		baton->hash, baton->stamp);
+		baton->hash, baton->stamp) < 0) {
+	seriesLoadBaton	*load = (seriesLoadBaton *)baton->arg;
+
+	/* pushed samples report failed writes on completion */
+	if (load->source && load->error == 0)
+	    load->error = reply ? -EIO : -ENOTCONN;
     }
 
     doneRedisStreamBaton(baton);
@@ -1092,18 +1107,10 @@ redis_series_stream(redisSlots *slots, sds stamp, metric_t *metric,
     redisStreamBaton		*baton;
     unsigned int		count;
     int				i, sts, type;
-    sds				cmd, key, name, stream = sdsempty();
-
-    if ((baton = malloc(sizeof(redisStreamBaton))) == NULL) {
-	stream = sdscatfmt(stream, "OOM creating stream baton");
-	batoninfo(load, PMLOG_ERROR, stream);
-	return;
-    }
-    initRedisStreamBaton(baton, slots, stamp, hash, load);
-    seriesBatonReferences(load, 2, "redis_series_stream");
+    char			errmsg[PM_MAXERRMSGLEN];
+    sds				cmd, key, msg, name, stream = sdsempty();
 
     count = 6;	/* XADD key MAXLEN ~ len stamp */
-    key = sdscatfmt(sdsempty(), "pcp:values:series:%s", hash);
 
     if ((sts = metric->error) < 0) {
 	sds minus1 = sdsnewlen("-1", 2);
@@ -1137,6 +1144,32 @@ redis_series_stream(redisSlots *slots, sds stamp, metric_t *metric,
 	sdsfree(name);
     }
 
+    if (seriesStoreEnabled()) {
+	if ((sts = seriesStoreAppend(hash, stamp, stream)) == -EEXIST) {
+	    if (UNLIKELY(pmDebugOptions.desperate)) {
+		infofmt(msg, "duplicate or early stream %s insert at time %s",
+			hash, stamp);
+		batoninfo(load, PMLOG_DEBUG, msg);
+	    }
+	} else if (sts < 0) {
+	    infofmt(msg, "stream %s insert at time %s failed: %s",
+			hash, stamp, pmErrStr_r(sts, errmsg, sizeof(errmsg)));
+	    batoninfo(load, PMLOG_ERROR, msg);
+	}
+	sdsfree(stream);
+	return;
+    }
+
+    if ((baton = malloc(sizeof(redisStreamBaton))) == NULL) {
+	infofmt(msg, "OOM creating stream baton");
+	batoninfo(load, PMLOG_ERROR, msg);
+	sdsfree(stream);
+	return;
+    }
+    initRedisStreamBaton(baton, slots, stamp, hash, load);
+    seriesBatonReferences(load, 2, "redis_series_stream");
+
+    key = sdscatfmt(sdsempty(), "pcp:values:series:%s", hash);
     cmd = redis_command(count);
     cmd = redis_param_str(cmd, XADD, XADD_LEN);
     cmd = redis_param_sds(cmd, key);
@@ -1568,6 +1601,13 @@ redisSeriesInit(struct dict *config)
 	    cursorcount = sdsnew("256");
     }
 
+    if (!valueswindow) {
+	if ((option = pmIniFileLookup(config, "pmseries", "values.window")))
+	    valueswindow = strtoul(option, NULL, 10);
+	if (valueswindow == 0)
+	    valueswindow = 256;
+    }
+
     if (!maxstreamlen) {
 	if ((option = pmIniFileLookup(config, "pmseries", "stream.maxlen")))
 	    maxstreamlen = option;
@@ -1581,6 +1621,8 @@ redisSeriesInit(struct dict *config)
 	else
 	    streamexpire = sdsnew("86400");	/* 1 day (without changes) */
     }
+
+    seriesStoreInit(config);
 }
 
 void
@@ -1588,6 +1630,7 @@ redisGlobalsInit(struct dict *config)
 {
     redisSeriesInit(config);
     redisSearchInit(config);
+    seriesIndexInit(config);
     redisScriptsInit();
     redisMapsInit();
 }
@@ -1713,6 +1756,8 @@ pmSeriesClose(pmSeriesModule *module)
     seriesModuleData	*data = (seriesModuleData *)module->privdata;
 
     if (data) {
+	pmSeriesPushClose(module);
+	seriesStoreClose();
 	if (!data->shareslots)
 	    redisSlotsFree(data->slots);
 	memset(data, 0, sizeof(seriesModuleData));
@@ -1761,6 +1806,20 @@ pmDiscoverSetConfiguration(pmDiscoverModule *module, dict *config)
     return -ENOMEM;
 }
 
+int
+pmDiscoverSetShard(pmDiscoverModule *module, unsigned int shard,
+		unsigned int nshards)
+{
+    discoverModuleData	*data = getDiscoverModuleData(module);
+
+    if (data) {
+	data->shard = shard;
+	data->nshards = nshards;
+	return 0;
+    }
+    return -ENOMEM;
+}
+
 int
 pmDiscoverSetEventLoop(pmDiscoverModule *module, void *events)
 {
@@ -1780,6 +1839,7 @@ pmDiscoverSetupMetrics(pmDiscoverModule *module)
     pmUnits		nounits = MMV_UNITS(0,0,0,0,0,0);
     pmUnits		countunits = MMV_UNITS(0,0,1,0,0,0);
     pmUnits		secondsunits = MMV_UNITS(0,1,0,0,PM_TIME_SEC,0);
+    pmUnits		msecunits = MMV_UNITS(0,1,0,0,PM_TIME_MSEC,0);
     pmInDom		noindom = MMV_INDOM_NULL;
 
     if (data == NULL || data->metrics == NULL)
@@ -1890,6 +1950,65 @@ pmDiscoverSetupMetrics(pmDiscoverModule *module)
 	"metadata read returned less data than header indicated",
 	"number of times a metadata record read returned less than expected length");
 
+    mmv_stats_add_metric(data->metrics, "changed_entries", 21,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, noindom,
+	"filesystem changes to individual directory entries",
+	"number of filesystem change events naming a single directory entry,\n"
+	"each of which is processed without rescanning the directory");
+
+    mmv_stats_add_metric(data->metrics, "rescans", 22,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, noindom,
+	"full rescans of monitored directories",
+	"number of filesystem change events requiring a full directory rescan");
+
+    mmv_stats_add_metric(data->metrics, "cursors.saved", 23,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, noindom,
+	"times the archive cursors file has been written",
+	"number of times per-archive logvol cursors have been saved to disk");
+
+    mmv_stats_add_metric(data->metrics, "cursors.resumed", 24,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, noindom,
+	"archives resumed from a saved cursor",
+	"number of archives whose logvol processing resumed from a cursor\n"
+	"saved by an earlier process, rather than from the end of archive");
+
+    mmv_stats_add_metric(data->metrics, "ingest.depth", 25,
+	MMV_TYPE_U64, MMV_SEM_INSTANT, countunits, noindom,
+	"key server requests in-flight when last checked during ingest",
+	"number of key server requests awaiting a response, as observed\n"
+	"most recently when reading archive logvol data.  Logvol reads are\n"
+	"paused above the [discover] ingest.high watermark.");
+
+    mmv_stats_add_metric(data->metrics, "ingest.paused", 26,
+	MMV_TYPE_U64, MMV_SEM_INSTANT, nounits, noindom,
+	"archives with logvol reads currently paused",
+	"number of archives whose logvol reads are paused awaiting the\n"
+	"key server request backlog to drain below ingest.low");
+
+    mmv_stats_add_metric(data->metrics, "ingest.stalls", 27,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, noindom,
+	"times archive logvol reads were paused",
+	"number of times logvol reads for an archive have been paused\n"
+	"due to the key server request backlog");
+
+    mmv_stats_add_metric(data->metrics, "ingest.stall_time", 28,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, msecunits, noindom,
+	"time archive logvol reads spent paused",
+	"cumulative time logvol reads for all archives spent paused due\n"
+	"to the key server request backlog");
+
+    mmv_stats_add_metric(data->metrics, "ingest.drops", 29,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, noindom,
+	"times unread archive logvol data was dropped",
+	"number of times unread logvol data for an archive was skipped\n"
+	"due to the key server request backlog (ingest.policy = drop)");
+
+    mmv_stats_add_metric(data->metrics, "cursors.unchanged", 30,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, noindom,
+	"archives with a saved cursor left unopened as unchanged",
+	"number of archives with a cursor saved by an earlier process whose\n"
+	"size and modification time are unchanged since, so were not opened");
+
     data->metrics_handle = mmv_stats_start(data->metrics);
 }
 
@@ -1956,6 +2075,18 @@ pmDiscoverSetup(pmDiscoverModule *module, pmDiscoverCallBacks *cbs, void *arg)
 	}
     }
 
+    /* bounds on the key server request backlog from logvol values */
+    data->ingest_high = 1000000;
+    if ((option = pmIniFileLookup(config, "discover", "ingest.high")))
+	data->ingest_high = strtoul(option, NULL, 10);
+    data->ingest_low = data->ingest_high / 2;
+    if ((option = pmIniFileLookup(config, "discover", "ingest.low")))
+	data->ingest_low = strtoul(option, NULL, 10);
+    if (data->ingest_low > data->ingest_high)
+	data->ingest_low = data->ingest_high;
+    if ((option = pmIniFileLookup(config, "discover", "ingest.policy")))
+	data->ingest_drop = (strcasecmp(option, "drop") == 0);
+
     /* create global EVAL hashes and string map caches */
     redisSearchInit(data->config);
     redisSeriesInit(data->config);
@@ -1968,6 +2099,7 @@ pmDiscoverSetup(pmDiscoverModule *module, pmDiscoverCallBacks *cbs, void *arg)
     pmDiscoverSetupMetrics(module);
 
     if (access(logdir, F_OK) == 0) {
+	pmDiscoverCursorsSetup(module);
 	sts = pmDiscoverRegister(logdir, module, cbs, arg);
 	if (sts >= 0) {
 	    data->handle = sts;
@@ -1984,6 +2116,8 @@ pmDiscoverClose(pmDiscoverModule *module)
     unsigned int	i;
 
     if (discover) {
+	pmDiscoverCursorsClose(module);
+	pmDiscoverIngestClose(module);
 	pmDiscoverUnregister(discover->handle);
 	if (!discover->shareslots)
 	    redisSlotsFree(discover->slots);
@@ -125,6 +125,7 @@ typedef struct seriesGetContext {
 
     context_t		context;
     unsigned long long	count;		/* number of samples processed */
+    unsigned long long	values;		/* number of values processed */
     pmResult		*result;	/* currently active sample data */
     int			error;		/* PMAPI error code from fetch */
 
@@ -152,6 +153,9 @@ typedef struct seriesLoadBaton {
     const char		**metrics;	/* metric specification strings */
     dict		*errors;	/* PMIDs where errors observed */
     dict		*wanted;	/* allowed metrics list PMIDs */
+    dict		*search;	/* search documents to be written */
+    struct timeval	started;	/* load start time, for a summary */
+    struct seriesLoadBaton *source;	/* pushed source owning the context */
 
     int			error;
     void		*arg;
@@ -168,10 +172,13 @@ typedef struct seriesModuleData {
     redisSlots		*slots;
     unsigned int	shareslots;
     unsigned int	search;
+    struct dict		*pushed;	/* pushed sample sources, by name */
+    unsigned int	pushlimit;	/* maximum pushed sources held */
 } seriesModuleData;
 
 extern seriesModuleData *getSeriesModuleData(pmSeriesModule *);
 extern void pmSeriesStatsAdd(pmSeriesModule *, const char *, const char *, double);
 extern void pmSeriesStatsSet(pmSeriesModule *, const char *, const char *, double);
+extern void pmSeriesPushClose(pmSeriesModule *);
 
 #endif	/* SERIES_SCHEMA_H */
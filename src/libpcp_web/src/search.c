@@ -170,37 +170,200 @@ redis_search_text_prep(sds s, int min_length, char *prefix, char *suffix)
     return formatted_result;
 }
 
+/*
+ * Documents are queued on the load baton and written in batches - once
+ * per discovery pass or fetched result, or on reaching index.batch - so
+ * repeated additions of a document (a metric name and then its help text,
+ * or instances shared by several metrics) are merged.  A digest of each
+ * field written is kept, and documents without changes are not rewritten.
+ */
+typedef struct searchText {
+    pmSearchTextType	type;
+    sds			name;
+    sds			indom;
+    sds			oneline;
+    sds			helptext;
+} searchText;
+
+typedef struct searchIndexed {
+    uint64_t		indom;		/* digests of written fields, */
+    uint64_t		oneline;	/* zero if not yet written */
+    uint64_t		helptext;
+} searchIndexed;
+
+typedef struct searchWrite {
+    seriesLoadBaton	*baton;
+    sds			docid;
+} searchWrite;
+
+static unsigned int	searchbatch;	/* documents per batch of writes */
+static unsigned int	searchcache;	/* limit on indexed document digests */
+static dict		*searchindexed;	/* docid: searchIndexed */
+static void		*searchmetrics;	/* MMV handle for indexing metrics */
+
+static uint64_t
+searchHashCallBack(const void *key)
+{
+    return dictGenHashFunction((unsigned char *)key, sdslen((sds)key));
+}
+
+static int
+searchCompareCallBack(void *privdata, const void *key1, const void *key2)
+{
+    (void)privdata;
+    return sdscmp((sds)key1, (sds)key2) == 0;
+}
+
+static void *
+searchDupCallBack(void *privdata, const void *key)
+{
+    (void)privdata;
+    return sdsdup((sds)key);
+}
+
+static void
+searchFreeCallBack(void *privdata, void *key)
+{
+    (void)privdata;
+    sdsfree((sds)key);
+}
+
+static void
+searchTextFreeCallBack(void *privdata, void *value)
+{
+    searchText		*text = (searchText *)value;
+
+    (void)privdata;
+    sdsfree(text->name);
+    sdsfree(text->indom);
+    sdsfree(text->oneline);
+    sdsfree(text->helptext);
+    free(text);
+}
+
+static void
+searchIndexedFreeCallBack(void *privdata, void *value)
+{
+    (void)privdata;
+    free(value);
+}
+
+static dictType searchTextDictCallBacks = {
+    .hashFunction	= searchHashCallBack,
+    .keyCompare		= searchCompareCallBack,
+    .keyDup		= searchDupCallBack,
+    .keyDestructor	= searchFreeCallBack,
+    .valDestructor	= searchTextFreeCallBack,
+};
+
+static dictType searchIndexedDictCallBacks = {
+    .hashFunction	= searchHashCallBack,
+    .keyCompare		= searchCompareCallBack,
+    .keyDup		= searchDupCallBack,
+    .keyDestructor	= searchFreeCallBack,
+    .valDestructor	= searchIndexedFreeCallBack,
+};
+
+static void
+search_stats_add(const char *name, double count)
+{
+    if (searchmetrics)
+	mmv_stats_add(searchmetrics, name, NULL, count);
+}
+
+static uint64_t
+search_digest(const char *field)
+{
+    uint64_t		digest;
+
+    if (field == NULL || *field == '\0')
+	return 0;
+    digest = dictGenHashFunction((unsigned char *)field, strlen(field));
+    return digest ? digest : 1;	/* zero means field not written */
+}
+
 static void
 redis_search_text_add_callback(
 	redisClusterAsyncContext *c, void *r, void *arg)
 {
-    seriesLoadBaton	*baton = (seriesLoadBaton *)arg;
+    searchWrite		*write = (searchWrite *)arg;
+    seriesLoadBaton	*baton = write->baton;
     seriesGetContext	*context = &baton->pmapi;
     redisReply		*reply = r;
 
-    checkStatusReplyOK(baton->info, baton->userdata, c, reply,
-		"%s: %s", FT_ADD, "search text add");
+    if (checkStatusReplyOK(baton->info, baton->userdata, c, reply,
+		"%s: %s", FT_ADD, "search text add") < 0) {
+	/* document must be written again when next discovered */
+	if (searchindexed)
+	    dictDelete(searchindexed, write->docid);
+	search_stats_add("index.errors", 1);
+    }
+    sdsfree(write->docid);
+    free(write);
     doneSeriesGetContext(context, "redis_search_text_add_callback");
 }
 
-void
-redis_search_text_add(redisSlots *slots, pmSearchTextType type,
-		const char *name, const char *indom,
-		const char *oneline, const char *helptext, void *arg)
+static void
+redis_search_text_write(redisSlots *slots, seriesLoadBaton *baton,
+		sds docid, searchText *text)
 {
-    seriesLoadBaton	*baton = (seriesLoadBaton *)arg;
     seriesGetContext	*context = &baton->pmapi;
+    searchIndexed	*indexed = NULL, digests;
+    searchWrite		*write;
     unsigned int	length;
-    const char		*typestr = pmSearchTextTypeStr(type);
+    const char		*typestr = pmSearchTextTypeStr(text->type);
+    const char		*indom, *oneline, *helptext;
     char		buffer[8];
-    sds			cmd, key, docid;
+    sds			cmd;
+
+    digests.indom = search_digest(text->indom);
+    digests.oneline = search_digest(text->oneline);
+    digests.helptext = search_digest(text->helptext);
+
+    if (searchindexed)
+	indexed = (searchIndexed *)dictFetchValue(searchindexed, docid);
+
+    /* only fields changed since the document was last written are sent */
+    indom = text->indom;
+    oneline = text->oneline;
+    helptext = text->helptext;
+    if (indexed) {
+	if (digests.indom == indexed->indom)
+	    indom = NULL;
+	if (digests.oneline == indexed->oneline)
+	    oneline = NULL;
+	if (digests.helptext == indexed->helptext)
+	    helptext = NULL;
+	if (!indom && !oneline && !helptext) {
+	    search_stats_add("index.skipped", 1);
+	    return;
+	}
+    }
+    if ((write = calloc(1, sizeof(searchWrite))) == NULL)
+	return;
 
-    seriesBatonCheckMagic(baton, MAGIC_LOAD, "redis_search_text_add");
+    if (searchindexed && indexed == NULL) {
+	if (dictSize(searchindexed) >= searchcache)
+	    dictEmpty(searchindexed, NULL);
+	if ((indexed = calloc(1, sizeof(searchIndexed))) != NULL)
+	    dictAdd(searchindexed, docid, indexed);
+    }
+    if (indexed) {
+	if (indom)
+	    indexed->indom = digests.indom;
+	if (oneline)
+	    indexed->oneline = digests.oneline;
+	if (helptext)
+	    indexed->helptext = digests.helptext;
+    }
 
     if (pmDebugOptions.search)
-	fprintf(stderr, "%s: %s %s\n", "redis_search_text_add", typestr, name);
+	fprintf(stderr, "%s: %s %s\n", "redis_search_text_write",
+			typestr, text->name);
 
-    seriesBatonReference(context, "redis_search_text_add");
+    write->baton = baton;
+    write->docid = sdsdup(docid);
+    seriesBatonReference(context, "redis_search_text_write");
 
     /*
      * FT.ADD pcp:text <docid> 1.0
@@ -209,51 +372,119 @@ redis_search_text_add(redisSlots *slots, pmSearchTextType type,
      *		FIELDS NAME <name> TYPE <type>
      *		[INDOM <indom>] [ONELINE <oneline>] [HELPTEXT <helptext>]
      */
-    key = sdsnewlen(FT_TEXT_KEY, FT_TEXT_KEY_LEN);
     length = 4 + 2 + 2 + 5;
-    if (indom && *indom != '\0')
+    if (indom)
 	length += 2;
-    if (oneline && *oneline != '\0')
+    if (oneline)
 	length += 2;
-    if (helptext && *helptext != '\0')
+    if (helptext)
 	length += 2;
     cmd = redis_command(length);
 
     cmd = redis_param_str(cmd, FT_ADD, FT_ADD_LEN);
     cmd = redis_param_str(cmd, FT_TEXT_KEY, FT_TEXT_KEY_LEN);
-    docid = redis_search_docid(FT_TEXT_KEY, typestr, name);
     cmd = redis_param_sds(cmd, docid);
-    sdsfree(docid);
     cmd = redis_param_str(cmd, "1", 1);
 
     cmd = redis_param_str(cmd, FT_REPLACE, FT_REPLACE_LEN);
     cmd = redis_param_str(cmd, FT_PARTIAL, FT_PARTIAL_LEN);
 
-    length = pmsprintf(buffer, sizeof(buffer), "%u", type);
+    length = pmsprintf(buffer, sizeof(buffer), "%u", text->type);
     cmd = redis_param_str(cmd, FT_PAYLOAD, FT_PAYLOAD_LEN);
     cmd = redis_param_str(cmd, buffer, length);
 
     cmd = redis_param_str(cmd, FT_FIELDS, FT_FIELDS_LEN);
     cmd = redis_param_str(cmd, FT_NAME, FT_NAME_LEN);
-    cmd = redis_param_str(cmd, name, strlen(name));
+    cmd = redis_param_sds(cmd, text->name);
     cmd = redis_param_str(cmd, FT_TYPE, FT_TYPE_LEN);
     cmd = redis_param_str(cmd, typestr, strlen(typestr));
-    if (indom && *indom != '\0') {
+    if (indom) {
 	cmd = redis_param_str(cmd, FT_INDOM, FT_INDOM_LEN);
-	cmd = redis_param_str(cmd, indom, strlen(indom));
+	cmd = redis_param_sds(cmd, text->indom);
     }
-    if (oneline && *oneline != '\0') {
+    if (oneline) {
 	cmd = redis_param_str(cmd, FT_ONELINE, FT_ONELINE_LEN);
-	cmd = redis_param_str(cmd, oneline, strlen(oneline));
+	cmd = redis_param_sds(cmd, text->oneline);
     }
-    if (helptext && *helptext != '\0') {
+    if (helptext) {
 	cmd = redis_param_str(cmd, FT_HELPTEXT, FT_HELPTEXT_LEN);
-	cmd = redis_param_str(cmd, helptext, strlen(helptext));
+	cmd = redis_param_sds(cmd, text->helptext);
     }
 
-    sdsfree(key);
-    redisSlotsRequestFirstNode(slots, cmd, redis_search_text_add_callback, arg);
+    redisSlotsRequestFirstNode(slots, cmd, redis_search_text_add_callback, write);
     sdsfree(cmd);
+    search_stats_add("index.writes", 1);
+}
+
+/* write out all documents queued on this load baton */
+void
+redis_search_text_flush(redisSlots *slots, void *arg)
+{
+    seriesLoadBaton	*baton = (seriesLoadBaton *)arg;
+    dictIterator	*iterator;
+    dictEntry		*entry;
+
+    if (baton->search == NULL || dictSize(baton->search) == 0)
+	return;
+
+    iterator = dictGetIterator(baton->search);
+    while ((entry = dictNext(iterator)) != NULL)
+	redis_search_text_write(slots, baton,
+			(sds)dictGetKey(entry), (searchText *)dictGetVal(entry));
+    dictReleaseIterator(iterator);
+    dictEmpty(baton->search, NULL);
+    search_stats_add("index.batches", 1);
+}
+
+static void
+search_text_field(sds *field, const char *value)
+{
+    if (value == NULL || *value == '\0')
+	return;
+    if (*field == NULL)
+	*field = sdsnew(value);
+    else
+	*field = sdscpy(*field, value);
+}
+
+void
+redis_search_text_add(redisSlots *slots, pmSearchTextType type,
+		const char *name, const char *indom,
+		const char *oneline, const char *helptext, void *arg)
+{
+    seriesLoadBaton	*baton = (seriesLoadBaton *)arg;
+    searchText		*text;
+    const char		*typestr = pmSearchTextTypeStr(type);
+    sds			docid;
+
+    seriesBatonCheckMagic(baton, MAGIC_LOAD, "redis_search_text_add");
+
+    if (pmDebugOptions.search)
+	fprintf(stderr, "%s: %s %s\n", "redis_search_text_add", typestr, name);
+
+    if (baton->search == NULL)
+	baton->search = dictCreate(&searchTextDictCallBacks, NULL);
+
+    docid = redis_search_docid(FT_TEXT_KEY, typestr, name);
+    if ((text = (searchText *)dictFetchValue(baton->search, docid)) != NULL) {
+	search_stats_add("index.merged", 1);
+    } else if ((text = calloc(1, sizeof(searchText))) != NULL) {
+	text->type = type;
+	text->name = sdsnew(name);
+	dictAdd(baton->search, docid, text);
+    }
+    sdsfree(docid);
+    search_stats_add("index.docs", 1);
+    if (text == NULL)
+	return;
+
+    /* PARTIAL updates - fields not given here are left unchanged */
+    search_text_field(&text->indom, indom);
+    search_text_field(&text->oneline, oneline);
+    search_text_field(&text->helptext, helptext);
+
+    if (dictSize(baton->search) >= searchbatch)
+	redis_search_text_flush(slots, baton);
 }
 
 void
@@ -1040,6 +1271,65 @@ redisSearchInit(struct dict *config)
 	    resultcount_str = sdsnew("10");
 	resultcount = atoi(resultcount_str);
     }
+
+    if (!searchbatch) {
+	if ((option = pmIniFileLookup(config, "pmsearch", "index.batch")))
+	    searchbatch = strtoul(option, NULL, 0);
+	if (searchbatch == 0)
+	    searchbatch = 256;
+	if ((option = pmIniFileLookup(config, "pmsearch", "index.cache")))
+	    searchcache = strtoul(option, NULL, 0);
+	else
+	    searchcache = 1000000;
+	if (searchcache)
+	    searchindexed = dictCreate(&searchIndexedDictCallBacks, NULL);
+    }
+}
+
+static void
+pmSearchSetupMetrics(pmSearchModule *module)
+{
+    seriesModuleData	*data = getSeriesModuleData(module);
+    pmUnits		countunits = MMV_UNITS(0,0,1,0,0,0);
+    pmInDom		noindom = MMV_INDOM_NULL;
+
+    if (data == NULL || data->metrics == NULL)
+	return; /* no metric registry has been set up */
+
+    mmv_stats_add_metric(data->metrics, "index.docs", 1,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, noindom,
+	"documents queued for indexing",
+	"total metric, indom and instance documents queued for indexing");
+
+    mmv_stats_add_metric(data->metrics, "index.merged", 2,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, noindom,
+	"documents merged into a queued document",
+	"total documents merged with the same document already queued for\n"
+	"indexing in the current batch");
+
+    mmv_stats_add_metric(data->metrics, "index.skipped", 3,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, noindom,
+	"unchanged documents not written",
+	"total queued documents not written as they are unchanged since\n"
+	"they were last indexed");
+
+    mmv_stats_add_metric(data->metrics, "index.writes", 4,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, noindom,
+	"documents written for indexing",
+	"total FT.ADD requests issued for new or changed documents");
+
+    mmv_stats_add_metric(data->metrics, "index.batches", 5,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, noindom,
+	"batches of documents written",
+	"total batches of queued documents written for indexing");
+
+    mmv_stats_add_metric(data->metrics, "index.errors", 6,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, countunits, noindom,
+	"failed document writes",
+	"total FT.ADD requests for indexing documents that failed");
+
+    data->metrics_handle = mmv_stats_start(data->metrics);
+    searchmetrics = data->metrics_handle;
 }
 
 int
@@ -1064,6 +1354,9 @@ pmSearchSetup(pmSearchModule *module, void *arg)
 			module->on_setup, arg, data->events, arg);
 	data->shareslots = 0;
     }
+
+    pmSearchSetupMetrics(module);
+
     return 0;
 }
 
@@ -1083,6 +1376,8 @@ pmSearchClose(pmSearchModule *module)
     seriesModuleData	*search = (seriesModuleData *)module->privdata;
 
     if (search) {
+	if (searchmetrics == search->metrics_handle)
+	    searchmetrics = NULL;
 	if (!search->shareslots)
 	    redisSlotsFree(search->slots);
 	memset(search, 0, sizeof(*search));
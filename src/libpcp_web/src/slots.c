@@ -64,6 +64,188 @@ redis_disconnect_callback(const redisAsyncContext *redis, int status)
     }
 }
 
+/*
+ * Optional coalescing of requests into per-node queues, which are
+ * written to each node (as a single pipelined write) once either a
+ * count of requests is reached or after a short delay.  Writes are
+ * held back, while any other request flushes the queue for its node
+ * straight away - requests to any one node are sent in order.
+ */
+#define COALESCE_BUCKETS	8
+
+static const unsigned int coalesce_sizes[COALESCE_BUCKETS] = {
+    1, 2, 4, 8, 16, 32, 64, UINT_MAX
+};
+static const unsigned int coalesce_latency[COALESCE_BUCKETS] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, UINT_MAX	/* usec */
+};
+
+enum {
+    COALESCE_QUEUED,
+    COALESCE_FLUSHES,
+    COALESCE_SIZE,
+    COALESCE_LATENCY = COALESCE_SIZE + COALESCE_BUCKETS,
+    NUM_COALESCE_VALUES = COALESCE_LATENCY + COALESCE_BUCKETS
+};
+
+typedef struct redisSlotsQueue {
+#if defined(HAVE_LIBUV)
+    uv_timer_t		timer;		/* flush timer, handle must be first */
+#endif
+    redisSlots		*slots;
+    sds			addr;		/* node address, the queue key */
+    unsigned int	count;		/* number of queued requests */
+    unsigned int	flushing;	/* flush timer expires immediately */
+    int64_t		first;		/* usec time oldest request queued */
+    redisSlotsReplyData	*head;
+    redisSlotsReplyData	*tail;
+    pmAtomValue		*values[NUM_COALESCE_VALUES];
+} redisSlotsQueue;
+
+/*
+ * Histogram bucket instance names, by bucket upper bound - per-node
+ * bucket counters, as MMV_TYPE_HISTOGRAM metrics must be singular.
+ */
+static sds
+coalesce_name(sds addr, unsigned int bound)
+{
+    if (bound == UINT_MAX)
+	return sdscatfmt(sdsempty(), "%S::inf", addr);
+    return sdscatfmt(sdsempty(), "%S::%u", addr, bound);
+}
+
+/* per-node instances for nodes known at the time metrics are setup */
+static void
+redis_coalesce_metrics(redisSlots *slots)
+{
+    pmUnits		units_count = MMV_UNITS(0, 0, 1, 0, 0, PM_COUNT_ONE);
+    dictIterator	*iterator;
+    dictEntry		*entry;
+    cluster_node	*node;
+    unsigned int	i, n, count = 0;
+    sds			*names;
+
+    if ((iterator = dictGetSafeIterator(slots->acc->cc->nodes)) == NULL)
+	return;
+    while (dictNext(iterator) != NULL)
+	count++;
+    dictReleaseIterator(iterator);
+    if (count == 0 || !slots->cluster_mode)
+	count = 1;	/* requests all sent to the first node */
+
+    names = calloc(count * (1 + 2 * COALESCE_BUCKETS), sizeof(sds));
+    if (names == NULL)
+	return;
+    slots->coalesce_names = names;
+
+    mmv_stats_add_indom(slots->metrics, 1,
+	"Redis nodes",
+	"Redis nodes receiving coalesced requests");
+    mmv_stats_add_indom(slots->metrics, 2,
+	"Redis node flush sizes",
+	"Number of coalesced requests written to each Redis node at once, "
+	"by (maximum) number of requests in each flush.");
+    mmv_stats_add_indom(slots->metrics, 3,
+	"Redis node flush latencies",
+	"Time oldest coalesced request waited before being written to each "
+	"Redis node, by (maximum) microseconds waiting.");
+
+    iterator = dictGetSafeIterator(slots->acc->cc->nodes);
+    for (n = 0; n < count && (entry = dictNext(iterator)) != NULL; n++) {
+	node = dictGetVal(entry);
+	names[n] = sdsdup(node->addr);
+	mmv_stats_add_instance(slots->metrics, 1, n, names[n]);
+	for (i = 0; i < COALESCE_BUCKETS; i++) {
+	    names[count + n * COALESCE_BUCKETS + i] =
+		    coalesce_name(node->addr, coalesce_sizes[i]);
+	    mmv_stats_add_instance(slots->metrics, 2, n * COALESCE_BUCKETS + i,
+		    names[count + n * COALESCE_BUCKETS + i]);
+	}
+	for (i = 0; i < COALESCE_BUCKETS; i++) {
+	    names[count * (1 + COALESCE_BUCKETS) + n * COALESCE_BUCKETS + i] =
+		    coalesce_name(node->addr, coalesce_latency[i]);
+	    mmv_stats_add_instance(slots->metrics, 3, n * COALESCE_BUCKETS + i,
+		    names[count * (1 + COALESCE_BUCKETS) + n * COALESCE_BUCKETS + i]);
+	}
+    }
+    dictReleaseIterator(iterator);
+    slots->coalesce_nnodes = n;
+
+    mmv_stats_add_metric(slots->metrics, "requests.coalesced", 8,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_count, MMV_INDOM_NULL,
+	"number of coalesced requests",
+	"total number of requests queued for coalesced writes");
+
+    mmv_stats_add_metric(slots->metrics, "requests.flushes", 9,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_count, MMV_INDOM_NULL,
+	"number of coalesced writes",
+	"total number of writes of coalesced requests to all nodes");
+
+    mmv_stats_add_metric(slots->metrics, "nodes.queued", 10,
+	MMV_TYPE_U64, MMV_SEM_DISCRETE, units_count, 1,
+	"coalesced requests queued for each node",
+	"current depth of the coalesced request queue for each node");
+
+    mmv_stats_add_metric(slots->metrics, "nodes.flushes", 11,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_count, 1,
+	"coalesced writes to each node",
+	"total number of writes of coalesced requests to each node");
+
+    mmv_stats_add_metric(slots->metrics, "nodes.flush.size", 12,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_count, 2,
+	"histogram of coalesced write sizes for each node",
+	"number of coalesced writes to each node by number of requests");
+
+    mmv_stats_add_metric(slots->metrics, "nodes.flush.latency", 13,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_count, 3,
+	"histogram of coalesced write latency for each node",
+	"number of coalesced writes to each node by the time in microseconds\n"
+	"that the oldest request waited in the queue before being written");
+}
+
+static void
+redis_coalesce_queue_values(redisSlots *slots, redisSlotsQueue *queue)
+{
+    void		*map = slots->metrics_handle;
+    unsigned int	i, n, count = slots->coalesce_nnodes;
+    sds			*names = slots->coalesce_names;
+
+    memset(queue->values, 0, sizeof(queue->values));
+    if (map == NULL || names == NULL)
+	return;
+    for (n = 0; n < count; n++)
+	if (sdscmp(names[n], queue->addr) == 0)
+	    break;
+    if (n == count)
+	return;		/* node not known when metrics were setup */
+
+    queue->values[COALESCE_QUEUED] =
+	    mmv_lookup_value_desc(map, "nodes.queued", names[n]);
+    queue->values[COALESCE_FLUSHES] =
+	    mmv_lookup_value_desc(map, "nodes.flushes", names[n]);
+    for (i = 0; i < COALESCE_BUCKETS; i++) {
+	queue->values[COALESCE_SIZE + i] =
+		mmv_lookup_value_desc(map, "nodes.flush.size",
+			names[count + n * COALESCE_BUCKETS + i]);
+	queue->values[COALESCE_LATENCY + i] =
+		mmv_lookup_value_desc(map, "nodes.flush.latency",
+			names[count * (1 + COALESCE_BUCKETS) + n * COALESCE_BUCKETS + i]);
+    }
+}
+
+/* resolve metric values for queues created before metrics were setup */
+static void
+redis_coalesce_values(redisSlots *slots)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+
+    iterator = dictGetSafeIterator(slots->queues);
+    while ((entry = dictNext(iterator)) != NULL)
+	redis_coalesce_queue_values(slots, dictGetVal(entry));
+    dictReleaseIterator(iterator);
+}
+
 void
 redisSlotsSetupMetrics(redisSlots *slots)
 {
@@ -110,7 +292,13 @@ redisSlotsSetupMetrics(redisSlots *slots)
 	"bytes allocated for inflight requests",
 	"amount of bytes allocated for inflight requests");
 
+    if (slots->queues)
+	redis_coalesce_metrics(slots);
+
     slots->metrics_handle = mmv_stats_start(slots->metrics);
+
+    if (slots->queues)
+	redis_coalesce_values(slots);
 }
 
 int
@@ -123,6 +311,32 @@ redisSlotsSetMetricRegistry(redisSlots *slots, mmv_registry_t *registry)
     return -ENOMEM;
 }
 
+static void
+redis_coalesce_setup(redisSlots *slots, dict *config)
+{
+#if defined(HAVE_LIBUV)
+    unsigned int	value;
+    sds			option;
+
+    if ((option = pmIniFileLookup(config, "pmseries", "coalesce.enabled")) == NULL ||
+	strcmp(option, "true") != 0 || slots->events == NULL)
+	return;
+
+    slots->coalesce_count = 64;
+    if ((option = pmIniFileLookup(config, "pmseries", "coalesce.count")) &&
+	(value = strtoul(option, NULL, 10)) > 0)
+	slots->coalesce_count = value;
+    slots->coalesce_delay = 2;
+    if ((option = pmIniFileLookup(config, "pmseries", "coalesce.delay")))
+	slots->coalesce_delay = strtoul(option, NULL, 10);
+
+    slots->queues = dictCreate(&sdsKeyDictCallBacks, "queues");
+#else
+    (void)slots;
+    (void)config;
+#endif
+}
+
 redisSlots *
 redisSlotsInit(dict *config, void *events)
 {
@@ -226,20 +440,11 @@ redisSlotsInit(dict *config, void *events)
         return slots;
     }
 
+    redis_coalesce_setup(slots, config);
     slots->setup = 1;
     return slots;
 }
 
-void
-redisSlotsFree(redisSlots *slots)
-{
-    redisClusterAsyncDisconnect(slots->acc);
-    redisClusterAsyncFree(slots->acc);
-    dictRelease(slots->keymap);
-    memset(slots, 0, sizeof(*slots));
-    free(slots);
-}
-
 /* extracted from hiutil.c, BSD-3-Clause, https://github.com/Nordix/hiredis-cluster */
 static inline int64_t
 usec_now()
@@ -280,6 +485,7 @@ redisSlotsReplyDataAlloc(redisSlots *slots, size_t req_size,
 void
 redisSlotsReplyDataFree(redisSlotsReplyData *srd)
 {
+    sdsfree(srd->cmd);
     free(srd);
 }
 
@@ -302,6 +508,309 @@ redisSlotsReplyCallback(redisClusterAsyncContext *c, void *r, void *arg)
     redisSlotsReplyDataFree(arg);
 }
 
+static cluster_node *
+redis_first_node(redisSlots *slots)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+
+    iterator = dictGetSafeIterator(slots->acc->cc->nodes);
+    entry = dictNext(iterator);
+    dictReleaseIterator(iterator);
+    return entry ? dictGetVal(entry) : NULL;
+}
+
+#if defined(HAVE_LIBUV)
+static const struct {
+    const char		*name;
+    unsigned int	length;
+} coalesce_writes[] = {
+    { XADD, XADD_LEN },
+    { HMSET, HMSET_LEN },
+    { HSET, HSET_LEN },
+    { SADD, SADD_LEN },
+    { SETS, SETS_LEN },
+    { EXPIRE, EXPIRE_LEN },
+    { GEOADD, GEOADD_LEN },
+    { PUBLISH, PUBLISH_LEN },
+    { FT_ADD, FT_ADD_LEN },
+};
+
+/* locate the next bulk string argument in a Redis protocol request */
+static const char *
+redis_request_arg(const char *p, const char *end, unsigned int *length)
+{
+    unsigned long	bytes;
+    char		*q;
+
+    if (p >= end || *p != '$')
+	return NULL;
+    bytes = strtoul(p + 1, &q, 10);
+    if (q >= end || *q != '\r' || (size_t)(end - q) < bytes + 4)
+	return NULL;
+    *length = bytes;
+    return q + 2;
+}
+
+/*
+ * Find the queue for the node serving the key of a request, as it
+ * would be routed by the cluster library, also noting whether this
+ * request is a write (which can be held back for coalescing).
+ */
+static redisSlotsQueue *
+redis_coalesce_queue(redisSlots *slots, const sds cmd, int *write)
+{
+    const char		*p = cmd, *end = cmd + sdslen(cmd);
+    const char		*name, *arg = NULL;
+    unsigned int	i, length, namelen;
+    long long		position = 1;
+    redisSlotsQueue	*queue;
+    cluster_node	*node;
+    dictEntry		*entry;
+    char		buffer[128];
+    sds			key = NULL;
+
+    *write = 0;
+    if (*p != '*' || (p = memchr(p, '\n', end - p)) == NULL ||
+	(name = redis_request_arg(p + 1, end, &namelen)) == NULL)
+	return NULL;
+    for (i = 0; i < sizeof(coalesce_writes) / sizeof(coalesce_writes[0]); i++) {
+	if (namelen == coalesce_writes[i].length &&
+	    strncasecmp(name, coalesce_writes[i].name, namelen) == 0) {
+	    *write = 1;
+	    break;
+	}
+    }
+
+    if (slots->cluster_mode) {
+	if (dictSize(slots->keymap) > 0) {
+	    key = sdsnewlen(name, namelen);
+	    sdstolower(key);
+	    if ((entry = dictFind(slots->keymap, key)) != NULL)
+		position = dictGetSignedIntegerVal(entry);
+	    sdsfree(key);
+	    key = NULL;
+	}
+	for (p = name + namelen + 2; position > 0; position--) {
+	    if ((arg = redis_request_arg(p, end, &length)) == NULL)
+		return NULL;
+	    p = arg + length + 2;
+	}
+	if (arg == NULL)
+	    return NULL;
+	if (length < sizeof(buffer)) {
+	    memcpy(buffer, arg, length);
+	    buffer[length] = '\0';
+	    node = redisClusterGetNodeByKey(slots->acc->cc, buffer);
+	} else {
+	    key = sdsnewlen(arg, length);
+	    node = redisClusterGetNodeByKey(slots->acc->cc, key);
+	    sdsfree(key);
+	}
+    } else {
+	node = redis_first_node(slots);
+    }
+    if (node == NULL || node->addr == NULL)
+	return NULL;
+
+    if ((entry = dictFind(slots->queues, node->addr)) != NULL)
+	return (redisSlotsQueue *)dictGetVal(entry);
+
+    if ((queue = calloc(1, sizeof(redisSlotsQueue))) == NULL)
+	return NULL;
+    queue->slots = slots;
+    queue->addr = sdsdup(node->addr);
+    uv_timer_init(slots->events, &queue->timer);
+    queue->timer.data = (void *)queue;
+    redis_coalesce_queue_values(slots, queue);
+    dictAdd(slots->queues, queue->addr, queue);
+    return queue;
+}
+
+/* send a coalesced request, failures are reported via its callback */
+static void
+redis_coalesce_submit(redisSlots *slots, redisSlotsReplyData *srd)
+{
+    cluster_node	*node;
+    sds			cmd = srd->cmd;
+    int			sts;
+
+    srd->cmd = NULL;
+    if (slots->cluster_mode)
+	sts = redisClusterAsyncFormattedCommand(slots->acc,
+			redisSlotsReplyCallback, srd, cmd, sdslen(cmd));
+    else if ((node = redis_first_node(slots)) != NULL)
+	sts = redisClusterAsyncFormattedCommandToNode(slots->acc, node,
+			redisSlotsReplyCallback, srd, cmd, sdslen(cmd));
+    else
+	sts = REDIS_ERR;
+
+    if (sts != REDIS_OK) {
+	pmNotifyErr(LOG_ERR, "redisSlotsRequest: %s (%s)\n", slots->acc->errstr, cmd);
+	mmv_stats_inc(slots->metrics_handle, "requests.error", NULL);
+	redisSlotsReplyCallback(slots->acc, NULL, srd);
+    }
+    sdsfree(cmd);
+}
+
+/*
+ * Write all requests queued for a node - within the one event loop
+ * iteration these are buffered by the node connection and written
+ * together.
+ */
+static void
+redis_coalesce_flush(redisSlotsQueue *queue)
+{
+    redisSlots		*slots = queue->slots;
+    redisSlotsReplyData	*srd, *next;
+    void		*map = slots->metrics_handle;
+    unsigned int	i, j, count = queue->count;
+    int64_t		wait;
+
+    queue->flushing = 0;
+    if (count == 0)
+	return;
+
+    wait = usec_now() - queue->first;
+    srd = queue->head;
+    queue->head = queue->tail = NULL;
+    queue->count = 0;
+
+    for (; srd != NULL; srd = next) {
+	next = srd->next;
+	srd->next = NULL;
+	redis_coalesce_submit(slots, srd);
+    }
+
+    mmv_stats_inc(map, "requests.flushes", NULL);
+    for (i = 0; count > coalesce_sizes[i]; i++)
+	;
+    for (j = 0; wait > coalesce_latency[j]; j++)
+	;
+    mmv_set_value(map, queue->values[COALESCE_QUEUED], 0);
+    mmv_inc_value(map, queue->values[COALESCE_FLUSHES], 1);
+    mmv_inc_value(map, queue->values[COALESCE_SIZE + i], 1);
+    mmv_inc_value(map, queue->values[COALESCE_LATENCY + j], 1);
+}
+
+/*
+ * Write the requests queued for all nodes, ahead of a request which
+ * cannot be queued (its node is unknown) and so is sent directly.
+ */
+static void
+redis_coalesce_flush_all(redisSlots *slots)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+
+    iterator = dictGetSafeIterator(slots->queues);
+    while ((entry = dictNext(iterator)) != NULL)
+	redis_coalesce_flush((redisSlotsQueue *)dictGetVal(entry));
+    dictReleaseIterator(iterator);
+}
+
+static void
+redis_coalesce_timer(uv_timer_t *timer)
+{
+    redis_coalesce_flush((redisSlotsQueue *)timer->data);
+}
+
+static void
+redis_coalesce_close(uv_handle_t *handle)
+{
+    redisSlotsQueue	*queue = (redisSlotsQueue *)handle->data;
+
+    sdsfree(queue->addr);
+    free(queue);
+}
+
+static int
+redis_coalesce_request(redisSlots *slots, redisSlotsQueue *queue, int write,
+		const sds cmd, redisClusterCallbackFn *callback, void *arg)
+{
+    redisSlotsReplyData	*srd;
+
+    if (UNLIKELY(pmDebugOptions.desperate))
+	fprintf(stderr, "Queueing raw redis command for node %s\n%s",
+			queue->addr, cmd);
+
+    if ((srd = redisSlotsReplyDataAlloc(slots, sdslen(cmd), callback, arg)) == NULL ||
+	(srd->cmd = sdsdup(cmd)) == NULL) {
+	free(srd);
+	mmv_stats_inc(slots->metrics_handle, "requests.error", NULL);
+	pmNotifyErr(LOG_ERR, "Error: redisSlotsRequest failed to allocate reply data (%zu bytes)\n", sdslen(cmd));
+	return -ENOMEM;
+    }
+    if (queue->tail)
+	queue->tail->next = srd;
+    else {
+	queue->head = srd;
+	queue->first = srd->start;
+    }
+    queue->tail = srd;
+    queue->count++;
+
+    mmv_stats_inc(slots->metrics_handle, "requests.total", NULL);
+    mmv_stats_inc(slots->metrics_handle, "requests.coalesced", NULL);
+    mmv_set_value(slots->metrics_handle, queue->values[COALESCE_QUEUED], queue->count);
+
+    slots->inflight_requests++;
+    mmv_stats_inc(slots->metrics_handle, "requests.inflight.total", NULL);
+    mmv_stats_add(slots->metrics_handle, "requests.inflight.bytes", NULL, sdslen(cmd));
+
+    /* flush on the next loop iteration for reads and full queues */
+    if (!write || queue->count >= slots->coalesce_count) {
+	if (!queue->flushing) {
+	    queue->flushing = 1;
+	    uv_timer_start(&queue->timer, redis_coalesce_timer, 0, 0);
+	}
+    } else if (queue->count == 1) {
+	uv_timer_start(&queue->timer, redis_coalesce_timer, slots->coalesce_delay, 0);
+    }
+    return REDIS_OK;
+}
+#endif
+
+static void
+redis_coalesce_free(redisSlots *slots)
+{
+#if defined(HAVE_LIBUV)
+    redisSlotsQueue	*queue;
+    dictIterator	*iterator;
+    dictEntry		*entry;
+
+    iterator = dictGetSafeIterator(slots->queues);
+    while ((entry = dictNext(iterator)) != NULL) {
+	queue = (redisSlotsQueue *)dictGetVal(entry);
+	redis_coalesce_flush(queue);
+	uv_timer_stop(&queue->timer);
+	uv_close((uv_handle_t *)&queue->timer, redis_coalesce_close);
+    }
+    dictReleaseIterator(iterator);
+#endif
+    dictRelease(slots->queues);
+}
+
+void
+redisSlotsFree(redisSlots *slots)
+{
+    unsigned int	i, count;
+
+    if (slots->queues)
+	redis_coalesce_free(slots);
+    if (slots->coalesce_names) {
+	count = slots->coalesce_nnodes * (1 + 2 * COALESCE_BUCKETS);
+	for (i = 0; i < count; i++)
+	    sdsfree(slots->coalesce_names[i]);
+	free(slots->coalesce_names);
+    }
+    redisClusterAsyncDisconnect(slots->acc);
+    redisClusterAsyncFree(slots->acc);
+    dictRelease(slots->keymap);
+    memset(slots, 0, sizeof(*slots));
+    free(slots);
+}
+
 /*
  * Submit an arbitrary request to a (set of) Redis instance(s).
  * The given key is used to determine the slot used, as per the
@@ -316,10 +825,23 @@ redisSlotsRequest(redisSlots *slots, const sds cmd,
 {
     int			sts;
     redisSlotsReplyData	*srd;
+#if defined(HAVE_LIBUV)
+    redisSlotsQueue	*queue;
+    int			write;
+#endif
 
     if (UNLIKELY(!slots->setup))
         return -ENOTCONN;
 
+#if defined(HAVE_LIBUV)
+    if (slots->queues) {
+	if ((queue = redis_coalesce_queue(slots, cmd, &write)) != NULL)
+	    return redis_coalesce_request(slots, queue, write, cmd, callback, arg);
+	/* not queued - earlier requests must still be written first */
+	redis_coalesce_flush_all(slots);
+    }
+#endif
+
     if (!slots->cluster_mode)
 	return redisSlotsRequestFirstNode(slots, cmd, callback, arg);
 
@@ -350,24 +872,27 @@ int
 redisSlotsRequestFirstNode(redisSlots *slots, const sds cmd,
 		redisClusterCallbackFn *callback, void *arg)
 {
-    dictIterator	*iterator;
-    dictEntry		*entry;
     cluster_node	*node;
     redisSlotsReplyData	*srd;
+#if defined(HAVE_LIBUV)
+    dictEntry		*entry;
+#endif
     int			sts;
 
     if (UNLIKELY(!slots->setup))
         return -ENOTCONN;
 
-    iterator = dictGetSafeIterator(slots->acc->cc->nodes);
-    entry = dictNext(iterator);
-    dictReleaseIterator(iterator);
-    if (!entry) {
+    if ((node = redis_first_node(slots)) == NULL) {
 	pmNotifyErr(LOG_ERR, "redisSlotsRequestFirstNode: No Redis node configured.\n");
 	return REDIS_ERR;
     }
 
-    node = dictGetVal(entry);
+#if defined(HAVE_LIBUV)
+    /* write any requests queued for this node ahead of this one */
+    if (slots->queues && (entry = dictFind(slots->queues, node->addr)) != NULL)
+	redis_coalesce_flush((redisSlotsQueue *)dictGetVal(entry));
+#endif
+
     if (UNLIKELY(pmDebugOptions.desperate))
 	fprintf(stderr, "Sending raw redis command to node %s\n%s", node->addr, cmd);
 
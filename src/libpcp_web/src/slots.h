@@ -46,6 +46,12 @@ typedef struct redisSlots {
     void		*metrics_handle; /* MMV handle */
 
     int			inflight_requests; /* number of Redis requests without response */
+
+    unsigned int	coalesce_count;	/* queued requests flushed at once */
+    unsigned int	coalesce_delay;	/* milliseconds before a queue flush */
+    unsigned int	coalesce_nnodes; /* nodes instrumented with metrics */
+    sds			*coalesce_names; /* node and bucket instance names */
+    dict		*queues;	/* per-node queues of coalesced writes */
 } redisSlots;
 
 /* wraps the actual Redis callback and data */
@@ -56,6 +62,9 @@ typedef struct redisSlotsReplyData {
 
     redisClusterCallbackFn	*callback;	/* actual callback */
     void			*arg;		/* actual callback args */
+
+    sds				cmd;		/* request, while coalescing */
+    struct redisSlotsReplyData	*next;		/* next request in node queue */
 } redisSlotsReplyData;
 
 typedef void (*redisPhase)(redisSlots *, void *);	/* phased operations */
@@ -0,0 +1,976 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_LIBUV
+#include <uv.h>
+#endif
+#include "pmapi.h"
+#include "libpcp.h"
+#include "private.h"
+#include "util.h"
+#include "store.h"
+
+/*
+ * Local storage backend - the values of each series are written to
+ * a directory named by the series hash, holding a sequence of chunks.
+ * Each chunk is a pair of append-only files: an index of fixed-size
+ * entries (stream timestamp, offset and length) which is searched via
+ * mmap, and the encoded instance:value pairs for each entry.  Chunks
+ * hold a fixed number of entries, and whole chunks are removed once
+ * the series holds stream.maxlen entries without the oldest chunk.
+ * Writers take a lock on the current chunk index, so several processes
+ * may safely append to the same series.  Chunk files of the series
+ * written most recently are held open, up to the storage.files limit,
+ * with the least recently written series closed (and forgotten, their
+ * state is read back from the chunk files when next written) beyond
+ * that.  As with the key server streams, series not written for
+ * stream.expire seconds are removed - by a sweep of the storage
+ * directory, a few series at a time from the timer callback.
+ */
+#define STORE_MAGIC	0x50435053	/* "PCPS" */
+#define STORE_VERSION	1
+#define SWEEP_INTERVAL	600	/* maximum seconds between expiry sweeps */
+#define SWEEP_ENTRIES	256	/* series checked on each timer callback */
+
+typedef struct storeHeader {
+    __uint32_t		magic;		/* STORE_MAGIC */
+    __uint32_t		version;	/* STORE_VERSION */
+    __uint32_t		chunk;		/* chunk number in this series */
+    __uint32_t		entrysize;	/* size of each index entry */
+} storeHeader;
+
+typedef struct storeEntry {
+    __uint64_t		millis;		/* stream timestamp, milliseconds */
+    __uint32_t		sequence;	/* stream timestamp, sequence part */
+    __uint32_t		length;		/* bytes of encoded values */
+    __uint64_t		offset;		/* start of values in values file */
+} storeEntry;
+
+typedef struct storeSeries {
+    sds			hash;		/* key in the series dict */
+    sds			path;		/* directory for this series */
+    unsigned int	first;		/* oldest chunk number */
+    unsigned int	last;		/* chunk number being appended */
+    int			ifd;		/* index file of last chunk or -1 */
+    int			vfd;		/* values file of last chunk or -1 */
+    storeEntry		tail;		/* most recently appended entry */
+    time_t		written;	/* time of most recent append */
+    struct storeSeries	*prev;		/* open series, most recently */
+    struct storeSeries	*next;		/* written first (LRU order) */
+} storeSeries;
+
+typedef struct storeReply {
+#ifdef HAVE_LIBUV
+    uv_work_t		work;
+    sds			hash;
+    sds			start;
+    sds			end;
+    unsigned int	count;
+#endif
+    redisClusterCallbackFn	*callback;
+    void		*arg;
+    redisReply		*reply;
+    int			ready;		/* range has been read */
+    struct storeReply	*next;
+} storeReply;
+
+static sds		storepath;
+static unsigned int	chunksize;
+static unsigned int	maxfiles;
+static unsigned int	maxlen;
+static unsigned int	nopen;
+static storeSeries	*openhead;	/* most recently written */
+static storeSeries	*opentail;	/* least recently written */
+static dict		*storeseries;
+static unsigned int	expire;		/* seconds without writes, or zero */
+static int		sweeptimer = -1;
+static time_t		sweeptime;	/* start of the most recent sweep */
+static DIR		*sweepdir;	/* storage directory being swept */
+
+static const seriesStoreOps *store;
+static int		configured;
+
+static storeReply	*pending, **lastpending = &pending;
+static int		delivering;
+
+/*
+ * Replies built in the same form as the key server protocol parser
+ */
+static redisReply *
+reply_create(int type)
+{
+    redisReply		*reply;
+
+    if ((reply = calloc(1, sizeof(redisReply))) != NULL)
+	reply->type = type;
+    return reply;
+}
+
+static redisReply *
+reply_string(const char *string, size_t length)
+{
+    redisReply		*reply;
+
+    if ((reply = reply_create(REDIS_REPLY_STRING)) == NULL)
+	return NULL;
+    if ((reply->str = malloc(length + 1)) == NULL) {
+	free(reply);
+	return NULL;
+    }
+    memcpy(reply->str, string, length);
+    reply->str[length] = '\0';
+    reply->len = length;
+    return reply;
+}
+
+static int
+reply_append(redisReply *array, redisReply *element)
+{
+    redisReply		**elements;
+    size_t		count = array->elements;
+
+    if (element == NULL)
+	return -ENOMEM;
+    /* array space is doubled whenever the count reaches a power of two */
+    if ((count & (count - 1)) == 0) {
+	elements = realloc(array->element,
+			(count ? count * 2 : 1) * sizeof(redisReply *));
+	if (elements == NULL)
+	    return -ENOMEM;
+	array->element = elements;
+    }
+    array->element[array->elements++] = element;
+    return 0;
+}
+
+static void
+reply_free(redisReply *reply)
+{
+    size_t		i;
+
+    if (reply == NULL)
+	return;
+    if (reply->type == REDIS_REPLY_ARRAY) {
+	for (i = 0; i < reply->elements; i++)
+	    reply_free(reply->element[i]);
+	free(reply->element);
+    } else {
+	free(reply->str);
+    }
+    free(reply);
+}
+
+/*
+ * Add one stream entry - its identifier then an array of the encoded
+ * instance:value pairs, each one a "$<length>\r\n<bytes>\r\n" string.
+ */
+static int
+reply_entry(redisReply *reply, storeEntry *entry, const char *values)
+{
+    redisReply		*item, *array;
+    const char		*p = values, *end = values + entry->length;
+    char		*next, id[64];
+    size_t		length;
+    int			n, sts;
+
+    if ((item = reply_create(REDIS_REPLY_ARRAY)) == NULL)
+	return -ENOMEM;
+    n = pmsprintf(id, sizeof(id), "%" FMT_UINT64 "-%u",
+			(__uint64_t)entry->millis, entry->sequence);
+    if ((sts = reply_append(item, reply_string(id, n))) < 0 ||
+	(sts = reply_append(item, array = reply_create(REDIS_REPLY_ARRAY))) < 0) {
+	reply_free(item);
+	return sts;
+    }
+    while (p < end && *p == '$') {
+	length = strtoul(p + 1, &next, 10);
+	if (next + 2 + length + 2 > end)
+	    break;
+	if ((sts = reply_append(array, reply_string(next + 2, length))) < 0) {
+	    reply_free(item);
+	    return sts;
+	}
+	p = next + 2 + length + 2;
+    }
+    if ((sts = reply_append(reply, item)) < 0)
+	reply_free(item);
+    return sts;
+}
+
+/* parse a stream identifier ("millis[-sequence]", or "-" and "+") */
+static void
+local_stream_id(const char *string, int upper, storeEntry *entry)
+{
+    char		*end;
+
+    memset(entry, 0, sizeof(*entry));
+    if (strcmp(string, "-") == 0)
+	return;
+    if (strcmp(string, "+") == 0) {
+	entry->millis = UINT64_MAX;
+	entry->sequence = UINT32_MAX;
+	return;
+    }
+    entry->millis = strtoull(string, &end, 10);
+    if (*end == '-')
+	entry->sequence = strtoul(end + 1, NULL, 10);
+    else
+	entry->sequence = upper ? UINT32_MAX : 0;
+}
+
+static int
+local_compare(const storeEntry *a, const storeEntry *b)
+{
+    if (a->millis != b->millis)
+	return (a->millis > b->millis) ? 1 : -1;
+    if (a->sequence != b->sequence)
+	return (a->sequence > b->sequence) ? 1 : -1;
+    return 0;
+}
+
+/* index of the first entry after (strict) or at or after the key */
+static unsigned int
+local_search(storeEntry *entries, unsigned int count,
+		storeEntry *key, int strict)
+{
+    unsigned int	low = 0, high = count, mid;
+    int			cmp;
+
+    while (low < high) {
+	mid = low + (high - low) / 2;
+	cmp = local_compare(&entries[mid], key);
+	if (cmp < 0 || (strict && cmp == 0))
+	    low = mid + 1;
+	else
+	    high = mid;
+    }
+    return low;
+}
+
+static int
+local_lock(int fd, int type)
+{
+#ifndef IS_MINGW
+    struct flock	lock;
+
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &lock) < 0) {
+	if (oserror() != EINTR)
+	    return -oserror();
+    }
+#else
+    (void)fd;
+    (void)type;
+#endif
+    return 0;
+}
+
+static sds
+local_chunk_name(sds path, unsigned int chunk, const char *suffix)
+{
+    return sdscatprintf(sdsempty(), "%s%c%u.%s",
+			path, pmPathSeparator(), chunk, suffix);
+}
+
+static int
+local_chunk_compare(const void *a, const void *b)
+{
+    unsigned int	x = *(unsigned int *)a, y = *(unsigned int *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* sorted list of the chunk numbers present for a series */
+static int
+local_chunks(sds path, unsigned int **chunks)
+{
+    struct dirent	*dp;
+    unsigned int	*list = NULL, *tmp, chunk, count = 0, size = 0;
+    char		*end;
+    DIR			*dir;
+
+    *chunks = NULL;
+    if ((dir = opendir(path)) == NULL)
+	return 0;
+    while ((dp = readdir(dir)) != NULL) {
+	chunk = strtoul(dp->d_name, &end, 10);
+	if (end == dp->d_name || strcmp(end, ".index") != 0)
+	    continue;
+	if (count == size) {
+	    size = size ? size * 2 : 8;
+	    if ((tmp = realloc(list, size * sizeof(unsigned int))) == NULL)
+		break;
+	    list = tmp;
+	}
+	list[count++] = chunk;
+    }
+    closedir(dir);
+    if (count > 1)
+	qsort(list, count, sizeof(unsigned int), local_chunk_compare);
+    *chunks = list;
+    return count;
+}
+
+static void
+local_unlink(storeSeries *series)
+{
+    if (series->prev)
+	series->prev->next = series->next;
+    else
+	openhead = series->next;
+    if (series->next)
+	series->next->prev = series->prev;
+    else
+	opentail = series->prev;
+    series->prev = series->next = NULL;
+}
+
+/* move an open series to the most recently written end of the list */
+static void
+local_touch(storeSeries *series)
+{
+    if (openhead == series)
+	return;
+    local_unlink(series);
+    if ((series->next = openhead) != NULL)
+	openhead->prev = series;
+    else
+	opentail = series;
+    openhead = series;
+}
+
+static void
+local_shut(storeSeries *series)
+{
+    if (series->ifd >= 0) {
+	close(series->ifd);
+	close(series->vfd);
+	series->ifd = series->vfd = -1;
+	local_unlink(series);
+	nopen--;
+    }
+}
+
+static void
+local_free(storeSeries *series)
+{
+    local_shut(series);
+    sdsfree(series->hash);
+    sdsfree(series->path);
+    free(series);
+}
+
+static void
+local_forget(storeSeries *series)
+{
+    dictDelete(storeseries, series->hash);
+    local_free(series);
+}
+
+/*
+ * Bound the open files and the series held - least recently written
+ * series are closed and forgotten, to be looked up again if written.
+ */
+static void
+local_limit(storeSeries *current)
+{
+    while (nopen > maxfiles && opentail && opentail != current)
+	local_forget(opentail);
+}
+
+static int
+local_open(storeSeries *series)
+{
+    sds			name;
+    int			sts;
+
+    name = local_chunk_name(series->path, series->last, "index");
+    series->ifd = open(name, O_RDWR | O_CREAT, 0644);
+    /* directory removed by an expiry sweep since this series was found */
+    if (series->ifd < 0 && oserror() == ENOENT &&
+	__pmMakePath(series->path, 0755) == 0)
+	series->ifd = open(name, O_RDWR | O_CREAT, 0644);
+    sdsfree(name);
+    if (series->ifd < 0)
+	return -oserror();
+    name = local_chunk_name(series->path, series->last, "values");
+    series->vfd = open(name, O_RDWR | O_CREAT, 0644);
+    sdsfree(name);
+    if (series->vfd < 0) {
+	sts = -oserror();
+	close(series->ifd);
+	series->ifd = -1;
+	return sts;
+    }
+    nopen++;
+    local_touch(series);
+    local_limit(series);
+    return 0;
+}
+
+static storeSeries *
+local_series(const char *hash)
+{
+    storeSeries		*series;
+    unsigned int	*chunks;
+    sds			key = sdsnew(hash);
+    int			count;
+
+    if ((series = dictFetchValue(storeseries, key)) != NULL) {
+	sdsfree(key);
+	return series;
+    }
+    if ((series = calloc(1, sizeof(storeSeries))) == NULL) {
+	sdsfree(key);
+	return NULL;
+    }
+    series->hash = key;
+    series->path = sdscatprintf(sdsempty(), "%s%c%s",
+				storepath, pmPathSeparator(), hash);
+    series->ifd = series->vfd = -1;
+    if ((count = local_chunks(series->path, &chunks)) > 0) {
+	series->first = chunks[0];
+	series->last = chunks[count - 1];
+    } else if (__pmMakePath(series->path, 0755) < 0 && oserror() != EEXIST) {
+	local_free(series);
+	return NULL;
+    }
+    free(chunks);
+    dictAdd(storeseries, key, series);
+    return series;
+}
+
+/* remove whole chunks while stream.maxlen entries remain without them */
+static void
+local_trim(storeSeries *series, unsigned int count)
+{
+    sds			name;
+
+    while (series->first < series->last &&
+	   (series->last - series->first - 1) * chunksize + count >= maxlen) {
+	name = local_chunk_name(series->path, series->first, "index");
+	unlink(name);
+	sdsfree(name);
+	name = local_chunk_name(series->path, series->first, "values");
+	unlink(name);
+	sdsfree(name);
+	series->first++;
+    }
+}
+
+static int
+local_append(const char *hash, sds stamp, sds values)
+{
+    storeSeries		*series;
+    storeHeader		header;
+    storeEntry		entry, tail;
+    struct stat		sbuf;
+    unsigned int	count;
+    off_t		offset;
+    int			sts;
+
+    local_stream_id(stamp, 0, &entry);
+    if ((series = local_series(hash)) == NULL)
+	return -ENOMEM;
+    if (local_compare(&entry, &series->tail) <= 0)
+	return -EEXIST;
+
+    /* lock the current chunk, moving to the next once this one is full */
+    for (;;) {
+	if (series->ifd < 0 && (sts = local_open(series)) < 0)
+	    return sts;
+	local_touch(series);
+	if ((sts = local_lock(series->ifd, F_WRLCK)) < 0)
+	    return sts;
+	if (fstat(series->ifd, &sbuf) < 0)
+	    goto fail;
+	if (sbuf.st_size < (off_t)sizeof(storeHeader)) {
+	    header.magic = STORE_MAGIC;
+	    header.version = STORE_VERSION;
+	    header.chunk = series->last;
+	    header.entrysize = sizeof(storeEntry);
+	    if (pwrite(series->ifd, &header, sizeof(header), 0) != sizeof(header))
+		goto fail;
+	    sbuf.st_size = sizeof(storeHeader);
+	}
+	count = (sbuf.st_size - sizeof(storeHeader)) / sizeof(storeEntry);
+	offset = sizeof(storeHeader) + (off_t)count * sizeof(storeEntry);
+	/* another process may have appended since our last write */
+	if (count > 0 &&
+	    pread(series->ifd, &tail, sizeof(tail), offset - sizeof(tail)) == sizeof(tail))
+	    series->tail = tail;
+	if (count < chunksize)
+	    break;
+	local_lock(series->ifd, F_UNLCK);
+	local_shut(series);
+	series->last++;
+    }
+
+    if (local_compare(&entry, &series->tail) <= 0) {
+	sts = -EEXIST;
+	goto unlock;
+    }
+
+    if (fstat(series->vfd, &sbuf) < 0)
+	goto fail;
+    entry.offset = sbuf.st_size;
+    entry.length = sdslen(values);
+    if (pwrite(series->vfd, values, entry.length, entry.offset) != entry.length)
+	goto fail;
+    if (pwrite(series->ifd, &entry, sizeof(entry), offset) != sizeof(entry))
+	goto fail;
+    series->tail = entry;
+    series->written = time(NULL);
+    local_trim(series, count + 1);
+    sts = 0;
+    goto unlock;
+
+fail:
+    sts = oserror() ? -oserror() : -EIO;
+unlock:
+    local_lock(series->ifd, F_UNLCK);
+    return sts;
+}
+
+/*
+ * Add entries from one chunk between low and high to the reply, most
+ * recent first up to count entries if count is set.  Returns 1 when no
+ * further chunks need to be visited, else zero or a negative error.
+ */
+static int
+local_chunk_range(sds path, unsigned int chunk, storeEntry *low,
+		storeEntry *high, unsigned int count, redisReply *reply)
+{
+    storeHeader		*header;
+    storeEntry		*entries, *entry;
+    struct stat		sbuf;
+    unsigned int	i, nentries;
+    size_t		isize, vsize = 0;
+    char		*imap = NULL, *vmap = NULL;
+    sds			name;
+    int			ifd, vfd = -1, sts = 0;
+
+    name = local_chunk_name(path, chunk, "index");
+    ifd = open(name, O_RDONLY);
+    sdsfree(name);
+    if (ifd < 0)	/* removed since listed, older than maxlen */
+	return 0;
+    name = local_chunk_name(path, chunk, "values");
+    vfd = open(name, O_RDONLY);
+    sdsfree(name);
+    if (vfd < 0 || fstat(ifd, &sbuf) < 0)
+	goto done;
+    isize = sbuf.st_size;
+    if (isize <= sizeof(storeHeader))
+	goto done;
+    /* values are always written ahead of the index entry describing them */
+    if (fstat(vfd, &sbuf) < 0 || (vsize = sbuf.st_size) == 0)
+	goto done;
+    if ((imap = __pmMemoryMap(ifd, isize, 0)) == NULL ||
+	(vmap = __pmMemoryMap(vfd, vsize, 0)) == NULL) {
+	sts = -ENOMEM;
+	goto done;
+    }
+    header = (storeHeader *)imap;
+    if (header->magic != STORE_MAGIC || header->version != STORE_VERSION ||
+	header->entrysize != sizeof(storeEntry)) {
+	sts = -EINVAL;
+	goto done;
+    }
+    entries = (storeEntry *)(imap + sizeof(storeHeader));
+    nentries = (isize - sizeof(storeHeader)) / sizeof(storeEntry);
+
+    if (count == 0) {
+	for (i = local_search(entries, nentries, low, 0); i < nentries; i++) {
+	    entry = &entries[i];
+	    if (local_compare(entry, high) > 0) {
+		sts = 1;
+		break;
+	    }
+	    if (entry->offset + entry->length > vsize)
+		break;
+	    if ((sts = reply_entry(reply, entry, vmap + entry->offset)) < 0)
+		break;
+	}
+    } else {
+	for (i = local_search(entries, nentries, high, 1); i > 0; i--) {
+	    entry = &entries[i - 1];
+	    if (reply->elements >= count || local_compare(entry, low) < 0) {
+		sts = 1;
+		break;
+	    }
+	    if (entry->offset + entry->length > vsize)
+		continue;
+	    if ((sts = reply_entry(reply, entry, vmap + entry->offset)) < 0)
+		break;
+	}
+	if (sts == 0 && reply->elements >= count)
+	    sts = 1;
+    }
+
+done:
+    if (vmap)
+	__pmMemoryUnmap(vmap, vsize);
+    if (imap)
+	__pmMemoryUnmap(imap, isize);
+    if (vfd >= 0)
+	close(vfd);
+    close(ifd);
+    return sts;
+}
+
+/*
+ * Entries from start to end, as XRANGE - or when a count is given, as
+ * XREVRANGE (start being the upper bound) with at most count entries.
+ */
+static redisReply *
+local_range(const char *hash, sds start, sds end, unsigned int count)
+{
+    storeEntry		low, high;
+    redisReply		*reply;
+    unsigned int	*chunks;
+    sds			path;
+    int			i, nchunks, sts = 0;
+
+    if (count) {
+	local_stream_id(start, 1, &high);
+	local_stream_id(end, 0, &low);
+    } else {
+	local_stream_id(start, 0, &low);
+	local_stream_id(end, 1, &high);
+    }
+    if ((reply = reply_create(REDIS_REPLY_ARRAY)) == NULL)
+	return NULL;
+
+    path = sdscatprintf(sdsempty(), "%s%c%s",
+			storepath, pmPathSeparator(), hash);
+    nchunks = local_chunks(path, &chunks);
+    for (i = 0; i < nchunks && sts == 0; i++)
+	sts = local_chunk_range(path, chunks[count ? nchunks - i - 1 : i],
+				&low, &high, count, reply);
+    free(chunks);
+    sdsfree(path);
+
+    if (sts < 0) {
+	reply_free(reply);
+	return NULL;
+    }
+    return reply;
+}
+
+/* remove all chunks of a series not written for stream.expire seconds */
+static void
+local_expire(const char *hash, time_t now)
+{
+    storeSeries		*series;
+    struct stat		sbuf;
+    unsigned int	*chunks;
+    sds			key = sdsnew(hash), path, name;
+    int			count, sts, i;
+
+    series = dictFetchValue(storeseries, key);
+    sdsfree(key);
+    if (series && now - series->written < expire)
+	return;
+
+    path = sdscatprintf(sdsempty(), "%s%c%s",
+			storepath, pmPathSeparator(), hash);
+    count = local_chunks(path, &chunks);
+    if (count > 0) {
+	/* other processes may append - the newest index shows when */
+	name = local_chunk_name(path, chunks[count - 1], "index");
+	sts = stat(name, &sbuf);
+	sdsfree(name);
+	if (sts == 0 && now - sbuf.st_mtime < expire)
+	    goto done;
+    }
+    if (series)
+	local_forget(series);
+    for (i = 0; i < count; i++) {
+	name = local_chunk_name(path, chunks[i], "index");
+	unlink(name);
+	sdsfree(name);
+	name = local_chunk_name(path, chunks[i], "values");
+	unlink(name);
+	sdsfree(name);
+    }
+    rmdir(path);
+    if (pmDebugOptions.series)
+	fprintf(stderr, "%s: expired series %s (%d chunks)\n",
+			"local_expire", hash, count);
+done:
+    free(chunks);
+    sdsfree(path);
+}
+
+/*
+ * Sweep the storage directory for expired series, starting a new pass
+ * at most every SWEEP_INTERVAL seconds (sooner for shorter expiry) and
+ * checking a bounded number of series on each timer callback.
+ */
+static void
+local_expire_timer(void *arg)
+{
+    struct dirent	*dp;
+    time_t		now = time(NULL);
+    unsigned int	i;
+
+    (void)arg;
+    if (sweepdir == NULL) {
+	if (now - sweeptime < (expire < SWEEP_INTERVAL ? expire : SWEEP_INTERVAL))
+	    return;
+	sweeptime = now;
+	if ((sweepdir = opendir(storepath)) == NULL)
+	    return;
+    }
+    for (i = 0; i < SWEEP_ENTRIES; i++) {
+	if ((dp = readdir(sweepdir)) == NULL) {
+	    closedir(sweepdir);
+	    sweepdir = NULL;
+	    break;
+	}
+	if (dp->d_name[0] != '.')
+	    local_expire(dp->d_name, now);
+    }
+}
+
+static int
+local_setup(struct dict *config)
+{
+    sds			option;
+
+    if ((option = pmIniFileLookup(config, "pmseries", "storage.path")))
+	storepath = sdsdup(option);
+    else
+	storepath = sdscatprintf(sdsempty(), "%s%cpmproxy%cseries",
+			pmGetConfig("PCP_TMP_DIR"), pmPathSeparator(),
+			pmPathSeparator());
+    if (__pmMakePath(storepath, 0755) < 0 && oserror() != EEXIST) {
+	sdsfree(storepath);
+	storepath = NULL;
+	return -oserror();
+    }
+
+    chunksize = 1024;
+    if ((option = pmIniFileLookup(config, "pmseries", "storage.chunk")))
+	chunksize = strtoul(option, NULL, 10);
+    if (chunksize == 0)
+	chunksize = 1;
+    maxfiles = 256;
+    if ((option = pmIniFileLookup(config, "pmseries", "storage.files")))
+	maxfiles = strtoul(option, NULL, 10);
+    maxlen = 8640;	/* 1 day, ~10 second delta */
+    if ((option = pmIniFileLookup(config, "pmseries", "stream.maxlen")))
+	maxlen = strtoul(option, NULL, 10);
+    expire = 86400;	/* 1 day (without changes) */
+    if ((option = pmIniFileLookup(config, "pmseries", "stream.expire")))
+	expire = strtoul(option, NULL, 10);
+
+    storeseries = dictCreate(&sdsKeyDictCallBacks, NULL);
+    if (expire) {
+	sweeptime = time(NULL);
+	sweeptimer = pmWebTimerRegister(local_expire_timer, NULL);
+    }
+    return 0;
+}
+
+static void
+local_close(void)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+    storeSeries		*series;
+
+    if (sweeptimer >= 0) {
+	pmWebTimerRelease(sweeptimer);
+	sweeptimer = -1;
+    }
+    if (sweepdir) {
+	closedir(sweepdir);
+	sweepdir = NULL;
+    }
+    if (storeseries) {
+	iterator = dictGetSafeIterator(storeseries);
+	while ((entry = dictNext(iterator)) != NULL) {
+	    series = (storeSeries *)dictGetVal(entry);
+	    local_free(series);
+	}
+	dictReleaseIterator(iterator);
+	dictRelease(storeseries);
+	storeseries = NULL;
+    }
+    sdsfree(storepath);
+    storepath = NULL;
+}
+
+static const seriesStoreOps backends[] = {
+    { .name	= "local",
+      .setup	= local_setup,
+      .append	= local_append,
+      .range	= local_range,
+      .close	= local_close },
+};
+
+void
+seriesStoreInit(struct dict *config)
+{
+    sds			option;
+    char		errmsg[PM_MAXERRMSGLEN];
+    unsigned int	i;
+    int			sts;
+
+    if (configured)
+	return;
+    configured = 1;
+
+    if ((option = pmIniFileLookup(config, "pmseries", "storage")) == NULL ||
+	strcmp(option, "redis") == 0)
+	return;
+    for (i = 0; i < ARRAY_SIZE(backends); i++)
+	if (strcmp(option, backends[i].name) == 0)
+	    break;
+    if (i == ARRAY_SIZE(backends)) {
+	pmNotifyErr(LOG_ERR, "unknown pmseries storage \"%s\", "
+			"values are stored in the key server", option);
+	return;
+    }
+    if ((sts = backends[i].setup(config)) < 0) {
+	pmNotifyErr(LOG_ERR, "cannot setup %s pmseries storage (%s), "
+			"values are stored in the key server", backends[i].name,
+			pmErrStr_r(sts, errmsg, sizeof(errmsg)));
+	return;
+    }
+    store = &backends[i];
+}
+
+int
+seriesStoreEnabled(void)
+{
+    return store != NULL;
+}
+
+int
+seriesStoreAppend(const char *hash, sds stamp, sds values)
+{
+    if (store == NULL)
+	return -ENOTSUP;
+    return store->append(hash, stamp, values);
+}
+
+static void
+store_reply_free(storeReply *reply)
+{
+#ifdef HAVE_LIBUV
+    sdsfree(reply->hash);
+    sdsfree(reply->start);
+    sdsfree(reply->end);
+#endif
+    reply_free(reply->reply);
+    free(reply);
+}
+
+/* pass replies to their callbacks in the order ranges were requested */
+static void
+store_deliver(void)
+{
+    storeReply		*reply;
+
+    if (delivering)
+	return;
+    delivering = 1;
+    while ((reply = pending) != NULL && reply->ready) {
+	if ((pending = reply->next) == NULL)
+	    lastpending = &pending;
+	reply->callback(NULL, reply->reply, reply->arg);
+	store_reply_free(reply);
+    }
+    delivering = 0;
+}
+
+#ifdef HAVE_LIBUV
+/* read chunk files for a range on a libuv threadpool thread */
+static void
+store_range_work(uv_work_t *work)
+{
+    storeReply		*reply = (storeReply *)work->data;
+
+    reply->reply = store->range(reply->hash, reply->start, reply->end,
+				reply->count);
+}
+
+static void
+store_range_done(uv_work_t *work, int status)
+{
+    storeReply		*reply = (storeReply *)work->data;
+
+    (void)status;
+    reply->ready = 1;
+    store_deliver();
+}
+#endif
+
+/*
+ * Ranges are read from the chunk files on the libuv threadpool (else
+ * synchronously, without an event loop).  Replies are passed to their
+ * callbacks in request order from a queue here, on the event loop -
+ * callbacks commonly issue the next range request, which must not
+ * recurse back into the callback.
+ */
+void
+seriesStoreRange(void *events, const char *hash, sds start, sds end,
+		unsigned int count, redisClusterCallbackFn *callback, void *arg)
+{
+    storeReply		*reply;
+
+    if (store == NULL || (reply = calloc(1, sizeof(storeReply))) == NULL) {
+	callback(NULL, NULL, arg);
+	return;
+    }
+    reply->callback = callback;
+    reply->arg = arg;
+    *lastpending = reply;
+    lastpending = &reply->next;
+
+#ifdef HAVE_LIBUV
+    if (events) {
+	reply->hash = sdsnew(hash);
+	reply->start = sdsdup(start);
+	reply->end = sdsdup(end);
+	reply->count = count;
+	reply->work.data = reply;
+	if (uv_queue_work((uv_loop_t *)events, &reply->work,
+			store_range_work, store_range_done) == 0)
+	    return;
+    }
+#else
+    (void)events;
+#endif
+
+    reply->reply = store->range(hash, start, end, count);
+    reply->ready = 1;
+    store_deliver();
+}
+
+void
+seriesStoreClose(void)
+{
+    if (store)
+	store->close();
+    store = NULL;
+    configured = 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#ifndef SERIES_STORE_H
+#define SERIES_STORE_H
+
+#include <hiredis-cluster/hircluster.h>
+#include "sds.h"
+#include "dict.h"
+
+/*
+ * Storage backends for time series values (the pcp:values:series:*
+ * streams).  By default values are kept in the key server, otherwise
+ * an embedded backend selected by the pmseries "storage" setting is
+ * used - appends are identified by series hash and stream timestamp,
+ * with the instance:value pairs already in the key server protocol
+ * encoding, and ranges are returned as XRANGE/XREVRANGE style replies.
+ */
+typedef struct seriesStoreOps {
+    const char		*name;
+    int			(*setup)(struct dict *);
+    int			(*append)(const char *, sds, sds);
+    redisReply		*(*range)(const char *, sds, sds, unsigned int);
+    void		(*close)(void);
+} seriesStoreOps;
+
+extern void seriesStoreInit(struct dict *);
+extern int seriesStoreEnabled(void);
+extern int seriesStoreAppend(const char *, sds, sds);
+extern void seriesStoreRange(void *, const char *, sds, sds, unsigned int,
+		redisClusterCallbackFn *, void *);
+extern void seriesStoreClose(void);
+
+#endif	/* SERIES_STORE_H */
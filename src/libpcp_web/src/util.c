@@ -600,7 +600,6 @@ pmwebapi_instance_hash(indom_t *ip, instance_t *instance)
 sds
 pmwebapi_new_context(context_t *cp)
 {
-    char		labels[PM_MAXLABELJSONLEN];
     char		pmmsg[PM_MAXERRMSGLEN];
     sds			msg = NULL;
     int			sts;
@@ -616,7 +615,24 @@ pmwebapi_new_context(context_t *cp)
 	else
 	    infofmt(msg, "cannot open archive \"%s\": %s",
 		    cp->name.sds, pmErrStr_r(sts, pmmsg, sizeof(pmmsg)));
-    } else if ((sts = pmwebapi_source_meta(cp, labels, sizeof(labels))) < 0) {
+	return msg;
+    }
+    return pmwebapi_attach_context(cp);
+}
+
+/*
+ * Complete setup of a context around its (current) PMAPI context,
+ * which may have been newly created or shared with other contexts.
+ */
+sds
+pmwebapi_attach_context(context_t *cp)
+{
+    char		labels[PM_MAXLABELJSONLEN];
+    char		pmmsg[PM_MAXERRMSGLEN];
+    sds			msg = NULL;
+    int			sts;
+
+    if ((sts = pmwebapi_source_meta(cp, labels, sizeof(labels))) < 0) {
 	infofmt(msg, "failed to get context labels: %s",
 		    pmErrStr_r(sts, pmmsg, sizeof(pmmsg)));
     } else if ((sts = pmwebapi_source_hash(cp->name.hash, labels, sts)) < 0) {
@@ -967,6 +983,8 @@ pmwebapi_add_instances_labels(struct context *context, struct indom *indom)
 			pmErrStr_r(sts, errmsg, sizeof(errmsg)));
 	    indom->labelset = NULL;
 	    indom->updated = sts = 0;
+	} else if (indom->labelset) {
+	    indom->version++;
 	}
     }
 
@@ -991,6 +1009,7 @@ pmwebapi_add_instances_labels(struct context *context, struct indom *indom)
 	    if (instance->labelset)
 		pmFreeLabelSets(instance->labelset, 1);
 	    instance->labelset = labels;
+	    indom->version++;
 
 	    pmwebapi_instance_hash(indom, instance);
 
@@ -1050,6 +1069,7 @@ pmwebapi_new_instance(indom_t *indom, int inst, sds name)
     pmwebapi_string_hash(instance->name.id, name, sdslen(name));
     pmwebapi_instance_hash(indom, instance);
     dictAdd(indom->insts, &inst, (void *)instance);
+    indom->version++;
     return instance;
 }
 
@@ -1067,6 +1087,7 @@ pmwebapi_add_instance(struct indom *indom, int inst, char *name)
 	    instance->name.sds = sdscatlen(instance->name.sds, name, length);
 	    pmwebapi_string_hash(instance->name.id, name, length);
 	    pmwebapi_instance_hash(indom, instance);
+	    indom->version++;
 	}
 	return instance;
     }
@@ -1133,6 +1154,7 @@ pmwebapi_free_metric(metric_t *metric)
     labellist_t		*list = metric->labellist;
     int			i, type = metric->desc.type;
 
+    pmwebapi_free_scrape(metric);
     sdsfree(metric->helptext);
     sdsfree(metric->oneline);
     sdsfree(metric->labels);
@@ -1165,6 +1187,54 @@ pmwebapi_free_metric(metric_t *metric)
     free(metric);
 }
 
+void
+pmwebapi_free_exposition(exposition_t *expose, int count)
+{
+    int			i;
+
+    if (expose == NULL)
+	return;
+    for (i = 0; i < count; i++) {
+	sdsfree(expose[i].series);
+	sdsfree(expose[i].labels);
+	sdsfree(expose[i].header);
+	sdsfree(expose[i].prefix);
+    }
+    free(expose);
+}
+
+/* drop all cached scrape expositions for a metric, e.g. on label change */
+void
+pmwebapi_free_scrape(metric_t *metric)
+{
+    scrape_t		*scrape = metric->scrape;
+    exposition_t	*expose;
+    int			i;
+
+    if (scrape) {
+	for (i = 0; i < metric->numnames; i++) {
+	    expose = &scrape->names[i];
+	    sdsfree(expose->series);
+	    sdsfree(expose->labels);
+	    sdsfree(expose->header);
+	    sdsfree(expose->prefix);
+	}
+	sdsfree(scrape->sem);
+	sdsfree(scrape->type);
+	sdsfree(scrape->units);
+	free(scrape);
+	metric->scrape = NULL;
+    }
+
+    if (metric->desc.indom == PM_INDOM_NULL || metric->u.vlist == NULL)
+	return;
+    for (i = 0; i < metric->u.vlist->listcount; i++) {
+	pmwebapi_free_exposition(metric->u.vlist->value[i].expose,
+				metric->numnames);
+	metric->u.vlist->value[i].expose = NULL;
+    }
+}
+
 struct metric *
 pmwebapi_new_metric(context_t *cp, const sds name, pmDesc *desc,
 		int numnames, char **names)
@@ -1298,6 +1368,8 @@ pmwebapi_add_item_labels(struct context *context, struct metric *metric)
 			pmID_item(metric->desc.pmid),
 			pmErrStr_r(sts, errmsg, sizeof(errmsg)));
 	    metric->labelset = NULL;
+	} else if (metric->labelset) {
+	    pmwebapi_free_scrape(metric);
 	}
     }
 }
@@ -1313,6 +1385,7 @@ pmwebapi_metric_help(struct context *context, struct metric *metric)
 	sts = pmLookupText(pmid, PM_TEXT_ONELINE | PM_TEXT_DIRECT, &text);
 	if (sts == 0) {
 	    metric->oneline = sdsnew(text);
+	    pmwebapi_free_scrape(metric);
 	    free(text);
 	} else if (sts == PM_ERR_IPC) {
 	    context->setup = 0;
@@ -53,6 +53,7 @@ extern void pmwebapi_metric_hash(struct metric *);
 extern void pmwebapi_instance_hash(struct indom *, struct instance *);
 
 extern sds pmwebapi_new_context(struct context *);
+extern sds pmwebapi_attach_context(struct context *);
 extern void pmwebapi_locate_context(struct context *);
 extern void pmwebapi_setup_context(struct context *);
 extern void pmwebapi_release_context(struct context *);
@@ -104,6 +105,9 @@ extern int pmwebapi_add_valueset(struct metric *, pmValueSet *);
 extern void pmwebapi_free_metric(struct metric *);
 extern void pmwebapi_metric_help(struct context *, struct metric *);
 
+extern void pmwebapi_free_exposition(struct exposition *, int);
+extern void pmwebapi_free_scrape(struct metric *);
+
 extern void pmwebapi_event_flags(void);
 extern void pmwebapi_event_missed(void);
 extern sds pmwebapi_usectimestamp(sds, struct timeval *);
@@ -18,6 +18,7 @@
 #include "schema.h"
 #include "util.h"
 #include "load.h"
+#include "sha1.h"
 #ifdef HAVE_REGEX_H
 #include <regex.h>
 #endif
@@ -32,6 +33,12 @@ static unsigned int default_timeout;	/* timeout in milliseconds */
 #define DEFAULT_BATCHSIZE 256
 static unsigned int default_batchsize;	/* for groups of metrics */
 
+#define DEFAULT_SCRAPE_TIMEOUT 60000
+static unsigned int default_scrape_timeout; /* anonymous scrape reuse */
+
+#define DEFAULT_UPSTREAM_CLIENTS 32
+static unsigned int default_upstream_clients; /* contexts per upstream */
+
 /* constant string keys (initialized during setup) */
 static sds PARAM_HOSTNAME, PARAM_HOSTSPEC, PARAM_CTXNUM, PARAM_CTXID,
            PARAM_POLLTIME, PARAM_PREFIX, PARAM_MNAME, PARAM_MNAMES,
@@ -39,17 +46,21 @@ static sds PARAM_HOSTNAME, PARAM_HOSTSPEC, PARAM_CTXNUM, PARAM_CTXID,
            PARAM_INAME, PARAM_MVALUE, PARAM_TARGET, PARAM_EXPR, PARAM_MATCH;
 static sds AUTH_USERNAME, AUTH_PASSWORD;
 static sds EMPTYSTRING, LOCALHOST, WORK_TIMER, POLL_TIMEOUT, BATCHSIZE;
+static sds SCRAPE_TIMEOUT, UPSTREAM_CLIENTS;
 
 enum matches { MATCH_EXACT, MATCH_GLOB, MATCH_REGEX };
 enum profile { PROFILE_ADD, PROFILE_DEL };
 
 typedef struct webgroups {
     struct dict		*contexts;
+    struct dict		*scrapes;	/* anonymous scrape contexts */
     mmv_registry_t	*metrics;
     void		*metrics_handle;
     struct dict		*config;
     uv_loop_t		*events;
     unsigned int	active;
+    unsigned int	worker;		/* index of this worker process */
+    unsigned int	nworkers;	/* context identifier modulus */
     uv_timer_t		timer;
     uv_mutex_t		mutex;
     int			stats_timer;
@@ -69,6 +80,343 @@ webgroups_lookup(pmWebGroupModule *module)
     return groups;
 }
 
+/*
+ * Upstream PMAPI contexts, shared by web contexts using the same hostspec
+ * and credentials so that many clients watching one host do not each hold
+ * a pmcd connection.  Concurrent fetches on an upstream context are also
+ * merged - callers arriving while a fetch is in progress add their pmIDs
+ * to the next batch, which is fetched once and split back out per caller.
+ */
+typedef struct upbatch {
+    unsigned int	refcount;	/* callers waiting on or using batch */
+    unsigned int	done;		/* batch fetch has completed */
+    int			sts;		/* batch fetch status */
+    int			numpmid;
+    int			maxpmid;
+    pmID		*pmids;		/* union of all callers pmIDs */
+    pmResult		*result;
+} upbatch_t;
+
+typedef struct upstream {
+    struct upstream	*next;		/* more upstreams for this source */
+    sds			key;		/* hostspec and credentials */
+    int			context;	/* shared PMAPI context handle */
+    unsigned int	refcount;	/* web contexts using this upstream */
+    unsigned int	fetching;	/* a batch fetch is in progress */
+    upbatch_t		*batch;		/* batch accepting more pmIDs */
+    uv_cond_t		cond;
+} upstream_t;
+
+static struct dict	*upstreams;	/* key -> list of upstream_t */
+static uv_mutex_t	upstreams_lock;
+static unsigned int	upstreams_count;	/* shared PMAPI contexts */
+static unsigned int	upstreams_clients;	/* web contexts sharing them */
+static unsigned long long upstreams_merged;	/* fetches done by others */
+
+static sds
+webgroup_upstream_key(context_t *cp)
+{
+    return sdscatfmt(sdsempty(), "%S\n%S\n%S", cp->name.sds,
+		cp->username ? cp->username : EMPTYSTRING,
+		cp->password ? cp->password : EMPTYSTRING);
+}
+
+static void
+webgroup_upstream_release(context_t *cp)
+{
+    upstream_t		*up = cp->upstream, *list;
+
+    if (up == NULL)
+	return;
+    cp->upstream = NULL;
+    cp->context = -1;
+
+    uv_mutex_lock(&upstreams_lock);
+    upstreams_clients--;
+    if (--up->refcount > 0) {
+	uv_mutex_unlock(&upstreams_lock);
+	return;
+    }
+    if ((list = (upstream_t *)dictFetchValue(upstreams, up->key)) == up) {
+	if (up->next)
+	    dictReplace(upstreams, up->key, up->next);
+	else
+	    dictDelete(upstreams, up->key);
+    } else {
+	while (list && list->next != up)
+	    list = list->next;
+	if (list)
+	    list->next = up->next;
+    }
+    upstreams_count--;
+    uv_mutex_unlock(&upstreams_lock);
+
+    if (pmDebugOptions.http || pmDebugOptions.libweb)
+	fprintf(stderr, "releasing upstream context %d (%p)\n",
+			up->context, up);
+
+    pmDestroyContext(up->context);
+    uv_cond_destroy(&up->cond);
+    sdsfree(up->key);
+    free(up);
+}
+
+/*
+ * Attach a new web context to an upstream context with spare capacity,
+ * else establish a new upstream context for it (and later arrivals).
+ */
+static sds
+webgroup_upstream_attach(context_t *cp)
+{
+    upstream_t		*up, *list;
+    char		errbuf[PM_MAXERRMSGLEN];
+    sds			key, msg = NULL;
+    int			sts;
+
+    key = webgroup_upstream_key(cp);
+
+    uv_mutex_lock(&upstreams_lock);
+    list = (upstream_t *)dictFetchValue(upstreams, key);
+    for (up = list; up != NULL; up = up->next)
+	if (up->refcount < default_upstream_clients)
+	    break;
+    if (up != NULL) {
+	up->refcount++;
+	upstreams_clients++;
+	uv_mutex_unlock(&upstreams_lock);
+	sdsfree(key);
+
+	cp->upstream = up;
+	cp->context = up->context;
+	if ((sts = pmUseContext(cp->context)) < 0) {
+	    infofmt(msg, "cannot use shared context: %s",
+			pmErrStr_r(sts, errbuf, sizeof(errbuf)));
+	    return msg;
+	}
+	if ((msg = pmwebapi_attach_context(cp)) != NULL) {
+	    /* shared connection may have been lost, retry once */
+	    if ((sts = pmReconnectContext(cp->context)) < 0)
+		return msg;
+	    sdsfree(msg);
+	    msg = pmwebapi_attach_context(cp);
+	}
+	if (msg == NULL && (pmDebugOptions.http || pmDebugOptions.libweb))
+	    fprintf(stderr, "context %d sharing upstream context %d (%p)\n",
+			cp->randomid, up->context, up);
+	return msg;
+    }
+    uv_mutex_unlock(&upstreams_lock);
+
+    /* no upstream context with capacity, connect without lock held */
+    if ((msg = pmwebapi_new_context(cp)) != NULL ||
+	(up = (upstream_t *)calloc(1, sizeof(upstream_t))) == NULL) {
+	sdsfree(key);	/* on allocation failure context stays private */
+	return msg;
+    }
+    up->key = key;
+    up->context = cp->context;
+    up->refcount = 1;
+    uv_cond_init(&up->cond);
+
+    uv_mutex_lock(&upstreams_lock);
+    if ((list = (upstream_t *)dictFetchValue(upstreams, key)) != NULL) {
+	up->next = list->next;
+	list->next = up;
+    } else {
+	dictAdd(upstreams, key, up);
+    }
+    upstreams_count++;
+    upstreams_clients++;
+    uv_mutex_unlock(&upstreams_lock);
+
+    cp->upstream = up;
+    return NULL;
+}
+
+static sds
+webgroup_connect_context(context_t *cp)
+{
+    if (default_upstream_clients > 1 && cp->type == PM_CONTEXT_HOST)
+	return webgroup_upstream_attach(cp);
+    return pmwebapi_new_context(cp);
+}
+
+/*
+ * Instance profiles, derived metrics and metric stores modify PMAPI
+ * context state, so a web context using these is moved from any shared
+ * upstream onto its own copy.
+ */
+static int
+webgroup_private_context(context_t *cp, sds *message)
+{
+    char		errbuf[PM_MAXERRMSGLEN];
+    int			sts;
+
+    if (cp->upstream == NULL)
+	return 0;
+    if ((sts = pmDupContext()) < 0) {
+	infofmt(*message, "cannot create private context: %s",
+			pmErrStr_r(sts, errbuf, sizeof(errbuf)));
+	return sts;
+    }
+    webgroup_upstream_release(cp);
+    cp->context = sts;
+    return 0;
+}
+
+static void
+webgroup_free_context(context_t *cp)
+{
+    webgroup_upstream_release(cp);
+    pmwebapi_free_context(cp);
+}
+
+static int
+webgroup_batch_add(upbatch_t *batch, int numpmid, pmID *pmidlist)
+{
+    pmID		*pmids;
+    int			i, j, size;
+
+    for (i = 0; i < numpmid; i++) {
+	for (j = 0; j < batch->numpmid; j++)
+	    if (batch->pmids[j] == pmidlist[i])
+		break;
+	if (j < batch->numpmid)
+	    continue;
+	if (batch->numpmid == batch->maxpmid) {
+	    size = batch->maxpmid ? batch->maxpmid * 2 : numpmid;
+	    if ((pmids = realloc(batch->pmids, size * sizeof(pmID))) == NULL)
+		return -ENOMEM;
+	    batch->pmids = pmids;
+	    batch->maxpmid = size;
+	}
+	batch->pmids[batch->numpmid++] = pmidlist[i];
+    }
+    return 0;
+}
+
+static void
+webgroup_batch_put(upbatch_t *batch)
+{
+    unsigned int	refcount;
+
+    uv_mutex_lock(&upstreams_lock);
+    refcount = --batch->refcount;
+    uv_mutex_unlock(&upstreams_lock);
+
+    if (refcount == 0) {
+	if (batch->result)
+	    pmFreeResult(batch->result);
+	free(batch->pmids);
+	free(batch);
+    }
+}
+
+/* extract one callers values, in the order requested, from a batch */
+static int
+webgroup_batch_split(upbatch_t *batch, int numpmid, pmID *pmidlist,
+		pmResult **resultp)
+{
+    pmResult		*result, *shared = batch->result;
+    size_t		size;
+    int			i, j;
+
+    size = sizeof(pmResult) + (numpmid - 1) * sizeof(pmValueSet *);
+    if ((result = (pmResult *)malloc(size)) == NULL)
+	return -ENOMEM;
+    result->timestamp = shared->timestamp;
+    result->numpmid = numpmid;
+    for (i = 0; i < numpmid; i++) {
+	for (j = 0; j < shared->numpmid; j++)
+	    if (batch->pmids[j] == pmidlist[i])
+		break;
+	if (j == shared->numpmid) {
+	    free(result);
+	    return PM_ERR_TOOBIG;
+	}
+	result->vset[i] = shared->vset[j];
+    }
+    *resultp = result;
+    return numpmid;
+}
+
+/*
+ * Fetch on behalf of a web context - directly for a private context, or
+ * via a (possibly merged) batch fetch on a shared upstream context.  The
+ * result must be released using webgroup_free_result with the batch.
+ */
+static int
+webgroup_fetch_result(context_t *cp, int numpmid, pmID *pmidlist,
+		pmResult **resultp, upbatch_t **batchp)
+{
+    upstream_t		*up = cp->upstream;
+    upbatch_t		*batch;
+    pmResult		*result;
+    int			sts, leader = 0;
+
+    *batchp = NULL;
+    if (up == NULL)
+	return pmFetch(numpmid, pmidlist, resultp);
+
+    uv_mutex_lock(&upstreams_lock);
+    if ((batch = up->batch) == NULL) {
+	if ((batch = (upbatch_t *)calloc(1, sizeof(upbatch_t))) == NULL) {
+	    uv_mutex_unlock(&upstreams_lock);
+	    return -ENOMEM;
+	}
+	up->batch = batch;
+    }
+    if (webgroup_batch_add(batch, numpmid, pmidlist) < 0) {
+	uv_mutex_unlock(&upstreams_lock);
+	return -ENOMEM;
+    }
+    batch->refcount++;
+
+    while (batch->done == 0) {
+	if (up->fetching) {
+	    uv_cond_wait(&up->cond, &upstreams_lock);
+	    continue;
+	}
+	/* no fetch in progress, so this caller fetches for the batch */
+	up->fetching = 1;
+	if (up->batch == batch)
+	    up->batch = NULL;
+	uv_mutex_unlock(&upstreams_lock);
+
+	sts = pmFetch(batch->numpmid, batch->pmids, &result);
+
+	uv_mutex_lock(&upstreams_lock);
+	batch->result = (sts >= 0) ? result : NULL;
+	batch->sts = sts;
+	batch->done = 1;
+	up->fetching = 0;
+	uv_cond_broadcast(&up->cond);
+	leader = 1;
+    }
+    if (leader == 0)
+	upstreams_merged++;
+    uv_mutex_unlock(&upstreams_lock);
+
+    if ((sts = batch->sts) >= 0)
+	sts = webgroup_batch_split(batch, numpmid, pmidlist, resultp);
+    if (sts < 0)
+	webgroup_batch_put(batch);
+    else
+	*batchp = batch;
+    return sts;
+}
+
+static void
+webgroup_free_result(pmResult *result, upbatch_t *batch)
+{
+    if (batch == NULL) {
+	pmFreeResult(result);
+    } else {
+	free(result);
+	webgroup_batch_put(batch);
+    }
+}
+
 static int
 webgroup_deref_context(struct context *cp)
 {
@@ -87,7 +435,7 @@ webgroup_release_context(uv_handle_t *handle)
     if (pmDebugOptions.http || pmDebugOptions.libweb)
 	fprintf(stderr, "releasing context %p [refcount=%u]\n",
 			context, context->refcount);
-    pmwebapi_free_context(context);
+    webgroup_free_context(context);
 }
 
 static void
@@ -219,10 +567,14 @@ webgroup_new_context(pmWebGroupSettings *sp, dict *params,
     cp->timeout = polltime;
 
     uv_mutex_lock(&groups->mutex);
-    if ((cp->randomid = random()) < 0 ||
+    cp->randomid = random();
+    if (groups->nworkers > 1)	/* identify the owning worker process */
+	cp->randomid = (cp->randomid % (INT_MAX / groups->nworkers)) *
+			groups->nworkers + groups->worker;
+    if (cp->randomid < 0 ||
 	dictFind(groups->contexts, &cp->randomid) != NULL) {
 	infofmt(*message, "random number failure on new web context");
-	pmwebapi_free_context(cp);
+	webgroup_free_context(cp);
 	*status = -ESRCH;
 	uv_mutex_unlock(&groups->mutex);
 	return NULL;
@@ -233,13 +585,13 @@ webgroup_new_context(pmWebGroupSettings *sp, dict *params,
     cp->realm = sdscatfmt(sdsempty(), "pmapi/%i", cp->randomid);
     if (cp->name.sds == NULL || cp->origin == NULL || cp->realm == NULL) {
 	infofmt(*message, "out-of-memory on new web context");
-	pmwebapi_free_context(cp);
+	webgroup_free_context(cp);
 	*status = -ENOMEM;
 	return NULL;
     }
 
     if (webgroup_access(cp, cp->name.sds, params, status, message, arg) < 0) {
-	pmwebapi_free_context(cp);
+	webgroup_free_context(cp);
 	return NULL;
     }
     access.password = cp->password;
@@ -247,13 +599,13 @@ webgroup_new_context(pmWebGroupSettings *sp, dict *params,
     access.realm = cp->realm;
     if (sp->callbacks.on_check &&
         sp->callbacks.on_check(cp->origin, &access, status, message, arg)) {
-  	pmwebapi_free_context(cp);
+  	webgroup_free_context(cp);
   	return NULL;
     }
 
-    if ((*message = pmwebapi_new_context(cp)) != NULL) {
+    if ((*message = webgroup_connect_context(cp)) != NULL) {
 	*status = -ENOTCONN;
-	pmwebapi_free_context(cp);
+	webgroup_free_context(cp);
 	return NULL;
     }
     uv_mutex_lock(&groups->mutex);
@@ -280,6 +632,7 @@ webgroup_garbage_collect(struct webgroups *groups)
     dictIterator        *iterator;
     dictEntry           *entry;
     context_t		*cp;
+    unsigned int	randomid;
 
     if (pmDebugOptions.http || pmDebugOptions.libweb)
 	fprintf(stderr, "%s: started\n", "webgroup_garbage_collect");
@@ -299,6 +652,21 @@ webgroup_garbage_collect(struct webgroups *groups)
 	    }
 	}
 	dictReleaseIterator(iterator);
+
+	/* drop anonymous scrape entries for contexts no longer in use */
+	if (groups->scrapes) {
+	    iterator = dictGetSafeIterator(groups->scrapes);
+	    while ((entry = dictNext(iterator)) != NULL) {
+		randomid = (unsigned int)(uintptr_t)dictGetVal(entry);
+		cp = (context_t *)dictFetchValue(groups->contexts, &randomid);
+		if (cp != NULL && cp->garbage == 0)
+		    continue;
+		if (pmDebugOptions.http || pmDebugOptions.libweb)
+		    fprintf(stderr, "GC scrape context %u\n", randomid);
+		dictDelete(groups->scrapes, dictGetKey(entry));
+	    }
+	    dictReleaseIterator(iterator);
+	}
 	uv_mutex_unlock(&groups->mutex);
     }
 
@@ -320,6 +688,12 @@ refresh_maps_metrics(void *data)
 	    NULL, dictSize(labelsmap));
 	mmv_stats_set(groups->metrics_handle, "instmap.size",
 	    NULL, dictSize(instmap));
+	mmv_stats_set(groups->metrics_handle, "upstream.contexts",
+	    NULL, upstreams_count);
+	mmv_stats_set(groups->metrics_handle, "upstream.clients",
+	    NULL, upstreams_clients);
+	mmv_stats_set(groups->metrics_handle, "upstream.merged",
+	    NULL, upstreams_merged);
     }
 }
 
@@ -348,6 +722,7 @@ webgroup_use_context(struct context *cp, int *status, sds *message, void *arg)
 		return NULL;
 	    }
 	    cp->setup = 1;
+	    cp->version++;	/* invalidate any cached metadata */
 	}
 	if ((sts = pmUseContext(cp->context)) < 0) {
 	    infofmt(*message, "cannot use existing context: %s",
@@ -573,6 +948,8 @@ pmWebGroupDerive(pmWebGroupSettings *settings, sds id, dict *params, void *arg)
     if (!(cp = webgroup_lookup_context(settings, &id, params, &sts, &msg, arg)))
 	goto done;
     id = cp->origin;
+    if ((sts = webgroup_private_context(cp, &msg)) < 0)
+	goto done;
 
     if (expr && !metric) {	/* configuration file mode */
 	if (pmDebugOptions.libweb)
@@ -660,12 +1037,14 @@ webgroup_fetch(pmWebGroupSettings *settings, context_t *cp,
     pmWebValueSet	webvalueset;
     pmWebValue		webvalue;
     pmResult		*result;
+    upbatch_t		*batch;
     char		err[PM_MAXERRMSGLEN];
     sds			v = sdsempty(), series = NULL;
     sds			id = cp->origin;
     int			i, j, k, sts, inst, type, status = 0;
 
-    if ((sts = pmFetch(numpmid, pmidlist, &result)) >= 0) {
+    sts = webgroup_fetch_result(cp, numpmid, pmidlist, &result, &batch);
+    if (sts >= 0) {
 	webresult.seconds = result->timestamp.tv_sec;
 	webresult.nanoseconds = result->timestamp.tv_usec * 1000;
 
@@ -737,7 +1116,7 @@ webgroup_fetch(pmWebGroupSettings *settings, context_t *cp,
 		}
 	    }
 	}
-	pmFreeResult(result);
+	webgroup_free_result(result, batch);
     } else if (sts == PM_ERR_IPC) {
 	cp->setup = 0;
     }
@@ -1159,6 +1538,8 @@ pmWebGroupProfile(pmWebGroupSettings *settings, sds id, dict *params, void *arg)
     if (!(cp = webgroup_lookup_context(settings, &id, params, &sts, &msg, arg)))
 	goto done;
     id = cp->origin;
+    if ((sts = webgroup_private_context(cp, &msg)) < 0)
+	goto done;
 
     if (expr == NULL) {
 	infofmt(msg, "invalid profile parameters");
@@ -1691,6 +2072,62 @@ scrape_instance_labelsets(metric_t *metric, indom_t *indom, instance_t *inst,
     sdsclear(labels->buffer);
 }
 
+/*
+ * Metric metadata strings, series identifiers and converted labels are
+ * cached with each metric (and each metric instance value) until the
+ * context or instance domain metadata version changes, such that most
+ * scrapes need only encode new values into the precompiled expositions.
+ */
+static scrape_t *
+scrape_metric_cache(context_t *cp, metric_t *metric)
+{
+    scrape_t		*scrape = metric->scrape;
+    char		buffer[64];
+    int			i;
+
+    if (scrape && scrape->version == cp->version)
+	return scrape;
+
+    pmwebapi_free_scrape(metric);
+    if ((scrape = calloc(1, sizeof(scrape_t) +
+			metric->numnames * sizeof(exposition_t))) == NULL)
+	return NULL;
+    scrape->version = cp->version;
+    scrape->sem = sdsnew(pmwebapi_semantics_str(metric, buffer, sizeof(buffer)));
+    scrape->type = sdsnew(pmwebapi_type_str(metric, buffer, sizeof(buffer)));
+    scrape->units = sdsnew(pmwebapi_units_str(metric, buffer, sizeof(buffer)));
+
+    if (metric->labels == NULL)
+	pmwebapi_metric_hash(metric);
+    for (i = 0; i < metric->numnames; i++) {
+	scrape->names[i].version = cp->version;
+	scrape->names[i].series = pmwebapi_hash_sds(NULL, metric->names[i].hash);
+    }
+    metric->scrape = scrape;
+    return scrape;
+}
+
+static exposition_t *
+scrape_value_cache(context_t *cp, metric_t *metric, indom_t *indom,
+		value_t *value)
+{
+    int			i;
+
+    /* either version changing alone invalidates - so never sum them */
+    if (value->expose && value->expose[0].version == cp->version &&
+	value->expose[0].indomversion == indom->version)
+	return value->expose;
+
+    pmwebapi_free_exposition(value->expose, metric->numnames);
+    if ((value->expose = calloc(metric->numnames, sizeof(exposition_t))) == NULL)
+	return NULL;
+    for (i = 0; i < metric->numnames; i++) {
+	value->expose[i].version = cp->version;
+	value->expose[i].indomversion = indom->version;
+    }
+    return value->expose;
+}
+
 static int
 webgroup_scrape(pmWebGroupSettings *settings, context_t *cp,
 		int numpmid, struct metric **mplist, pmID *pmidlist,
@@ -1700,21 +2137,21 @@ webgroup_scrape(pmWebGroupSettings *settings, context_t *cp,
     struct metric	*metric;
     struct indom	*indom;
     struct value	*value;
+    exposition_t	*expose, *vexpose;
+    scrape_t		*cache;
     pmWebLabelSet	labels;
     pmWebScrape		scrape;
     pmResult		*result;
-    sds			sems, types, units;
-    sds			v = sdsempty(), series = NULL;
+    upbatch_t		*batch;
+    sds			v = sdsempty();
     int			i, j, k, sts, type;
 
-    /* pre-allocate buffers for metric metadata */
-    sems = sdsnewlen(SDS_NOINIT, 20); sdsclear(sems);
-    types = sdsnewlen(SDS_NOINIT, 20); sdsclear(types);
-    units = sdsnewlen(SDS_NOINIT, 64); sdsclear(units);
+    /* pre-allocate buffer for label conversion (on cache miss only) */
     labels.buffer = sdsnewlen(SDS_NOINIT, PM_MAXLABELJSONLEN);
     sdsclear(labels.buffer);
 
-    if ((sts = pmFetch(numpmid, pmidlist, &result)) >= 0) {
+    sts = webgroup_fetch_result(cp, numpmid, pmidlist, &result, &batch);
+    if (sts >= 0) {
 	scrape.seconds = result->timestamp.tv_sec;
 	scrape.nanoseconds = result->timestamp.tv_usec * 1000;
 
@@ -1740,41 +2177,40 @@ webgroup_scrape(pmWebGroupSettings *settings, context_t *cp,
 		pmwebapi_add_indom_instances(cp, indom) > 0)
 		pmwebapi_add_instances_labels(cp, indom);
 
+	    if ((cache = scrape_metric_cache(cp, metric)) == NULL)
+		continue;
+
 	    for (j = 0; j < metric->numnames; j++) {
-		series = pmwebapi_hash_sds(series, metric->names[j].hash);
-		scrape.metric.series = series;
+		expose = &cache->names[j];
+		scrape.metric.series = expose->series;
 		scrape.metric.name = metric->names[j].sds;
 		scrape.metric.pmid = metric->desc.pmid;
 		scrape.metric.indom = metric->desc.indom;
-
-		pmwebapi_semantics_str(metric, sems, 20);
-		scrape.metric.sem = sems;
-		sdsupdatelen(sems);
-		pmwebapi_type_str(metric, types, 20);
-		scrape.metric.type = types;
-		sdsupdatelen(types);
-		pmwebapi_units_str(metric, units, 64);
-		scrape.metric.units = units;
-		sdsupdatelen(units);
+		scrape.metric.sem = cache->sem;
+		scrape.metric.type = cache->type;
+		scrape.metric.units = cache->units;
 		scrape.metric.labels = NULL;
 		scrape.metric.oneline = metric->oneline;
 		scrape.metric.helptext = metric->helptext;
+		scrape.header = &expose->header;
 
 		if (metric->desc.indom == PM_INDOM_NULL || metric->u.vlist == NULL) {
 		    v = webgroup_encode_value(v, type, &metric->u.atom);
-		    scrape.value.series = series;
+		    scrape.value.series = expose->series;
 		    scrape.value.inst = PM_IN_NULL;
 		    scrape.value.value = v;
 		    memset(&scrape.instance, 0, sizeof(scrape.instance));
 		    scrape.instance.inst = PM_IN_NULL;
 
-		    if (metric->labels == NULL)
-			pmwebapi_metric_hash(metric);
-		    scrape_metric_labelsets(metric, &labels);
-		    if (settings->callbacks.on_scrape_labels)
-			settings->callbacks.on_scrape_labels(
+		    if (expose->labels == NULL) {
+			scrape_metric_labelsets(metric, &labels);
+			if (settings->callbacks.on_scrape_labels)
+			    settings->callbacks.on_scrape_labels(
 					cp->origin, &labels, arg);
-		    scrape.metric.labels = labels.buffer;
+			expose->labels = sdsdup(labels.buffer);
+		    }
+		    scrape.metric.labels = expose->labels;
+		    scrape.prefix = &expose->prefix;
 
 		    settings->callbacks.on_scrape(cp->origin, &scrape, arg);
 		    continue;
@@ -1786,27 +2222,36 @@ webgroup_scrape(pmWebGroupSettings *settings, context_t *cp,
 		    instance = dictFetchValue(indom->insts, &value->inst);
 		    if (instance == NULL)
 			continue;
+		    if ((vexpose = scrape_value_cache(cp, metric, indom, value)) == NULL)
+			continue;
+		    vexpose += j;
+
+		    if (instance->labels == NULL)
+			pmwebapi_instance_hash(indom, instance);
+		    if (vexpose->series == NULL)
+			vexpose->series = pmwebapi_hash_sds(NULL, instance->name.hash);
+		    if (vexpose->labels == NULL) {
+			scrape_instance_labelsets(metric, indom, instance, &labels);
+			if (settings->callbacks.on_scrape_labels)
+			    settings->callbacks.on_scrape_labels(
+					cp->origin, &labels, arg);
+			vexpose->labels = sdsdup(labels.buffer);
+		    }
+
 		    v = webgroup_encode_value(v, type, &value->atom);
-		    series = pmwebapi_hash_sds(series, instance->name.hash);
-		    scrape.value.series = series;
+		    scrape.value.series = vexpose->series;
 		    scrape.value.inst = value->inst;
 		    scrape.value.value = v;
 		    scrape.instance.inst = instance->inst;
 		    scrape.instance.name = instance->name.sds;
-
-		    if (instance->labels == NULL)
-			pmwebapi_instance_hash(indom, instance);
-		    scrape_instance_labelsets(metric, indom, instance, &labels);
-		    if (settings->callbacks.on_scrape_labels)
-			settings->callbacks.on_scrape_labels(
-					cp->origin, &labels, arg);
-		    scrape.instance.labels = labels.buffer;
+		    scrape.instance.labels = vexpose->labels;
+		    scrape.prefix = &vexpose->prefix;
 
 		    settings->callbacks.on_scrape(cp->origin, &scrape, arg);
 		}
 	    }
 	}
-	pmFreeResult(result);
+	webgroup_free_result(result, batch);
     } else {
 	char		err[PM_MAXERRMSGLEN];
 
@@ -1817,10 +2262,6 @@ webgroup_scrape(pmWebGroupSettings *settings, context_t *cp,
     }
 
     sdsfree(v);
-    sdsfree(sems);
-    sdsfree(types);
-    sdsfree(units);
-    sdsfree(series);
     sdsfree(labels.buffer);
 
     return sts < 0 ? sts : 0;
@@ -1916,6 +2357,87 @@ webgroup_scrape_tree(const char *prefix, struct webscrape *scrape)
     return sts;
 }
 
+/*
+ * Scrape context keys hold credentials only as a hash of the username
+ * and password, never the password itself.
+ */
+static sds
+webgroup_scrape_credentials(sds key, sds username, sds password)
+{
+    unsigned char	hash[20];
+    char		buffer[42];
+    SHA1_CTX		shactx;
+
+    SHA1Init(&shactx);
+    SHA1Update(&shactx, (unsigned char *)username, sdslen(username));
+    if (password) {
+	SHA1Update(&shactx, (unsigned char *)":", 1);
+	SHA1Update(&shactx, (unsigned char *)password, sdslen(password));
+    }
+    SHA1Final(hash, &shactx);
+    pmwebapi_hash_str(hash, buffer, sizeof(buffer));
+    return sdscatfmt(key, "\n%s", buffer);
+}
+
+/*
+ * Anonymous scrapes (no context identifier) of the same host with the
+ * same credentials share a long-lived context, such that metadata and
+ * precompiled exposition templates persist from one scrape to the next.
+ */
+static struct context *
+webgroup_scrape_context(pmWebGroupSettings *sp, sds *id, dict *params,
+		int *status, sds *message, void *arg)
+{
+    struct webgroups	*groups = webgroups_lookup(&sp->module);
+    struct context	*cp = NULL;
+    unsigned int	randomid;
+    dictEntry		*entry;
+    sds			key, value, origin;
+
+    if (*id != NULL || default_scrape_timeout == 0 ||
+	(params && dictFetchValue(params, PARAM_POLLTIME) != NULL))
+	return webgroup_lookup_context(sp, id, params, status, message, arg);
+
+    value = NULL;
+    if (params && (value = dictFetchValue(params, PARAM_HOSTSPEC)) == NULL)
+	value = dictFetchValue(params, PARAM_HOSTNAME);
+    key = sdscatfmt(sdsempty(), "%S", value ? value : LOCALHOST);
+    if (params && (value = dictFetchValue(params, AUTH_USERNAME)) != NULL)
+	key = webgroup_scrape_credentials(key, value,
+			dictFetchValue(params, AUTH_PASSWORD));
+
+    uv_mutex_lock(&groups->mutex);
+    if (groups->scrapes == NULL)
+	groups->scrapes = dictCreate(&sdsKeyDictCallBacks, NULL);
+    if ((entry = dictFind(groups->scrapes, key)) != NULL) {
+	randomid = (unsigned int)(uintptr_t)dictGetVal(entry);
+	cp = (struct context *)dictFetchValue(groups->contexts, &randomid);
+	if (cp == NULL || cp->garbage) {
+	    dictDelete(groups->scrapes, key);
+	    cp = NULL;
+	}
+    }
+    uv_mutex_unlock(&groups->mutex);
+
+    if (cp != NULL) {
+	sdsfree(key);
+	origin = cp->origin;
+	return webgroup_lookup_context(sp, &origin, params, status, message, arg);
+    }
+
+    if ((cp = webgroup_lookup_context(sp, id, params, status, message, arg))) {
+	if (cp->timeout < default_scrape_timeout) {
+	    cp->timeout = default_scrape_timeout;
+	    uv_timer_start(&cp->timer, webgroup_timeout_context, cp->timeout, 0);
+	}
+	uv_mutex_lock(&groups->mutex);
+	dictAdd(groups->scrapes, key, (void *)(uintptr_t)cp->randomid);
+	uv_mutex_unlock(&groups->mutex);
+    }
+    sdsfree(key);	/* scrapes dictionary keeps its own copy */
+    return cp;
+}
+
 void
 pmWebGroupScrape(pmWebGroupSettings *settings, sds id, dict *params, void *arg)
 {
@@ -1934,7 +2456,7 @@ pmWebGroupScrape(pmWebGroupSettings *settings, sds id, dict *params, void *arg)
 	metrics = NULL;
     }
 
-    if (!(cp = webgroup_lookup_context(settings, &id, params, &sts, &msg, arg)))
+    if (!(cp = webgroup_scrape_context(settings, &id, params, &sts, &msg, arg)))
 	goto done;
     id = cp->origin;
 
@@ -2163,6 +2685,8 @@ pmWebGroupStore(pmWebGroupSettings *settings, sds id, dict *params, void *arg)
     if (!(cp = webgroup_lookup_context(settings, &id, params, &sts, &msg, arg)))
 	goto done;
     id = cp->origin;
+    if ((sts = webgroup_private_context(cp, &msg)) < 0)
+	goto done;
 
     if (instnames) {
 	length = sdslen(instnames);
@@ -2246,6 +2770,8 @@ pmWebGroupSetup(pmWebGroupModule *module)
     WORK_TIMER = sdsnew("pmwebapi.work");
     POLL_TIMEOUT = sdsnew("pmwebapi.timeout");
     BATCHSIZE = sdsnew("pmwebapi.batchsize");
+    SCRAPE_TIMEOUT = sdsnew("pmwebapi.scrape.timeout");
+    UPSTREAM_CLIENTS = sdsnew("pmwebapi.upstream.clients");
     AUTH_USERNAME = sdsnew("auth.username");
     AUTH_PASSWORD = sdsnew("auth.password");
 
@@ -2257,6 +2783,12 @@ pmWebGroupSetup(pmWebGroupModule *module)
     /* setup a dictionary mapping context number to data */
     groups->contexts = dictCreate(&intKeyDictCallBacks, NULL);
 
+    /* setup a dictionary of shared upstream PMAPI contexts */
+    if (upstreams == NULL) {
+	uv_mutex_init(&upstreams_lock);
+	upstreams = dictCreate(&sdsKeyDictCallBacks, NULL);
+    }
+
     return 0;
 }
 
@@ -2303,6 +2835,22 @@ pmWebGroupSetConfiguration(pmWebGroupModule *module, dict *config)
 	    default_batchsize = DEFAULT_BATCHSIZE;
     }
 
+    if ((value = dictFetchValue(config, SCRAPE_TIMEOUT)) == NULL) {
+	default_scrape_timeout = DEFAULT_SCRAPE_TIMEOUT;
+    } else {
+	default_scrape_timeout = strtoul(value, &endnum, 0);
+	if (*endnum != '\0')
+	    default_scrape_timeout = DEFAULT_SCRAPE_TIMEOUT;
+    }
+
+    if ((value = dictFetchValue(config, UPSTREAM_CLIENTS)) == NULL) {
+	default_upstream_clients = DEFAULT_UPSTREAM_CLIENTS;
+    } else {
+	default_upstream_clients = strtoul(value, &endnum, 0);
+	if (*endnum != '\0')
+	    default_upstream_clients = DEFAULT_UPSTREAM_CLIENTS;
+    }
+
     if (webgroups) {
 	webgroups->config = config;
 	return 0;
@@ -2343,10 +2891,48 @@ pmWebGroupSetupMetrics(pmWebGroupModule *module)
 	"instance name map dictionary size",
 	"number of entries in the instance name map dictionary");
 
+    /*
+     * Shared upstream PMAPI context metrics
+     */
+    mmv_stats_add_metric(webgroups->metrics, "upstream.contexts", 5,
+	MMV_TYPE_U32, MMV_SEM_INSTANT, nounits, noindom,
+	"shared upstream PMAPI contexts",
+	"number of PMAPI contexts shared between web contexts");
+
+    mmv_stats_add_metric(webgroups->metrics, "upstream.clients", 6,
+	MMV_TYPE_U32, MMV_SEM_INSTANT, nounits, noindom,
+	"web contexts using shared upstream contexts",
+	"number of web contexts attached to shared upstream PMAPI contexts");
+
+    mmv_stats_add_metric(webgroups->metrics, "upstream.merged", 7,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, nounits, noindom,
+	"fetches merged into a concurrent fetch",
+	"number of web context fetches satisfied by a batch fetch issued\n"
+	"by another web context sharing the same upstream PMAPI context");
+
     webgroups->metrics_handle = mmv_stats_start(webgroups->metrics);
 }
 
 
+/*
+ * Context identifiers are chosen such that the identifier modulo the
+ * number of worker processes is the index of the worker creating it,
+ * allowing requests to be passed on to the worker owning a context.
+ */
+int
+pmWebGroupSetWorker(pmWebGroupModule *module, unsigned int worker,
+		unsigned int nworkers)
+{
+    struct webgroups	*webgroups = webgroups_lookup(module);
+
+    if (webgroups) {
+	webgroups->worker = worker;
+	webgroups->nworkers = nworkers;
+	return 0;
+    }
+    return -ENOMEM;
+}
+
 int
 pmWebGroupSetMetricRegistry(pmWebGroupModule *module, mmv_registry_t *registry)
 {
@@ -2380,10 +2966,14 @@ pmWebGroupClose(pmWebGroupModule *module)
 	    webgroup_drop_context((context_t *)dictGetVal(entry), NULL);
 	dictReleaseIterator(iterator);
 	dictRelease(groups->contexts);
+	if (groups->scrapes)
+	    dictRelease(groups->scrapes);
 	memset(groups, 0, sizeof(struct webgroups));
 	free(groups);
     }
 
+    sdsfree(SCRAPE_TIMEOUT);
+    sdsfree(UPSTREAM_CLIENTS);
     sdsfree(PARAM_HOSTNAME);
     sdsfree(PARAM_HOSTSPEC);
     sdsfree(PARAM_CTXNUM);
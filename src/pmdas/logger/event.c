@@ -318,8 +318,6 @@ multiread:
 	return 0;
     if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
 	return 0;
-    if (bytes > maxmem)
-	return 0;
     if (bytes < 0) {
 	pmNotifyErr(LOG_ERR, "read failure on %s: %s",
 		      logfile->pathname, strerror(errno));
@@ -40,6 +40,7 @@
  *	logger.perfile.{LOGFILE}.numclients	- number of attached
  *						  clients/logfile
  *	logger.perfile.{LOGFILE}.records	- event records/logfile
+ *	logger.perfile.{LOGFILE}.dropped	- events discarded unseen
  */
 
 #define DEFAULT_MAXMEM	(2 * 1024 * 1024)	/* 2 megabytes */
@@ -90,8 +91,19 @@ static pmdaMetric dynamic_metrictab[] = {
     { NULL, 				/* m_user gets filled in later */
       { 0 /* pmid gets filled in later */, PM_TYPE_U64, PM_INDOM_NULL,
 	PM_SEM_INSTANT, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) }, },
+/* perfile.{LOGFILE}.dropped */
+    { NULL, 				/* m_user gets filled in later */
+      { 0 /* pmid gets filled in later */, PM_TYPE_U64, PM_INDOM_NULL,
+	PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) }, },
 };
 
+/*
+ * The dropped metric is numbered separately (in cluster 1, with the
+ * logfile handle as the item) so the identifiers of the other per-file
+ * metrics are unchanged from earlier versions of this PMDA.
+ */
+#define DYNAMIC_DROPPED	7
+
 static char *dynamic_nametab[] = {
 /* perfile.{LOGFILE}.count */
     "count",
@@ -107,6 +119,8 @@ static char *dynamic_nametab[] = {
     "records",
 /* perfile.{LOGFILE}.queuemem */
     "queuemem",
+/* perfile.{LOGFILE}.dropped */
+    "dropped",
 };
 
 static const char *dynamic_helptab[] = {
@@ -124,6 +138,9 @@ static const char *dynamic_helptab[] = {
     "Event records for this logfile.",
 /* perfile.{LOGFILE}.queuemem */
     "Amount of memory used for event data.",
+/* perfile.{LOGFILE}.dropped */
+    "Number of events for this logfile discarded before all clients had\n"
+    "seen them, as the queue had reached its memory limit (see -m option).",
 };
 
 static pmdaMetric static_metrictab[] = {
@@ -164,9 +181,11 @@ logger_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 static int
 valid_pmid(unsigned int cluster, unsigned int item)
 {
-    if (cluster != 0 || item > nummetrics)
-	return PM_ERR_PMID;
-    return 0;
+    if (cluster == 0 && item <= nummetrics)
+	return 0;
+    if (cluster == 1 && item < event_logcount())
+	return 0;
+    return PM_ERR_PMID;
 }
 
 static int
@@ -186,7 +205,7 @@ logger_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	return sts;
 
     sts = PMDA_FETCH_STATIC;
-    if (item < 4) {
+    if (cluster == 0 && item < 4) {
 	switch (item) {
 	    case 0:			/* logger.numclients */
 		sts = pmdaEventClients(atom);
@@ -234,6 +253,9 @@ logger_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	    case 6:			/* perfile.{LOGFILE}.queuemem */
 		sts = pmdaEventQueueMemory(queue, atom);
 		break;
+	    case DYNAMIC_DROPPED:	/* perfile.{LOGFILE}.dropped */
+		sts = pmdaEventQueueDropped(queue, atom);
+		break;
 	    default:
 		return PM_ERR_PMID;
 	}
@@ -317,24 +339,22 @@ static int
 logger_text(int ident, int type, char **buffer, pmdaExt *pmda)
 {
     int numstatics = sizeof(static_metrictab)/sizeof(static_metrictab[0]);
+    int i;
 
     pmdaEventNewClient(pmda->e_context);
 
     if ((type & PM_TEXT_PMID) == PM_TEXT_PMID) {
-	/* Lookup pmid in the metric table. */
-	int item = pmID_item(ident);
-
-	/* If the PMID item was for a dynamic metric... */
-	if (item >= numstatics && item < nummetrics
-	    /* and the PMID matches... */
-	    && metrictab[item].m_desc.pmid == (pmID)ident
-	    /* and we've got user data... */
-	    && metrictab[item].m_user != NULL) {
-	    dynamic_metric_info_t *pinfo = metrictab[item].m_user;
-
-	    /* Return the correct help text. */
-	    *buffer = (char *)pinfo->help_text;
-	    return 0;
+	/* Lookup pmid in the dynamic part of the metric table. */
+	for (i = numstatics; i < nummetrics; i++) {
+	    /* If the PMID matches and we've got user data... */
+	    if (metrictab[i].m_desc.pmid == (pmID)ident &&
+		metrictab[i].m_user != NULL) {
+		dynamic_metric_info_t *pinfo = metrictab[i].m_user;
+
+		/* Return the correct help text. */
+		*buffer = (char *)pinfo->help_text;
+		return 0;
+	    }
 	}
     }
     return pmdaText(ident, type, buffer, pmda);
@@ -388,7 +408,10 @@ logger_init(pmdaInterface *dp, const char *configfile)
     for (i = 0; i < numloggers; i++) {
 	memcpy(pmetric, dynamic_metrictab, sizeof(dynamic_metrictab));
 	for (j = 0; j < numdynamics; j++) {
-	    pmetric[j].m_desc.pmid = PMDA_PMID(0, item++);
+	    if (j == DYNAMIC_DROPPED)
+		pmetric[j].m_desc.pmid = PMDA_PMID(1, i);
+	    else
+		pmetric[j].m_desc.pmid = PMDA_PMID(0, item++);
 	    pmetric[j].m_user = pinfo++;
 	}
 	pmetric += numdynamics;
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2013,2016 Red Hat.
+ * Copyright (C) 2013,2016,2026 Red Hat.
  * Copyright (C) 2009 Aconex.  All Rights Reserved.
  * Copyright (C) 2001 Silicon Graphics, Inc.  All Rights Reserved.
  *
@@ -183,6 +183,9 @@ metrictype(int mtype)
     case MMV_TYPE_ELAPSED:
 	type = "elapsed";
 	break;
+    case MMV_TYPE_HISTOGRAM:
+	type = "histogram";
+	break;
     default:
 	type = "?";
 	break;
@@ -270,7 +273,7 @@ dump_metrics1(void *addr, size_t size, int idx, long base, __uint64_t offset, __
 }
 
 int
-dump_metrics2(void *addr, size_t size, int idx, long base, __uint64_t offset, __int32_t count)
+dump_metrics2(void *addr, size_t size, int idx, long base, __uint64_t offset, __int32_t count, int version)
 {
     int i;
     char buf[MMV_STRINGMAX];
@@ -301,7 +304,9 @@ dump_metrics2(void *addr, size_t size, int idx, long base, __uint64_t offset, __
 	printf("       type=%s (0x%x), sem=%s (0x%x), pad=0x%x\n",
 		metrictype(m[i].type), m[i].type,
 		metricsem(m[i].semantics), m[i].semantics,
-		m[i].padding);
+		version < MMV_VERSION4 ? m[i].shards : 0);
+	if (version >= MMV_VERSION4 && m[i].shards)
+	    printf("       shards=%u\n", m[i].shards);
 	printf("       units=%s\n", pmUnitsStr(&m[i].dimension));
 	if (m[i].indom != PM_INDOM_NULL && m[i].indom != 0)
 	    printf("       indom=%d\n", m[i].indom);
@@ -346,7 +351,38 @@ dump_metrics(void *addr, size_t size, int idx, long base, __uint64_t offset, __i
 		idx, base, offset, count);
     if (version == MMV_VERSION1)
 	return dump_metrics1(addr, size, idx, base, offset, count);
-    return dump_metrics2(addr, size, idx, base, offset, count);
+    return dump_metrics2(addr, size, idx, base, offset, count, version);
+}
+
+/*
+ * Histograms are reported as the derived count and the sum of samples,
+ * followed by the bucket bounds and count for each non-empty bucket
+ */
+int
+dump_histogram(void *addr, size_t size, mmv_disk_value_t *vals, int i, int toc)
+{
+    mmv_disk_histogram_t *hp;
+    __uint64_t count = 0;
+    int b;
+
+    if (vals[i].extra <= 0 ||
+	size < vals[i].extra + sizeof(mmv_disk_histogram_t)) {
+	printf(" = ?\n");
+	printf("Bad file size: toc[%d] histogram value[%d] extra\n", toc, i);
+	return 1;
+    }
+    hp = (mmv_disk_histogram_t *)((char *)addr + vals[i].extra);
+    for (b = 0; b < MMV_HISTOGRAM_BUCKETS; b++)
+	count += hp->buckets[b];
+    printf(" = count %"PRIu64", sum %"PRIu64"\n", count, hp->sum);
+    for (b = 0; b < MMV_HISTOGRAM_BUCKETS; b++) {
+	if (hp->buckets[b] == 0)
+	    continue;
+	printf("       [%"PRIu64"-%"PRIu64"] = %"PRIu64"\n",
+		(__uint64_t)MMV_HISTOGRAM_LOWER(b),
+		(__uint64_t)MMV_HISTOGRAM_UPPER(b), hp->buckets[b]);
+    }
+    return 0;
 }
 
 int
@@ -396,6 +432,8 @@ dump_value(void *addr, size_t size, mmv_disk_value_t *vals, int i, int toc, int
 	    printf("Bad (positive) ELAPSED 'extra' value found!");
 	}
 	break;
+    case MMV_TYPE_HISTOGRAM:
+	return dump_histogram(addr, size, vals, i, toc);
     default:
 	printf("Unknown type %d", type);
     }
@@ -440,8 +478,52 @@ dump_values1(void *addr, size_t size, int idx, long base, __uint64_t offset, __i
     return 0;
 }
 
+/*
+ * Sharded values are reported as the sum of the value and its shards
+ */
+int
+dump_shards(void *addr, size_t size, mmv_disk_value_t *vals, int i, int toc, int type, __uint32_t shards)
+{
+    mmv_disk_shard_t *shard;
+    mmv_disk_value_t sum = vals[i];
+    __uint32_t j;
+
+    if (shards > MMV_SHARDMAX ||
+	size < vals[i].extra + shards * sizeof(mmv_disk_shard_t)) {
+	printf(" = ?\n");
+	printf("Bad file size: toc[%d] sharded value[%d] extra\n", toc, i);
+	return 1;
+    }
+    shard = (mmv_disk_shard_t *)((char *)addr + vals[i].extra);
+    for (j = 0; j < shards; j++) {
+	switch (type) {
+	case MMV_TYPE_I32:
+	    sum.value.l += shard[j].value.l;
+	    break;
+	case MMV_TYPE_U32:
+	    sum.value.ul += shard[j].value.ul;
+	    break;
+	case MMV_TYPE_I64:
+	    sum.value.ll += shard[j].value.ll;
+	    break;
+	case MMV_TYPE_U64:
+	    sum.value.ull += shard[j].value.ull;
+	    break;
+	case MMV_TYPE_FLOAT:
+	    sum.value.f += shard[j].value.f;
+	    break;
+	case MMV_TYPE_DOUBLE:
+	    sum.value.d += shard[j].value.d;
+	    break;
+	default:
+	    break;
+	}
+    }
+    return dump_value(addr, size, &sum, 0, toc, type);
+}
+
 int
-dump_values2(void *addr, size_t size, int idx, long base, __uint64_t offset, __int32_t count)
+dump_values2(void *addr, size_t size, int idx, long base, __uint64_t offset, __int32_t count, int version)
 {
     int i;
     char buf[MMV_STRINGMAX];
@@ -496,7 +578,10 @@ dump_values2(void *addr, size_t size, int idx, long base, __uint64_t offset, __i
 	    buf[sizeof(buf)-1] = '\0';
 	    printf("[%d or \"%s\"]", instance->internal, buf);
 	}
-	dump_value(addr, size, vals, i, idx, metric->type);
+	if (version >= MMV_VERSION4 && metric->shards)
+	    dump_shards(addr, size, vals, i, idx, metric->type, metric->shards);
+	else
+	    dump_value(addr, size, vals, i, idx, metric->type);
     }
     return 0;
 }
@@ -508,7 +593,31 @@ dump_values(void *addr, size_t size, int idx, long base, __uint64_t offset, __in
 		idx, base, offset, count);
     if (version == MMV_VERSION1)
 	return dump_values1(addr, size, idx, base, offset, count);
-    return dump_values2(addr, size, idx, base, offset, count);
+    return dump_values2(addr, size, idx, base, offset, count, version);
+}
+
+int
+dump_shardarea(void *addr, size_t size, int idx, long base, __uint64_t offset, __int32_t count)
+{
+    printf("\nTOC[%d]: offset %ld, shards offset %"PRIu64" (%d entries)\n",
+		idx, base, offset, count);
+    if (size < offset + count * sizeof(mmv_disk_shard_t)) {
+	printf("Bad file size: too small for toc[%d] shards\n", idx);
+	return 1;
+    }
+    return 0;
+}
+
+int
+dump_histograms(void *addr, size_t size, int idx, long base, __uint64_t offset, __int32_t count)
+{
+    printf("\nTOC[%d]: offset %ld, histograms offset %"PRIu64" (%d entries)\n",
+		idx, base, offset, count);
+    if (size < offset + count * sizeof(mmv_disk_histogram_t)) {
+	printf("Bad file size: too small for toc[%d] histograms\n", idx);
+	return 1;
+    }
+    return 0;
 }
 
 int
@@ -616,7 +725,7 @@ dump(const char *file, void *addr, size_t size)
     }
     version = hdr->version;
     if (version != MMV_VERSION1 && version != MMV_VERSION2 &&
-	version != MMV_VERSION3)
+	version != MMV_VERSION3 && version != MMV_VERSION4)
     {
 	printf("Version %d not supported\n", version);
 	return 1;
@@ -688,6 +797,14 @@ dump(const char *file, void *addr, size_t size)
 	    if (dump_labels(addr, size, i, base, offset, count))
 		sts = 1;
 	    break;    
+	case MMV_TOC_SHARDS:
+	    if (dump_shardarea(addr, size, i, base, offset, count))
+		sts = 1;
+	    break;
+	case MMV_TOC_HISTOGRAMS:
+	    if (dump_histograms(addr, size, i, base, offset, count))
+		sts = 1;
+	    break;
 	default:
 	    printf("Unrecognised TOC[%d] type: 0x%x\n", i, type);
 	    sts = 1;
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2012-2020 Red Hat.
+ * Copyright (c) 2012-2020,2026 Red Hat.
  * Copyright (c) 2009-2010 Aconex. All Rights Reserved.
  * Copyright (c) 1995-2000,2009 Silicon Graphics, Inc. All Rights Reserved.
  *
@@ -71,15 +71,18 @@ typedef struct {
     int			mcnt1;		/* number of metrics */
     int			mcnt2;		/* number of v2 metrics */
     int			lcnt;		/* number of labels */
-    int			version;	/* v1/v2/v3 version number */
+    int			version;	/* v1/v2/v3/v4 version number */
     int			cluster;	/* cluster identifier */
     pid_t		pid;		/* process identifier */
     __int64_t		len;		/* mmap region len */
     __uint64_t		gen;		/* generation number on open */
+    dev_t		dev;		/* file device on open */
+    ino_t		ino;		/* file inode on open */
 } stats_t;
 
 typedef struct {
     pmdaMetric		*metrics;
+    char		**names;	/* metric names, parallel to metrics */
     pmdaIndom		*indoms;
     pmdaNameSpace	*pmns;
     stats_t		*slist;
@@ -87,6 +90,7 @@ typedef struct {
     int			mtot;
     int			intot;
     int			reload;		/* require reload of maps */
+    int			rescan;		/* client file(s) still in flux */
     int			notify;		/* notify pmcd of changes */
     int			statsdir_code;	/* last statsdir stat code */
     time_t		statsdir_ts;	/* last statsdir timestamp */
@@ -105,6 +109,18 @@ typedef struct {
 #define MAX_MMV_CLUSTER ((1<<12)-1)
 #define MAX_MMV_LABELS	((1<<8)-1)
 
+/*
+ * Histogram metrics share one instance domain (in the otherwise unused
+ * cluster zero indom space) - an instance per bucket, then derived count
+ * and sum instances.
+ */
+#define HISTOGRAM_SERIAL	1
+#define HISTOGRAM_COUNT		MMV_HISTOGRAM_BUCKETS
+#define HISTOGRAM_SUM		(MMV_HISTOGRAM_BUCKETS + 1)
+#define HISTOGRAM_NUMINST	(MMV_HISTOGRAM_BUCKETS + 2)
+
+static char histogram_names[MMV_HISTOGRAM_BUCKETS][24];
+
 /*
  * Check cluster number validity (must be in range 0 .. 1<<12).
  */
@@ -154,10 +170,12 @@ choose_cluster(agent_t *ap, int requested, const char *path)
 }
 
 static int
-create_client_stat(agent_t *ap, const char *client, const char *path, size_t size)
+create_client_stat(agent_t *ap, const char *client, const char *path,
+		struct stat *statbuf)
 {
     mmv_disk_header_t	header;
     stats_t		*sp;
+    size_t		size = statbuf->st_size;
     size_t		offset;
     void		*m;
     int			cluster;
@@ -183,7 +201,8 @@ create_client_stat(agent_t *ap, const char *client, const char *path, size_t siz
 
 	    if (header.version != MMV_VERSION1 &&
 		header.version != MMV_VERSION2 &&
-		header.version != MMV_VERSION3) {
+		header.version != MMV_VERSION3 &&
+		header.version != MMV_VERSION4) {
 		if (pmDebugOptions.appl0)
 		    pmNotifyErr(LOG_ERR,
 			"%s: %s client version %d unsupported (current is %d)",
@@ -238,6 +257,8 @@ create_client_stat(agent_t *ap, const char *client, const char *path, size_t siz
 		sp[in].cluster = cluster;
 		sp[in].gen = header.g1;
 		sp[in].len = size;
+		sp[in].dev = statbuf->st_dev;
+		sp[in].ino = statbuf->st_ino;
 		ap->slist = sp;
 		ap->scnt++;
 	    } else {
@@ -344,22 +365,80 @@ verify_metric_item2(mmv_disk_metric2_t *ml, int k, char *name, stats_t *s)
     return 0;
 }
 
+/* add the histogram buckets indom, the first time a histogram is seen */
+static int
+create_histogram_indom(pmdaExt *pmda, stats_t *s, pmInDom indom)
+{
+    agent_t		*ap = (agent_t *)pmdaExtGetData(pmda);
+    pmdaIndom		*ip;
+    int			i;
+
+    for (i = 0; i < ap->intot; i++)
+	if (ap->indoms[i].it_indom == indom)
+	    return 0;
+
+    ip = realloc(ap->indoms, sizeof(pmdaIndom) * (ap->intot + 1));
+    if (ip == NULL) {
+	pmNotifyErr(LOG_ERR, "%s: cannot grow indom list in %s",
+			pmGetProgname(), s->name);
+	return -ENOMEM;
+    }
+    ap->indoms = ip;
+    ip = &ap->indoms[ap->intot++];
+    ip->it_indom = indom;
+    ip->it_set = (pmdaInstid *)calloc(HISTOGRAM_NUMINST, sizeof(pmdaInstid));
+    if (ip->it_set == NULL) {
+	pmNotifyErr(LOG_ERR, "%s: cannot get memory for instance list in %s",
+			pmGetProgname(), s->name);
+	ip->it_numinst = 0;
+	return -ENOMEM;
+    }
+    /* buckets are named by their (inclusive) upper bound */
+    for (i = 0; i < MMV_HISTOGRAM_BUCKETS; i++) {
+	if (histogram_names[i][0] == '\0')
+	    pmsprintf(histogram_names[i], sizeof(histogram_names[i]),
+			"%"PRIu64, (uint64_t)MMV_HISTOGRAM_UPPER(i));
+	ip->it_set[i].i_inst = i;
+	ip->it_set[i].i_name = histogram_names[i];
+    }
+    ip->it_set[HISTOGRAM_COUNT].i_inst = HISTOGRAM_COUNT;
+    ip->it_set[HISTOGRAM_COUNT].i_name = "count";
+    ip->it_set[HISTOGRAM_SUM].i_inst = HISTOGRAM_SUM;
+    ip->it_set[HISTOGRAM_SUM].i_name = "sum";
+    ip->it_numinst = HISTOGRAM_NUMINST;
+    return 0;
+}
+
 static int
 create_metric(pmdaExt *pmda, stats_t *s, char *name, pmID pmid, unsigned indom,
 	mmv_metric_type_t type, mmv_metric_sem_t semantics, pmUnits units)
 {
     pmdaMetric		*mp;
     agent_t		*ap = (agent_t *)pmdaExtGetData(pmda);
+    char		**np;
 
     if (pmDebugOptions.appl0)
 	pmNotifyErr(LOG_DEBUG, "MMV: create_metric: %s - %s", name, pmIDStr(pmid));
 
+    if (type == MMV_TYPE_HISTOGRAM &&
+	create_histogram_indom(pmda, s,
+		pmInDom_build(pmda->e_domain, HISTOGRAM_SERIAL)) < 0)
+	return -ENOMEM;
+
     mp = realloc(ap->metrics, sizeof(pmdaMetric) * (ap->mtot + 1));
     if (mp == NULL)  {
 	pmNotifyErr(LOG_ERR, "cannot grow MMV metric list: %s", s->name);
 	return -ENOMEM;
     }
     ap->metrics = mp;
+    np = realloc(ap->names, sizeof(char *) * (ap->mtot + 1));
+    if (np == NULL || (np[ap->mtot] = strdup(name)) == NULL)  {
+	if (np)
+	    ap->names = np;
+	pmNotifyErr(LOG_ERR, "cannot grow MMV metric names: %s", s->name);
+	return -ENOMEM;
+    }
+    ap->names = np;
     ap->metrics[ap->mtot].m_user = ap;
     ap->metrics[ap->mtot].m_desc.pmid = pmid;
 
@@ -368,6 +447,10 @@ create_metric(pmdaExt *pmda, stats_t *s, char *name, pmID pmid, unsigned indom,
 	ap->metrics[ap->mtot].m_desc.sem = PM_SEM_COUNTER;
 	ap->metrics[ap->mtot].m_desc.type = MMV_TYPE_I64;
 	ap->metrics[ap->mtot].m_desc.units = unit;
+    } else if (type == MMV_TYPE_HISTOGRAM) {
+	ap->metrics[ap->mtot].m_desc.sem = PM_SEM_COUNTER;
+	ap->metrics[ap->mtot].m_desc.type = PM_TYPE_U64;
+	memcpy(&ap->metrics[ap->mtot].m_desc.units, &units, sizeof(pmUnits));
     } else {
 	if (semantics)
 	    ap->metrics[ap->mtot].m_desc.sem = semantics;
@@ -376,7 +459,10 @@ create_metric(pmdaExt *pmda, stats_t *s, char *name, pmID pmid, unsigned indom,
 	ap->metrics[ap->mtot].m_desc.type = type;
 	memcpy(&ap->metrics[ap->mtot].m_desc.units, &units, sizeof(pmUnits));
     }
-    if (!indom || indom == PM_INDOM_NULL)
+    if (type == MMV_TYPE_HISTOGRAM)
+	ap->metrics[ap->mtot].m_desc.indom = 
+		pmInDom_build(pmda->e_domain, HISTOGRAM_SERIAL);
+    else if (!indom || indom == PM_INDOM_NULL)
 	ap->metrics[ap->mtot].m_desc.indom = PM_INDOM_NULL;
     else
 	ap->metrics[ap->mtot].m_desc.indom = 
@@ -443,7 +529,7 @@ update_indom(pmdaExt *pmda, stats_t *s, __uint64_t offset, __uint32_t count,
 	    if (j == ip->it_numinst)
 		newinsts++;
 	}
-    } else if (s->version == MMV_VERSION2 || s->version == MMV_VERSION3) {
+    } else if (s->version >= MMV_VERSION2) {
 	in2 = (mmv_disk_instance2_t *)((char *)s->addr + offset);
 	for (i = 0; i < count; i++) {
 	    for (j = 0; j < ip->it_numinst; j++) {
@@ -485,7 +571,7 @@ update_indom(pmdaExt *pmda, stats_t *s, __uint64_t offset, __uint32_t count,
 		ip->it_numinst++;
 	    }
 	}
-    } else if (s->version == MMV_VERSION2 || s->version == MMV_VERSION3) {
+    } else if (s->version >= MMV_VERSION2) {
 	for (i = 0; i < count; i++) {
 	    for (j = 0; j < ip->it_numinst; j++)
 		if (ip->it_set[j].i_inst == in2[i].internal)
@@ -540,7 +626,7 @@ create_indom(pmdaExt *pmda, stats_t *s, __uint64_t offset, __uint32_t count,
 	    ip->it_set[i].i_inst = in1[i].internal;
 	    ip->it_set[i].i_name = in1[i].external;
 	}
-    } else if (s->version == MMV_VERSION2 || s->version == MMV_VERSION3) {
+    } else if (s->version >= MMV_VERSION2) {
 	in2 = (mmv_disk_instance2_t *)((char *)s->addr + offset);
 	ip->it_numinst = count;
 	for (i = 0; i < count; i++) {
@@ -553,15 +639,260 @@ create_indom(pmdaExt *pmda, stats_t *s, __uint64_t offset, __uint32_t count,
     return 0;
 }
 
+/*
+ * Add the metrics, indoms, values and labels from one client mapping
+ * into the agent tables.
+ */
 static void
-map_stats(pmdaExt *pmda)
+map_client(pmdaExt *pmda, stats_t *s)
+{
+    agent_t		*ap = (agent_t *)pmdaExtGetData(pmda);
+    mmv_disk_indom_t	*id;
+    mmv_disk_header_t	*hdr = (mmv_disk_header_t *)s->addr;
+    mmv_disk_toc_t	*toc = (mmv_disk_toc_t *)
+			((char *)s->addr + sizeof(mmv_disk_header_t));
+    int			j, k;
+
+    for (j = 0; j < hdr->tocs; j++) {
+	__uint64_t offset = toc[j].offset;
+	__uint32_t count = toc[j].count;
+	__uint32_t type = toc[j].type;
+
+	switch (type) {
+	case MMV_TOC_METRICS:
+	    if (count > MAX_MMV_ITEMS) {
+		if (pmDebugOptions.appl0) {
+		    pmNotifyErr(LOG_ERR, "MMV: %s - "
+				    "metrics count: %d > %d",
+				    s->name, count, MAX_MMV_ITEMS);
+		}
+		continue;
+	    }
+	    if (s->version == MMV_VERSION1) {
+		mmv_disk_metric_t *ml = (mmv_disk_metric_t *)
+				    ((char *)s->addr + offset);
+
+		offset += (count * sizeof(mmv_disk_metric_t));
+		if (s->len < offset) {
+		    if (pmDebugOptions.appl0) {
+			pmNotifyErr(LOG_INFO, "MMV: %s - "
+				    "metrics offset: %"PRIu64" < %"PRIu64,
+				    s->name, s->len, (int64_t)offset);
+		    }
+		    continue;
+		}
+
+		s->metrics1 = ml;
+		s->mcnt1 = count;
+
+		for (k = 0; k < count; k++) {
+		    mmv_disk_metric_t *mp = &ml[k];
+		    char name[MAXPATHLEN];
+		    pmID pmid;
+
+		    /* build name, check its legitimate and unique */
+		    if (hdr->flags & MMV_FLAG_NOPREFIX)
+			pmsprintf(name, sizeof(name), "%s.", ap->prefix);
+		    else
+			pmsprintf(name, sizeof(name), "%s.%s.", ap->prefix, s->name);
+		    strcat(name, mp->name);
+		    if (verify_metric_name(ap, name, k, s) != 0)
+			continue;
+		    if (verify_metric_item(ml, k, name, s) != 0)
+			continue;
+
+		    pmid = pmID_build(pmda->e_domain, s->cluster, mp->item);
+		    create_metric(pmda, s, name, pmid, mp->indom,
+				    mp->type, mp->semantics, mp->dimension);
+		}
+	    }
+	    else if (s->version >= MMV_VERSION2) {
+		mmv_disk_metric2_t *ml = (mmv_disk_metric2_t *)
+				    ((char *)s->addr + offset);
+
+		offset += (count * sizeof(mmv_disk_metric2_t));
+		if (s->len < offset) {
+		    if (pmDebugOptions.appl0) {
+			pmNotifyErr(LOG_INFO, "MMV: %s - "
+				    "metrics offset: %"PRIu64" < %"PRIu64,
+				    s->name, s->len, (int64_t)offset);
+		    }
+		    continue;
+		}
+
+		s->metrics2 = ml;
+		s->mcnt2 = count;
+
+		for (k = 0; k < count; k++) {
+		    mmv_disk_metric2_t *mp = &ml[k];
+		    mmv_disk_string_t *string;
+		    char buf[MMV_STRINGMAX];
+		    char name[MAXPATHLEN];
+		    __uint64_t mname;
+		    pmID pmid;
+
+		    mname = mp->name;
+		    if (s->len < mname + sizeof(mmv_disk_string_t)) {
+			if (pmDebugOptions.appl0) {
+			    pmNotifyErr(LOG_INFO, "MMV: %s - "
+				    "metrics2 name: %"PRIu64" < %"PRIu64,
+				    s->name, s->len, mname);
+			}
+			continue;
+		    }
+		    string = (mmv_disk_string_t *)((char *)s->addr + mname);
+		    memcpy(buf, string->payload, sizeof(buf));
+		    buf[sizeof(buf)-1] = '\0';
+
+		    /* build name, check its legitimate and unique */
+		    if (hdr->flags & MMV_FLAG_NOPREFIX)
+			pmsprintf(name, sizeof(name), "%s.", ap->prefix);
+		    else
+			pmsprintf(name, sizeof(name), "%s.%s.", ap->prefix, s->name);
+		    strcat(name, buf);
+
+		    if (verify_metric_name(ap, name, k, s) != 0)
+			continue;
+		    if (verify_metric_item2(ml, k, name, s) != 0)
+			continue;
+
+		    pmid = pmID_build(pmda->e_domain, s->cluster, mp->item);
+		    create_metric(pmda, s, name, pmid, mp->indom,
+				    mp->type, mp->semantics, mp->dimension);
+		}
+	    }
+	    break;
+
+	case MMV_TOC_INDOMS:
+	    if (count > MAX_MMV_SERIAL) {
+		if (pmDebugOptions.appl0) {
+		    pmNotifyErr(LOG_ERR, "MMV: %s - "
+				    "indoms count: %d > %d",
+				    s->name, count, MAX_MMV_SERIAL);
+		}
+		continue;
+	    }
+	    id = (mmv_disk_indom_t *)((char *)s->addr + offset);
+
+	    offset += (count * sizeof(mmv_disk_indom_t));
+	    if (s->len < offset) {
+		if (pmDebugOptions.appl0) {
+		    pmNotifyErr(LOG_ERR, "MMV: %s - "
+				    "indoms offset: %"PRIu64" < %"PRIu64,
+				    s->name, s->len, offset);
+		}
+		continue;
+	    }
+
+	    for (k = 0; k < count; k++) {
+		int sts, serial = id[k].serial;
+		pmInDom pmindom;
+		pmdaIndom *ip;
+		__uint64_t ioffset = id[k].offset;
+		__uint32_t icount = id[k].count;
+
+		if (s->version == MMV_VERSION1) {
+		    ioffset += (icount * sizeof(mmv_disk_instance_t));
+		    if (s->len < ioffset) {
+			if (pmDebugOptions.appl0) {
+			    pmNotifyErr(LOG_ERR, "MMV: %s - "
+				    "indom[%d] offset: %"PRIu64" < %"PRIu64,
+				    s->name, k, s->len, ioffset);
+			}
+			continue;
+		    }
+		} else {
+		    ioffset += (icount * sizeof(mmv_disk_instance2_t));
+		    if (s->len < ioffset) {
+			if (pmDebugOptions.appl0) {
+			    pmNotifyErr(LOG_ERR, "MMV: %s - "
+				    "indom[%d] offset: %"PRIu64" < %"PRIu64,
+				    s->name, k, s->len, ioffset);
+			}
+			continue;
+		    }
+		}
+		ioffset = id[k].offset;
+		sts = verify_indom_serial(pmda, serial, s, &pmindom, &ip);
+		if (sts == -EINVAL)
+		    continue;
+		else if (sts == -EEXIST)
+		    /* see if we have new instances to add here */
+		    update_indom(pmda, s, ioffset, icount, &id[k], ip);
+		else
+		    /* first time we've observed this indom */
+		    create_indom(pmda, s, ioffset, icount, &id[k], pmindom);
+	    }
+	    break;
+
+	case MMV_TOC_VALUES:
+	    offset += (count * sizeof(mmv_disk_value_t));
+	    if (s->len < offset) {
+		if (pmDebugOptions.appl0) {
+		    pmNotifyErr(LOG_ERR, "MMV: %s - "
+				    "values offset: %"PRIu64" < %"PRIu64,
+				    s->name, s->len, offset);
+		}
+		continue;
+	    }
+	    offset -= (count * sizeof(mmv_disk_value_t));
+
+	    s->vcnt = count;
+	    s->values = (mmv_disk_value_t *)((char *)s->addr + offset);
+	    break;
+
+	case MMV_TOC_INSTANCES:
+	case MMV_TOC_STRINGS:
+	case MMV_TOC_SHARDS:
+	case MMV_TOC_HISTOGRAMS:
+	    break;
+
+	case MMV_TOC_LABELS:
+	    if (count > MAX_MMV_LABELS) {
+		if (pmDebugOptions.appl0) {
+		    pmNotifyErr(LOG_ERR, "MMV: %s - "
+			       "labels count: %d > %d",
+				s->name, count, MAX_MMV_LABELS);
+		}
+		continue;
+	    }
+	    mmv_disk_label_t *lb = (mmv_disk_label_t *)
+				    ((char *)s->addr + offset);
+
+	    offset += (count * sizeof(mmv_disk_label_t));
+	    if (s->len < offset) {
+		if (pmDebugOptions.appl0) {
+		    pmNotifyErr(LOG_INFO, "MMV: %s - "
+			    "labels offset: %"PRIu64" < %"PRIu64,
+			    s->name, s->len, (int64_t)offset);
+		}
+		continue;
+	    }
+
+	    s->labels = lb;
+	    s->lcnt = count;
+	    break;
+
+	default:
+	    if (pmDebugOptions.appl0) {
+		pmNotifyErr(LOG_DEBUG, "MMV: %s - bad TOC type (%x)",
+				s->name, type);
+	    }
+	    break;
+	}
+    }
+}
+
+/*
+ * (Re)create the namespace from the hard-coded control metrics and
+ * the names of all metrics currently in the agent metric table.
+ */
+static int
+create_pmns(pmdaExt *pmda)
 {
-    struct dirent	**files;
-    struct stat		statbuf;
     agent_t		*ap = (agent_t *)pmdaExtGetData(pmda);
-    char		path[MAXPATHLEN], name[64], *client;
-    int			need_reload = 0, sep = pmPathSeparator();
-    int			i, j, k, sts, num;
+    char		name[64];
+    int			m, sts;
 
     if (ap->pmns) {
 	pmdaTreeRelease(ap->pmns);
@@ -572,7 +903,7 @@ map_stats(pmdaExt *pmda)
 	pmNotifyErr(LOG_ERR, "%s: failed to create new pmns: %s\n",
 			pmGetProgname(), pmErrStr(sts));
 	ap->pmns = NULL;
-	return;
+	return sts;
     }
 
     /* hard-coded metrics (not from mmap'd files) */
@@ -582,25 +913,25 @@ map_stats(pmdaExt *pmda)
     pmdaTreeInsert(ap->pmns, pmID_build(pmda->e_domain, 0, 1), name);
     pmsprintf(name, sizeof(name), "%s.control.files", ap->prefix);
     pmdaTreeInsert(ap->pmns, pmID_build(pmda->e_domain, 0, 2), name);
-    ap->mtot = 3;
 
-    if (ap->indoms != NULL) {
-	for (i = 0; i < ap->intot; i++)
-	    free(ap->indoms[i].it_set);
-	free(ap->indoms);
-	ap->indoms = NULL;
-	ap->intot = 0;
-    }
+    for (m = 3; m < ap->mtot; m++)
+	pmdaTreeInsert(ap->pmns, ap->metrics[m].m_desc.pmid, ap->names[m]);
+    return 0;
+}
 
-    if (ap->slist != NULL) {
-	for (i = 0; i < ap->scnt; i++) {
-	    free(ap->slist[i].name);
-	    __pmMemoryUnmap(ap->slist[i].addr, ap->slist[i].len);
-	}
-	free(ap->slist);
-	ap->slist = NULL;
-	ap->scnt = 0;
-    }
+/*
+ * Map any client files in the stats directory not already mapped,
+ * appending them to the client list.  Returns non-zero if some file
+ * was still being created and should be looked for again later.
+ */
+static int
+scan_stats(agent_t *ap)
+{
+    struct dirent	**files;
+    struct stat		statbuf;
+    char		path[MAXPATHLEN], *client;
+    int			need_rescan = 0, sep = pmPathSeparator();
+    int			i, j, num;
 
     num = scandir(ap->statsdir, &files, NULL, alphasort);
     for (i = 0; i < num; i++) {
@@ -608,11 +939,17 @@ map_stats(pmdaExt *pmda)
 	    continue;
 
 	client = files[i]->d_name;
+	for (j = 0; j < ap->scnt; j++)
+	    if (strcmp(ap->slist[j].name, client) == 0)
+		break;
+	if (j < ap->scnt)
+	    continue;
+
 	pmsprintf(path, sizeof(path), "%s%c%s", ap->statsdir, sep, client);
 
 	if (stat(path, &statbuf) >= 0 && S_ISREG(statbuf.st_mode))
-	    if (create_client_stat(ap, client, path, statbuf.st_size) == -EAGAIN)
-		need_reload = 1;
+	    if (create_client_stat(ap, client, path, &statbuf) == -EAGAIN)
+		need_rescan = 1;
     }
 
     for (i = 0; i < num; i++)
@@ -620,243 +957,171 @@ map_stats(pmdaExt *pmda)
     if (num > 0)
 	free(files);
 
-    for (i = 0; ap->slist && i < ap->scnt; i++) {
-	stats_t	*s = ap->slist + i;
-	mmv_disk_indom_t *id;
-	mmv_disk_header_t *hdr = (mmv_disk_header_t *)s->addr;
-	mmv_disk_toc_t *toc = (mmv_disk_toc_t *)
-			((char *)s->addr + sizeof(mmv_disk_header_t));
+    return need_rescan;
+}
 
-	for (j = 0; j < hdr->tocs; j++) {
-	    __uint64_t offset = toc[j].offset;
-	    __uint32_t count = toc[j].count;
-	    __uint32_t type = toc[j].type;
+static void
+map_stats(pmdaExt *pmda)
+{
+    agent_t		*ap = (agent_t *)pmdaExtGetData(pmda);
+    int			i;
 
-	    switch (type) {
-	    case MMV_TOC_METRICS:
-		if (count > MAX_MMV_ITEMS) {
-		    if (pmDebugOptions.appl0) {
-			pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"metrics count: %d > %d",
-					s->name, count, MAX_MMV_ITEMS);
-		    }
-		    continue;
-		}
-		if (s->version == MMV_VERSION1) {
-		    mmv_disk_metric_t *ml = (mmv_disk_metric_t *)
-					((char *)s->addr + offset);
+    for (i = 3; i < ap->mtot; i++)
+	free(ap->names[i]);
+    ap->mtot = 3;
 
-		    offset += (count * sizeof(mmv_disk_metric_t));
-		    if (s->len < offset) {
-			if (pmDebugOptions.appl0) {
-			    pmNotifyErr(LOG_INFO, "MMV: %s - "
-					"metrics offset: %"PRIu64" < %"PRIu64,
-					s->name, s->len, (int64_t)offset);
-			}
-			continue;
-		    }
+    if (create_pmns(pmda) < 0)
+	return;
 
-		    s->metrics1 = ml;
-		    s->mcnt1 = count;
-
-		    for (k = 0; k < count; k++) {
-			mmv_disk_metric_t *mp = &ml[k];
-			char name[MAXPATHLEN];
-			pmID pmid;
-
-			/* build name, check its legitimate and unique */
-			if (hdr->flags & MMV_FLAG_NOPREFIX)
-			    pmsprintf(name, sizeof(name), "%s.", ap->prefix);
-			else
-			    pmsprintf(name, sizeof(name), "%s.%s.", ap->prefix, s->name);
-			strcat(name, mp->name);
-			if (verify_metric_name(ap, name, k, s) != 0)
-			    continue;
-			if (verify_metric_item(ml, k, name, s) != 0)
-			    continue;
-
-			pmid = pmID_build(pmda->e_domain, s->cluster, mp->item);
-			create_metric(pmda, s, name, pmid, mp->indom,
-					mp->type, mp->semantics, mp->dimension);
-		    }
-		}
-		else if (s->version == MMV_VERSION2 || s->version == MMV_VERSION3) {
-		    mmv_disk_metric2_t *ml = (mmv_disk_metric2_t *)
-					((char *)s->addr + offset);
+    if (ap->indoms != NULL) {
+	for (i = 0; i < ap->intot; i++)
+	    free(ap->indoms[i].it_set);
+	free(ap->indoms);
+	ap->indoms = NULL;
+	ap->intot = 0;
+    }
 
-		    offset += (count * sizeof(mmv_disk_metric2_t));
-		    if (s->len < offset) {
-			if (pmDebugOptions.appl0) {
-			    pmNotifyErr(LOG_INFO, "MMV: %s - "
-					"metrics offset: %"PRIu64" < %"PRIu64,
-					s->name, s->len, (int64_t)offset);
-			}
-			continue;
-		    }
+    if (ap->slist != NULL) {
+	for (i = 0; i < ap->scnt; i++) {
+	    free(ap->slist[i].name);
+	    __pmMemoryUnmap(ap->slist[i].addr, ap->slist[i].len);
+	}
+	free(ap->slist);
+	ap->slist = NULL;
+	ap->scnt = 0;
+    }
 
-		    s->metrics2 = ml;
-		    s->mcnt2 = count;
-
-		    for (k = 0; k < count; k++) {
-			mmv_disk_metric2_t *mp = &ml[k];
-			mmv_disk_string_t *string;
-			char buf[MMV_STRINGMAX];
-			char name[MAXPATHLEN];
-			__uint64_t mname;
-			pmID pmid;
-
-			mname = mp->name;
-			if (s->len < mname + sizeof(mmv_disk_string_t)) {
-			    if (pmDebugOptions.appl0) {
-				pmNotifyErr(LOG_INFO, "MMV: %s - "
-					"metrics2 name: %"PRIu64" < %"PRIu64,
-					s->name, s->len, mname);
-			    }
-			    continue;
-			}
-			string = (mmv_disk_string_t *)((char *)s->addr + mname);
-			memcpy(buf, string->payload, sizeof(buf));
-			buf[sizeof(buf)-1] = '\0';
-
-			/* build name, check its legitimate and unique */
-			if (hdr->flags & MMV_FLAG_NOPREFIX)
-			    pmsprintf(name, sizeof(name), "%s.", ap->prefix);
-			else
-			    pmsprintf(name, sizeof(name), "%s.%s.", ap->prefix, s->name);
-			strcat(name, buf);
-
-			if (verify_metric_name(ap, name, k, s) != 0)
-			    continue;
-			if (verify_metric_item2(ml, k, name, s) != 0)
-			    continue;
-
-			pmid = pmID_build(pmda->e_domain, s->cluster, mp->item);
-			create_metric(pmda, s, name, pmid, mp->indom,
-					mp->type, mp->semantics, mp->dimension);
-		    }
-		}
-		break;
+    ap->rescan = scan_stats(ap);
 
-	    case MMV_TOC_INDOMS:
-		if (count > MAX_MMV_SERIAL) {
-		    if (pmDebugOptions.appl0) {
-			pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"indoms count: %d > %d",
-					s->name, count, MAX_MMV_SERIAL);
-		    }
-		    continue;
-		}
-		id = (mmv_disk_indom_t *)((char *)s->addr + offset);
+    for (i = 0; ap->slist && i < ap->scnt; i++)
+	map_client(pmda, ap->slist + i);
 
-		offset += (count * sizeof(mmv_disk_indom_t));
-		if (s->len < offset) {
-		    if (pmDebugOptions.appl0) {
-			pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"indoms offset: %"PRIu64" < %"PRIu64,
-					s->name, s->len, offset);
-		    }
-		    continue;
-		}
+    pmdaTreeRebuildHash(ap->pmns, ap->mtot); /* for reverse (pmid->name) lookups */
+    ap->reload = 0;
+}
 
-		for (k = 0; k < count; k++) {
-		    int sts, serial = id[k].serial;
-		    pmInDom pmindom;
-		    pmdaIndom *ip;
-		    __uint64_t ioffset = id[k].offset;
-		    __uint32_t icount = id[k].count;
-
-		    if (s->version == MMV_VERSION1) {
-			ioffset += (icount * sizeof(mmv_disk_instance_t));
-			if (s->len < ioffset) {
-			    if (pmDebugOptions.appl0) {
-				pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"indom[%d] offset: %"PRIu64" < %"PRIu64,
-					s->name, k, s->len, ioffset);
-			    }
-			    continue;
-			}
-		    } else {
-			ioffset += (icount * sizeof(mmv_disk_instance2_t));
-			if (s->len < ioffset) {
-			    if (pmDebugOptions.appl0) {
-				pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"indom[%d] offset: %"PRIu64" < %"PRIu64,
-					s->name, k, s->len, ioffset);
-			    }
-			    continue;
-			}
-		    }
-		    ioffset = id[k].offset;
-		    sts = verify_indom_serial(pmda, serial, s, &pmindom, &ip);
-		    if (sts == -EINVAL)
-			continue;
-		    else if (sts == -EEXIST)
-			/* see if we have new instances to add here */
-			update_indom(pmda, s, ioffset, icount, &id[k], ip);
-		    else
-			/* first time we've observed this indom */
-			create_indom(pmda, s, ioffset, icount, &id[k], pmindom);
-		}
-		break;
+/*
+ * Check whether a mapped client has gone stale - its generation number
+ * changed, its process exited or (when the stats directory changed) the
+ * file was removed, replaced or made inaccessible.
+ */
+static int
+stale_client_stat(agent_t *ap, stats_t *s, int rescan)
+{
+    mmv_disk_header_t	*hdr = (mmv_disk_header_t *)s->addr;
+    struct stat		statbuf;
+    char		path[MAXPATHLEN];
 
-	    case MMV_TOC_VALUES:
-		offset += (count * sizeof(mmv_disk_value_t));
-		if (s->len < offset) {
-		    if (pmDebugOptions.appl0) {
-			pmNotifyErr(LOG_ERR, "MMV: %s - "
-					"values offset: %"PRIu64" < %"PRIu64,
-					s->name, s->len, offset);
-		    }
-		    continue;
-		}
-		offset -= (count * sizeof(mmv_disk_value_t));
+    if (hdr->g1 != s->gen || hdr->g2 != s->gen)
+	return 1;
+    if (s->pid && !__pmProcessExists(s->pid))
+	return 1;
+    if (!rescan)
+	return 0;
 
-		s->vcnt = count;
-		s->values = (mmv_disk_value_t *)((char *)s->addr + offset);
-		break;
+    pmsprintf(path, sizeof(path), "%s%c%s",
+		ap->statsdir, pmPathSeparator(), s->name);
+    if (stat(path, &statbuf) < 0 || !S_ISREG(statbuf.st_mode) ||
+	statbuf.st_dev != s->dev || statbuf.st_ino != s->ino ||
+	statbuf.st_size != s->len || access(path, R_OK) < 0)
+	return 1;
+    return 0;
+}
 
-	    case MMV_TOC_INSTANCES:
-	    case MMV_TOC_STRINGS:
-		break;
-		
-	    case MMV_TOC_LABELS:
-	        if (count > MAX_MMV_LABELS) {
-		    if (pmDebugOptions.appl0) {
-		        pmNotifyErr(LOG_ERR, "MMV: %s - "
-		                   "labels count: %d > %d",
-				    s->name, count, MAX_MMV_LABELS);
-		    }
-		    continue;
-		}
-		mmv_disk_label_t *lb = (mmv_disk_label_t *)
-					((char *)s->addr + offset);
+/*
+ * Indom serials hold only the low 11 bits of the cluster, so clusters
+ * differing in the top bit share indoms - treat them as changed together.
+ */
+static void
+mark_cluster(char *dirty, int cluster)
+{
+    dirty[cluster] = 1;
+    dirty[cluster ^ (1 << 11)] = 1;
+}
 
-		offset += (count * sizeof(mmv_disk_label_t));
-		if (s->len < offset) {
-		    if (pmDebugOptions.appl0) {
-		        pmNotifyErr(LOG_INFO, "MMV: %s - "
-				"labels offset: %"PRIu64" < %"PRIu64,
-				s->name, s->len, (int64_t)offset);
-		    }
-		    continue;
-		}
+/*
+ * Incremental reload - unmap only the stale clients, map any new ones,
+ * and replace the metrics and indoms of just the clusters affected by
+ * those changes (other clients sharing such a cluster are walked again,
+ * their mappings are left untouched).  Returns the number of changes.
+ */
+static int
+reload_stats(pmdaExt *pmda, int rescan)
+{
+    agent_t		*ap = (agent_t *)pmdaExtGetData(pmda);
+    pmdaIndom		*ip;
+    stats_t		*s;
+    char		dirty[MAX_MMV_CLUSTER + 1];
+    int			i, j, cluster, scnt, changes = 0;
 
-		s->labels = lb;
-		s->lcnt = count;
-	    	break;
+    memset(dirty, 0, sizeof(dirty));
 
-	    default:
-		if (pmDebugOptions.appl0) {
-		    pmNotifyErr(LOG_DEBUG, "MMV: %s - bad TOC type (%x)",
-				    s->name, type);
-		}
-		break;
-	    }
+    for (i = j = 0; i < ap->scnt; i++) {
+	s = &ap->slist[i];
+	if (!stale_client_stat(ap, s, rescan)) {
+	    if (i != j)
+		ap->slist[j] = *s;
+	    j++;
+	    continue;
+	}
+	if (pmDebugOptions.appl0)
+	    pmNotifyErr(LOG_DEBUG, "MMV: unloading %s client: %d \"%s\"",
+			    ap->prefix, s->cluster, s->name);
+	mark_cluster(dirty, s->cluster);
+	free(s->name);
+	__pmMemoryUnmap(s->addr, s->len);
+	changes++;
+    }
+    ap->scnt = j;
+
+    /* a client may have been replaced by a new file of the same name */
+    if (rescan || changes) {
+	scnt = ap->scnt;
+	ap->rescan = scan_stats(ap);
+	for (i = scnt; i < ap->scnt; i++) {
+	    mark_cluster(dirty, ap->slist[i].cluster);
+	    changes++;
 	}
     }
+    if (!changes)
+	return 0;
+
+    /* remove metrics and indoms belonging to the affected clusters */
+    for (i = j = 3; i < ap->mtot; i++) {
+	if (dirty[pmID_cluster(ap->metrics[i].m_desc.pmid)]) {
+	    free(ap->names[i]);
+	    continue;
+	}
+	if (i != j) {
+	    ap->metrics[j] = ap->metrics[i];
+	    ap->names[j] = ap->names[i];
+	}
+	j++;
+    }
+    ap->mtot = j;
+
+    for (i = j = 0; i < ap->intot; i++) {
+	ip = &ap->indoms[i];
+	cluster = pmInDom_serial(ip->it_indom) >> 11;
+	if (cluster && dirty[cluster]) {
+	    free(ip->it_set);
+	    continue;
+	}
+	if (i != j)
+	    ap->indoms[j] = *ip;
+	j++;
+    }
+    ap->intot = j;
+
+    if (create_pmns(pmda) < 0)
+	return changes;
+
+    for (i = 0; i < ap->scnt; i++)
+	if (dirty[ap->slist[i].cluster])
+	    map_client(pmda, ap->slist + i);
 
     pmdaTreeRebuildHash(ap->pmns, ap->mtot); /* for reverse (pmid->name) lookups */
-    ap->reload = need_reload;
+    return changes;
 }
 
 static int
@@ -962,6 +1227,98 @@ mmv_lookup_stat_metric_value(agent_t *agent, pmID pmid, unsigned int inst,
     return mmv_lookup_stat_metric(agent, pmid, inst, stats, value, NULL, NULL);
 }
 
+/*
+ * Sharded (v4) values are updated by clients in separate cache lines,
+ * the exported value is the sum of the value and each of its shards.
+ */
+static int
+mmv_shard_sum(stats_t *s, mmv_disk_value_t *v, int type, pmAtomValue *atom)
+{
+    mmv_disk_metric2_t	*m;
+    mmv_disk_shard_t	*shard;
+    __uint64_t		offset;
+    __uint32_t		i, shards;
+
+    if (s->version < MMV_VERSION4)
+	return 0;
+    m = (mmv_disk_metric2_t *)((char *)s->addr + v->metric);
+    if ((shards = m->shards) == 0)
+	return 0;
+    offset = v->extra;
+    if (shards > MMV_SHARDMAX ||
+	s->len < offset + shards * sizeof(mmv_disk_shard_t)) {
+	if (pmDebugOptions.appl0)
+	    pmNotifyErr(LOG_ERR, "MMV: %s - "
+			"bad shards: %u at offset %"PRIu64,
+			s->name, shards, offset);
+	return PM_ERR_GENERIC;
+    }
+    shard = (mmv_disk_shard_t *)((char *)s->addr + offset);
+    for (i = 0; i < shards; i++) {
+	switch (type) {
+	    case MMV_TYPE_I32:
+		atom->l += shard[i].value.l;
+		break;
+	    case MMV_TYPE_U32:
+		atom->ul += shard[i].value.ul;
+		break;
+	    case MMV_TYPE_I64:
+		atom->ll += shard[i].value.ll;
+		break;
+	    case MMV_TYPE_U64:
+		atom->ull += shard[i].value.ull;
+		break;
+	    case MMV_TYPE_FLOAT:
+		atom->f += shard[i].value.f;
+		break;
+	    case MMV_TYPE_DOUBLE:
+		atom->d += shard[i].value.d;
+		break;
+	    default:
+		break;
+	}
+    }
+    return 0;
+}
+
+/*
+ * Histogram values - bucket instances with no samples are omitted,
+ * the count instance is derived from the sum of all the buckets.
+ */
+static int
+mmv_histogram_fetch(stats_t *s, mmv_disk_value_t *v, unsigned int inst,
+	pmAtomValue *atom)
+{
+    mmv_disk_histogram_t *hp;
+    __uint64_t		offset = v->extra;
+    int			i;
+
+    if (s->version < MMV_VERSION4 || offset == 0 ||
+	s->len < offset + sizeof(mmv_disk_histogram_t)) {
+	if (pmDebugOptions.appl0)
+	    pmNotifyErr(LOG_ERR, "MMV: %s - "
+			"bad histogram offset: %"PRIu64" < %"PRIu64,
+			s->name, s->len,
+			offset + sizeof(mmv_disk_histogram_t));
+	return PM_ERR_GENERIC;
+    }
+    hp = (mmv_disk_histogram_t *)((char *)s->addr + offset);
+
+    if (inst == HISTOGRAM_SUM) {
+	atom->ull = hp->sum;
+    } else if (inst == HISTOGRAM_COUNT) {
+	atom->ull = 0;
+	for (i = 0; i < MMV_HISTOGRAM_BUCKETS; i++)
+	    atom->ull += hp->buckets[i];
+    } else if (inst < MMV_HISTOGRAM_BUCKETS) {
+	if ((atom->ull = hp->buckets[inst]) == 0)
+	    return PMDA_FETCH_NOVALUES;
+    } else {
+	return PM_ERR_INST;
+    }
+    return PMDA_FETCH_STATIC;
+}
+
 /*
  * callback provided to pmdaFetch
  */
@@ -1007,16 +1364,22 @@ mmv_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		if ((flags & MMV_FLAG_SENTINEL) &&
 		    (memcmp(atom, &aNaN, sizeof(*atom)) == 0))
 		    return PMDA_FETCH_NOVALUES;
+		if ((sts = mmv_shard_sum(s, v, sts, atom)) < 0)
+		    return sts;
 		break;
 	    case MMV_TYPE_FLOAT:
 		memcpy(atom, &v->value, sizeof(pmAtomValue));
 		if ((flags & MMV_FLAG_SENTINEL) && atom->f == fNaN)
 		    return PMDA_FETCH_NOVALUES;
+		if ((sts = mmv_shard_sum(s, v, sts, atom)) < 0)
+		    return sts;
 		break;
 	    case MMV_TYPE_DOUBLE:
 		memcpy(atom, &v->value, sizeof(pmAtomValue));
 		if ((flags & MMV_FLAG_SENTINEL) && atom->d == dNaN)
 		    return PMDA_FETCH_NOVALUES;
+		if ((sts = mmv_shard_sum(s, v, sts, atom)) < 0)
+		    return sts;
 		break;
 	    case MMV_TYPE_ELAPSED: {
 		atom->ll = v->value.ll;
@@ -1048,6 +1411,8 @@ mmv_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		atom->cp = ap->buffer;
 		break;
 	    }
+	    case MMV_TYPE_HISTOGRAM:
+		return mmv_histogram_fetch(s, v, inst, atom);
 	}
 	return PMDA_FETCH_STATIC;
     }
@@ -1060,30 +1425,23 @@ mmv_reload_maybe(pmdaExt *pmda)
 {
     struct stat		s;
     agent_t		*ap = (agent_t *)pmdaExtGetData(pmda);
-    int			i, need_reload = ap->reload;
+    int			i, need_reload = ap->reload, rescan = ap->rescan;
 
-    /* check if generation numbers changed or monitored process exited */
-    for (i = 0; i < ap->scnt; i++) {
-	mmv_disk_header_t *hdr = (mmv_disk_header_t *)ap->slist[i].addr;
-	if (hdr->g1 != ap->slist[i].gen || hdr->g2 != ap->slist[i].gen) {
-	    need_reload++;
-	    break;
-	}
-	if (ap->slist[i].pid && !__pmProcessExists(ap->slist[i].pid)) {
-	    need_reload++;
-	    break;
-	}
-    }
+    if (ap->pmns == NULL)
+	need_reload++;	/* initial load */
 
     /*
-     * check if the directory has been modified, reload if so;
+     * check if the directory has been modified, rescan it if so;
      * note modification may involve removal or newly appeared,
      * a change in permissions from accessible to not (or vice-
-     * versa), and so on.
+     * versa), and so on.  If the directory itself has become
+     * (in)accessible, reload everything.
      */
     if (stat(ap->statsdir, &s) >= 0) {
 	if (s.st_mtime != ap->statsdir_ts) {
-	    need_reload++;
+	    if (ap->statsdir_code != 0)
+		need_reload++;
+	    rescan++;
 	    ap->statsdir_code = 0;
 	    ap->statsdir_ts = s.st_mtime;
 	}
@@ -1100,16 +1458,27 @@ mmv_reload_maybe(pmdaExt *pmda)
 	if (pmDebugOptions.appl0)
 	    pmNotifyErr(LOG_DEBUG, "MMV: %s: reloading", pmGetProgname());
 	map_stats(pmda);
+    } else {
+	/*
+	 * check if generation numbers changed or monitored process
+	 * exited, and for new or replaced files - only the changed
+	 * mappings are unmapped/remapped.
+	 */
+	if ((i = reload_stats(pmda, rescan)) == 0)
+	    return;
+	if (pmDebugOptions.appl0)
+	    pmNotifyErr(LOG_DEBUG, "MMV: %s: reloaded %d changed client(s)",
+			    pmGetProgname(), i);
+    }
 
-	pmda->e_indoms = ap->indoms;
-	pmda->e_nindoms = ap->intot;
-	pmdaRehash(pmda, ap->metrics, ap->mtot);
+    pmda->e_indoms = ap->indoms;
+    pmda->e_nindoms = ap->intot;
+    pmdaRehash(pmda, ap->metrics, ap->mtot);
 
-	if (pmDebugOptions.appl0)
-	    pmNotifyErr(LOG_DEBUG, 
+    if (pmDebugOptions.appl0)
+	pmNotifyErr(LOG_DEBUG, 
 		      "MMV: %s: %d metrics and %d indoms after reload", 
 		      pmGetProgname(), ap->mtot, ap->intot);
-    }
 }
 
 /* Intercept request for descriptor and check if we'd have to reload */
@@ -1360,8 +1729,21 @@ mmv_labelCallBack(pmInDom indom, unsigned int inst, pmLabelSet **lp)
     mmv_disk_label_t	lb;
     stats_t		*s;
     agent_t		*ap = (agent_t *)privdata;
+    char		buf[64];
     int			i, j, count = 0;
 
+    /* histogram buckets are labelled with their bounds */
+    if (pmInDom_serial(indom) == HISTOGRAM_SERIAL) {
+	if (inst >= MMV_HISTOGRAM_BUCKETS)
+	    return 0;
+	pmsprintf(buf, sizeof(buf), "{\"lower\":%"PRIu64",\"upper\":%"PRIu64"}",
+			(uint64_t)MMV_HISTOGRAM_LOWER(inst),
+			(uint64_t)MMV_HISTOGRAM_UPPER(inst));
+	if (__pmAddLabels(lp, buf, PM_LABEL_INSTANCES) < 0)
+	    return 0;
+	return 1;
+    }
+
     /* search for labels with requested indom and instance identifier */
     for (i = 0; i < ap->scnt; i++) {
 	s = &ap->slist[i];
@@ -1414,7 +1796,9 @@ init_pmda(pmdaInterface *dp, agent_t *ap)
 	 * cases below, and pmns initialization in map_stats()
 	 */
 	ap->mtot = 3;
-	if ((ap->metrics = malloc(ap->mtot * sizeof(pmdaMetric))) != NULL) {
+	ap->names = calloc(ap->mtot, sizeof(char *));
+	if ((ap->metrics = malloc(ap->mtot * sizeof(pmdaMetric))) != NULL &&
+	    ap->names != NULL) {
 	    /*
 	     * all the hard-coded metrics have the same semantics
 	     */
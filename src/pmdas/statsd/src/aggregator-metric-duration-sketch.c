@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2019 Miroslav Foltýn.  All Rights Reserved.
+ * 
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "utils.h"
+#include "aggregators.h"
+#include "aggregator-metric-duration.h"
+#include "aggregator-metric-duration-sketch.h"
+#include "config-reader.h"
+
+/* Values below this are counted separately, their logarithm isn't meaningful */
+#define SKETCH_MIN_INDEXABLE_VALUE 1e-9
+#define SKETCH_INITIAL_BUCKETS 64
+
+/**
+ * Gets index of bucket which value falls into
+ * @arg sketch - Sketch for which to compute index
+ * @arg value - Value greater than SKETCH_MIN_INDEXABLE_VALUE
+ * @return bucket index
+ */
+static long
+get_sketch_index(struct sketch_duration* sketch, double value) {
+    return (long)ceil(log(value) / sketch->log_gamma);
+}
+
+/**
+ * Gets value representing given bucket, it is within relative accuracy from any value in bucket
+ * @arg sketch - Sketch to which bucket belongs
+ * @arg index - Bucket index
+ * @return value estimate
+ */
+static double
+get_sketch_bucket_value(struct sketch_duration* sketch, long index) {
+    return 2.0 * exp(index * sketch->log_gamma) / (sketch->gamma + 1.0);
+}
+
+/**
+ * Clears sketch, allocated buckets are kept
+ * @arg sketch - Sketch to clear
+ * @arg now - Start of new interval
+ */
+static void
+clear_sketch(struct sketch_duration* sketch, time_t now) {
+    memset(sketch->buckets, 0, sizeof(uint64_t) * sketch->capacity);
+    sketch->offset = 0;
+    sketch->length = 0;
+    sketch->zero_count = 0;
+    sketch->count = 0;
+    sketch->min = 0;
+    sketch->max = 0;
+    sketch->mean = 0;
+    sketch->m2 = 0;
+    sketch->interval_start = now;
+}
+
+/**
+ * Clears sketch when its reset interval has elapsed
+ * @arg sketch - Sketch to check
+ */
+static void
+check_sketch_interval(struct sketch_duration* sketch) {
+    if (sketch->reset_interval == 0) {
+        return;
+    }
+    time_t now = time(NULL);
+    if (now - sketch->interval_start >= sketch->reset_interval) {
+        clear_sketch(sketch, now);
+    }
+}
+
+/**
+ * Makes sketch buckets cover indexes from low to high, these never span more than max_buckets.
+ * Counts in buckets below low are collapsed into the lowest bucket.
+ * @arg sketch - Sketch to resize
+ * @arg low - New lowest bucket index
+ * @arg high - New highest bucket index
+ */
+static void
+resize_sketch(struct sketch_duration* sketch, long low, long high) {
+    size_t new_length = (size_t)(high - low + 1);
+    if (new_length > sketch->capacity) {
+        size_t new_capacity = sketch->capacity;
+        while (new_capacity < new_length) {
+            new_capacity *= 2;
+        }
+        if (new_capacity > sketch->max_buckets) {
+            new_capacity = sketch->max_buckets;
+        }
+        uint64_t* new_buckets = realloc(sketch->buckets, sizeof(uint64_t) * new_capacity);
+        ALLOC_CHECK("Unable to allocate memory for sketch buckets.");
+        memset(new_buckets + sketch->capacity, 0, sizeof(uint64_t) * (new_capacity - sketch->capacity));
+        sketch->buckets = new_buckets;
+        sketch->capacity = new_capacity;
+    }
+    uint64_t collapsed = 0;
+    if (sketch->offset < low) {
+        size_t dropped = (size_t)(low - sketch->offset);
+        if (dropped > sketch->length) {
+            dropped = sketch->length;
+        }
+        size_t i;
+        for (i = 0; i < dropped; i++) {
+            collapsed += sketch->buckets[i];
+        }
+        memmove(sketch->buckets, sketch->buckets + dropped, sizeof(uint64_t) * (sketch->length - dropped));
+        memset(sketch->buckets + sketch->length - dropped, 0, sizeof(uint64_t) * dropped);
+        sketch->length -= dropped;
+        sketch->offset = sketch->length ? sketch->offset + (long)dropped : low;
+    }
+    size_t shift = (size_t)(sketch->offset - low);
+    if (shift > 0 && sketch->length > 0) {
+        memmove(sketch->buckets + shift, sketch->buckets, sizeof(uint64_t) * sketch->length);
+        memset(sketch->buckets, 0, sizeof(uint64_t) * shift);
+    }
+    sketch->offset = low;
+    sketch->length = new_length;
+    sketch->buckets[0] += collapsed;
+}
+
+/**
+ * Creates sketch duration value
+ * @arg config - Config containing sketch accuracy, bucket limit and reset interval
+ * @arg value - Initial value
+ * @arg out - Placeholder for sketch
+ */
+void
+create_sketch_duration_value(struct agent_config* config, double value, void** out) {
+    struct sketch_duration* sketch = (struct sketch_duration*) malloc(sizeof(struct sketch_duration));
+    ALLOC_CHECK("Unable to allocate memory for duration sketch.");
+    *sketch = (struct sketch_duration) { 0 };
+    double accuracy = config->duration_sketch_accuracy;
+    sketch->gamma = (1.0 + accuracy) / (1.0 - accuracy);
+    sketch->log_gamma = log(sketch->gamma);
+    sketch->max_buckets = config->duration_sketch_buckets;
+    sketch->capacity = sketch->max_buckets < SKETCH_INITIAL_BUCKETS ? sketch->max_buckets : SKETCH_INITIAL_BUCKETS;
+    sketch->buckets = (uint64_t*) calloc(sketch->capacity, sizeof(uint64_t));
+    ALLOC_CHECK("Unable to allocate memory for sketch buckets.");
+    sketch->reset_interval = config->duration_sketch_reset_interval;
+    sketch->interval_start = time(NULL);
+    update_sketch_duration_value(value, sketch);
+    *out = sketch;
+}
+
+/**
+ * Records value into sketch
+ * @arg value - Value to record
+ * @arg sketch - Sketch to update
+ */
+void
+update_sketch_duration_value(double value, struct sketch_duration* sketch) {
+    check_sketch_interval(sketch);
+    if (value < SKETCH_MIN_INDEXABLE_VALUE) {
+        sketch->zero_count++;
+    } else {
+        long index = get_sketch_index(sketch, value);
+        long low = index;
+        long high = index;
+        if (sketch->length > 0) {
+            long current_high = sketch->offset + (long)sketch->length - 1;
+            low = index < sketch->offset ? index : sketch->offset;
+            high = index > current_high ? index : current_high;
+        }
+        if (high - low + 1 > (long)sketch->max_buckets) {
+            low = high - (long)sketch->max_buckets + 1;
+        }
+        if (sketch->length == 0 || low != sketch->offset || (size_t)(high - low + 1) != sketch->length) {
+            resize_sketch(sketch, low, high);
+        }
+        if (index < low) {
+            index = low;
+        }
+        sketch->buckets[index - sketch->offset]++;
+    }
+    if (sketch->count == 0 || value < sketch->min) {
+        sketch->min = value;
+    }
+    if (sketch->count == 0 || value > sketch->max) {
+        sketch->max = value;
+    }
+    sketch->count++;
+    double delta = value - sketch->mean;
+    sketch->mean += delta / sketch->count;
+    sketch->m2 += delta * (value - sketch->mean);
+}
+
+/**
+ * Gets estimate of value at given quantile, ranks follow the exact duration aggregation
+ * @arg sketch - Target sketch
+ * @arg rank - Zero based rank of value
+ * @return value estimate
+ */
+static double
+get_sketch_value_at_rank(struct sketch_duration* sketch, uint64_t rank) {
+    if (rank < sketch->zero_count) {
+        return sketch->min;
+    }
+    uint64_t accumulator = sketch->zero_count;
+    double result = sketch->max;
+    size_t i;
+    for (i = 0; i < sketch->length; i++) {
+        accumulator += sketch->buckets[i];
+        if (accumulator > rank) {
+            result = get_sketch_bucket_value(sketch, sketch->offset + (long)i);
+            break;
+        }
+    }
+    if (result < sketch->min) {
+        return sketch->min;
+    }
+    if (result > sketch->max) {
+        return sketch->max;
+    }
+    return result;
+}
+
+/**
+ * Gets rank of value at given percentile
+ * @arg count - Count of values
+ * @arg percentile - Percentile of value
+ * @return zero based rank
+ */
+static uint64_t
+get_sketch_percentile_rank(uint64_t count, double percentile) {
+    double rank = round((percentile / 100.0) * (double)count) - 1;
+    return rank < 0 ? 0 : (uint64_t)rank;
+}
+
+/**
+ * Gets duration values meta data from sketch
+ * @arg sketch - Target sketch
+ * @arg instance - What information to extract
+ * @return duration instance value
+ */
+double
+get_sketch_duration_instance(struct sketch_duration* sketch, enum DURATION_INSTANCE instance) {
+    if (sketch == NULL) {
+        return 0;
+    }
+    check_sketch_interval(sketch);
+    if (sketch->count == 0) {
+        return 0;
+    }
+    switch (instance) {
+        case DURATION_MIN:
+            return sketch->min;
+        case DURATION_MAX:
+            return sketch->max;
+        case DURATION_COUNT:
+            return (double)sketch->count;
+        case DURATION_AVERAGE:
+            return sketch->mean;
+        case DURATION_MEDIAN:
+            return get_sketch_value_at_rank(sketch, (uint64_t)ceil((sketch->count / 2.0) - 1));
+        case DURATION_PERCENTILE90:
+            return get_sketch_value_at_rank(sketch, get_sketch_percentile_rank(sketch->count, 90));
+        case DURATION_PERCENTILE95:
+            return get_sketch_value_at_rank(sketch, get_sketch_percentile_rank(sketch->count, 95));
+        case DURATION_PERCENTILE99:
+            return get_sketch_value_at_rank(sketch, get_sketch_percentile_rank(sketch->count, 99));
+        case DURATION_STANDARD_DEVIATION:
+            return sqrt(sketch->m2 / (double)sketch->count);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Prints sketch metadata in human readable way
+ * @arg f - Opened file handle, doesn't close it when finished
+ * @arg sketch - Target sketch
+ */
+void
+print_sketch_duration_value(FILE* f, struct sketch_duration* sketch) {
+    fprintf(f, "min             = %lf\n", get_sketch_duration_instance(sketch, DURATION_MIN));
+    fprintf(f, "max             = %lf\n", get_sketch_duration_instance(sketch, DURATION_MAX));
+    fprintf(f, "median          = %lf\n", get_sketch_duration_instance(sketch, DURATION_MEDIAN));
+    fprintf(f, "average         = %lf\n", get_sketch_duration_instance(sketch, DURATION_AVERAGE));
+    fprintf(f, "percentile90    = %lf\n", get_sketch_duration_instance(sketch, DURATION_PERCENTILE90));
+    fprintf(f, "percentile95    = %lf\n", get_sketch_duration_instance(sketch, DURATION_PERCENTILE95));
+    fprintf(f, "percentile99    = %lf\n", get_sketch_duration_instance(sketch, DURATION_PERCENTILE99));
+    fprintf(f, "count           = %lf\n", get_sketch_duration_instance(sketch, DURATION_COUNT));
+    fprintf(f, "std deviation   = %lf\n", get_sketch_duration_instance(sketch, DURATION_STANDARD_DEVIATION));
+    fprintf(f, "buckets         = %zu/%zu\n", sketch->length, sketch->max_buckets);
+}
+
+/**
+ * Frees sketch duration metric value
+ * @arg config
+ * @arg value - value to be freed
+ */
+void
+free_sketch_duration_value(struct agent_config* config, void* value) {
+    (void)config;
+    struct sketch_duration* sketch = (struct sketch_duration*)value;
+    if (sketch != NULL) {
+        if (sketch->buckets != NULL) {
+            free(sketch->buckets);
+        }
+        free(sketch);
+    }
+}
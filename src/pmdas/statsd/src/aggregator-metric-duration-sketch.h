@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2020 Red Hat.
+ * Copyright (c) 2019 Miroslav Foltýn.  All Rights Reserved.
+ * 
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+#ifndef AGGREGATOR_DURATION_SKETCH_
+#define AGGREGATOR_DURATION_SKETCH_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "aggregator-metric-duration.h"
+#include "config-reader.h"
+
+/**
+ * Quantile sketch (DDSketch) - values are counted in logarithmically sized buckets,
+ * so that any quantile is estimated within relative accuracy given by config.
+ * Bucket i holds values in (gamma^(i-1), gamma^i], where gamma = (1 + accuracy) / (1 - accuracy).
+ * Number of buckets is bounded, when exceeded the lowest buckets are collapsed together.
+ * Min, max, count, average and standard deviation are tracked exactly.
+ */
+typedef struct sketch_duration {
+    double gamma;
+    double log_gamma;
+    uint64_t* buckets;
+    long offset; // bucket index of buckets[0]
+    size_t length; // buckets in use
+    size_t capacity; // buckets allocated
+    size_t max_buckets;
+    uint64_t zero_count; // values too small to be indexed
+    uint64_t count;
+    double min;
+    double max;
+    double mean;
+    double m2; // sum of squares of differences from mean
+    time_t reset_interval;
+    time_t interval_start;
+} sketch_duration;
+
+/**
+ * Creates sketch duration value
+ * @arg config - Config containing sketch accuracy, bucket limit and reset interval
+ * @arg value - Initial value
+ * @arg out - Placeholder for sketch
+ */
+extern void
+create_sketch_duration_value(struct agent_config* config, double value, void** out);
+
+/**
+ * Records value into sketch
+ * @arg value - Value to record
+ * @arg sketch - Sketch to update
+ */
+extern void
+update_sketch_duration_value(double value, struct sketch_duration* sketch);
+
+/**
+ * Gets duration values meta data from sketch
+ * @arg sketch - Target sketch
+ * @arg instance - What information to extract
+ * @return duration instance value
+ */
+extern double
+get_sketch_duration_instance(struct sketch_duration* sketch, enum DURATION_INSTANCE instance);
+
+/**
+ * Prints sketch metadata in human readable way
+ * @arg f - Opened file handle, doesn't close it when finished
+ * @arg sketch - Target sketch
+ */
+extern void
+print_sketch_duration_value(FILE* f, struct sketch_duration* sketch);
+
+/**
+ * Frees sketch duration metric value
+ * @arg config
+ * @arg value - value to be freed
+ */
+extern void
+free_sketch_duration_value(struct agent_config* config, void* value);
+
+#endif
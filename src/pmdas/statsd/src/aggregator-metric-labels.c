@@ -27,7 +27,7 @@
  * @arg container - Metrics struct acting as metrics wrapper
  * @arg item - Parent item
  * 
- * Synchronized by 
+ * Synchronized by mutex on pmda_metrics_shard
  */
 static void
 create_labels_dict(
@@ -35,7 +35,8 @@ create_labels_dict(
     struct pmda_metrics_container* container,
     struct metric* item
 ) {
-    pthread_mutex_lock(&container->mutex);
+    struct pmda_metrics_shard* shard = get_metric_shard(container, item->name);
+    pthread_mutex_lock(&shard->mutex);
     /**
      * Callbacks for metrics hashtable
      */
@@ -48,7 +49,7 @@ create_labels_dict(
     };
     labels* children = dictCreate(&metric_label_dict_callbacks, container->metrics_privdata);
     item->children = children;
-    pthread_mutex_unlock(&container->mutex);
+    pthread_mutex_unlock(&shard->mutex);
 }
 
 
@@ -78,10 +79,8 @@ process_labeled_datagram(
     if (!labeled_children_dict_exists) {
         create_labels_dict(config, container, item);
     }
-    char* label_key = create_metric_dict_key(datagram->tags);
-    if (label_key == NULL) {
-        METRIC_PROCESSING_ERR_LOG("%s REASON: unable to create hashtable key for labeled child.", throwing_away_msg);
-    }
+    // hashtable duplicates keys it stores, interned tags are used as is
+    char* label_key = datagram->tags;
     struct metric_label* label;
     int label_exists = find_label_by_name(container, item, label_key, &label);
     int status = 0;
@@ -103,7 +102,6 @@ process_labeled_datagram(
             status = 0;
         }
     }
-    free(label_key);
     return status;
 }
 
@@ -124,17 +122,18 @@ find_label_by_name(
     char* key,
     struct metric_label** out
 ) {
-    pthread_mutex_lock(&container->mutex);
+    struct pmda_metrics_shard* shard = get_metric_shard(container, item->name);
+    pthread_mutex_lock(&shard->mutex);
     dictEntry* result = dictFind(item->children, key);
     if (result == NULL) {
-        pthread_mutex_unlock(&container->mutex);
+        pthread_mutex_unlock(&shard->mutex);
         return 0;
     }
     if (out != NULL) {
         struct metric_label* label = (struct metric_label*)result->v.val;
         *out = label;
     }
-    pthread_mutex_unlock(&container->mutex);
+    pthread_mutex_unlock(&shard->mutex);
     return 1;
 }
 
@@ -241,10 +240,13 @@ create_label(
  */
 void
 add_label(struct pmda_metrics_container* container, struct metric* item, char* key, struct metric_label* label) {
-    pthread_mutex_lock(&container->mutex);
+    struct pmda_metrics_shard* shard = get_metric_shard(container, item->name);
+    pthread_mutex_lock(&shard->mutex);
     dictAdd(item->children, key, label);
-    container->generation += 1;
     item->meta->pcp_instance_change_requested = 1;
+    pthread_mutex_unlock(&shard->mutex);
+    pthread_mutex_lock(&container->mutex);
+    container->generation += 1;
     pthread_mutex_unlock(&container->mutex);
 }
 
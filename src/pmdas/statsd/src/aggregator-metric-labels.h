@@ -25,7 +25,7 @@
  * @arg item - Metric serving as root
  * @arg datagram - Datagram to be processed
  * 
- * Synchronized by mutex on pmda_metrics_container
+ * Synchronized by mutex on pmda_metrics_shard
  */
 extern int
 process_labeled_datagram(
@@ -43,7 +43,7 @@ process_labeled_datagram(
  * @arg out - Placeholder label
  * @return 1 when any found, 0 when not
  * 
- * Synchronized by mutex on pmda_metrics_container
+ * Synchronized by mutex on pmda_metrics_shard
  */
 extern int
 find_label_by_name(
@@ -76,7 +76,7 @@ create_label(
  * @arg key - Label key
  * @arg label - Label to be saved
  * 
- * Synchronized by mutex on pmda_metrics_container
+ * Synchronized by mutex on pmda_metrics_shard
  */
 extern void
 add_label(struct pmda_metrics_container* container, struct metric* item, char* key, struct metric_label* label);
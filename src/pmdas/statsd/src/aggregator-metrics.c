@@ -12,6 +12,7 @@
  * for more details.
  */
 #include <stddef.h>
+#include <stdint.h>
 #include <pcp/pmapi.h>
 #include <pcp/pmda.h>
 #include <pcp/dict.h>
@@ -55,31 +56,67 @@ init_pmda_metrics(struct agent_config* config) {
     ALLOC_CHECK("Unable to create priv PMDA metrics container data.");
     dict_data->config = config;
     dict_data->container = container;
-    metrics* m = dictCreate(&metric_dict_callbacks, dict_data);
-    container->metrics = m;
+    container->shard_count = config->aggregator_threads;
+    container->shards =
+        (struct pmda_metrics_shard*) malloc(sizeof(struct pmda_metrics_shard) * container->shard_count);
+    ALLOC_CHECK("Unable to create PMDA metrics shards.");
+    size_t i;
+    for (i = 0; i < container->shard_count; i++) {
+        pthread_mutex_init(&container->shards[i].mutex, NULL);
+        container->shards[i].metrics = dictCreate(&metric_dict_callbacks, dict_data);
+    }
     container->generation = 0;
     container->metrics_privdata = dict_data;
     return container;
 }
 
 /**
- * Creates STATSD metric hashtable key for use in hashtable related functions (find_metric_by_name, check_metric_name_available)
- * @return new key
+ * Frees pmda_metrics_container structure, including all recorded metrics
+ * @arg container - Metrics container
  */
-char*
-create_metric_dict_key(char* key) {
-    size_t maximum_key_size = 2048;
-    char buffer[maximum_key_size]; // maximum key size
-    int key_size = pmsprintf(
-        buffer,
-        maximum_key_size,
-        "%s",
-        key
-    ) + 1;
-    char* result = malloc(key_size);
-    ALLOC_CHECK("Unable to allocate memory for hashtable key");
-    memcpy(result, &buffer, key_size);
-    return result;
+void
+free_pmda_metrics(struct pmda_metrics_container* container) {
+    size_t i;
+    for (i = 0; i < container->shard_count; i++) {
+        dictRelease(container->shards[i].metrics);
+        pthread_mutex_destroy(&container->shards[i].mutex);
+    }
+    free(container->shards);
+    free(container->metrics_privdata);
+    pthread_mutex_destroy(&container->mutex);
+    free(container);
+}
+
+/**
+ * Returns index of shard that metric of given name belongs to
+ * Uses FNV-1a rather than hashtable hash function, so that hashtable buckets within a shard are evenly used
+ * @arg name - Metric name
+ * @arg shard_count - Total count of shards
+ * @return shard index
+ */
+size_t
+get_metric_shard_index(const char* name, size_t shard_count) {
+    if (shard_count <= 1) {
+        return 0;
+    }
+    uint32_t hash = 2166136261u;
+    const unsigned char* c;
+    for (c = (const unsigned char*)name; *c != '\0'; c++) {
+        hash ^= *c;
+        hash *= 16777619u;
+    }
+    return hash % shard_count;
+}
+
+/**
+ * Returns shard that metric of given name belongs to
+ * @arg container - Metrics container
+ * @arg name - Metric name
+ * @return shard
+ */
+struct pmda_metrics_shard*
+get_metric_shard(struct pmda_metrics_container* container, const char* name) {
+    return &container->shards[get_metric_shard_index(name, container->shard_count)];
 }
 
 /**
@@ -93,11 +130,8 @@ int
 process_metric(struct agent_config* config, struct pmda_metrics_container* container, struct statsd_datagram* datagram) {
     struct metric* item;
     char throwing_away_msg[] = "Throwing away parsed datagram.";
-    char* metric_key = create_metric_dict_key(datagram->name);
-    if (metric_key == NULL) {
-        METRIC_PROCESSING_ERR_LOG("%s REASON: unable to create hashtable key for metric record.", throwing_away_msg);
-        return 0;
-    }
+    // hashtable duplicates keys it stores, interned name is used as is
+    char* metric_key = datagram->name;
     int status = 0;
     int metric_exists = find_metric_by_name(container, metric_key, &item);
     if (metric_exists) {
@@ -146,7 +180,6 @@ process_metric(struct agent_config* config, struct pmda_metrics_container* conta
             status = 0;
         }
     }
-    free(metric_key);
     return status;
 }
 
@@ -210,10 +243,7 @@ print_metric_meta(FILE* f, struct metric_metadata* meta) {
 void
 write_metrics_to_file(struct agent_config* config, struct pmda_metrics_container* container) {
     VERBOSE_LOG(0, "Writing metrics to file...");
-    pthread_mutex_lock(&container->mutex);
-    metrics* m = container->metrics;
     if (strlen(config->debug_output_filename) == 0) {
-        pthread_mutex_unlock(&container->mutex);
         return; 
     }
     int sep = pmPathSeparator();
@@ -227,36 +257,40 @@ write_metrics_to_file(struct agent_config* config, struct pmda_metrics_container
     FILE* f;
     f = fopen(debug_output, "a+");
     if (f == NULL) {
-        pthread_mutex_unlock(&container->mutex);
         VERBOSE_LOG(0, "Unable to open file for output.");
         return;
     }
-    dictIterator* iterator = dictGetSafeIterator(m);
-    dictEntry* current;
     long int count = 0;
-    while ((current = dictNext(iterator)) != NULL) {
-        struct metric* item = (struct metric*)current->v.val;
-        switch (item->type) {
-            case METRIC_TYPE_COUNTER:
-                print_counter_metric(config, f, item);
-                break;
-            case METRIC_TYPE_GAUGE:
-                print_gauge_metric(config, f, item);
-                break;
-            case METRIC_TYPE_DURATION:
-                print_duration_metric(config, f, item);
-                break;
-            case METRIC_TYPE_NONE:
-                // not an actualy metric error case
-                break;
+    size_t i;
+    for (i = 0; i < container->shard_count; i++) {
+        struct pmda_metrics_shard* shard = &container->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        dictIterator* iterator = dictGetSafeIterator(shard->metrics);
+        dictEntry* current;
+        while ((current = dictNext(iterator)) != NULL) {
+            struct metric* item = (struct metric*)current->v.val;
+            switch (item->type) {
+                case METRIC_TYPE_COUNTER:
+                    print_counter_metric(config, f, item);
+                    break;
+                case METRIC_TYPE_GAUGE:
+                    print_gauge_metric(config, f, item);
+                    break;
+                case METRIC_TYPE_DURATION:
+                    print_duration_metric(config, f, item);
+                    break;
+                case METRIC_TYPE_NONE:
+                    // not an actualy metric error case
+                    break;
+            }
+            count++;
         }
-        count++;
+        dictReleaseIterator(iterator);
+        pthread_mutex_unlock(&shard->mutex);
     }
-    dictReleaseIterator(iterator);
     fprintf(f, "----------------\n");
     fprintf(f, "Total number of records: %lu \n", count);
     fclose(f);    
-    pthread_mutex_unlock(&container->mutex);
     VERBOSE_LOG(0, "Wrote metrics to debug file.");
 }
 
@@ -271,18 +305,18 @@ write_metrics_to_file(struct agent_config* config, struct pmda_metrics_container
  */
 int
 find_metric_by_name(struct pmda_metrics_container* container, char* key, struct metric** out) {
-    pthread_mutex_lock(&container->mutex);
-    metrics* m = container->metrics;
-    dictEntry* result = dictFind(m, key);
+    struct pmda_metrics_shard* shard = get_metric_shard(container, key);
+    pthread_mutex_lock(&shard->mutex);
+    dictEntry* result = dictFind(shard->metrics, key);
     if (result == NULL) {
-        pthread_mutex_unlock(&container->mutex);
+        pthread_mutex_unlock(&shard->mutex);
         return 0;
     }
     if (out != NULL) {
         struct metric* item = (struct metric*)result->v.val;
         *out = item;
     }
-    pthread_mutex_unlock(&container->mutex);
+    pthread_mutex_unlock(&shard->mutex);
     return 1;
 }
 
@@ -341,8 +375,11 @@ create_metric(struct agent_config* config, struct statsd_datagram* datagram, str
  */
 void
 add_metric(struct pmda_metrics_container* container, char* key, struct metric* item) {
+    struct pmda_metrics_shard* shard = get_metric_shard(container, key);
+    pthread_mutex_lock(&shard->mutex);
+    dictAdd(shard->metrics, key, item);
+    pthread_mutex_unlock(&shard->mutex);
     pthread_mutex_lock(&container->mutex);
-    dictAdd(container->metrics, key, item);
     container->generation += 1;
     pthread_mutex_unlock(&container->mutex);
 }
@@ -356,8 +393,11 @@ add_metric(struct pmda_metrics_container* container, char* key, struct metric* i
  */
 void
 remove_metric(struct pmda_metrics_container* container, char* key) {
+    struct pmda_metrics_shard* shard = get_metric_shard(container, key);
+    pthread_mutex_lock(&shard->mutex);
+    dictDelete(shard->metrics, key);
+    pthread_mutex_unlock(&shard->mutex);
     pthread_mutex_lock(&container->mutex);
-    dictDelete(container->metrics, key);
     container->generation += 1;
     pthread_mutex_unlock(&container->mutex);
 }
@@ -381,7 +421,8 @@ update_metric_value(
     struct statsd_datagram* datagram,
     void** value
 ) {
-    pthread_mutex_lock(&container->mutex);
+    struct pmda_metrics_shard* shard = get_metric_shard(container, datagram->name);
+    pthread_mutex_lock(&shard->mutex);
     int status = 0;
     if (datagram->type != type) {
         status = -1;
@@ -413,7 +454,7 @@ update_metric_value(
                 break;
         }
     }
-    pthread_mutex_unlock(&container->mutex);
+    pthread_mutex_unlock(&shard->mutex);
     return status;
 }
 
@@ -437,6 +478,7 @@ check_metric_name_available(struct pmda_metrics_container* container, char* key)
         "pmda.metrics_tracked",
         "pmda.time_spent_aggregating",
         "pmda.time_spent_parsing",
+        "pmda.kernel_dropped",
         "pmda.settings.max_udp_packet_size",
         "pmda.settings.max_unprocessed_packets",
         "pmda.settings.verbose",
@@ -444,7 +486,9 @@ check_metric_name_available(struct pmda_metrics_container* container, char* key)
         "pmda.settings.debug_output_filename",
         "pmda.settings.port",
         "pmda.settings.parser_type",
-        "pmda.settings.duration_aggregation_type"
+        "pmda.settings.duration_aggregation_type",
+        "pmda.settings.listener_threads",
+        "pmda.settings.aggregator_threads"
     };
     size_t i;
     for (i = 0; i < sizeof(g_blocklist) / sizeof(g_blocklist[0]); i++) {
@@ -517,7 +561,8 @@ free_metric_metadata(struct metric_metadata* meta) {
  */
 void
 mark_metric_as_pernament(struct pmda_metrics_container* container, struct metric* item) {
-    pthread_mutex_lock(&container->mutex);
+    struct pmda_metrics_shard* shard = get_metric_shard(container, item->name);
+    pthread_mutex_lock(&shard->mutex);
     item->pernament = 1;
-    pthread_mutex_unlock(&container->mutex);
+    pthread_mutex_unlock(&shard->mutex);
 }
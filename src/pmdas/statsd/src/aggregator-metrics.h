@@ -90,11 +90,21 @@ typedef struct duration_values_meta {
     double std_deviation;
 } duration_values_meta;
 
-typedef struct pmda_metrics_container {
+/**
+ * Part of metrics hashtable, metrics are assigned to shards by hash of their name.
+ * Each shard is written only by single aggregator thread, mutex guards against concurrent PCP reads
+ */
+typedef struct pmda_metrics_shard {
     metrics* metrics;
+    pthread_mutex_t mutex;
+} pmda_metrics_shard;
+
+typedef struct pmda_metrics_container {
+    struct pmda_metrics_shard* shards;
+    size_t shard_count;
     struct pmda_metrics_dict_privdata* metrics_privdata;
     size_t generation;
-    pthread_mutex_t mutex;
+    pthread_mutex_t mutex; // guards generation
 } pmda_metrics_container;
 
 typedef struct pmda_metrics_dict_privdata {
@@ -109,11 +119,29 @@ extern struct pmda_metrics_container*
 init_pmda_metrics(struct agent_config* config);
 
 /**
- * Creates STATSD metric hashtable key for use in hashtable related functions (find_metric_by_name, check_metric_name_available)
- * @return new key
+ * Frees pmda_metrics_container structure, including all recorded metrics
+ * @arg container - Metrics container
+ */
+extern void
+free_pmda_metrics(struct pmda_metrics_container* container);
+
+/**
+ * Returns index of shard that metric of given name belongs to
+ * @arg name - Metric name
+ * @arg shard_count - Total count of shards
+ * @return shard index
+ */
+extern size_t
+get_metric_shard_index(const char* name, size_t shard_count);
+
+/**
+ * Returns shard that metric of given name belongs to
+ * @arg container - Metrics container
+ * @arg name - Metric name
+ * @return shard
  */
-extern char*
-create_metric_dict_key(char* key);
+extern struct pmda_metrics_shard*
+get_metric_shard(struct pmda_metrics_container* container, const char* name);
 
 /**
  * Processes datagram struct into metric 
@@ -138,7 +166,7 @@ free_metric(struct agent_config* config, struct metric* item);
  * @arg config - Config containing information about where to output
  * @arg container - Metrics struct acting as metrics wrapper
  * 
- * Synchronized by mutex on pmda_metrics_container
+ * Synchronized by mutex on pmda_metrics_shard
  */
 extern void
 write_metrics_to_file(struct agent_config* config, struct pmda_metrics_container* container);
@@ -150,7 +178,7 @@ write_metrics_to_file(struct agent_config* config, struct pmda_metrics_container
  * @arg out - Placeholder metric
  * @return 1 when any found, 0 when not
  * 
- * Synchronized by mutex on pmda_metrics_container
+ * Synchronized by mutex on pmda_metrics_shard
  */
 extern int
 find_metric_by_name(struct pmda_metrics_container* container, char* key, struct metric** out);
@@ -170,7 +198,7 @@ create_metric(struct agent_config* config, struct statsd_datagram* datagram, str
  * @arg container - Metrics container 
  * @arg item - Metric to be saved
  * 
- * Synchronized by mutex on pmda_metrics_container
+ * Synchronized by mutex on pmda_metrics_shard
  */
 extern void
 add_metric(struct pmda_metrics_container* container, char* key, struct metric* item);
@@ -180,7 +208,7 @@ add_metric(struct pmda_metrics_container* container, char* key, struct metric* i
  * @arg container - Metrics container
  * @arg key - Metric's hashtable key
  * 
- * Synchronized by mutex on pmda_metrics_container
+ * Synchronized by mutex on pmda_metrics_shard
  */
 extern void
 remove_metric(struct pmda_metrics_container* container, char* key);
@@ -194,7 +222,7 @@ remove_metric(struct pmda_metrics_container* container, char* key);
  * @arg value - Dest value
  * @return 1 on success, 0 when update itself fails, -1 when metric with same name but different type is already recorded
  * 
- * Synchronized by mutex on pmda_metrics_container
+ * Synchronized by mutex on pmda_metrics_shard
  */
 extern int
 update_metric_value(
@@ -244,7 +272,7 @@ print_metric_meta(FILE* f, struct metric_metadata* meta);
  * @arg container - Metrics container
  * @arg item - Metric to be updated
  * 
- * Synchronized by mutex on pmda_metrics_container struct
+ * Synchronized by mutex on pmda_metrics_shard struct
  */
 extern void
 mark_metric_as_pernament(struct pmda_metrics_container* container, struct metric* item);
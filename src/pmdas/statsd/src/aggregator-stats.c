@@ -74,6 +74,9 @@ reset_stat(struct agent_config* config, struct pmda_stats_container* s, enum STA
             s->stats->metrics_recorded->gauge = 0;
             s->stats->metrics_recorded->duration = 0;
             break;
+        case STAT_KERNEL_DROPPED:
+            s->stats->kernel_dropped = 0;
+            break;
     }
     pthread_mutex_unlock(&s->mutex);
 }
@@ -126,10 +129,36 @@ process_stat(struct agent_config* config, struct pmda_stats_container* s, enum S
             }
             break;
         }
+        case STAT_KERNEL_DROPPED:
+            s->stats->kernel_dropped += *((unsigned long*) data);
+            break;
     }
     pthread_mutex_unlock(&s->mutex);
 }
 
+/**
+ * Adds stats accumulated by single thread to shared ones and resets them
+ * @arg config
+ * @arg s - Data structure shared with PCP thread containing all PMDA statistics data
+ * @arg local - Thread's stats, metrics_recorded is not used
+ * 
+ * Synchronized by mutex on pmda_stats_container
+ */
+void
+merge_stats(struct agent_config* config, struct pmda_stats_container* s, struct pmda_stats* local) {
+    (void)config;
+    pthread_mutex_lock(&s->mutex);
+    s->stats->received += local->received;
+    s->stats->parsed += local->parsed;
+    s->stats->dropped += local->dropped;
+    s->stats->aggregated += local->aggregated;
+    s->stats->time_spent_parsing += local->time_spent_parsing;
+    s->stats->time_spent_aggregating += local->time_spent_aggregating;
+    s->stats->kernel_dropped += local->kernel_dropped;
+    pthread_mutex_unlock(&s->mutex);
+    *local = (struct pmda_stats) { 0 };
+}
+
 /**
  * Write PMDA stats
  * @arg config - config specifies where to write
@@ -166,6 +195,7 @@ write_stats_to_file(struct agent_config* config, struct pmda_stats_container* st
     fprintf(f, "parsed: %lu \n", stats->stats->parsed);
     fprintf(f, "thrown away: %lu \n", stats->stats->dropped);
     fprintf(f, "aggregated: %lu \n", stats->stats->aggregated);
+    fprintf(f, "dropped by kernel: %lu \n", stats->stats->kernel_dropped);
     fprintf(f, "time spent parsing: %lu ns \n", stats->stats->time_spent_parsing);
     fprintf(f, "time spent aggregating: %lu ns \n", stats->stats->time_spent_aggregating);
     fprintf(
@@ -214,6 +244,9 @@ get_agent_stat(struct agent_config* config, struct pmda_stats_container* stats,
         case STAT_TIME_SPENT_AGGREGATING:
             result = stats->stats->time_spent_aggregating;
             break;
+        case STAT_KERNEL_DROPPED:
+            result = stats->stats->kernel_dropped;
+            break;
         case STAT_TRACKED_METRIC:
         {
             if (data != NULL) {
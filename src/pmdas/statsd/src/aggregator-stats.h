@@ -27,7 +27,8 @@ typedef enum STAT_TYPE {
     STAT_AGGREGATED,
     STAT_TIME_SPENT_PARSING,
     STAT_TIME_SPENT_AGGREGATING,
-    STAT_TRACKED_METRIC
+    STAT_TRACKED_METRIC,
+    STAT_KERNEL_DROPPED
 } STAT_TYPE;
 
 typedef struct metric_counters {
@@ -43,6 +44,7 @@ typedef struct pmda_stats {
     size_t aggregated;
     size_t time_spent_parsing;
     size_t time_spent_aggregating;
+    size_t kernel_dropped;
     struct metric_counters* metrics_recorded;
 } pmda_stats;
 
@@ -80,6 +82,17 @@ reset_stat(struct agent_config* config, struct pmda_stats_container* s, enum STA
 extern void
 process_stat(struct agent_config* config, struct pmda_stats_container* s, enum STAT_TYPE type, void* data);
 
+/**
+ * Adds stats accumulated by single thread to shared ones and resets them
+ * @arg config
+ * @arg s - Data structure shared with PCP thread containing all PMDA statistics data
+ * @arg local - Thread's stats, metrics_recorded is not used
+ * 
+ * Synchronized by mutex on pmda_stats_container
+ */
+extern void
+merge_stats(struct agent_config* config, struct pmda_stats_container* s, struct pmda_stats* local);
+
 /**
  * Write PMDA stats
  * @arg config - config specifies where to write
@@ -30,9 +30,9 @@
 #include "aggregator-stats.h"
 
 /**
- * Mutex guarding aggregator proccesing, so there are no race condiditions if we request debug output.
+ * Maximum count of datagrams processed before their stats are merged into shared ones
  */
-static pthread_mutex_t g_aggregator_processing_lock;
+#define AGGREGATOR_STATS_BATCH 64
 
 /**
  * This is shared with a function thats called from signal handler, should debug data be requested
@@ -40,7 +40,8 @@ static pthread_mutex_t g_aggregator_processing_lock;
 static struct aggregator_args* g_aggregator_args = NULL;
 
 /**
- * Thread startpoint - passes down given datagram to aggregator to record value it contains (should be used for a single new thread)
+ * Thread startpoint - passes down given datagram to aggregator to record value it contains
+ * (one thread per metrics shard, each given its own aggregator_args)
  * @arg args - aggregator_args
  */
 void*
@@ -55,6 +56,7 @@ aggregator_exec(void* args) {
     struct parser_to_aggregator_message* message;
     struct timespec t0, t1;
     unsigned long time_spent_aggregating;
+    struct pmda_stats stats = { 0 };
     int should_exit;
     while(1) {
         should_exit = check_exit_flag();
@@ -72,56 +74,43 @@ aggregator_exec(void* args) {
             free_parser_to_aggregator_message(message);
             continue;
         }
-        pthread_mutex_lock(&g_aggregator_processing_lock);
-        process_stat(config, stats_container, STAT_RECEIVED, NULL);
-        if (message->type == PARSER_RESULT_PARSED) {
+        stats.received += message->length + message->dropped;
+        stats.parsed += message->length;
+        stats.dropped += message->dropped;
+        stats.time_spent_parsing += message->time;
+        size_t i;
+        for (i = 0; i < message->length; i++) {
             clock_gettime(CLOCK_MONOTONIC, &t0);
-            int status = process_metric(config, metrics_container, (struct statsd_datagram*) message->data);
+            int status = process_metric(config, metrics_container, &message->data[i]);
             clock_gettime(CLOCK_MONOTONIC, &t1);
             time_spent_aggregating = t1.tv_nsec - t0.tv_nsec;
-            process_stat(config, stats_container, STAT_PARSED, NULL);
-            process_stat(config, stats_container, STAT_TIME_SPENT_PARSING, &message->time);
             if (status) {
-                process_stat(config, stats_container, STAT_AGGREGATED, NULL);
-                process_stat(config, stats_container, STAT_TIME_SPENT_AGGREGATING, &time_spent_aggregating);
+                stats.aggregated += 1;
+                stats.time_spent_aggregating += time_spent_aggregating;
             } else {
-                process_stat(config, stats_container, STAT_DROPPED, NULL);
+                stats.dropped += 1;
             }
-        } else if (message->type == PARSER_RESULT_DROPPED) {
-            process_stat(config, stats_container, STAT_DROPPED, NULL);
-            process_stat(config, stats_container, STAT_TIME_SPENT_PARSING, &message->time);
         }
         free_parser_to_aggregator_message(message);
-        pthread_mutex_unlock(&g_aggregator_processing_lock);
+        // stats are shared by all aggregator threads, merge them once queue is drained
+        if (stats.received >= AGGREGATOR_STATS_BATCH || chan_size(parser_to_aggregator) == 0) {
+            merge_stats(config, stats_container, &stats);
+        }
     }
+    merge_stats(config, stats_container, &stats);
     VERBOSE_LOG(2, "Aggregator thread exiting.");
     pthread_exit(NULL);
 }
 
 /**
  * Outputs debug info
+ * Each shard is locked only while its metrics are written, so aggregation continues meanwhile
  */
 void
 aggregator_debug_output() {
     if (g_aggregator_args != NULL) {
-        pthread_mutex_lock(&g_aggregator_processing_lock);
         write_metrics_to_file(g_aggregator_args->config, g_aggregator_args->metrics_container);
         write_stats_to_file(g_aggregator_args->config, g_aggregator_args->stats_container);
-        pthread_mutex_unlock(&g_aggregator_processing_lock);
-    }
-}
-
-/**
- * Frees pointer to aggregator message
- * @arg message - Message to be freed
- */
-void
-free_parser_to_aggregator_message(struct parser_to_aggregator_message* message) {
-    if (message != NULL) {
-        if (message->data != NULL) {
-            free_datagram(message->data);
-        }
-        free(message);
     }
 }
 
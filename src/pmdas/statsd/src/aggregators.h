@@ -32,7 +32,8 @@ typedef struct aggregator_args
 } aggregator_args;
 
 /**
- * Thread startpoint - passes down given datagram to aggregator to record value it contains (should be used for a single new thread)
+ * Thread startpoint - passes down given datagram to aggregator to record value it contains
+ * (one thread per metrics shard, each given its own aggregator_args)
  * @arg args - aggregator_args
  */
 extern void*
@@ -44,13 +45,6 @@ aggregator_exec(void* args);
 extern void
 aggregator_debug_output();
 
-/**
- * Frees pointer to aggregator message
- * @arg message - Message to be freed
- */
-extern void
-free_parser_to_aggregator_message(struct parser_to_aggregator_message* message);
-
 /**
  * Creates arguments for Agregator thread
  * @arg config - Application config
@@ -33,8 +33,14 @@ set_default_config(struct agent_config* config) {
     memcpy(config->debug_output_filename, "debug", 6);
     config->show_version = 0;
     config->port = 8125;
+    config->listener_threads = 1;
+    config->receive_batch_size = 64;
+    config->aggregator_threads = 1;
     config->parser_type = PARSER_TYPE_BASIC;
     config->duration_aggregation_type = DURATION_AGGREGATION_TYPE_HDR_HISTOGRAM;
+    config->duration_sketch_accuracy = 0.01;
+    config->duration_sketch_buckets = 2048;
+    config->duration_sketch_reset_interval = 0;
     pmGetUsername(&(config->username));
 }
 
@@ -71,6 +77,21 @@ ini_line_handler(void* user, const char* section, const char* name, const char*
         if (param < UINT32_MAX) {
             dest->port = (unsigned int) param;
         }
+    } else if (MATCH("listener_threads")) {
+        long unsigned int param = strtoul(value, NULL, 10);
+        if (param > 0 && param <= MAX_LISTENER_THREADS) {
+            dest->listener_threads = (unsigned int) param;
+        }
+    } else if (MATCH("receive_batch_size")) {
+        long unsigned int param = strtoul(value, NULL, 10);
+        if (param > 0 && param <= MAX_RECEIVE_BATCH_SIZE) {
+            dest->receive_batch_size = (unsigned int) param;
+        }
+    } else if (MATCH("aggregator_threads")) {
+        long unsigned int param = strtoul(value, NULL, 10);
+        if (param > 0 && param <= MAX_AGGREGATOR_THREADS) {
+            dest->aggregator_threads = (unsigned int) param;
+        }
     } else if (MATCH("verbose")) {
         long unsigned int param = strtoul(value, NULL, 10);
         if (param < 3) {
@@ -96,6 +117,21 @@ ini_line_handler(void* user, const char* section, const char* name, const char*
         if (param < UINT32_MAX) {
             dest->duration_aggregation_type = (unsigned int) param;
         }
+    } else if (MATCH("duration_sketch_accuracy")) {
+        double param = strtod(value, NULL);
+        if (param > 0 && param < 0.5) {
+            dest->duration_sketch_accuracy = param;
+        }
+    } else if (MATCH("duration_sketch_buckets")) {
+        long unsigned int param = strtoul(value, NULL, 10);
+        if (param > 0 && param <= MAX_DURATION_SKETCH_BUCKETS) {
+            dest->duration_sketch_buckets = (unsigned int) param;
+        }
+    } else if (MATCH("duration_sketch_reset_interval")) {
+        long unsigned int param = strtoul(value, NULL, 10);
+        if (param < UINT32_MAX) {
+            dest->duration_sketch_reset_interval = (unsigned int) param;
+        }
     } else {
         return 0;
     }
@@ -137,13 +173,19 @@ read_agent_config_cmd(pmdaInterface* dispatch, struct agent_config* dest, int ar
         { "max-udp", 1, 'Z', "MAX-UDP", "Maximum size of UDP datagram" },
         { "port", 1, 'P', "PORT", "Port to listen to" },
         { "parser-type", 1, 'r', "PARSER-TYPE", "Parser type to use (ragel = 1, basic = 0)" },
-        { "duration-aggregation-type", 1, 'a', "DURATION-AGGREGATION-TYPE", "Aggregation type for duration metric to use (hdr_histogram = 1, basic histogram = 0)" },
+        { "duration-aggregation-type", 1, 'a', "DURATION-AGGREGATION-TYPE", "Aggregation type for duration metric to use (sketch = 2, hdr_histogram = 1, basic histogram = 0)" },
         { "max-unprocessed-packets-size:", 1, 'z', "MAX-UNPROCESSED-PACKETS-SIZE", "Maximum count of unprocessed packets." },
+        { "listener-threads", 1, 't', "LISTENER-THREADS", "Number of threads receiving datagrams" },
+        { "receive-batch-size", 1, 'b', "RECEIVE-BATCH-SIZE", "Maximum count of datagrams received at once" },
+        { "aggregator-threads", 1, 'A', "AGGREGATOR-THREADS", "Number of threads aggregating metrics" },
+        { "duration-sketch-accuracy", 1, 'e', "DURATION-SKETCH-ACCURACY", "Relative accuracy of duration sketch quantiles" },
+        { "duration-sketch-buckets", 1, 'B', "DURATION-SKETCH-BUCKETS", "Maximum count of buckets in a duration sketch" },
+        { "duration-sketch-reset-interval", 1, 'R', "DURATION-SKETCH-RESET-INTERVAL", "Seconds after which duration sketch is reset (0 = never)" },
         PMDA_OPTIONS_END
     };
 
     static pmdaOptions opts = {
-        .short_options = "D:d:l:U:v:so:Z:P:r:a:z:?",
+        .short_options = "D:d:l:U:v:so:Z:P:r:a:z:t:b:A:e:B:R:?",
         .long_options = longopts,
     };
     while(1) {
@@ -219,6 +261,66 @@ read_agent_config_cmd(pmdaInterface* dispatch, struct agent_config* dest, int ar
                 }
                 break;
             }
+            case 't':
+            {
+                long unsigned int param = strtoul(opts.optarg, NULL, 10);
+                if (param > 0 && param <= MAX_LISTENER_THREADS) {
+                    dest->listener_threads = (unsigned int) param;
+                } else {
+                    pmNotifyErr(LOG_INFO, "listener_threads option value is out of bounds.");
+                }
+                break;
+            }
+            case 'b':
+            {
+                long unsigned int param = strtoul(opts.optarg, NULL, 10);
+                if (param > 0 && param <= MAX_RECEIVE_BATCH_SIZE) {
+                    dest->receive_batch_size = (unsigned int) param;
+                } else {
+                    pmNotifyErr(LOG_INFO, "receive_batch_size option value is out of bounds.");
+                }
+                break;
+            }
+            case 'A':
+            {
+                long unsigned int param = strtoul(opts.optarg, NULL, 10);
+                if (param > 0 && param <= MAX_AGGREGATOR_THREADS) {
+                    dest->aggregator_threads = (unsigned int) param;
+                } else {
+                    pmNotifyErr(LOG_INFO, "aggregator_threads option value is out of bounds.");
+                }
+                break;
+            }
+            case 'e':
+            {
+                double param = strtod(opts.optarg, NULL);
+                if (param > 0 && param < 0.5) {
+                    dest->duration_sketch_accuracy = param;
+                } else {
+                    pmNotifyErr(LOG_INFO, "duration_sketch_accuracy option value is out of bounds.");
+                }
+                break;
+            }
+            case 'B':
+            {
+                long unsigned int param = strtoul(opts.optarg, NULL, 10);
+                if (param > 0 && param <= MAX_DURATION_SKETCH_BUCKETS) {
+                    dest->duration_sketch_buckets = (unsigned int) param;
+                } else {
+                    pmNotifyErr(LOG_INFO, "duration_sketch_buckets option value is out of bounds.");
+                }
+                break;
+            }
+            case 'R':
+            {
+                long unsigned int param = strtoul(opts.optarg, NULL, 10);
+                if (param < UINT32_MAX) {
+                    dest->duration_sketch_reset_interval = (unsigned int) param;
+                } else {
+                    pmNotifyErr(LOG_INFO, "duration_sketch_reset_interval option value is out of bounds.");
+                }
+                break;
+            }
         }
     }
     if (opts.errors) {
@@ -245,7 +347,16 @@ print_agent_config(struct agent_config* config) {
     pmNotifyErr(LOG_INFO, "parser_type: %s \n", config->parser_type == PARSER_TYPE_BASIC ? "BASIC" : "RAGEL");
     pmNotifyErr(LOG_INFO, "maximum of unprocessed packets: %d \n", config->max_unprocessed_packets);
     pmNotifyErr(LOG_INFO, "maximum udp packet size: %ld \n", config->max_udp_packet_size);
+    pmNotifyErr(LOG_INFO, "listener threads: %d \n", config->listener_threads);
+    pmNotifyErr(LOG_INFO, "receive batch size: %d \n", config->receive_batch_size);
+    pmNotifyErr(LOG_INFO, "aggregator threads: %d \n", config->aggregator_threads);
     pmNotifyErr(LOG_INFO, "duration_aggregation_type: %s\n", 
-        config->duration_aggregation_type == DURATION_AGGREGATION_TYPE_HDR_HISTOGRAM ? "HDR_HISTOGRAM" : "BASIC");
+        config->duration_aggregation_type == DURATION_AGGREGATION_TYPE_HDR_HISTOGRAM ? "HDR_HISTOGRAM" :
+        config->duration_aggregation_type == DURATION_AGGREGATION_TYPE_SKETCH ? "SKETCH" : "BASIC");
+    if (config->duration_aggregation_type == DURATION_AGGREGATION_TYPE_SKETCH) {
+        pmNotifyErr(LOG_INFO, "duration sketch accuracy: %g \n", config->duration_sketch_accuracy);
+        pmNotifyErr(LOG_INFO, "duration sketch buckets: %d \n", config->duration_sketch_buckets);
+        pmNotifyErr(LOG_INFO, "duration sketch reset interval: %d \n", config->duration_sketch_reset_interval);
+    }
     pmNotifyErr(LOG_INFO, "</settings>\n");
 }
@@ -21,6 +21,11 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#define MAX_LISTENER_THREADS 64
+#define MAX_RECEIVE_BATCH_SIZE 1024
+#define MAX_AGGREGATOR_THREADS 64
+#define MAX_DURATION_SKETCH_BUCKETS 65536
+
 typedef enum PARSER_TYPE {
     PARSER_TYPE_BASIC = 0,
     PARSER_TYPE_RAGEL = 1
@@ -28,7 +33,8 @@ typedef enum PARSER_TYPE {
 
 typedef enum DURATION_AGGREGATION_TYPE {
     DURATION_AGGREGATION_TYPE_BASIC = 0,
-    DURATION_AGGREGATION_TYPE_HDR_HISTOGRAM = 1
+    DURATION_AGGREGATION_TYPE_HDR_HISTOGRAM = 1,
+    DURATION_AGGREGATION_TYPE_SKETCH = 2
 } DURATION_AGGREGATION_TYPE;
 
 typedef struct agent_config {
@@ -39,6 +45,12 @@ typedef struct agent_config {
     unsigned int show_version;
     unsigned int max_unprocessed_packets;
     unsigned int port;
+    unsigned int listener_threads;
+    unsigned int receive_batch_size;
+    unsigned int aggregator_threads;
+    double duration_sketch_accuracy;
+    unsigned int duration_sketch_buckets;
+    unsigned int duration_sketch_reset_interval;
     char* debug_output_filename;
     char* username;
 } agent_config;
@@ -18,9 +18,11 @@
 #include <errno.h>
 #include <string.h>
 #include <netdb.h>
+#include <poll.h>
 #include <chan/chan.h>
 #include <pthread.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <signal.h>
 
 #include "network-listener.h"
@@ -29,20 +31,95 @@
 #include "utils.h"
 #include "config-reader.h"
 
+#ifndef MSG_WAITFORONE
+/* recvmmsg is not available, datagrams are received with recvmsg one by one */
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+#endif
+
+static char* end_message = "PMDASTATSD_EXIT";
+
 /**
- * Thread entrypoint - listens on address and port specified in config 
- * for UDP/TCP containing StatsD payload and then sends it over to parser thread for parsing
- * @arg args - network_listener_args
+ * Pool of datagram buffers shared by listener threads and parser,
+ * so that steady state receiving doesn't allocate
  */
-void*
-network_listener_exec(void* args) {
-    pthread_setname_np(pthread_self(), "Net. Listener");
-    static char* end_message = "PMDASTATSD_EXIT"; 
-    struct agent_config* config = ((struct network_listener_args*)args)->config;
-    chan_t* network_listener_to_parser = ((struct network_listener_args*)args)->network_listener_to_parser;
+static struct datagram_pool {
+    pthread_mutex_t mutex;
+    struct unprocessed_statsd_datagram* free;
+    size_t count;
+    size_t max_count;
+    size_t buffer_size;
+} pool = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0 };
+
+/* Count of listener threads still running, last one to exit notifies parser */
+static pthread_mutex_t listeners_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int listeners_running = 0;
+
+/**
+ * Sets size of pooled buffers and count of them kept around
+ * @arg config - Application config
+ */
+static void
+init_datagram_pool(struct agent_config* config) {
+    size_t size = config->max_udp_packet_size;
+    if (size < strlen(end_message)) {
+        size = strlen(end_message);
+    }
+    pthread_mutex_lock(&pool.mutex);
+    pool.buffer_size = size + 1;
+    pool.max_count = config->max_unprocessed_packets +
+        (size_t)config->receive_batch_size * config->listener_threads;
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+/**
+ * Takes datagram from pool or allocates new one, if pool is empty
+ * @return datagram with value buffer of pool.buffer_size bytes
+ */
+static struct unprocessed_statsd_datagram*
+get_unprocessed_datagram() {
+    struct unprocessed_statsd_datagram* datagram;
+    pthread_mutex_lock(&pool.mutex);
+    datagram = pool.free;
+    if (datagram != NULL) {
+        pool.free = datagram->next;
+        pool.count--;
+    }
+    pthread_mutex_unlock(&pool.mutex);
+    if (datagram == NULL) {
+        datagram = (struct unprocessed_statsd_datagram*) malloc(sizeof(struct unprocessed_statsd_datagram) + pool.buffer_size);
+        ALLOC_CHECK("Unable to assign memory for struct representing unprocessed datagrams.");
+        datagram->value = (char*)(datagram + 1);
+    }
+    datagram->length = 0;
+    datagram->next = NULL;
+    return datagram;
+}
+
+/**
+ * Sends end message to parser
+ * @arg network_listener_to_parser - Network listener -> Parser
+ */
+static void
+send_end_message(chan_t* network_listener_to_parser) {
+    struct unprocessed_statsd_datagram* datagram = get_unprocessed_datagram();
+    datagram->length = strlen(end_message);
+    memcpy(datagram->value, end_message, datagram->length + 1);
+    chan_send(network_listener_to_parser, datagram);
+}
+
+/**
+ * Creates UDP socket bound to port specified in config,
+ * shared with other listener threads via SO_REUSEPORT where more of them are running
+ * @arg config - Application config
+ * @return socket file descriptor
+ */
+static int
+create_listener_socket(struct agent_config* config) {
     const char* hostname = 0;
     struct addrinfo hints;
-    fd_set readfds;
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_DGRAM;
@@ -59,93 +136,229 @@ network_listener_exec(void* args) {
     if (fd == -1) {
         DIE("failed creating socket (err=%s)", strerror(errno));
     }
+    int on = 1;
+#ifdef SO_REUSEPORT
+    if (config->listener_threads > 1 &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+        DIE("failed setting SO_REUSEPORT on socket (err=%s)", strerror(errno));
+    }
+#endif
+#ifdef SO_RXQ_OVFL
+    if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) == -1) {
+        VERBOSE_LOG(1, "Unable to track datagrams dropped by kernel (err=%s)", strerror(errno));
+    }
+#endif
+    (void)on;
     if (bind(fd, res->ai_addr, res->ai_addrlen) == -1) {
         DIE("failed binding socket (err=%s)", strerror(errno));
     }
-    VERBOSE_LOG(0, "Socket enstablished.");
-    VERBOSE_LOG(0, "Waiting for datagrams.");
     fcntl(fd, F_SETFL, O_NONBLOCK);
-    struct timeval tv;
     freeaddrinfo(res);
-    int max_udp_packet_size = config->max_udp_packet_size;
-    char *buffer = (char *) malloc(max_udp_packet_size * sizeof(char));
-    struct sockaddr_storage src_addr;
-    socklen_t src_addr_len = sizeof(src_addr);
-    int rv;
-    while(1) {
-        FD_ZERO(&readfds);
-        FD_SET(fd, &readfds);
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
-        rv = select(fd + 1, &readfds, NULL, NULL, &tv);
-        if (rv == 1) {
-            ssize_t count = recvfrom(fd, buffer, max_udp_packet_size, 0, (struct sockaddr*)&src_addr, &src_addr_len);
-            if (count == -1) {
-                DIE("%s", strerror(errno));
-            } 
-            // since we checked for -1
-            else if ((signed int)count == max_udp_packet_size) { 
-                VERBOSE_LOG(2, "Datagram too large for buffer: truncated and skipped");
-            } else {
-                struct unprocessed_statsd_datagram* datagram = (struct unprocessed_statsd_datagram*) malloc(sizeof(struct unprocessed_statsd_datagram));
-                ALLOC_CHECK("Unable to assign memory for struct representing unprocessed datagrams.");
-                datagram->value = (char*) malloc(sizeof(char) * (count + 1));
-                ALLOC_CHECK("Unable to assign memory for datagram value.");
-                memcpy(datagram->value, buffer, count);
-                datagram->value[count] = '\0';
-                if (strcmp(end_message, datagram->value) == 0) {
-                    free_unprocessed_datagram(datagram);
+    return fd;
+}
+
+/**
+ * Receives up to count datagrams from non-blocking socket
+ * @arg fd - Socket
+ * @arg messages - Message headers, prepared by caller
+ * @arg count - Count of messages
+ * @return count of received datagrams, 0 when there are none waiting
+ */
+static int
+receive_datagrams(int fd, struct mmsghdr* messages, unsigned int count) {
+#ifdef MSG_WAITFORONE
+    int received = recvmmsg(fd, messages, count, MSG_DONTWAIT, NULL);
+    if (received == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        DIE("%s", strerror(errno));
+    }
+    return received;
+#else
+    unsigned int received;
+    for (received = 0; received < count; received++) {
+        ssize_t length = recvmsg(fd, &messages[received].msg_hdr, MSG_DONTWAIT);
+        if (length == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                break;
+            }
+            DIE("%s", strerror(errno));
+        }
+        messages[received].msg_len = (unsigned int)length;
+    }
+    return (int)received;
+#endif
+}
+
+/**
+ * Extracts count of datagrams dropped by kernel on socket since it was created
+ * @arg message - Received message
+ * @arg dropped - Updated with the count, if message carries it
+ */
+static void
+read_kernel_dropped(struct msghdr* message, uint32_t* dropped) {
+#ifdef SO_RXQ_OVFL
+    struct cmsghdr* cmsg;
+    for (cmsg = CMSG_FIRSTHDR(message); cmsg != NULL; cmsg = CMSG_NXTHDR(message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            memcpy(dropped, CMSG_DATA(cmsg), sizeof(uint32_t));
+        }
+    }
+#else
+    (void)message;
+    (void)dropped;
+#endif
+}
+
+/**
+ * Thread entrypoint - listens on address and port specified in config
+ * for UDP/TCP containing StatsD payload and then sends it over to parser thread for parsing
+ * @arg args - network_listener_args
+ */
+void*
+network_listener_exec(void* args) {
+    pthread_setname_np(pthread_self(), "Net. Listener");
+    struct agent_config* config = ((struct network_listener_args*)args)->config;
+    chan_t* network_listener_to_parser = ((struct network_listener_args*)args)->network_listener_to_parser;
+    struct pmda_stats_container* stats = ((struct network_listener_args*)args)->stats;
+    int fd = create_listener_socket(config);
+    VERBOSE_LOG(0, "Socket enstablished.");
+    VERBOSE_LOG(0, "Waiting for datagrams.");
+    unsigned int batch_size = config->receive_batch_size;
+    size_t max_udp_packet_size = config->max_udp_packet_size;
+    size_t control_size = CMSG_SPACE(sizeof(uint32_t));
+    struct unprocessed_statsd_datagram** datagrams =
+        (struct unprocessed_statsd_datagram**) calloc(batch_size, sizeof(struct unprocessed_statsd_datagram*));
+    ALLOC_CHECK("Unable to assign memory for received datagrams.");
+    struct mmsghdr* messages = (struct mmsghdr*) calloc(batch_size, sizeof(struct mmsghdr));
+    ALLOC_CHECK("Unable to assign memory for received message headers.");
+    struct iovec* iovecs = (struct iovec*) calloc(batch_size, sizeof(struct iovec));
+    ALLOC_CHECK("Unable to assign memory for received message buffers.");
+    char* control = (char*) calloc(batch_size, control_size);
+    ALLOC_CHECK("Unable to assign memory for received message control data.");
+    uint32_t kernel_dropped = 0;
+    uint32_t kernel_dropped_reported = 0;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int received, rv, i, done = 0;
+    while(!done) {
+        rv = poll(&pfd, 1, 1000);
+        if (rv == -1 && errno != EINTR) {
+            DIE("%s", strerror(errno));
+        }
+        if (rv <= 0) {
+            if (check_exit_flag()) {
+                break;
+            }
+            continue;
+        }
+        // drain socket, batch at a time
+        do {
+            for (i = 0; i < (int)batch_size; i++) {
+                if (datagrams[i] == NULL) {
+                    datagrams[i] = get_unprocessed_datagram();
+                }
+                iovecs[i].iov_base = datagrams[i]->value;
+                iovecs[i].iov_len = max_udp_packet_size;
+                messages[i].msg_hdr.msg_iov = &iovecs[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+                messages[i].msg_hdr.msg_name = NULL;
+                messages[i].msg_hdr.msg_namelen = 0;
+                messages[i].msg_hdr.msg_control = control + i * control_size;
+                messages[i].msg_hdr.msg_controllen = control_size;
+                messages[i].msg_hdr.msg_flags = 0;
+                messages[i].msg_len = 0;
+            }
+            received = receive_datagrams(fd, messages, batch_size);
+            for (i = 0; i < received; i++) {
+                read_kernel_dropped(&messages[i].msg_hdr, &kernel_dropped);
+                if (messages[i].msg_hdr.msg_flags & MSG_TRUNC ||
+                    messages[i].msg_len >= max_udp_packet_size) {
+                    VERBOSE_LOG(2, "Datagram too large for buffer: truncated and skipped");
+                    continue;
+                }
+                struct unprocessed_statsd_datagram* datagram = datagrams[i];
+                datagram->length = messages[i].msg_len;
+                datagram->value[datagram->length] = '\0';
+                if (datagram->length == strlen(end_message) &&
+                    memcmp(end_message, datagram->value, datagram->length) == 0) {
                     kill(getpid(), SIGINT);
+                    done = 1;
                     break;
                 }
+                datagrams[i] = NULL;
                 chan_send(network_listener_to_parser, datagram);
             }
-            memset(buffer, 0, max_udp_packet_size);
-            rv = 0;
-        } else {
-            int exit_flag = check_exit_flag();
-            if (exit_flag) {        
-                break;
+            if (kernel_dropped != kernel_dropped_reported) {
+                unsigned long delta = (uint32_t)(kernel_dropped - kernel_dropped_reported);
+                process_stat(config, stats, STAT_KERNEL_DROPPED, &delta);
+                kernel_dropped_reported = kernel_dropped;
             }
-        }
+        } while (!done && received == (int)batch_size);
     }
     VERBOSE_LOG(2, "Network listener thread exiting.");
-    struct unprocessed_statsd_datagram* datagram = (struct unprocessed_statsd_datagram*) malloc(sizeof(struct unprocessed_statsd_datagram));
-    ALLOC_CHECK("Unable to assign memory for struct representing unprocessed datagrams.");
-    size_t length = strlen(end_message) + 1;
-    datagram->value = (char*) malloc(sizeof(char) * length);
-    memcpy(datagram->value, end_message, length);
-    chan_send(network_listener_to_parser, datagram);
-    free(buffer);
+    close(fd);
+    for (i = 0; i < (int)batch_size; i++) {
+        free_unprocessed_datagram(datagrams[i]);
+    }
+    free(datagrams);
+    free(messages);
+    free(iovecs);
+    free(control);
+    pthread_mutex_lock(&listeners_mutex);
+    int last = --listeners_running == 0;
+    pthread_mutex_unlock(&listeners_mutex);
+    if (last) {
+        send_end_message(network_listener_to_parser);
+    }
     pthread_exit(NULL);
 }
 
 /**
- * Frees unprocessed datagram
+ * Returns unprocessed datagram to the pool of receive buffers
  * @arg datagram
  */
 void
 free_unprocessed_datagram(struct unprocessed_statsd_datagram* datagram) {
+    if (datagram == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool.mutex);
+    if (pool.count < pool.max_count) {
+        datagram->next = pool.free;
+        pool.free = datagram;
+        pool.count++;
+        datagram = NULL;
+    }
+    pthread_mutex_unlock(&pool.mutex);
     if (datagram != NULL) {
-        if (datagram->value != NULL) {
-            free(datagram->value);
-        }
         free(datagram);
     }
 }
 
 /**
- * Creates arguments for network listener thread
+ * Creates arguments for network listener threads, shared by all of them
  * @arg config - Application config
- * @arg unprocessed_channel - Network listener -> Parser
- * @arg stats_sink - Channel for sending stats about PMDA itself
+ * @arg network_listener_to_parser - Network listener -> Parser
+ * @arg stats - Data structure shared with PCP thread containing all PMDA statistics data
  * @return network_listener_args
  */
 struct network_listener_args*
-create_listener_args(struct agent_config* config, chan_t* network_listener_to_parser) {
+create_listener_args(struct agent_config* config, chan_t* network_listener_to_parser, struct pmda_stats_container* stats) {
     struct network_listener_args* listener_args = (struct network_listener_args*) malloc(sizeof(struct network_listener_args));
     ALLOC_CHECK("Unable to assign memory for listener arguments.");
     listener_args->config = config;
     listener_args->network_listener_to_parser = network_listener_to_parser;
+    listener_args->stats = stats;
+#ifndef SO_REUSEPORT
+    if (config->listener_threads > 1) {
+        VERBOSE_LOG(0, "SO_REUSEPORT is not supported, using single listener thread.");
+        config->listener_threads = 1;
+    }
+#endif
+    init_datagram_pool(config);
+    pthread_mutex_lock(&listeners_mutex);
+    listeners_running = config->listener_threads;
+    pthread_mutex_unlock(&listeners_mutex);
     return listener_args;
 }
@@ -19,16 +19,24 @@
 #include <chan/chan.h>
 
 #include "config-reader.h"
+#include "aggregator-stats.h"
 
+/**
+ * Received datagram, value points to NULL terminated payload stored right after the structure.
+ * Datagrams are pooled, return them with free_unprocessed_datagram
+ */
 typedef struct unprocessed_statsd_datagram
 {
     char* value;
+    size_t length;
+    struct unprocessed_statsd_datagram* next;
 } unprocessed_statsd_datagram;
 
 typedef struct network_listener_args
 {
     struct agent_config* config;
     chan_t* network_listener_to_parser;
+    struct pmda_stats_container* stats;
 } network_listener_args;
 
 /**
@@ -40,19 +48,20 @@ extern void*
 network_listener_exec(void* args);
 
 /**
- * Free unprocessed datagram
+ * Returns unprocessed datagram to the pool of receive buffers
  * @arg datagram
  */
 extern void
 free_unprocessed_datagram(struct unprocessed_statsd_datagram* datagram);
 
 /**
- * Creates arguments for network listener thread
+ * Creates arguments for network listener threads, shared by all of them
  * @arg config - Application config
  * @arg network_listener_to_parser - Network listener -> Parser
+ * @arg stats - Data structure shared with PCP thread containing all PMDA statistics data
  * @return network_listener_args
  */
 extern struct network_listener_args*
-create_listener_args(struct agent_config* config, chan_t* network_listener_to_parser);
+create_listener_args(struct agent_config* config, chan_t* network_listener_to_parser, struct pmda_stats_container* stats);
 
 #endif
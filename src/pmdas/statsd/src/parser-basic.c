@@ -54,50 +54,43 @@
      ((int) x >= (int) 'A' && (int) x <= (int) 'Z')) \
 
 static int
-parse(char* buffer, struct statsd_datagram** datagram);
+parse(char* buffer, struct statsd_datagram* datagram, struct parser_context* context);
 
 /**
  * Basic parser entry point
  * Parsers given buffer and populates datagram with parsed data if they are valid
+ * Buffer is tokenized in place, name and tags are interned by context, so nothing is allocated for known ones
  * @arg buffer - Buffer to be parsed
  * @arg datagram - Placeholder for parsed data
+ * @arg context - Parser context
  * @return 1 on success, 0 on fail 
  */
 int
-basic_parser_parse(char* buffer, struct statsd_datagram** datagram) {
-    *datagram = (struct statsd_datagram*) malloc(sizeof(struct statsd_datagram));
-    ALLOC_CHECK("Unabel to allocate space for statsd structured datagram.");
-    *(*datagram) = (struct statsd_datagram) {0};
-    int length = strlen(buffer);
-    if (buffer[length - 1] == '\n')
+basic_parser_parse(char* buffer, struct statsd_datagram* datagram, struct parser_context* context) {
+    *datagram = (struct statsd_datagram) {0};
+    reset_parser_context_tags(context);
+    size_t length = strlen(buffer);
+    if (length > 0 && buffer[length - 1] == '\n')
         buffer[length - 1] = 0;
-    if (parse(buffer, datagram)) {
+    if (parse(buffer, datagram, context)) {
         VERBOSE_LOG(2, "Parsed: %s", buffer);
         return 1;
     }
-    free_datagram(*datagram);
+    *datagram = (struct statsd_datagram) {0};
     METRIC_PROCESSING_ERR_LOG("Throwing away datagram. REASON: unable to parse: %s", buffer);
     return 0;
 };
 
 static int
-parse(char* buffer, struct statsd_datagram** datagram) {
+parse(char* buffer, struct statsd_datagram* datagram, struct parser_context* context) {
     size_t i = 0;
     size_t count = strlen(buffer) + 1;
-    struct tag_collection* tags = NULL;
-    char* tag_key = NULL;
-    char* tag_value = NULL;
+    const char* name = NULL;
+    size_t name_length = 0;
+    const char* tag_key = NULL;
+    size_t tag_key_length = 0;
     int past_type = 0;
     int any_tags = 0;
-    /* Flag field used to determine which memory to free in stats_datagram should data parsing fail, bits in this order
-     * tags
-     * metric
-     * type
-     * value
-     * sampling
-     * */
-    char field_allocated_flags = 0b00000000;
-    char tag_allocated_flags = 0b00000000;
     /*
      * 0 = name
      * 1 = tag_key
@@ -130,10 +123,8 @@ parse(char* buffer, struct statsd_datagram** datagram) {
                 } else if(IS_ALPHANUMERIC(buffer[i]) || IS_ALLOWED_PUNCTUATION(buffer[i])) {
                     continue;
                 } else if (buffer[i] == ',' || buffer[i] == ':') {
-                    (*datagram)->name = (char *) malloc(current_segment_length + 1);
-                    ALLOC_CHECK("Not enough memory to save metric attribute.");
-                    memcpy((*datagram)->name, &buffer[segment_start], current_segment_length + 1);
-                    (*datagram)->name[current_segment_length] = '\0';
+                    name = &buffer[segment_start];
+                    name_length = current_segment_length;
                     segment_start = i + 1;
                     if (buffer[i] == ',') {
                         segment_type = 1;
@@ -150,11 +141,8 @@ parse(char* buffer, struct statsd_datagram** datagram) {
                 if (IS_ALPHANUMERIC(buffer[i]) || IS_ALLOWED_PUNCTUATION(buffer[i])) {
                     continue;
                 } else if (buffer[i] == '=' || (past_type && buffer[i] == ':')) {
-                    tag_key = (char *) realloc(tag_key, current_segment_length + 1);
-                    ALLOC_CHECK("Not enough memory for tag key buffer.");
-                    tag_allocated_flags = tag_allocated_flags | 1 << 1;
-                    memcpy(tag_key, &buffer[segment_start], current_segment_length);
-                    tag_key[current_segment_length] = '\0';
+                    tag_key = &buffer[segment_start];
+                    tag_key_length = current_segment_length;
                     segment_type = 2;
                     segment_start = i + 1;
                 } else {
@@ -169,41 +157,8 @@ parse(char* buffer, struct statsd_datagram** datagram) {
                     continue;
                 } else if ((buffer[i] == ',' || buffer[i] == ':') ||
                             (past_type && (buffer[i] == ',' || buffer[i] == '\0'))) {
-                    tag_value = (char *) realloc(tag_value, current_segment_length + 1);
-                    ALLOC_CHECK("Not enough memory for tag value buffer.");
-                    tag_allocated_flags = tag_allocated_flags | 1 << 0;
-                    memcpy(tag_value, &buffer[segment_start], current_segment_length + 1);
-                    tag_value[current_segment_length] = '\0';
-                    size_t key_len = strlen(tag_key) + 1;
-                    size_t value_len = strlen(tag_value) + 1;
-                    struct tag* t = (struct tag*) malloc(sizeof(struct tag));
-                    ALLOC_CHECK("Unable to allocate memory for tag.");
-                    t->key = (char*) malloc(key_len);
-                    ALLOC_CHECK("Unable to allocate memory for tag key.");
-                    t->value = (char*) malloc(value_len);
-                    ALLOC_CHECK("Unable to allocate memory for tag value.");
-                    memcpy(t->key, tag_key, key_len);
-                    memcpy(t->value, tag_value, value_len);
-                    if (!any_tags) {
-                        tags = (struct tag_collection*) malloc(sizeof(struct tag_collection));
-                        ALLOC_CHECK("Unable to allocate memory for tag collection.");
-                        field_allocated_flags = field_allocated_flags | 1 << 0;
-                        tags->values = (struct tag**) malloc(sizeof(struct tag*));
-                        tags->values[0] = t;
-                        tags->length = 1;
-                        any_tags = 1;
-                    } else {
-                        struct tag** new_tags = (struct tag**) realloc(tags->values, sizeof(struct tag*) * (tags->length + 1));
-                        ALLOC_CHECK("Unable to allocate memory for tags.");
-                        tags->values = new_tags;
-                        tags->values[tags->length] = t;
-                        tags->length++;
-                    }
-                    free(tag_key);
-                    free(tag_value);
-                    tag_allocated_flags = 0;
-                    tag_key = NULL;
-                    tag_value = NULL;
+                    add_parser_context_tag(context, tag_key, tag_key_length, &buffer[segment_start], current_segment_length);
+                    any_tags = 1;
                     segment_start = i + 1;
                     if (buffer[i] == ',') {
                         segment_type = 1;
@@ -249,20 +204,20 @@ parse(char* buffer, struct statsd_datagram** datagram) {
                             char* startptr;
                             char* endptr = &buffer[i];
                             if (buffer[segment_start] == '+') {
-                                (*datagram)->explicit_sign = SIGN_PLUS;
+                                datagram->explicit_sign = SIGN_PLUS;
                                 startptr = &(buffer[segment_start]);
                             } else if (buffer[segment_start] == '-') {
-                                (*datagram)->explicit_sign = SIGN_MINUS;
+                                datagram->explicit_sign = SIGN_MINUS;
                                 startptr = &(buffer[segment_start + 1]);
                             } else {
-                                (*datagram)->explicit_sign = SIGN_NONE;
+                                datagram->explicit_sign = SIGN_NONE;
                                 startptr = &(buffer[segment_start]);
                             }
                             double value = strtod(startptr, &endptr);
                             if (startptr == endptr || errno == ERANGE) {
                                 goto error_clean_up;
                             }
-                            (*datagram)->value = value;
+                            datagram->value = value;
                             segment_type = 4;
                             segment_start = i + 1;
                             goto exit_value;
@@ -294,7 +249,7 @@ parse(char* buffer, struct statsd_datagram** datagram) {
                     } else {
                         type = METRIC_TYPE_COUNTER;
                     }
-                    (*datagram)->type = type;
+                    datagram->type = type;
                     if (buffer[i] == '|') {
                         segment_type = 5;
                         segment_start = i + 1;
@@ -325,32 +280,16 @@ parse(char* buffer, struct statsd_datagram** datagram) {
         }
 
     }
+    if (name == NULL) {
+        goto error_clean_up;
+    }
+    datagram->name = intern_string(context, name, name_length);
     if (any_tags) {
-        char* json = tag_collection_to_json(tags);
-        if (json != NULL) {
-            (*datagram)->tags = json;
-            (*datagram)->tags_pair_count = tags->length;
-        }
-        free_tag_collection(tags);
-        if (tag_allocated_flags & 2) {
-            free(tag_key);
-        }
-        if (tag_allocated_flags & 1) {
-            free(tag_value);
-        }
+        intern_parser_context_tags(context, datagram);
     }
     return 1;
 
     error_clean_up:;
-    if (any_tags) {
-        free_tag_collection(tags);
-    }
-    if (tag_allocated_flags & 2) {
-        free(tag_key);
-    }
-    if (tag_allocated_flags & 1) {
-        free(tag_value);
-    }
     return 0;
 }
 
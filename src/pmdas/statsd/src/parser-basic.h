@@ -22,9 +22,10 @@
  * Parsers given buffer and populates datagram with parsed data if they are valid
  * @arg buffer - Buffer to be parsed
  * @arg datagram - Placeholder for parsed data
+ * @arg context - Parser context
  * @return 1 on success, 0 on fail 
  */
 extern int
-basic_parser_parse(char *buffer, struct statsd_datagram** datagram);
+basic_parser_parse(char *buffer, struct statsd_datagram* datagram, struct parser_context* context);
 
 #endif
@@ -22,9 +22,10 @@
  * Parsers given buffer and populates datagram with parsed data if they are valid
  * @arg str - Buffer to be parsed
  * @arg datagram - Placeholder for parsed data
+ * @arg context - Parser context
  * @return 1 on success, 0 on fail 
  */
 extern int
-ragel_parser_parse(char* str, struct statsd_datagram** datagram);
+ragel_parser_parse(char* str, struct statsd_datagram* datagram, struct parser_context* context);
 
 #endif
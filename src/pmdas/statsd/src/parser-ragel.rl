@@ -30,26 +30,28 @@
 /**
  * Ragel parser entry point
  * Parsers given buffer and populates datagram with parsed data if they are valid
+ * Buffer is tokenized in place, name and tags are interned by context, so nothing is allocated for known ones
  * @arg str - Buffer to be parsed
  * @arg datagram - Placeholder for parsed data
+ * @arg context - Parser context
  * @return 1 on success, 0 on fail 
  */
 int
-ragel_parser_parse(char* str, struct statsd_datagram** datagram) {
-	*datagram = (struct statsd_datagram*) malloc(sizeof(struct statsd_datagram));
-	*(*datagram) = (struct statsd_datagram) {0};
-	ALLOC_CHECK("Not enough memory to save datagram");
+ragel_parser_parse(char* str, struct statsd_datagram* datagram, struct parser_context* context) {
+	*datagram = (struct statsd_datagram) {0};
+	reset_parser_context_tags(context);
 	size_t length = strlen(str);
 	char *p = str, *pe = (str + length + 1);
 	char *eof = pe;
 	int cs;
 	size_t current_index = 0;
 	size_t current_segment_start_index = 0;
-	struct tag_collection* tags = NULL;
-	char* tag_key = NULL;
-	char* tag_value = NULL;
-	int tag_key_allocated = 0;
-	int tag_value_allocated = 0;
+	const char* name = NULL;
+	size_t name_length = 0;
+	const char* tag_key = NULL;
+	size_t tag_key_length = 0;
+	const char* tag_value = NULL;
+	size_t tag_value_length = 0;
 	int any_tags = 0;
 
 	%%{
@@ -71,111 +73,57 @@ ragel_parser_parse(char* str, struct statsd_datagram** datagram) {
 		}
 
 		action name_parsed {
-			size_t current_segment_length = current_index - current_segment_start_index;
-			(*datagram)->name = (char*) malloc(current_segment_length + 1);
-			ALLOC_CHECK("Not enough memory to save metric name");
-			memcpy(
-				(*datagram)->name,
-				&str[current_segment_start_index],
-				current_segment_length
-			);
-			(*datagram)->name[current_segment_length] = '\0';
+			name = &str[current_segment_start_index];
+			name_length = current_index - current_segment_start_index;
 			current_segment_start_index = current_index + 1; 
 		}
 
 		action tag_parsed {
-			size_t key_len = strlen(tag_key) + 1;
-			size_t value_len = strlen(tag_value) + 1;
-			struct tag* t = (struct tag*) malloc(sizeof(struct tag));
-			ALLOC_CHECK("Unable to allocate memory for tag.");
-			t->key = (char*) malloc(key_len);
-			ALLOC_CHECK("Unable to allocate memory for tag key.");
-			memcpy(t->key, tag_key, key_len);
-			t->value = (char*) malloc(value_len);
-			ALLOC_CHECK("Unable to allocate memory for tag value.");
-			memcpy(t->value, tag_value, value_len);
-			if (!any_tags) {
-				tags = (struct tag_collection*) malloc(sizeof(struct tag_collection));
-				ALLOC_CHECK("Unable to allocate memory for tag collection.");
-				tags->values = (struct tag**) malloc(sizeof(struct tag*));
-				tags->values[0] = t;
-				tags->length = 1;
-				any_tags = 1;
-			} else {
-				struct tag** new_tags =
-					(struct tag**) realloc(tags->values, sizeof(struct tag*) * (tags->length + 1));
-				ALLOC_CHECK("Unable to allocate memory for tags");
-				if (tags != NULL) {
-					tags->values = new_tags;
-					tags->values[tags->length] = t;
-					tags->length++;
-				}
-			}
-			free(tag_key);
-			free(tag_value);
-			tag_key = NULL;
-			tag_value = NULL;
-			tag_key_allocated = 0;
-			tag_value_allocated = 0;
+			add_parser_context_tag(context, tag_key, tag_key_length, tag_value, tag_value_length);
+			any_tags = 1;
 		}
 
 		action value_parsed {
 			char* startptr;
 			char* endptr;
 			if (str[current_segment_start_index] == '+') {
-				(*datagram)->explicit_sign = SIGN_PLUS;
+				datagram->explicit_sign = SIGN_PLUS;
 				startptr = &str[current_segment_start_index + 1];
 			} else if (str[current_segment_start_index] == '-') {
-				(*datagram)->explicit_sign = SIGN_MINUS;
+				datagram->explicit_sign = SIGN_MINUS;
 				startptr = &str[current_segment_start_index + 1];
 			} else {
-				(*datagram)->explicit_sign = SIGN_NONE;
+				datagram->explicit_sign = SIGN_NONE;
 				startptr = &str[current_segment_start_index];
 			}
 			double value = strtod(startptr, &endptr);
 			if (startptr == endptr || errno == ERANGE) {
 				goto error_clean_up;
 			}
-			(*datagram)->value = value;
+			datagram->value = value;
 			current_segment_start_index = current_index + 1;
 		}
 
 		action type_parsed {
 			if (str[current_segment_start_index] == 'c') {
-				(*datagram)->type = METRIC_TYPE_COUNTER;
+				datagram->type = METRIC_TYPE_COUNTER;
 			} else if (str[current_segment_start_index] == 'g') {
-				(*datagram)->type = METRIC_TYPE_GAUGE;
+				datagram->type = METRIC_TYPE_GAUGE;
 			} else {
-				(*datagram)->type = METRIC_TYPE_DURATION;
+				datagram->type = METRIC_TYPE_DURATION;
 			}
 			current_segment_start_index = current_index + 1;
 		}
 
 		action tag_key_parsed {
-			size_t current_segment_length = current_index - current_segment_start_index;
-			tag_key = (char *) realloc(tag_key, current_segment_length + 1);
-			ALLOC_CHECK("Not enough memory for tag key buffer.");
-			tag_key_allocated = 1;
-			memcpy(
-				tag_key,
-				&str[current_segment_start_index], 
-				current_segment_length
-			);
-			tag_key[current_segment_length] = '\0';
+			tag_key = &str[current_segment_start_index];
+			tag_key_length = current_index - current_segment_start_index;
 			current_segment_start_index = current_index + 1;
 		}
 
 		action tag_value_parsed {
-			size_t current_segment_length = current_index - current_segment_start_index;
-			tag_value = (char *) realloc(tag_value, current_segment_length + 1);
-			ALLOC_CHECK("Not enough memory for tag key buffer.");
-			tag_value_allocated = 1;
-			memcpy(
-				tag_value,
-				&str[current_segment_start_index], 
-				current_segment_length
-			);
-			tag_value[current_segment_length] = '\0';
+			tag_value = &str[current_segment_start_index];
+			tag_value_length = current_index - current_segment_start_index;
 			current_segment_start_index = current_index + 1;
 		}
 
@@ -198,15 +146,9 @@ ragel_parser_parse(char* str, struct statsd_datagram** datagram) {
 	(void)statsd_error;
 	(void)statsd_first_final;
 
+	datagram->name = intern_string(context, name, name_length);
 	if (any_tags) {
-		char* json = tag_collection_to_json(tags);
-		if (json != NULL) {
-			(*datagram)->tags = json;
-			(*datagram)->tags_pair_count = tags->length;
-		}
-		free_tag_collection(tags);
-		if (tag_key_allocated) free(tag_key);
-		if (tag_value_allocated) free(tag_value);
+		intern_parser_context_tags(context, datagram);
 	}
 	if (str[length - 1] == '\n')
         str[length - 1] = 0;
@@ -214,14 +156,9 @@ ragel_parser_parse(char* str, struct statsd_datagram** datagram) {
 	return 1;
 
 	error_clean_up:
-	if (any_tags) {
-		free_tag_collection(tags);
-	}
-	if (tag_key_allocated) free(tag_key);
-	if (tag_value_allocated) free(tag_value);
-	if (str[length - 1] == '\n')
+	if (length > 0 && str[length - 1] == '\n')
         str[length - 1] = 0;
-	free_datagram(*datagram);
+	*datagram = (struct statsd_datagram) {0};
 	METRIC_PROCESSING_ERR_LOG("Throwing away datagram. REASON: unable to parse: %s", str);
 	return 0;
 };
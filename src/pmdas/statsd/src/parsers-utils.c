@@ -28,74 +28,299 @@
 
 #define CHECK_DISCREPANCY_VALUE(field, value) (field != value)
 
-static int
-tag_comparator(const void* x, const void* y) {
-    int res = strcmp((*(struct tag**)x)->key, (*(struct tag**)y)->key);
-    return res;
+#define INTERNED_STRINGS_INITIAL_CAPACITY 256
+#define INTERNED_STRINGS_LIMIT 16384
+#define TAGS_INITIAL_CAPACITY 16
+
+/**
+ * Creates empty table of interned strings
+ * @return interned_table
+ */
+static struct interned_table*
+create_interned_table() {
+    struct interned_table* table = (struct interned_table*) malloc(sizeof(struct interned_table));
+    ALLOC_CHECK("Unable to allocate memory for interned strings.");
+    table->capacity = INTERNED_STRINGS_INITIAL_CAPACITY;
+    table->count = 0;
+    table->strings = (struct interned_string*) calloc(table->capacity, sizeof(struct interned_string));
+    ALLOC_CHECK("Unable to allocate memory for interned strings.");
+    pthread_mutex_init(&table->mutex, NULL);
+    table->references = 0;
+    table->retired = 0;
+    return table;
 }
 
 /**
- * Converts tag_collection* struct to JSON string that is sorted by keys and contains no duplicities (right-most wins) 
+ * Frees table of interned strings, including all strings in it
+ * @arg table - Table to be freed
  */
-char*
-tag_collection_to_json(struct tag_collection* tags) {
-    char buffer[JSON_BUFFER_SIZE];
-    qsort(tags->values, tags->length, sizeof(struct tag*), tag_comparator);
-    buffer[0] = '{';
+static void
+free_interned_table(struct interned_table* table) {
     size_t i;
-    size_t current_size = 1;
-    char* format_first = "\"%s\":\"%s\"";
-    char* format_rest = ",\"%s\":\"%s\"";
-    int first_tag = 1;
-    for (i = 0; i < tags->length; i++) {
-        struct tag* current_tag = tags->values[i];
-        if (i + 1 < tags->length) {
-            struct tag* next_tag = tags->values[i + 1];
-            if (strcmp(next_tag->key, current_tag->key) == 0) {
-                continue;
-            } 
+    for (i = 0; i < table->capacity; i++) {
+        if (table->strings[i].value != NULL) {
+            free(table->strings[i].value);
+        }
+    }
+    free(table->strings);
+    pthread_mutex_destroy(&table->mutex);
+    free(table);
+}
+
+/**
+ * Creates parser context
+ * @return parser_context
+ */
+struct parser_context*
+create_parser_context() {
+    struct parser_context* context = (struct parser_context*) malloc(sizeof(struct parser_context));
+    ALLOC_CHECK("Unable to allocate memory for parser context.");
+    context->table = create_interned_table();
+    context->tags_capacity = TAGS_INITIAL_CAPACITY;
+    context->tags_count = 0;
+    context->tags = (struct tag_slice*) malloc(sizeof(struct tag_slice) * context->tags_capacity);
+    ALLOC_CHECK("Unable to allocate memory for parsed tags.");
+    return context;
+}
+
+/**
+ * Frees parser context, including current table of interned strings
+ * @arg context - Context to be freed
+ */
+void
+free_parser_context(struct parser_context* context) {
+    if (context != NULL) {
+        // messages still referencing current table free it once released
+        pthread_mutex_lock(&context->table->mutex);
+        context->table->retired = 1;
+        int unreferenced = context->table->references == 0;
+        pthread_mutex_unlock(&context->table->mutex);
+        if (unreferenced) {
+            free_interned_table(context->table);
         }
-        int pair_length = 
-            pmsprintf(
-                buffer + current_size,
-                JSON_BUFFER_SIZE - current_size,
-                first_tag ? format_first : format_rest,
-                current_tag->key,
-                current_tag->value
-            );
-        current_size += pair_length;
-        first_tag = 0;
-    }
-    if (current_size >= JSON_BUFFER_SIZE - 2) {
-        return NULL;
-    }
-    buffer[current_size] = '}';
-    buffer[current_size + 1] = '\0';
-    char* result = malloc(sizeof(char) * (current_size + 2));
-    ALLOC_CHECK("Unable to allocate memory for tags json.");
-    memcpy(result, buffer, current_size + 2);
+        free(context->tags);
+        free(context);
+    }
+}
+
+/**
+ * Takes reference to current table of interned strings, for message that will hold parsed datagrams
+ * @arg context - Parser context
+ * @return current table
+ */
+struct interned_table*
+reference_interned_table(struct parser_context* context) {
+    struct interned_table* table = context->table;
+    pthread_mutex_lock(&table->mutex);
+    table->references++;
+    pthread_mutex_unlock(&table->mutex);
+    return table;
+}
+
+/**
+ * Drops reference to table of interned strings, freeing it if it was retired and this was the last reference
+ * @arg table - Table of interned strings
+ */
+void
+release_interned_table(struct interned_table* table) {
+    pthread_mutex_lock(&table->mutex);
+    table->references--;
+    int unreferenced = table->retired && table->references == 0;
+    pthread_mutex_unlock(&table->mutex);
+    if (unreferenced) {
+        free_interned_table(table);
+    }
+}
+
+/**
+ * Retires current table of interned strings once it's full, starting a new one
+ * Called between received payloads, so that no message refers to both tables
+ * @arg context - Parser context
+ */
+void
+retire_interned_table(struct parser_context* context) {
+    if (context->table->count < INTERNED_STRINGS_LIMIT) {
+        return;
+    }
+    struct interned_table* table = context->table;
+    context->table = create_interned_table();
+    pthread_mutex_lock(&table->mutex);
+    table->retired = 1;
+    int unreferenced = table->references == 0;
+    pthread_mutex_unlock(&table->mutex);
+    if (unreferenced) {
+        free_interned_table(table);
+    }
+}
+
+static uint64_t
+hash_string(const char* value, size_t length) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char)value[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Doubles capacity of interned strings hashtable, rehashing them
+ * @arg table - Table of interned strings
+ */
+static void
+grow_interned_strings(struct interned_table* table) {
+    size_t new_capacity = table->capacity * 2;
+    struct interned_string* new_strings = (struct interned_string*) calloc(new_capacity, sizeof(struct interned_string));
+    ALLOC_CHECK("Unable to allocate memory for interned strings.");
+    size_t i;
+    for (i = 0; i < table->capacity; i++) {
+        struct interned_string* current = &table->strings[i];
+        if (current->value == NULL) {
+            continue;
+        }
+        size_t index = current->hash & (new_capacity - 1);
+        while (new_strings[index].value != NULL) {
+            index = (index + 1) & (new_capacity - 1);
+        }
+        new_strings[index] = *current;
+    }
+    free(table->strings);
+    table->strings = new_strings;
+    table->capacity = new_capacity;
+}
+
+/**
+ * Gets interned copy of given string
+ * @arg context - Parser context
+ * @arg value - String, doesn't have to be null terminated
+ * @arg length - Length of string
+ * @return null terminated interned string, never to be modified or freed, valid while table is referenced
+ */
+char*
+intern_string(struct parser_context* context, const char* value, size_t length) {
+    struct interned_table* table = context->table;
+    uint64_t hash = hash_string(value, length);
+    size_t mask = table->capacity - 1;
+    size_t index = hash & mask;
+    while (table->strings[index].value != NULL) {
+        struct interned_string* current = &table->strings[index];
+        if (current->hash == hash &&
+            strncmp(current->value, value, length) == 0 &&
+            current->value[length] == '\0') {
+            return current->value;
+        }
+        index = (index + 1) & mask;
+    }
+    char* result = (char*) malloc(length + 1);
+    ALLOC_CHECK("Unable to allocate memory for interned string.");
+    memcpy(result, value, length);
+    result[length] = '\0';
+    table->strings[index].hash = hash;
+    table->strings[index].value = result;
+    table->count++;
+    // keep at least half of slots empty, so that probing stays short
+    if (table->count * 2 > table->capacity) {
+        grow_interned_strings(table);
+    }
     return result;
 }
 
+/**
+ * Forgets tags collected so far, called before each line is parsed
+ * @arg context - Parser context
+ */
+void
+reset_parser_context_tags(struct parser_context* context) {
+    context->tags_count = 0;
+}
+
+/**
+ * Collects tag of line being parsed
+ * @arg context - Parser context
+ * @arg key - Tag key
+ * @arg key_length - Length of tag key
+ * @arg value - Tag value
+ * @arg value_length - Length of tag value
+ */
 void
-free_tag_collection(struct tag_collection* tags) {
-    if (tags != NULL) {
-        size_t i;
-        for (i = 0; i < tags->length; i++) {
-            struct tag* t = tags->values[i]; 
-            if (t != NULL) {
-                if (t->key != NULL) {
-                    free(t->key);
-                }
-                if (t->value != NULL) {
-                    free(t->value);
-                }
-                free(t);
-            }
+add_parser_context_tag(struct parser_context* context, const char* key, size_t key_length, const char* value, size_t value_length) {
+    if (context->tags_count == context->tags_capacity) {
+        size_t new_capacity = context->tags_capacity * 2;
+        struct tag_slice* new_tags = (struct tag_slice*) realloc(context->tags, sizeof(struct tag_slice) * new_capacity);
+        ALLOC_CHECK("Unable to allocate memory for parsed tags.");
+        context->tags = new_tags;
+        context->tags_capacity = new_capacity;
+    }
+    struct tag_slice* tag = &context->tags[context->tags_count];
+    tag->key = key;
+    tag->key_length = key_length;
+    tag->value = value;
+    tag->value_length = value_length;
+    context->tags_count++;
+}
+
+static int
+tag_key_compare(struct tag_slice* x, struct tag_slice* y) {
+    size_t length = x->key_length < y->key_length ? x->key_length : y->key_length;
+    int res = memcmp(x->key, y->key, length);
+    if (res != 0) {
+        return res;
+    }
+    return (x->key_length > y->key_length) - (x->key_length < y->key_length);
+}
+
+/**
+ * Sets datagram tags to interned JSON of collected tags, which is sorted by keys and contains no duplicities (right-most wins)
+ * Tags are left unset when their JSON doesn't fit into JSON_BUFFER_SIZE
+ * @arg context - Parser context
+ * @arg datagram - Datagram to populate
+ */
+void
+intern_parser_context_tags(struct parser_context* context, struct statsd_datagram* datagram) {
+    char buffer[JSON_BUFFER_SIZE];
+    struct tag_slice* tags = context->tags;
+    size_t count = context->tags_count;
+    size_t i, j;
+    // insertion sort is stable, so that of tags with same key the right-most one is last
+    for (i = 1; i < count; i++) {
+        struct tag_slice current = tags[i];
+        for (j = i; j > 0 && tag_key_compare(&tags[j - 1], &current) > 0; j--) {
+            tags[j] = tags[j - 1];
+        }
+        tags[j] = current;
+    }
+    size_t current_size = 0;
+    int pair_count = 0;
+    buffer[current_size++] = '{';
+    for (i = 0; i < count; i++) {
+        struct tag_slice* current_tag = &tags[i];
+        if (i + 1 < count && tag_key_compare(current_tag, &tags[i + 1]) == 0) {
+            continue;
+        }
+        // ,"key":"value"
+        size_t pair_length = current_tag->key_length + current_tag->value_length + 6;
+        if (current_size + pair_length >= JSON_BUFFER_SIZE - 2) {
+            return;
+        }
+        if (pair_count != 0) {
+            buffer[current_size++] = ',';
         }
-        free(tags->values);
-        free(tags);
+        buffer[current_size++] = '"';
+        memcpy(buffer + current_size, current_tag->key, current_tag->key_length);
+        current_size += current_tag->key_length;
+        buffer[current_size++] = '"';
+        buffer[current_size++] = ':';
+        buffer[current_size++] = '"';
+        memcpy(buffer + current_size, current_tag->value, current_tag->value_length);
+        current_size += current_tag->value_length;
+        buffer[current_size++] = '"';
+        pair_count++;
     }
+    buffer[current_size++] = '}';
+    datagram->tags = intern_string(context, buffer, current_size);
+    datagram->tags_pair_count = pair_count;
 }
 
 static const char*
@@ -134,7 +359,7 @@ sign_enum_to_str(enum SIGN sign) {
 
 int
 assert_statsd_datagram_eq(
-    struct statsd_datagram** datagram,
+    struct statsd_datagram* datagram,
     char* name,
     char* tags,
     double value,
@@ -142,25 +367,25 @@ assert_statsd_datagram_eq(
     enum SIGN explicit_sign
 ) {
     long int err_count = 0;
-    if (CHECK_DISCREPANCY((*datagram)->name, name)) {
+    if (CHECK_DISCREPANCY(datagram->name, name)) {
         err_count++;
-        fprintf(stdout, RED "FAIL: " RESET "Metric name doesn't match! %s =/= %s \n", (*datagram)->name, name);
+        fprintf(stdout, RED "FAIL: " RESET "Metric name doesn't match! %s =/= %s \n", datagram->name, name);
     }
-    if (CHECK_DISCREPANCY((*datagram)->tags, tags)) {
+    if (CHECK_DISCREPANCY(datagram->tags, tags)) {
         err_count++;
-        fprintf(stdout, RED "FAIL: " RESET "Tags don't match! %s =/= %s \n", (*datagram)->tags, tags);
+        fprintf(stdout, RED "FAIL: " RESET "Tags don't match! %s =/= %s \n", datagram->tags, tags);
     }
-    if (CHECK_DISCREPANCY_VALUE((*datagram)->value, value)) {
+    if (CHECK_DISCREPANCY_VALUE(datagram->value, value)) {
         err_count++;
-        fprintf(stdout, RED "FAIL: " RESET "Value doesn't match! %f =/= %f \n", (*datagram)->value, value);
+        fprintf(stdout, RED "FAIL: " RESET "Value doesn't match! %f =/= %f \n", datagram->value, value);
     }
-    if (CHECK_DISCREPANCY_VALUE((*datagram)->type, type)) {
+    if (CHECK_DISCREPANCY_VALUE(datagram->type, type)) {
         err_count++;
-        fprintf(stdout, RED "FAIL: " RESET "Type doesn't match! %s =/= %s \n", metric_enum_to_str((*datagram)->type), metric_enum_to_str(type));
+        fprintf(stdout, RED "FAIL: " RESET "Type doesn't match! %s =/= %s \n", metric_enum_to_str(datagram->type), metric_enum_to_str(type));
     }
-    if ((*datagram)->explicit_sign != explicit_sign) {
+    if (datagram->explicit_sign != explicit_sign) {
         err_count++;
-        fprintf(stdout, RED "FAIL: " RESET "Sign doesn't match %s =/= %s \n", sign_enum_to_str((*datagram)->explicit_sign), sign_enum_to_str(explicit_sign));
+        fprintf(stdout, RED "FAIL: " RESET "Sign doesn't match %s =/= %s \n", sign_enum_to_str(datagram->explicit_sign), sign_enum_to_str(explicit_sign));
     }
     return err_count;
 }
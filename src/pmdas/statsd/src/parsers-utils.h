@@ -16,6 +16,8 @@
 #define PARSERS_UTILS_
 
 #include <sys/time.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "parsers.h"
 
@@ -31,7 +33,7 @@
 
 #define CHECK_ERROR(string, name, tags, value, type, explicit_sign) \
     fprintf(stdout, MAG "CASE: %s " RESET "\n", string); \
-    if (parse(string, datagram)) { \
+    if (parse(string, datagram, context)) { \
         int local_err = 0; \
         local_err += assert_statsd_datagram_eq(datagram, name, tags, value, type, explicit_sign); \
         error_count += local_err; \
@@ -46,14 +48,16 @@
     struct timeval t0, t1; \
     fprintf(stdout, YEL name RESET "\n"); \
     long int error_count = 0; \
-    struct statsd_datagram** datagram = (struct statsd_datagram**) malloc(sizeof(struct statsd_datagram*)); \
-    *datagram = (struct statsd_datagram*) malloc(sizeof(struct statsd_datagram)); \
-    int (*parse)(char*, struct statsd_datagram**); \
+    struct statsd_datagram datagram_record; \
+    struct statsd_datagram* datagram = &datagram_record; \
+    struct parser_context* context = create_parser_context(); \
+    datagram_parse_callback parse; \
     parse = &fn; \
     gettimeofday(&t0, NULL); \
 
 #define END_TEST() \
     gettimeofday(&t1, NULL); \
+    free_parser_context(context); \
     fprintf(stdout, "Completed in %ld microseconds.\n", t1.tv_usec - t0.tv_usec); \
     if (error_count == 0) { \
         fprintf(stdout, GRN "TEST PASSED. " RESET "0 errors.\n"); \
@@ -63,28 +67,125 @@
         return EXIT_FAILURE; \
     } \
 
-extern struct tag {
-    char* key;
+/**
+ * Tag key and value, pointing into buffer that is being parsed
+ */
+typedef struct tag_slice {
+    const char* key;
+    size_t key_length;
+    const char* value;
+    size_t value_length;
+} tag_slice;
+
+typedef struct interned_string {
+    uint64_t hash;
     char* value;
-} tag;
+} interned_string;
+
+/**
+ * Table of interned strings, referenced by each parsed message holding datagrams that point into it
+ * Once it holds INTERNED_STRINGS_LIMIT strings the parser retires it and starts a new one,
+ * retired table is freed when the last message referencing it is released by aggregator
+ */
+typedef struct interned_table {
+    struct interned_string* strings; // open addressing hashtable
+    size_t capacity;
+    size_t count;
+    pthread_mutex_t mutex; // guards references and retired
+    size_t references;
+    int retired;
+} interned_table;
+
+/**
+ * Parser state reused between parsed lines, so that parsing itself doesn't allocate once warmed up
+ * - metric names and tag JSONs are interned, each distinct one is allocated once and then shared by all
+ *   datagrams containing it, until the table holding them is retired
+ * - tags of line being parsed are collected into array that only grows
+ */
+typedef struct parser_context {
+    struct interned_table* table; // current table of interned strings
+    struct tag_slice* tags;
+    size_t tags_capacity;
+    size_t tags_count;
+} parser_context;
+
+/**
+ * Creates parser context
+ * @return parser_context
+ */
+extern struct parser_context*
+create_parser_context();
+
+/**
+ * Frees parser context, including current table of interned strings
+ * @arg context - Context to be freed
+ */
+extern void
+free_parser_context(struct parser_context* context);
+
+/**
+ * Takes reference to current table of interned strings, for message that will hold parsed datagrams
+ * @arg context - Parser context
+ * @return current table
+ */
+extern struct interned_table*
+reference_interned_table(struct parser_context* context);
 
-extern struct tag_collection {
-    struct tag** values;
-    size_t length;
-} tag_collection;
+/**
+ * Drops reference to table of interned strings, freeing it if it was retired and this was the last reference
+ * @arg table - Table of interned strings
+ */
+extern void
+release_interned_table(struct interned_table* table);
 
 /**
- * Converts tag_collection* struct to JSON string that is sorted by keys and contains no duplicities (right-most wins) 
+ * Retires current table of interned strings once it's full, starting a new one
+ * Called between received payloads, so that no message refers to both tables
+ * @arg context - Parser context
+ */
+extern void
+retire_interned_table(struct parser_context* context);
+
+/**
+ * Gets interned copy of given string
+ * @arg context - Parser context
+ * @arg value - String, doesn't have to be null terminated
+ * @arg length - Length of string
+ * @return null terminated interned string, never to be modified or freed, valid while table is referenced
  */
 extern char*
-tag_collection_to_json(struct tag_collection* tags);
+intern_string(struct parser_context* context, const char* value, size_t length);
+
+/**
+ * Forgets tags collected so far, called before each line is parsed
+ * @arg context - Parser context
+ */
+extern void
+reset_parser_context_tags(struct parser_context* context);
 
+/**
+ * Collects tag of line being parsed
+ * @arg context - Parser context
+ * @arg key - Tag key
+ * @arg key_length - Length of tag key
+ * @arg value - Tag value
+ * @arg value_length - Length of tag value
+ */
+extern void
+add_parser_context_tag(struct parser_context* context, const char* key, size_t key_length, const char* value, size_t value_length);
+
+/**
+ * Sets datagram tags to interned JSON of collected tags, which is sorted by keys and contains no duplicities (right-most wins)
+ * Tags are left unset when their JSON doesn't fit into JSON_BUFFER_SIZE
+ * @arg context - Parser context
+ * @arg datagram - Datagram to populate
+ */
 extern void
-free_tag_collection(struct tag_collection* tags);
+intern_parser_context_tags(struct parser_context* context, struct statsd_datagram* datagram);
 
 extern int
 assert_statsd_datagram_eq(
-    struct statsd_datagram** datagram,
+    struct statsd_datagram* datagram,
     char* name,
     char* tags,
     double value,
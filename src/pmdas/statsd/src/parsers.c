@@ -22,13 +22,77 @@
 #include "network-listener.h"
 #include "parsers.h"
 #include "aggregators.h"
+#include "aggregator-metrics.h"
 #include "parser-basic.h"
 #include "parser-ragel.h"
+#include "parsers-utils.h"
 #include "utils.h"
 
+#define MESSAGE_INITIAL_CAPACITY 8
+
+/**
+ * Pool of parser to aggregator messages shared by parser and aggregator threads,
+ * so that steady state parsing doesn't allocate
+ */
+static struct message_pool {
+    pthread_mutex_t mutex;
+    struct parser_to_aggregator_message* free;
+    size_t count;
+    size_t max_count;
+} pool = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+
+/**
+ * Takes message from pool or allocates new one, if pool is empty
+ * @arg type - Message type
+ * @return empty message
+ */
+static struct parser_to_aggregator_message*
+get_parser_to_aggregator_message(enum PARSER_RESULT_TYPE type) {
+    struct parser_to_aggregator_message* message;
+    pthread_mutex_lock(&pool.mutex);
+    message = pool.free;
+    if (message != NULL) {
+        pool.free = message->next;
+        pool.count--;
+    }
+    pthread_mutex_unlock(&pool.mutex);
+    if (message == NULL) {
+        message = (struct parser_to_aggregator_message*) malloc(sizeof(struct parser_to_aggregator_message));
+        ALLOC_CHECK("Unable to assign memory for parser to aggregator message.");
+        message->capacity = MESSAGE_INITIAL_CAPACITY;
+        message->data = (struct statsd_datagram*) malloc(sizeof(struct statsd_datagram) * message->capacity);
+        ALLOC_CHECK("Unable to assign memory for parsed datagrams.");
+    }
+    message->length = 0;
+    message->dropped = 0;
+    message->type = type;
+    message->time = 0;
+    message->strings = NULL;
+    message->next = NULL;
+    return message;
+}
+
+/**
+ * Gets slot for next datagram in message, growing it as needed
+ * @arg message - Message to which datagram is added
+ * @return datagram placeholder
+ */
+static struct statsd_datagram*
+add_message_datagram(struct parser_to_aggregator_message* message) {
+    if (message->length == message->capacity) {
+        size_t new_capacity = message->capacity * 2;
+        struct statsd_datagram* new_data = (struct statsd_datagram*) realloc(message->data, sizeof(struct statsd_datagram) * new_capacity);
+        ALLOC_CHECK("Unable to assign memory for parsed datagrams.");
+        message->data = new_data;
+        message->capacity = new_capacity;
+    }
+    return &message->data[message->length++];
+}
+
 /**
  * Thread entrypoint - listens to incoming payload on a unprocessed channel
  * and sends over successfully parsed data over to Aggregator thread via processed channel
+ * Lines of each payload are sent as one batch per aggregator thread
  * @arg args - parser_args
  */
 void*
@@ -37,7 +101,11 @@ parser_exec(void* args) {
     static char* network_end_message = "PMDASTATSD_EXIT";
     struct agent_config* config = ((struct parser_args*)args)->config;
     chan_t* network_listener_to_parser = ((struct parser_args*)args)->network_listener_to_parser;
-    chan_t* parser_to_aggregator = ((struct parser_args*)args)->parser_to_aggregator;
+    chan_t** parser_to_aggregator = ((struct parser_args*)args)->parser_to_aggregator;
+    struct parser_context* context = ((struct parser_args*)args)->context;
+    size_t aggregator_count = config->aggregator_threads;
+    size_t next_aggregator = 0;
+    size_t i;
     datagram_parse_callback parse_datagram;
     if ((int)config->parser_type == (int)PARSER_TYPE_BASIC) {
         parse_datagram = &basic_parser_parse;
@@ -45,7 +113,9 @@ parser_exec(void* args) {
         parse_datagram = &ragel_parser_parse;
     }
     struct unprocessed_statsd_datagram* datagram;
-    ALLOC_CHECK("Unable to allocate space for unprocessed statsd datagram.");
+    struct parser_to_aggregator_message** batches =
+        (struct parser_to_aggregator_message**) calloc(aggregator_count, sizeof(struct parser_to_aggregator_message*));
+    ALLOC_CHECK("Unable to allocate space for parsed datagram batches.");
     char delim[] = "\n";
     struct timespec t0, t1;
     unsigned long time_spent_parsing;
@@ -67,38 +137,44 @@ parser_exec(void* args) {
             free_unprocessed_datagram(datagram);
             continue;
         }
-        struct statsd_datagram* parsed;
-        char* tok = strtok(datagram->value, delim);
+        struct statsd_datagram parsed;
+        char* saveptr;
+        char* tok = strtok_r(datagram->value, delim, &saveptr);
         while (tok != NULL) {
             clock_gettime(CLOCK_MONOTONIC, &t0);
-            int success = parse_datagram(tok, &parsed);
+            int success = parse_datagram(tok, &parsed, context);
             clock_gettime(CLOCK_MONOTONIC, &t1);
-            struct parser_to_aggregator_message* message =
-                (struct parser_to_aggregator_message*) malloc(sizeof(struct parser_to_aggregator_message));
-            ALLOC_CHECK("Unable to assign memory for parser to aggregator message.");
             time_spent_parsing = (t1.tv_nsec) - (t0.tv_nsec);
-            message->time = time_spent_parsing;
+            // aggregator thread owning metric's shard, dropped lines are only counted
+            size_t target = success ? get_metric_shard_index(parsed.name, aggregator_count) : next_aggregator;
+            if (batches[target] == NULL) {
+                batches[target] = get_parser_to_aggregator_message(PARSER_RESULT_PARSED);
+                batches[target]->strings = reference_interned_table(context);
+            }
             if (success) {
-                message->data = parsed;
-                message->type = PARSER_RESULT_PARSED;
-                chan_send(parser_to_aggregator, message);
+                *add_message_datagram(batches[target]) = parsed;
             } else {
-                message->data = NULL;
-                message->type = PARSER_RESULT_DROPPED;
-                chan_send(parser_to_aggregator, message);
+                batches[target]->dropped += 1;
+                next_aggregator = (next_aggregator + 1) % aggregator_count;
             }
-            tok = strtok(NULL, delim);
+            batches[target]->time += time_spent_parsing;
+            tok = strtok_r(NULL, delim, &saveptr);
         }
         free_unprocessed_datagram(datagram);
+        for (i = 0; i < aggregator_count; i++) {
+            if (batches[i] != NULL) {
+                chan_send(parser_to_aggregator[i], batches[i]);
+                batches[i] = NULL;
+            }
+        }
+        // no batch refers to interned strings now, so full table can be swapped for new one
+        retire_interned_table(context);
     }
     VERBOSE_LOG(2, "Parser exiting.");
-    struct parser_to_aggregator_message* message =
-        (struct parser_to_aggregator_message*) malloc(sizeof(struct parser_to_aggregator_message));
-    ALLOC_CHECK("Unable to assign memory for parser to aggregator message.");
-    message->type = PARSER_RESULT_END;
-    message->time = 0;
-    message->data = NULL;
-    chan_send(parser_to_aggregator, message);
+    free(batches);
+    for (i = 0; i < aggregator_count; i++) {
+        chan_send(parser_to_aggregator[i], get_parser_to_aggregator_message(PARSER_RESULT_END));
+    }
     pthread_exit(NULL);
 }
 
@@ -106,31 +182,69 @@ parser_exec(void* args) {
  * Creates arguments for parser thread
  * @arg config - Application config
  * @arg network_listener_to_parser - Network listener -> Parser
- * @arg parser_to_aggregator - Parser -> Aggregator
+ * @arg parser_to_aggregator - Parser -> Aggregator, one channel per aggregator thread
  * @return parser_args
  */
 struct parser_args*
-create_parser_args(struct agent_config* config, chan_t* network_listener_to_parser, chan_t* parser_to_aggregator) {
+create_parser_args(struct agent_config* config, chan_t* network_listener_to_parser, chan_t** parser_to_aggregator) {
     struct parser_args* parser_args = (struct parser_args*) malloc(sizeof(struct parser_args));
     ALLOC_CHECK("Unable to assign memory for parser arguments.");
     parser_args->config = config;
     parser_args->network_listener_to_parser = network_listener_to_parser;
     parser_args->parser_to_aggregator = parser_to_aggregator;
+    parser_args->context = create_parser_context();
+    pthread_mutex_lock(&pool.mutex);
+    // each aggregator has a full channel, one message being aggregated and one being filled by parser
+    pool.max_count = ((size_t)config->max_unprocessed_packets + 2) * config->aggregator_threads;
+    pthread_mutex_unlock(&pool.mutex);
     return parser_args;
 }
 
 /**
- * Frees datagram
+ * Frees arguments of parser thread, including parser context and pooled messages - only once aggregators are done with parsed datagrams
+ * @arg args - parser_args
  */
 void
-free_datagram(struct statsd_datagram* datagram) {
-    if (datagram != NULL) {
-        if (datagram->name != NULL) {
-            free(datagram->name);
-        }
-        if (datagram->tags != NULL) {
-            free(datagram->tags);
-        }
-        free(datagram);
+free_parser_args(struct parser_args* args) {
+    struct parser_to_aggregator_message* message;
+    if (args != NULL) {
+        free_parser_context(args->context);
+        free(args);
+    }
+    pthread_mutex_lock(&pool.mutex);
+    while (pool.free != NULL) {
+        message = pool.free;
+        pool.free = message->next;
+        free(message->data);
+        free(message);
+    }
+    pool.count = 0;
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+/**
+ * Returns parser to aggregator message to the pool of messages
+ * @arg message - Message to be returned
+ */
+void
+free_parser_to_aggregator_message(struct parser_to_aggregator_message* message) {
+    if (message == NULL) {
+        return;
+    }
+    if (message->strings != NULL) {
+        release_interned_table(message->strings);
+        message->strings = NULL;
+    }
+    pthread_mutex_lock(&pool.mutex);
+    if (pool.count < pool.max_count) {
+        message->next = pool.free;
+        pool.free = message;
+        pool.count++;
+        message = NULL;
+    }
+    pthread_mutex_unlock(&pool.mutex);
+    if (message != NULL) {
+        free(message->data);
+        free(message);
     }
 }
@@ -24,7 +24,8 @@ typedef struct parser_args
 {
     struct agent_config* config;
     chan_t* network_listener_to_parser;
-    chan_t* parser_to_aggregator;
+    chan_t** parser_to_aggregator; // one channel per aggregator thread
+    struct parser_context* context; // interned strings are referenced by parsed messages
 } parser_args;
 
 typedef enum METRIC_TYPE { 
@@ -36,7 +37,6 @@ typedef enum METRIC_TYPE {
 
 typedef enum PARSER_RESULT_TYPE {
     PARSER_RESULT_PARSED = 0b00,
-    PARSER_RESULT_DROPPED = 0b01,
     PARSER_RESULT_END = 0b11,
 } PARSER_RESULT;
 
@@ -46,13 +46,10 @@ typedef enum SIGN {
     SIGN_MINUS,
 } SIGN;
 
-typedef struct parser_to_aggregator_message
-{
-    struct statsd_datagram* data;
-    enum PARSER_RESULT_TYPE type;
-    unsigned long time;
-} parser_to_aggregator_message;
-
+/**
+ * Parsed datagram, name and tags are interned by parser_context and must not be modified or freed,
+ * they are valid until message holding datagram is released
+ */
 typedef struct statsd_datagram
 {
     char* name;
@@ -63,7 +60,26 @@ typedef struct statsd_datagram
     double value;
 } statsd_datagram;
 
-typedef int (*datagram_parse_callback)(char*, struct statsd_datagram**);
+/**
+ * Batch of datagrams parsed from single received payload, that belong to one aggregator thread
+ * Messages are pooled, return them with free_parser_to_aggregator_message
+ */
+typedef struct parser_to_aggregator_message
+{
+    struct statsd_datagram* data;
+    size_t length; // count of parsed datagrams
+    size_t capacity;
+    unsigned long dropped; // count of lines that failed to parse
+    enum PARSER_RESULT_TYPE type;
+    unsigned long time;
+    struct interned_table* strings; // table holding names and tags of datagrams, released with message
+    struct parser_to_aggregator_message* next;
+} parser_to_aggregator_message;
+
+struct parser_context;
+struct interned_table;
+
+typedef int (*datagram_parse_callback)(char*, struct statsd_datagram*, struct parser_context*);
 
 /**
  * Thread entrypoint - listens to incoming payload on a unprocessed channel and sends over successfully parsed data over to Aggregator thread via processed channel
@@ -76,22 +92,24 @@ parser_exec(void* args);
  * Creates arguments for parser thread
  * @arg config - Application config
  * @arg network_listener_to_parser - Network listener -> Parser
- * @arg parser_to_aggregator - Parser -> Aggregator
+ * @arg parser_to_aggregator - Parser -> Aggregator, one channel per aggregator thread
  * @return parser_args
  */
 extern struct parser_args*
-create_parser_args(struct agent_config* config, chan_t* network_listener_to_parser, chan_t* parser_to_aggregator);
+create_parser_args(struct agent_config* config, chan_t* network_listener_to_parser, chan_t** parser_to_aggregator);
 
 /**
- * 
+ * Frees arguments of parser thread, including parser context and pooled messages - only once aggregators are done with parsed datagrams
+ * @arg args - parser_args
  */
 extern void
-free_unprocessed_datagram(struct unprocessed_statsd_datagram* datagram);
+free_parser_args(struct parser_args* args);
 
 /**
- * Frees datagram
+ * Returns parser to aggregator message to the pool of messages
+ * @arg message - Message to be returned
  */
 extern void
-free_datagram(struct statsd_datagram* datagram);
+free_parser_to_aggregator_message(struct parser_to_aggregator_message* message);
 
 #endif
@@ -133,6 +133,7 @@ create_pcp_metric(char* key, struct metric* item, pmdaExt* pmda) {
         "STATSD: adding metric %s %s from %s\n", item->meta->pcp_name, pmIDStr(item->meta->pmid), item->name
     );
     item->meta->pcp_metric_index = i;
+    data->pcp_metric_count += 1;
 }
 
 /***
@@ -365,7 +366,6 @@ map_metric(char* key, struct metric* item, void* pmda) {
     if (item->meta->pcp_instance_change_requested == 1) {
         update_pcp_metric_instance_domain(key, item, (pmdaExt*)pmda);
     }
-    data->pcp_metric_count += 1;
     process_stat(data->config, data->stats_storage, STAT_TRACKED_METRIC, (void*)item->type);
     VERBOSE_LOG(1, "Populated PMNS with %d, %s .", item->meta->pmid, item->meta->pcp_name);
     pmdaTreeInsert(data->pcp_pmns, item->meta->pmid, item->meta->pcp_name);
@@ -403,6 +403,12 @@ insert_hardcoded_metrics(pmdaExt* pmda) {
     pmdaTreeInsert(data->pcp_pmns, pmID_build(pmda->e_domain, 0, 12), name);
     pmsprintf(name, 64, "statsd.pmda.settings.duration_aggregation_type");
     pmdaTreeInsert(data->pcp_pmns, pmID_build(pmda->e_domain, 0, 13), name);
+    pmsprintf(name, 64, "statsd.pmda.kernel_dropped");
+    pmdaTreeInsert(data->pcp_pmns, pmID_build(pmda->e_domain, 0, 14), name);
+    pmsprintf(name, 64, "statsd.pmda.settings.listener_threads");
+    pmdaTreeInsert(data->pcp_pmns, pmID_build(pmda->e_domain, 0, 15), name);
+    pmsprintf(name, 64, "statsd.pmda.settings.aggregator_threads");
+    pmdaTreeInsert(data->pcp_pmns, pmID_build(pmda->e_domain, 0, 16), name);
     VERBOSE_LOG(1, "Populated PMNS with hardcoded metrics.");
 }
 
@@ -427,18 +433,25 @@ statsd_map_stats(pmdaExt* pmda) {
     reset_stat(data->config, data->stats_storage, STAT_TRACKED_METRIC);
     insert_hardcoded_metrics(pmda);
     struct pmda_metrics_container* container = data->metrics_storage;
+    // metrics added while shards are mapped bump generation again, triggering another reload
     pthread_mutex_lock(&container->mutex);
-    metrics* m = container->metrics;
-    dictIterator* iterator = dictGetSafeIterator(m);
-    dictEntry* current;
-    while ((current = dictNext(iterator)) != NULL) {
-        struct metric* item = (struct metric*)current->v.val;
-        char* key = (char*)current->key;
-        map_metric(key, item, pmda);
-    }
-    dictReleaseIterator(iterator);
-    data->generation = data->metrics_storage->generation;
+    size_t generation = container->generation;
     pthread_mutex_unlock(&container->mutex);
+    size_t i;
+    for (i = 0; i < container->shard_count; i++) {
+        struct pmda_metrics_shard* shard = &container->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        dictIterator* iterator = dictGetSafeIterator(shard->metrics);
+        dictEntry* current;
+        while ((current = dictNext(iterator)) != NULL) {
+            struct metric* item = (struct metric*)current->v.val;
+            char* key = (char*)current->key;
+            map_metric(key, item, pmda);
+        }
+        dictReleaseIterator(iterator);
+        pthread_mutex_unlock(&shard->mutex);
+    }
+    data->generation = generation;
 
     pmdaTreeRebuildHash(data->pcp_pmns, data->pcp_metric_count);
 }
@@ -613,42 +626,61 @@ statsd_text(int ident, int type, char** buffer, pmdaExt* pmda) {
             }
             case 10:
             {
-                static char oneliner[] = "Debug flag.";
+                static char oneliner[] = "Debug output filename.";
                 static char full_description[] = 
-                    "Debug flag. This shows current setting.\n";
+                    "Debug output filename. This shows current setting.\n";
                 *buffer = (type & PM_TEXT_ONELINE) ? oneliner : full_description;
                 return 0;
             }
             case 11:
             {
-                static char oneliner[] = "Debug output filename.";
+                static char oneliner[] = "Port that is listened to.";
                 static char full_description[] = 
-                    "Debug output filename. This shows current setting.\n";
+                    "Port that is listened to. This shows current setting.\n";
                 *buffer = (type & PM_TEXT_ONELINE) ? oneliner : full_description;
                 return 0;
             }
             case 12:
             {
-                static char oneliner[] = "Port that is listened to.";
+                static char oneliner[] = "Used parser type.";
                 static char full_description[] = 
-                    "Port that is listened to. This shows current setting.\n";
+                    "Used parser type. This shows current setting.\n";
                 *buffer = (type & PM_TEXT_ONELINE) ? oneliner : full_description;
                 return 0;
             }
             case 13:
             {
-                static char oneliner[] = "Used parser type.";
+                static char oneliner[] = "Used duration aggregation type.";
                 static char full_description[] = 
-                    "Used parser type. This shows current setting.\n";
+                    "Used duration aggregation type. This shows current setting.\n";
                 *buffer = (type & PM_TEXT_ONELINE) ? oneliner : full_description;
                 return 0;
+            }
+            case 14:
+            {
+                static char oneliner[] = "Datagrams dropped by kernel count";
+                static char full_description[] = 
+                    "Number of datagrams/packets that were dropped by the kernel\n"
+                    "before the agent received them, because the socket receive\n"
+                    "buffer was full (requires SO_RXQ_OVFL support).\n";
+                *buffer = (type & PM_TEXT_ONELINE) ? oneliner : full_description;
                 return 0;
             }
-            case 14: 
+            case 15:
             {
-                static char oneliner[] = "Used duration aggregation type.";
+                static char oneliner[] = "Number of network listener threads.";
                 static char full_description[] = 
-                    "Used duration aggregation type. This shows current setting.\n";
+                    "Number of network listener threads, each receiving datagrams\n"
+                    "on its own socket. This shows current setting.\n";
+                *buffer = (type & PM_TEXT_ONELINE) ? oneliner : full_description;
+                return 0;
+            }
+            case 16:
+            {
+                static char oneliner[] = "Number of aggregator threads.";
+                static char full_description[] = 
+                    "Number of aggregator threads, each aggregating its own share\n"
+                    "of metrics (by hash of metric name). This shows current setting.\n";
                 *buffer = (type & PM_TEXT_ONELINE) ? oneliner : full_description;
                 return 0;
             }
@@ -798,9 +830,10 @@ statsd_label_callback(pmInDom in_dom, unsigned int inst, pmLabelSet** lp) {
     if (!found) {
         return 0;
     }
-    pthread_mutex_lock(&data->metrics_storage->mutex);
+    struct pmda_metrics_shard* shard = get_metric_shard(data->metrics_storage, item->name);
+    pthread_mutex_lock(&shard->mutex);
     pmdaAddLabels(lp, "%s", label->labels);
-    pthread_mutex_unlock(&data->metrics_storage->mutex);
+    pthread_mutex_unlock(&shard->mutex);
     return label->pair_count;
 }
 
@@ -914,10 +947,15 @@ statsd_resolve_static_metric_fetch(pmdaMetric* mdesc, unsigned int instance, pmA
             char* result;
             char* basic = "Basic";
             char* ragel = "HDR histogram";
+            char* sketch = "Sketch";
             if (config->duration_aggregation_type == DURATION_AGGREGATION_TYPE_BASIC) {
                 result = (char*) malloc(sizeof(char) * 6);
                 ALLOC_CHECK("Unable to allocate memory for duration aggregation type value.");
                 memcpy(result, basic, 6);
+            } else if (config->duration_aggregation_type == DURATION_AGGREGATION_TYPE_SKETCH) {
+                result = (char*) malloc(sizeof(char) * 7);
+                ALLOC_CHECK("Unable to allocate memory for duration aggregation type value.");
+                memcpy(result, sketch, 7);
             } else {
                 result = (char*) malloc(sizeof(char) * 14);
                 ALLOC_CHECK("Unable to allocate memory for duration aggregation type value.");
@@ -926,6 +964,18 @@ statsd_resolve_static_metric_fetch(pmdaMetric* mdesc, unsigned int instance, pmA
             (*atom)->cp = result;
             break;
         }
+        /* kernel_dropped */
+        case 14:
+            (*atom)->ull = get_agent_stat(config, stats, STAT_KERNEL_DROPPED, NULL);
+            break;
+        /* settings.listener_threads */
+        case 15:
+            (*atom)->ul = config->listener_threads;
+            break;
+        /* settings.aggregator_threads */
+        case 16:
+            (*atom)->ul = config->aggregator_threads;
+            break;
         default:
             status = PM_ERR_PMID;
     }
@@ -950,9 +1000,11 @@ statsd_resolve_dynamic_metric_fetch(pmdaMetric* mdesc, unsigned int instance, pm
                             (serial == STATSD_METRIC_DEFAULT_DURATION_INDOM);
     int status = PM_ERR_INST;
     enum DURATION_INSTANCE duration_stat;
+    // only aggregator thread owning this shard is held up while value is read
+    struct pmda_metrics_shard* shard = get_metric_shard(data->metrics_storage, result->name);
     // metrics without any labels
     if (is_default_domain) {
-        pthread_mutex_lock(&data->metrics_storage->mutex);
+        pthread_mutex_lock(&shard->mutex);
         if (result->type == METRIC_TYPE_DURATION) {
             duration_stat = map_to_duration_instance(instance);
             (*atom)->d = get_duration_instance(config, result->value, duration_stat);
@@ -960,7 +1012,7 @@ statsd_resolve_dynamic_metric_fetch(pmdaMetric* mdesc, unsigned int instance, pm
             (*atom)->d = *(double*)result->value;
         }
         status = PMDA_FETCH_STATIC;
-        pthread_mutex_unlock(&data->metrics_storage->mutex);
+        pthread_mutex_unlock(&shard->mutex);
     } 
     // metrics with labels
     else {
@@ -969,7 +1021,7 @@ statsd_resolve_dynamic_metric_fetch(pmdaMetric* mdesc, unsigned int instance, pm
                                     ((result->type == METRIC_TYPE_DURATION && instance < 9) || instance == 0);
         // check if request was for root value
         if (request_for_root_value) {
-            pthread_mutex_lock(&data->metrics_storage->mutex);
+            pthread_mutex_lock(&shard->mutex);
             if (result->type == METRIC_TYPE_DURATION) {
                 duration_stat = map_to_duration_instance(instance);
                 (*atom)->d = get_duration_instance(config, result->value, duration_stat);
@@ -977,7 +1029,7 @@ statsd_resolve_dynamic_metric_fetch(pmdaMetric* mdesc, unsigned int instance, pm
                 (*atom)->d = *(double*)result->value;
             }
             status = PMDA_FETCH_STATIC;
-            pthread_mutex_unlock(&data->metrics_storage->mutex);
+            pthread_mutex_unlock(&shard->mutex);
         } else {
         // else return some labeled value
             int instance_label_offset;
@@ -996,7 +1048,7 @@ statsd_resolve_dynamic_metric_fetch(pmdaMetric* mdesc, unsigned int instance, pm
                 &label
             );
             if (found) {
-                pthread_mutex_lock(&data->metrics_storage->mutex);
+                pthread_mutex_lock(&shard->mutex);
                 if (result->type == METRIC_TYPE_DURATION) {
                     duration_stat = map_to_duration_instance(instance);
                     (*atom)->d = get_duration_instance(config, label->value, duration_stat);
@@ -1004,7 +1056,7 @@ statsd_resolve_dynamic_metric_fetch(pmdaMetric* mdesc, unsigned int instance, pm
                     (*atom)->d = *(double*)label->value;
                 }
                 status = PMDA_FETCH_STATIC;
-                pthread_mutex_unlock(&data->metrics_storage->mutex);
+                pthread_mutex_unlock(&shard->mutex);
             }
         }
     }
@@ -106,7 +106,7 @@ create_statsd_hardcoded_instances(struct pmda_data_extension* data) {
 static void
 create_statsd_hardcoded_metrics(struct pmda_data_extension* data) {
     size_t i;
-    size_t hardcoded_count = 14;
+    size_t hardcoded_count = 17;
     data->pcp_metrics = (pmdaMetric*) malloc(hardcoded_count * sizeof(pmdaMetric));
     ALLOC_CHECK("Unable to allocate space for static PMDA metrics.");
     // helper containing only reference to priv data same for all hardcoded metrics
@@ -125,9 +125,9 @@ create_statsd_hardcoded_metrics(struct pmda_data_extension* data) {
                 data->pcp_metrics[i].m_desc.indom = PM_INDOM_NULL;
             }            
         } else {
-            if (i == 7) {
+            if (i == 7 || i == 14) {
                 data->pcp_metrics[i].m_desc.type = PM_TYPE_U64;
-            } else if (i < 10 || i == 11) {
+            } else if (i < 10 || i == 11 || i == 15 || i == 16) {
                 data->pcp_metrics[i].m_desc.type = PM_TYPE_U32;
             } else {
                 data->pcp_metrics[i].m_desc.type = PM_TYPE_STRING;
@@ -156,12 +156,8 @@ static void
 free_shared_data(struct agent_config* config, struct pmda_data_extension* data) {
     // frees config
     free(config->debug_output_filename);
-    // remove metrics dictionary and related
-    dictRelease(data->metrics_storage->metrics);
-    // privdata will be left behind, need to remove manually
-    free(data->metrics_storage->metrics_privdata);
-    pthread_mutex_destroy(&data->metrics_storage->mutex);
-    free(data->metrics_storage);
+    // remove metrics dictionaries and related
+    free_pmda_metrics(data->metrics_storage);
     // remove stats dictionary and related
     free(data->stats_storage->stats->metrics_recorded);
     free(data->stats_storage->stats);
@@ -249,17 +245,19 @@ main_PDU_loop(pmdaInterface* dispatch) {
         if (check_exit_flag()) break;
         if (__pmdaMainPDU(dispatch) < 0) break;
     }
+    // pmcd has gone away, so threads have to stop as on SIGINT
+    set_exit_flag();
     VERBOSE_LOG(2, "Exiting main PDU loop.");
 }
 
 static int _isDSO = 1; /* for local contexts */
-static pthread_t network_listener;
-static pthread_t aggregator;
+static pthread_t* network_listeners;
+static pthread_t* aggregators;
 static pthread_t parser;
 static chan_t* network_listener_to_parser;
-static chan_t* parser_to_aggregator;
+static chan_t** parser_to_aggregator;
 static struct network_listener_args* listener_thread_args;
-static struct aggregator_args* aggregator_thread_args;
+static struct aggregator_args** aggregator_thread_args;
 static struct parser_args* parser_thread_args;
 static struct agent_config config;
 static struct pmda_data_extension data = { 0 };
@@ -273,6 +271,7 @@ statsd_init(pmdaInterface *dispatch)
     struct pmda_metrics_container* metrics;
     struct pmda_stats_container* stats;
     int pthread_errno, sep = pmPathSeparator();
+    unsigned int i;
 
     if (_isDSO) {
         pmsprintf(
@@ -297,22 +296,38 @@ statsd_init(pmdaInterface *dispatch)
     if (network_listener_to_parser == NULL) {
 	    DIE("Unable to create channel network listener -> parser.");
     }
-    parser_to_aggregator = chan_init(config.max_unprocessed_packets);
-    if (parser_to_aggregator == NULL) {
-	    DIE("Unable to create channel parser -> aggregator.");
+    parser_to_aggregator = (chan_t**) malloc(sizeof(chan_t*) * config.aggregator_threads);
+    ALLOC_CHECK("Unable to assign memory for parser -> aggregator channels.");
+    for (i = 0; i < config.aggregator_threads; i++) {
+        parser_to_aggregator[i] = chan_init(config.max_unprocessed_packets);
+        if (parser_to_aggregator[i] == NULL) {
+	        DIE("Unable to create channel parser -> aggregator.");
+        }
     }
 
-    listener_thread_args = create_listener_args(&config, network_listener_to_parser);
+    listener_thread_args = create_listener_args(&config, network_listener_to_parser, stats);
     parser_thread_args = create_parser_args(&config, network_listener_to_parser, parser_to_aggregator);
-    aggregator_thread_args = create_aggregator_args(&config, parser_to_aggregator, metrics, stats);
+    aggregator_thread_args = (struct aggregator_args**) malloc(sizeof(struct aggregator_args*) * config.aggregator_threads);
+    ALLOC_CHECK("Unable to assign memory for aggregator arguments.");
+    for (i = 0; i < config.aggregator_threads; i++) {
+        aggregator_thread_args[i] = create_aggregator_args(&config, parser_to_aggregator[i], metrics, stats);
+    }
 
     pthread_errno = 0; 
-    pthread_errno = pthread_create(&network_listener, NULL, network_listener_exec, listener_thread_args);
-    PTHREAD_CHECK(pthread_errno);
+    network_listeners = (pthread_t*) malloc(sizeof(pthread_t) * config.listener_threads);
+    ALLOC_CHECK("Unable to assign memory for network listener threads.");
+    for (i = 0; i < config.listener_threads; i++) {
+        pthread_errno = pthread_create(&network_listeners[i], NULL, network_listener_exec, listener_thread_args);
+        PTHREAD_CHECK(pthread_errno);
+    }
     pthread_errno = pthread_create(&parser, NULL, parser_exec, parser_thread_args);
     PTHREAD_CHECK(pthread_errno);
-    pthread_errno = pthread_create(&aggregator, NULL, aggregator_exec, aggregator_thread_args);
-    PTHREAD_CHECK(pthread_errno);
+    aggregators = (pthread_t*) malloc(sizeof(pthread_t) * config.aggregator_threads);
+    ALLOC_CHECK("Unable to assign memory for aggregator threads.");
+    for (i = 0; i < config.aggregator_threads; i++) {
+        pthread_errno = pthread_create(&aggregators[i], NULL, aggregator_exec, aggregator_thread_args[i]);
+        PTHREAD_CHECK(pthread_errno);
+    }
 
     if (dispatch->status != 0) {
         pthread_exit(NULL);
@@ -342,31 +357,44 @@ statsd_init(pmdaInterface *dispatch)
 
 static void
 statsd_done(void) {    
-    if (pthread_join(network_listener, NULL) != 0) {
-        DIE("Error joining network network listener thread.");
-    } else {
-        VERBOSE_LOG(2, "Network listener thread joined.");
+    unsigned int i;
+    for (i = 0; i < config.listener_threads; i++) {
+        if (pthread_join(network_listeners[i], NULL) != 0) {
+            DIE("Error joining network network listener thread.");
+        } else {
+            VERBOSE_LOG(2, "Network listener thread joined.");
+        }
     }
     if (pthread_join(parser, NULL) != 0) {
         DIE("Error joining datagram parser thread.");
     } else {
         VERBOSE_LOG(2, "Parser thread joined.");
     }
-    if (pthread_join(aggregator, NULL) != 0) {    
-        DIE("Error joining datagram aggregator thread.");
-    } else {
-        VERBOSE_LOG(2, "Aggregator thread joined.");
+    for (i = 0; i < config.aggregator_threads; i++) {
+        if (pthread_join(aggregators[i], NULL) != 0) {    
+            DIE("Error joining datagram aggregator thread.");
+        } else {
+            VERBOSE_LOG(2, "Aggregator thread joined.");
+        }
     }
 
     free_shared_data(&config, &data);
     free(listener_thread_args);
-    free(parser_thread_args);
+    free(network_listeners);
+    free_parser_args(parser_thread_args);
+    for (i = 0; i < config.aggregator_threads; i++) {
+        free(aggregator_thread_args[i]);
+    }
     free(aggregator_thread_args);
+    free(aggregators);
     
     chan_close(network_listener_to_parser);
-    chan_close(parser_to_aggregator);
     chan_dispose(network_listener_to_parser);
-    chan_dispose(parser_to_aggregator);
+    for (i = 0; i < config.aggregator_threads; i++) {
+        chan_close(parser_to_aggregator[i]);
+        chan_dispose(parser_to_aggregator[i]);
+    }
+    free(parser_to_aggregator);
 }
 
 int
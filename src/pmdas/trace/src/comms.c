@@ -21,6 +21,7 @@
 #include "domain.h"
 #include "client.h"
 #include "comms.h"
+#include "data.h"
 
 extern struct timeval	interval;
 extern int readData(int, int *);
@@ -33,6 +34,10 @@ extern int	ctlport;		/* control port number */
 static int	ctlfd;			/* fd for control port */
 static int	pmcdfd;			/* fd for pmcd */
 
+/* poll often while shared memory rings are attached, else for new ones */
+#define SHM_DRAIN_USEC	10000
+#define SHM_SCAN_SEC	1
+
 void alarming(int, void *);
 static void hangup(int);
 static int getcport(void);
@@ -48,6 +53,7 @@ traceMain(pmdaInterface *dispatch)
 {
     client_t	*cp;
     fd_set	readyfds;
+    struct timeval	timeout;
     int		nready, i, pdutype, sts, protocol;
 
     ctlfd = getcport();
@@ -70,11 +76,17 @@ traceMain(pmdaInterface *dispatch)
 
     for (;;) {
 	memcpy(&readyfds, &fds, sizeof(readyfds));
-	nready = select(maxfd+1, &readyfds, NULL, NULL, NULL);
+	if (shmAttached()) {
+	    timeout.tv_sec = 0;
+	    timeout.tv_usec = SHM_DRAIN_USEC;
+	}
+	else {
+	    timeout.tv_sec = SHM_SCAN_SEC;
+	    timeout.tv_usec = 0;
+	}
+	nready = select(maxfd+1, &readyfds, NULL, NULL, &timeout);
 
-	if (nready == 0)
-	    continue;
-	else if (nready < 0) {
+	if (nready < 0) {
 	    if (neterror() != EINTR) {
 		pmNotifyErr(LOG_ERR, "select failure: %s", netstrerror());
 		exit(1);
@@ -83,6 +95,11 @@ traceMain(pmdaInterface *dispatch)
 	}
 
 	__pmAFblock();
+	shmPoll();
+	if (nready == 0) {
+	    __pmAFunblock();
+	    continue;
+	}
 	if (FD_ISSET(pmcdfd, &readyfds)) {
 	    if (pmDebugOptions.appl0)
 		pmNotifyErr(LOG_DEBUG, "processing pmcd request [fd=%d]", pmcdfd);
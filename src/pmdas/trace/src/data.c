@@ -1,4 +1,5 @@
 /*
+ * Copyright (c) 2026 Red Hat.
  * Copyright (c) 1997 Silicon Graphics, Inc.  All Rights Reserved.
  * 
  * This program is free software; you can redistribute it and/or modify it
@@ -16,10 +17,17 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "pmapi.h"
 #include "libpcp.h"
 #include "data.h"
 
+#ifndef O_NOFOLLOW
+#define O_NOFOLLOW	0	/* symbolic links are also rejected by lstat */
+#endif
+
 int
 instcmp(void *a, void *b)
 {
@@ -118,3 +126,328 @@ debuglibrary(void)
 }
 
 
+/*
+ * Shared memory rings, one for each process using the shared memory
+ * transport in libpcp_trace.  Rings are found by scanning the directory
+ * once a second, drained in batches from the main loop, and detached
+ * (after a final drain) once their file is removed or the process exits.
+ * The directory is created by (and owned by) the PMDA, allowing it to
+ * remove rings that processes were unable to remove themselves.  Since
+ * any process can create files there, only regular files shared with
+ * this PMDA alone (by owner or group, with a single link) are mapped.
+ */
+typedef struct {
+    pid_t		pid;
+    dev_t		dev;
+    ino_t		ino;
+    size_t		size;
+    int			seen;		/* found by the latest scan */
+    __pmTraceShmHdr	*hdr;		/* NULL if not a valid ring */
+    __pmTraceShmTag	*tags;
+    __pmTraceShmEvent	*events;
+    __uint32_t		ringsize;
+    __uint32_t		maxtags;
+    tracebatch_t	*batch;		/* accumulated per tag in a drain */
+    __uint32_t		*touched;	/* tags with events in this drain */
+} shmring_t;
+
+static char		shmdir[MAXPATHLEN];
+static shmring_t	*rings;
+static int		nrings;
+static int		nattached;
+static __uint64_t	detached;	/* events dropped by detached rings */
+static time_t		lastscan;
+
+void
+shmInit(void)
+{
+    pmsprintf(shmdir, sizeof(shmdir), "%s%c%s",
+		pmGetConfig("PCP_TMP_DIR"), pmPathSeparator(), TRACE_SHM_DIR);
+    /* like /tmp, any process can create its ring but not remove others */
+    if (access(shmdir, F_OK) < 0 &&
+	(mkdir2(shmdir, 01777) < 0 || chmod(shmdir, 01777) < 0))
+	pmNotifyErr(LOG_WARNING, "cannot create %s: %s - shared memory "
+			"transport disabled", shmdir, osstrerror());
+}
+
+static int
+shmDrain(shmring_t *rp)
+{
+    __pmTraceShmHdr	*hdr = rp->hdr;
+    __pmTraceShmEvent	*ep;
+    __pmTraceShmTag	*tp;
+    tracebatch_t	*bp;
+    char		tag[MAXTAGNAMELEN];
+    __uint64_t		pos;
+    __uint32_t		slot, type, length;
+    double		value;
+    int			i, count, ntouched = 0;
+
+    if (hdr == NULL)
+	return 0;
+
+    /* bounded, so a busy process cannot keep us here indefinitely */
+    pos = hdr->tail;
+    for (count = 0; count < rp->ringsize; count++) {
+	ep = &rp->events[pos & (rp->ringsize - 1)];
+	if (__atomic_load_n(&ep->seq, __ATOMIC_ACQUIRE) != pos + 1)
+	    break;
+	slot = ep->tag;
+	value = ep->value;
+	__atomic_store_n(&ep->seq, pos + rp->ringsize, __ATOMIC_RELEASE);
+	pos++;
+	if (slot >= rp->maxtags)
+	    continue;
+	bp = &rp->batch[slot];
+	if (bp->count++ == 0) {
+	    rp->touched[ntouched++] = slot;
+	    bp->first = bp->min = bp->max = value;
+	    bp->sum = 0;
+	}
+	else if (value < bp->min)
+	    bp->min = value;
+	else if (value > bp->max)
+	    bp->max = value;
+	bp->last = value;
+	bp->sum += value;
+    }
+    hdr->tail = pos;
+
+    /* one summary and ring buffer update per tag, not per event */
+    for (i = 0; i < ntouched; i++) {
+	slot = rp->touched[i];
+	bp = &rp->batch[slot];
+	tp = &rp->tags[slot];
+	type = tp->type;
+	length = tp->length;
+	if (type >= TRACE_FIRST_TYPE && type <= TRACE_LAST_TYPE &&
+	    length > 1 && length < MAXTAGNAMELEN) {
+	    memcpy(tag, tp->name, length);
+	    tag[length - 1] = '\0';
+	}
+	else
+	    length = 0;
+	if (length == 0 || strlen(tag) != length - 1)
+	    pmNotifyErr(LOG_ERR, "process %" FMT_PID ": bad tag in slot %u "
+			"- %u events ignored", rp->pid, slot, bp->count);
+	else
+	    updateData(-1, tag, length, type, bp);
+	bp->count = 0;
+    }
+
+    if (pmDebugOptions.appl0 && count > 0)
+	pmNotifyErr(LOG_DEBUG, "drained %d events for %d tags from process "
+		"%" FMT_PID, count, ntouched, rp->pid);
+    return count;
+}
+
+/*
+ * Check the opened file is the one scanned, and only accessible to
+ * this PMDA and the process that created it.
+ */
+static int
+shmSecure(struct stat *sbuf, shmring_t *rp)
+{
+    if (!S_ISREG(sbuf->st_mode) || sbuf->st_nlink != 1 ||
+	sbuf->st_dev != rp->dev || sbuf->st_ino != rp->ino)
+	return 0;
+    if ((sbuf->st_mode & (S_IRWXO | S_IXGRP | S_IXUSR)) != 0)
+	return 0;
+    return geteuid() == 0 || sbuf->st_uid == geteuid() ||
+	   ((sbuf->st_mode & S_IRWXG) != 0 && sbuf->st_gid == getegid());
+}
+
+static void
+shmAttach(const char *path, pid_t pid, struct stat *sbuf)
+{
+    __pmTraceShmHdr	*hdr = NULL;
+    shmring_t		*rp;
+    size_t		size;
+    int			fd;
+
+    if ((rp = realloc(rings, (nrings + 1) * sizeof(shmring_t))) == NULL) {
+	pmNotifyErr(LOG_ERR, "%s: cannot attach: %s", path, osstrerror());
+	return;
+    }
+    rings = rp;
+    rp = &rings[nrings++];
+    memset(rp, 0, sizeof(*rp));
+    rp->pid = pid;
+    rp->dev = sbuf->st_dev;
+    rp->ino = sbuf->st_ino;
+    rp->seen = 1;
+
+    /* never follow links, and check the file actually opened */
+    if ((fd = open(path, O_RDWR | O_NOFOLLOW | O_NONBLOCK)) < 0) {
+	pmNotifyErr(LOG_ERR, "%s: cannot open: %s", path, osstrerror());
+	return;
+    }
+    if (fstat(fd, sbuf) < 0 || !shmSecure(sbuf, rp)) {
+	close(fd);
+	pmNotifyErr(LOG_WARNING, "%s: unsafe file ownership or mode, ignored",
+			path);
+	return;
+    }
+    size = sbuf->st_size;
+    if (size < sizeof(__pmTraceShmHdr)) {
+	close(fd);
+	goto invalid;
+    }
+    hdr = (__pmTraceShmHdr *)__pmMemoryMap(fd, size, 1);
+    close(fd);
+    if (hdr == NULL) {
+	pmNotifyErr(LOG_ERR, "%s: cannot map: %s", path, osstrerror());
+	return;
+    }
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != TRACE_SHM_MAGIC ||
+	hdr->version != TRACE_SHM_VERSION || hdr->pid != pid ||
+	hdr->ringsize < 2 || (hdr->ringsize & (hdr->ringsize - 1)) != 0 ||
+	hdr->ringsize > TRACE_SHM_MAXRING || hdr->maxtags == 0 ||
+	hdr->maxtags > TRACE_SHM_MAXTAGS ||
+	size != TRACE_SHM_SIZE(hdr->maxtags, hdr->ringsize))
+	goto invalid;
+
+    rp->ringsize = hdr->ringsize;
+    rp->maxtags = hdr->maxtags;
+    if ((rp->batch = calloc(rp->maxtags, sizeof(tracebatch_t))) == NULL ||
+	(rp->touched = calloc(rp->maxtags, sizeof(__uint32_t))) == NULL) {
+	pmNotifyErr(LOG_ERR, "%s: cannot attach: %s", path, osstrerror());
+	free(rp->batch);
+	rp->batch = NULL;
+	__pmMemoryUnmap(hdr, size);
+	return;
+    }
+    rp->hdr = hdr;
+    rp->size = size;
+    rp->tags = TRACE_SHM_TAGS(hdr);
+    rp->events = TRACE_SHM_EVENTS(hdr);
+    nattached++;
+    if (pmDebugOptions.appl0)
+	pmNotifyErr(LOG_DEBUG, "attached %s (ringsize=%u, tail=%llu)",
+		path, rp->ringsize, (unsigned long long)hdr->tail);
+    return;
+
+invalid:
+    /* remembered (unmapped) so that it is only reported the once */
+    pmNotifyErr(LOG_WARNING, "%s: not a trace ring, ignored", path);
+    if (hdr != NULL)
+	__pmMemoryUnmap(hdr, size);
+}
+
+static void
+shmDetach(shmring_t *rp, int remove)
+{
+    char	path[MAXPATHLEN];
+
+    if (rp->hdr != NULL) {
+	shmDrain(rp);
+	detached += rp->hdr->dropped;
+	__pmMemoryUnmap(rp->hdr, rp->size);
+	free(rp->batch);
+	free(rp->touched);
+	nattached--;
+	if (pmDebugOptions.appl0)
+	    pmNotifyErr(LOG_DEBUG, "detached ring for process %" FMT_PID,
+			rp->pid);
+    }
+    if (remove) {
+	pmsprintf(path, sizeof(path), "%s%c%" FMT_PID,
+			shmdir, pmPathSeparator(), rp->pid);
+	if (unlink(path) < 0 && pmDebugOptions.appl0)
+	    pmNotifyErr(LOG_DEBUG, "cannot remove %s: %s", path, osstrerror());
+    }
+    *rp = rings[--nrings];
+}
+
+static void
+shmScan(void)
+{
+    DIR			*dirp;
+    struct dirent	*dp;
+    struct stat		sbuf;
+    char		path[MAXPATHLEN];
+    char		*endnum;
+    pid_t		pid;
+    int			i;
+
+    for (i = 0; i < nrings; i++)
+	rings[i].seen = 0;
+
+    if ((dirp = opendir(shmdir)) != NULL) {
+	while ((dp = readdir(dirp)) != NULL) {
+	    /* temporary files (.PID) are renamed to PID once initialised */
+	    pid = (pid_t)strtol(dp->d_name, &endnum, 10);
+	    if (!isdigit((int)dp->d_name[0]) || *endnum != '\0' || pid <= 0)
+		continue;
+	    pmsprintf(path, sizeof(path), "%s%c%s",
+			shmdir, pmPathSeparator(), dp->d_name);
+	    if (lstat(path, &sbuf) < 0 || !S_ISREG(sbuf.st_mode))
+		continue;
+	    for (i = 0; i < nrings; i++)
+		if (rings[i].pid == pid)
+		    break;
+	    if (i < nrings) {
+		if (rings[i].dev == sbuf.st_dev && rings[i].ino == sbuf.st_ino) {
+		    rings[i].seen = 1;
+		    continue;
+		}
+		shmDetach(&rings[i], 0);	/* PID reused, a new ring */
+	    }
+	    shmAttach(path, pid, &sbuf);
+	}
+	closedir(dirp);
+    }
+
+    /*
+     * Rings removed by their process have been drained already, rings
+     * left behind by processes that have exited are drained and removed.
+     */
+    for (i = 0; i < nrings; i++) {
+	if (!rings[i].seen)
+	    shmDetach(&rings[i], 0);
+	else if (rings[i].hdr != NULL && !__pmProcessExists(rings[i].pid))
+	    shmDetach(&rings[i], 1);
+	else
+	    continue;
+	i--;	/* last ring has been moved into this slot */
+    }
+}
+
+/*
+ * Called from the main loop - look for new rings and processes that
+ * have exited once a second, then drain all rings.
+ */
+int
+shmPoll(void)
+{
+    time_t	now = time(NULL);
+    int		i, count = 0;
+
+    if (shmdir[0] == '\0')
+	return 0;
+    if (now != lastscan) {
+	lastscan = now;
+	shmScan();
+    }
+    for (i = 0; i < nrings; i++)
+	count += shmDrain(&rings[i]);
+    return count;
+}
+
+int
+shmAttached(void)
+{
+    return nattached;
+}
+
+__uint64_t
+shmDropped(void)
+{
+    __uint64_t	dropped = detached;
+    int		i;
+
+    for (i = 0; i < nrings; i++)
+	if (rings[i].hdr != NULL)
+	    dropped += __atomic_load_n(&rings[i].hdr->dropped, __ATOMIC_RELAXED);
+    return dropped;
+}
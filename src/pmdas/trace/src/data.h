@@ -61,6 +61,26 @@ typedef struct {
     unsigned int	level;		/* controls reporting level */
 } ringbuf_t;
 
+/*
+ * Observations for one tag accumulated while draining a shared memory
+ * ring, or a single observation from a client PDU.
+ */
+typedef struct {
+    unsigned int	count;
+    double		first;
+    double		last;
+    double		min;
+    double		max;
+    double		sum;
+} tracebatch_t;
+
+int updateData(int, const char *, int, int, tracebatch_t *);
+
+void shmInit(void);
+int shmPoll(void);
+int shmAttached(void);
+__uint64_t shmDropped(void);
+
 void debuglibrary(void);
 
 extern int somedebug;
@@ -226,6 +226,7 @@ main(int argc, char **argv)
 
     pmdaOpenLog(&dispatch);
     pmSetProcessIdentity(username);
+    shmInit();
     traceInit(&dispatch);
     pmdaConnect(&dispatch);
     traceMain(&dispatch);
@@ -122,6 +122,10 @@ static pmdaMetric metrictab[] = {
     { NULL,
       { PMDA_PMID(0,19), PM_TYPE_DOUBLE, COUNTER_INDOM, PM_SEM_COUNTER,
 	PMDA_PMUNITS(0,0,0, 0,0,0) }, },	/* this may be modified at startup */
+/* control.dropped */
+    { NULL,
+      { PMDA_PMID(0,20), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER,
+	PMDA_PMUNITS(0,0,1, 0,0,PM_COUNT_ONE) }, },
 };
 
 extern void __pmdaStartInst(pmInDom indom, pmdaExt *pmda);
@@ -269,48 +273,23 @@ summarydel(void *a)
 }
 
 /*
- * Processes data from pcp_trace-linked client programs.
+ * Fold a batch of observations for one tag into the summary table and
+ * the working ring buffer entry.  Batches of one come from PDUs sent by
+ * connected clients, larger batches from draining shared memory rings.
  *
- * Return negative only on fd-related errors, as that connection will
- * later be closed.  Other errors - report in log file but continue.
+ * Returns the trace type, or negative if the data has been discarded.
  */
 int
-readData(int clientfd, int *protocol)
+updateData(int clientfd, const char *tag, int taglen, int type,
+		tracebatch_t *batch)
 {
-    __pmTracePDU	*result;
-    double	 	data;
     hashdata_t		newhash;
     hashdata_t		*hptr;
     hashdata_t		hash;
-    char		*tag;
-    int			type, taglen, sts;
-    int			freeflag=0;
 
-    if ((sts = __pmtracegetPDU(clientfd, TRACE_TIMEOUT_NEVER, &result)) < 0) {
-	pmNotifyErr(LOG_ERR, "bogus PDU read - %s", pmtraceerrstr(sts));
-	return -1;
-    }
-    else if (sts == TRACE_PDU_DATA) {
-	if ((sts = __pmtracedecodedata(result, &tag, &taglen,
-						&type, protocol, &data)) < 0)
-	    return -1;
-	if (type < TRACE_FIRST_TYPE || type > TRACE_LAST_TYPE) {
-	    pmNotifyErr(LOG_ERR, "unknown trace type for '%s' (%d)", tag, type);
-	    free(tag);
-	    return -1;
-	}
-	newhash.tag = tag;
-	newhash.taglength = taglen;
-	newhash.tracetype = type;
-    }
-    else if (sts == 0) {	/* client has exited - cleanup in mainloop */
-	return -1;
-    }
-    else {	/* unknown PDU type - bail & later kill connection */
-	pmNotifyErr(LOG_ERR, "unknown PDU - expected data PDU"
-		" (not type #%d)", sts);
-	return -1;
-    }
+    newhash.tag = (char *)tag;
+    newhash.taglength = taglen;
+    newhash.tracetype = type;
 
     /*
      * First, update the global summary table with this new data
@@ -336,13 +315,25 @@ readData(int clientfd, int *protocol)
 	    newhash.id = ++counters;
 	else	/* TRACE_TYPE_OBSERVE */
 	    newhash.id = ++observes;
+	if ((newhash.tag = strdup(tag)) == NULL) {
+	    pmNotifyErr(LOG_ERR, "summary table insert failure - '%s' "
+		"data ignored: %s", tag, osstrerror());
+	    return -1;
+	}
 	newhash.txcount = -1;	/* first time since reset or start */
 	newhash.padding = 0;
-	newhash.realcount = 1;	
-	newhash.realtime = data;	
+	newhash.realcount = batch->count;
 	newhash.fd = clientfd;
-	newhash.txmin = newhash.txmax = data;
-	newhash.txsum = data;
+	newhash.txmin = newhash.txmax = batch->first;
+	/* as though the first value created the entry, the rest updated it */
+	if (type == TRACE_TYPE_TRANSACT)
+	    newhash.realtime = batch->sum;
+	else
+	    newhash.realtime = batch->first;
+	if (type == TRACE_TYPE_COUNTER || type == TRACE_TYPE_OBSERVE)
+	    newhash.txsum = batch->last;
+	else
+	    newhash.txsum = batch->first;
 	hptr = &newhash;
 	if (pmDebugOptions.appl0)
 	    pmNotifyErr(LOG_DEBUG, "'%s' is new to the summary table!",
@@ -367,10 +358,10 @@ readData(int clientfd, int *protocol)
 	/* walk the indom table - if we find this new tag in it already, then
 	 * something is badly busted.
 	 */
-	for (sts = 0; sts < indomtab[indom].it_numinst; sts++) {
-	    if (strcmp(indomtab[indom].it_set[sts].i_name, hptr->tag) == 0) {
+	for (index = 0; index < indomtab[indom].it_numinst; index++) {
+	    if (strcmp(indomtab[indom].it_set[index].i_name, hptr->tag) == 0) {
 		fprintf(stderr, "'%s' (inst=%d, type=%d) entry in indomtab already!!!\n",
-			hptr->tag, indomtab[indom].it_set[sts].i_inst, hptr->tracetype);
+			hptr->tag, indomtab[indom].it_set[index].i_inst, hptr->tracetype);
 		abort();
 	    }
 	}
@@ -397,23 +388,21 @@ readData(int clientfd, int *protocol)
 	}
     }
     else {	/* update an existing entry */
-	freeflag++;	/* wont need tag afterwards, so mark for deletion */
 	if (hptr->taglength != newhash.taglength) {
 	    pmNotifyErr(LOG_ERR, "hash table update failure - '%s' "
 		"data ignored (bad tag length)", tag);
-	    free(newhash.tag);
 	    return -1;
 	}
 	else {	/* update existing entries free running counter */
-	    hptr->realcount++;
+	    hptr->realcount += batch->count;
 	    if (hptr->tracetype == TRACE_TYPE_TRANSACT)
-		hptr->realtime += data;
+		hptr->realtime += batch->sum;
 		/* keep running total of time attributed to transactions */
 	    else if (hptr->tracetype == TRACE_TYPE_COUNTER)
-		hptr->txsum = data;
+		hptr->txsum = batch->last;
 		/* counters are 'permanent' and immediately available */
 	    else if (hptr->tracetype == TRACE_TYPE_OBSERVE)
-		hptr->txsum = data;
+		hptr->txsum = batch->last;
 		/* observations are 'permanent' and immediately available */
 	    if (pmDebugOptions.appl0)
 		pmNotifyErr(LOG_DEBUG, "'%s' real count updated (%d)",
@@ -431,17 +420,22 @@ readData(int clientfd, int *protocol)
 	hash.id = 0;	/* the ring buffer is never used to resolve indoms */
 	hash.padding = 0;
 	hash.realcount = 1;
-	hash.realtime = data;
+	hash.realtime = batch->first;
 	hash.taglength = (unsigned int)taglen;
 	hash.fd = clientfd;
-	hash.txcount = 1;
-	hash.txmin = hash.txmax = data;
-	hash.txsum = data;
+	hash.txcount = batch->count;
+	if (type == TRACE_TYPE_TRANSACT) {
+	    hash.txmin = batch->min;
+	    hash.txmax = batch->max;
+	    hash.txsum = batch->sum;
+	}
+	else
+	    hash.txmin = hash.txmax = hash.txsum = batch->first;
 	hptr = &hash;
 	if (pmDebugOptions.appl0)
 	    pmNotifyErr(LOG_DEBUG, "fresh interval data on fd=%d rpos=%d "
-		    "('%s': len=%d type=%d value=%d)", clientfd, rpos,
-		    hash.tag, taglen, type, (int)data);
+		    "('%s': len=%d type=%d value=%d count=%u)", clientfd, rpos,
+		    hash.tag, taglen, type, (int)batch->first, batch->count);
 	if (__pmhashinsert(ringbuf.ring[rpos].stats, hash.tag, hptr) < 0) {
 	    pmNotifyErr(LOG_ERR, "ring buffer insert failure - '%s' "
 		"data ignored", hash.tag);
@@ -450,13 +444,13 @@ readData(int clientfd, int *protocol)
 	}
     }
     else {	/* update existing entry */
-	hptr->txcount++;
+	hptr->txcount += batch->count;
 	if (hptr->tracetype == TRACE_TYPE_TRANSACT) {
-	    if (data < hptr->txmin)
-		hptr->txmin = data;
-	    if (data > hptr->txmax)
-		hptr->txmax = data;
-	    hptr->txsum += data;
+	    if (batch->min < hptr->txmin)
+		hptr->txmin = batch->min;
+	    if (batch->max > hptr->txmax)
+		hptr->txmax = batch->max;
+	    hptr->txsum += batch->sum;
 	}
 	if (pmDebugOptions.appl0)
 	    pmNotifyErr(LOG_DEBUG, "Updating data on fd=%d ('%s': type=%d "
@@ -464,14 +458,56 @@ readData(int clientfd, int *protocol)
 		    clientfd, hptr->tag, hptr->tracetype,
 		    hptr->txcount, hptr->txmin, hptr->txmax, hptr->txsum);
     }
-    if (freeflag) {
-	free(newhash.tag);
-	newhash.tag = NULL;
-    }
 
     return hptr->tracetype;
 }
 
+/*
+ * Processes data from pcp_trace-linked client programs.
+ *
+ * Return negative only on fd-related errors, as that connection will
+ * later be closed.  Other errors - report in log file but continue.
+ */
+int
+readData(int clientfd, int *protocol)
+{
+    __pmTracePDU	*result;
+    tracebatch_t	batch;
+    double	 	data;
+    char		*tag;
+    int			type, taglen, sts;
+
+    if ((sts = __pmtracegetPDU(clientfd, TRACE_TIMEOUT_NEVER, &result)) < 0) {
+	pmNotifyErr(LOG_ERR, "bogus PDU read - %s", pmtraceerrstr(sts));
+	return -1;
+    }
+    else if (sts == TRACE_PDU_DATA) {
+	if ((sts = __pmtracedecodedata(result, &tag, &taglen,
+						&type, protocol, &data)) < 0)
+	    return -1;
+	if (type < TRACE_FIRST_TYPE || type > TRACE_LAST_TYPE) {
+	    pmNotifyErr(LOG_ERR, "unknown trace type for '%s' (%d)", tag, type);
+	    free(tag);
+	    return -1;
+	}
+    }
+    else if (sts == 0) {	/* client has exited - cleanup in mainloop */
+	return -1;
+    }
+    else {	/* unknown PDU type - bail & later kill connection */
+	pmNotifyErr(LOG_ERR, "unknown PDU - expected data PDU"
+		" (not type #%d)", sts);
+	return -1;
+    }
+
+    batch.count = 1;
+    batch.first = batch.last = data;
+    batch.min = batch.max = batch.sum = data;
+    sts = updateData(clientfd, tag, taglen, type, &batch);
+    free(tag);
+    return sts;
+}
+
 static void
 clearTable(hashtable_t *t, void *entry)
 {
@@ -756,6 +792,9 @@ auxFetch(int inst, pmID pmid, char *tag, pmAtomValue *atom)
 	case 16:			/* trace.control.debug */
 	    atom->ul = pmDebug;
 	    break;
+	case 20:			/* trace.control.dropped */
+	    atom->ull = shmDropped();
+	    break;
 	default:
 	    return PM_ERR_PMID;
 	}
@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#include <ctype.h>
+#include "server.h"
+#include "compress.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+ * HTTP response body compression (RFC 7231 section 3.1.2).  Clients
+ * advertise the codings they accept, from which the server picks its
+ * most preferred (pmproxy.compress.encodings) for each response body
+ * above a minimum size (pmproxy.compress.minsize).
+ */
+#define MAX_CODINGS	2
+
+static int compress_enabled;		/* pmproxy.compress.enabled */
+static size_t compress_minsize;		/* pmproxy.compress.minsize */
+static http_coding preferred[MAX_CODINGS+1];	/* in order of preference */
+
+enum {
+    COMPRESS_RESPONSES,
+    COMPRESS_BYTES_IN,
+    COMPRESS_BYTES_OUT,
+    COMPRESS_TIME,
+    NUM_COMPRESS_METRICS
+};
+
+static void *compress_map;
+static pmAtomValue *compress_values[NUM_COMPRESS_METRICS];
+
+struct http_encoder {
+    http_coding		coding;
+#ifdef HAVE_ZLIB
+    z_stream		gzip;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx		*zstd;
+#endif
+};
+
+static http_coding
+http_supported_coding(const char *name, size_t length)
+{
+#ifdef HAVE_ZLIB
+    if ((length == 4 && strncasecmp(name, "gzip", 4) == 0) ||
+	(length == 6 && strncasecmp(name, "x-gzip", 6) == 0))
+	return HTTP_CODING_GZIP;
+#endif
+#ifdef HAVE_ZSTD
+    if (length == 4 && strncasecmp(name, "zstd", 4) == 0)
+	return HTTP_CODING_ZSTD;
+#endif
+    (void)name; (void)length;
+    return HTTP_CODING_IDENTITY;
+}
+
+const char *
+http_coding_name(http_coding coding)
+{
+    if (coding == HTTP_CODING_GZIP)
+	return "gzip";
+    if (coding == HTTP_CODING_ZSTD)
+	return "zstd";
+    return "identity";
+}
+
+int
+http_compress_enabled(void)
+{
+    return compress_enabled;
+}
+
+/*
+ * Parse Accept-Encoding, e.g. "gzip, deflate;q=0.5, zstd, *;q=0"
+ * and return the set of codings we support that are not refused
+ * (q=0).  The client weighting is otherwise left to server choice.
+ */
+http_coding
+http_accept_encoding(const char *value, size_t length)
+{
+    const char		*p, *end = value + length;
+    const char		*name, *q;
+    http_coding		accepted = 0, coding;
+    size_t		namelen;
+    int			refused;
+
+    for (p = value; p < end; ) {
+	while (p < end && (isspace((int)*p) || *p == ','))
+	    p++;
+	for (name = p; p < end && *p != ',' && *p != ';' && !isspace((int)*p); p++)
+	    ;
+	namelen = p - name;
+
+	/* optional parameters - only the quality value is of interest */
+	refused = 0;
+	while (p < end && *p != ',') {
+	    if (*p == ';') {
+		for (q = p + 1; q < end && isspace((int)*q); q++)
+		    ;
+		if (end - q > 2 && (*q == 'q' || *q == 'Q') && q[1] == '=')
+		    refused = (strtod(q + 2, NULL) <= 0.0);
+	    }
+	    p++;
+	}
+	if (namelen == 0 || refused)
+	    continue;
+	if (namelen == 1 && *name == '*')
+	    accepted |= (HTTP_CODING_GZIP | HTTP_CODING_ZSTD);
+	else if ((coding = http_supported_coding(name, namelen)))
+	    accepted |= coding;
+    }
+    return accepted & (preferred[0] | preferred[1]);
+}
+
+http_coding
+http_select_encoding(http_coding accepted, size_t length)
+{
+    int			i;
+
+    if (!compress_enabled || accepted == 0 || length < compress_minsize)
+	return HTTP_CODING_IDENTITY;
+    for (i = 0; i < MAX_CODINGS && preferred[i]; i++)
+	if (accepted & preferred[i])
+	    return preferred[i];
+    return HTTP_CODING_IDENTITY;
+}
+
+struct http_encoder *
+http_encoder_create(http_coding coding)
+{
+    struct http_encoder	*encoder;
+
+    if ((encoder = calloc(1, sizeof(struct http_encoder))) == NULL)
+	return NULL;
+    encoder->coding = coding;
+
+    switch (coding) {
+#ifdef HAVE_ZLIB
+    case HTTP_CODING_GZIP:
+	/* windowBits of 15 plus 16 requests a gzip header and trailer */
+	if (deflateInit2(&encoder->gzip, Z_DEFAULT_COMPRESSION,
+			Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	    goto fail;
+	break;
+#endif
+#ifdef HAVE_ZSTD
+    case HTTP_CODING_ZSTD:
+	if ((encoder->zstd = ZSTD_createCCtx()) == NULL)
+	    goto fail;
+	ZSTD_CCtx_setParameter(encoder->zstd, ZSTD_c_compressionLevel,
+			ZSTD_CLEVEL_DEFAULT);
+	break;
+#endif
+    default:
+	goto fail;
+    }
+
+    if (compress_values[COMPRESS_RESPONSES])
+	mmv_inc_value(compress_map, compress_values[COMPRESS_RESPONSES], 1);
+    return encoder;
+
+fail:
+    free(encoder);
+    return NULL;
+}
+
+#ifdef HAVE_ZLIB
+static sds
+gzip_update(struct http_encoder *encoder, const char *data, size_t length, int finish)
+{
+    z_stream		*stream = &encoder->gzip;
+    size_t		space = length / 2 + 64;
+    sds			output = sdsempty();
+    int			sts;
+
+    stream->next_in = (Bytef *)data;
+    stream->avail_in = length;
+    do {
+	output = sdsMakeRoomFor(output, space);
+	stream->next_out = (Bytef *)output + sdslen(output);
+	stream->avail_out = sdsavail(output);
+	sts = deflate(stream, finish ? Z_FINISH : Z_SYNC_FLUSH);
+	sdsIncrLen(output, sdsavail(output) - stream->avail_out);
+	if (sts == Z_STREAM_ERROR)
+	    break;
+	space *= 2;
+    } while (stream->avail_out == 0 || (finish && sts != Z_STREAM_END));
+    return output;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static sds
+zstd_update(struct http_encoder *encoder, const char *data, size_t length, int finish)
+{
+    ZSTD_inBuffer	input = { data, length, 0 };
+    ZSTD_outBuffer	out;
+    size_t		space = ZSTD_CStreamOutSize();
+    size_t		remaining;
+    sds			output = sdsempty();
+
+    do {
+	output = sdsMakeRoomFor(output, space);
+	out.dst = output + sdslen(output);
+	out.size = sdsavail(output);
+	out.pos = 0;
+	remaining = ZSTD_compressStream2(encoder->zstd, &out, &input,
+				finish ? ZSTD_e_end : ZSTD_e_flush);
+	sdsIncrLen(output, out.pos);
+	if (ZSTD_isError(remaining))
+	    break;
+    } while (remaining != 0 || input.pos < input.size);
+    return output;
+}
+#endif
+
+sds
+http_encoder_update(struct http_encoder *encoder, const char *data,
+		size_t length, int finish)
+{
+    uint64_t		start = uv_hrtime();
+    sds			output;
+
+    switch (encoder->coding) {
+#ifdef HAVE_ZLIB
+    case HTTP_CODING_GZIP:
+	output = gzip_update(encoder, data, length, finish);
+	break;
+#endif
+#ifdef HAVE_ZSTD
+    case HTTP_CODING_ZSTD:
+	output = zstd_update(encoder, data, length, finish);
+	break;
+#endif
+    default:
+	return sdsnewlen(data, length);
+    }
+
+    if (compress_values[COMPRESS_BYTES_IN])
+	mmv_inc_value(compress_map, compress_values[COMPRESS_BYTES_IN], length);
+    if (compress_values[COMPRESS_BYTES_OUT])
+	mmv_inc_value(compress_map, compress_values[COMPRESS_BYTES_OUT], sdslen(output));
+    if (compress_values[COMPRESS_TIME])
+	mmv_inc_value(compress_map, compress_values[COMPRESS_TIME],
+			(uv_hrtime() - start) / 1000);
+    return output;
+}
+
+void
+http_encoder_free(struct http_encoder *encoder)
+{
+    if (encoder == NULL)
+	return;
+#ifdef HAVE_ZLIB
+    if (encoder->coding == HTTP_CODING_GZIP)
+	deflateEnd(&encoder->gzip);
+#endif
+#ifdef HAVE_ZSTD
+    if (encoder->coding == HTTP_CODING_ZSTD)
+	ZSTD_freeCCtx(encoder->zstd);
+#endif
+    free(encoder);
+}
+
+static void
+compress_metrics(struct proxy *proxy)
+{
+    mmv_registry_t	*registry = proxymetrics(proxy, METRICS_HTTP);
+    pmUnits		units_count = MMV_UNITS(0, 0, 1, 0, 0, PM_COUNT_ONE);
+    pmUnits		units_bytes = MMV_UNITS(1, 0, 0, PM_SPACE_BYTE, 0, 0);
+    pmUnits		units_usec = MMV_UNITS(0, 1, 0, 0, PM_TIME_USEC, 0);
+    pmInDom		noindom = MMV_INDOM_NULL;
+
+    if (registry == NULL)
+	return;
+
+    mmv_stats_add_metric(registry, "compress.responses", 1,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_count, noindom,
+	"compressed HTTP responses",
+	"Number of HTTP response bodies sent with a compressed content coding");
+    mmv_stats_add_metric(registry, "compress.bytes_in", 2,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_bytes, noindom,
+	"HTTP response bytes before compression",
+	"Total size of HTTP response bodies passed to compression encoders.\n"
+	"The compression ratio is compress.bytes_in / compress.bytes_out.");
+    mmv_stats_add_metric(registry, "compress.bytes_out", 3,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_bytes, noindom,
+	"HTTP response bytes after compression",
+	"Total size of compressed HTTP response bodies sent to clients");
+    mmv_stats_add_metric(registry, "compress.time", 4,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_usec, noindom,
+	"time spent compressing HTTP responses",
+	"Total (elapsed, CPU-bound) time spent in HTTP response encoders");
+
+    if ((compress_map = mmv_stats_start(registry)) == NULL)
+	return;
+    compress_values[COMPRESS_RESPONSES] = mmv_lookup_value_desc(compress_map, "compress.responses", NULL);
+    compress_values[COMPRESS_BYTES_IN] = mmv_lookup_value_desc(compress_map, "compress.bytes_in", NULL);
+    compress_values[COMPRESS_BYTES_OUT] = mmv_lookup_value_desc(compress_map, "compress.bytes_out", NULL);
+    compress_values[COMPRESS_TIME] = mmv_lookup_value_desc(compress_map, "compress.time", NULL);
+}
+
+void
+http_compress_setup(struct proxy *proxy)
+{
+    http_coding		coding;
+    sds			option, *names;
+    int			i, n, count = 0;
+
+    compress_enabled = 1;
+    if ((option = pmIniFileLookup(proxy->config, "pmproxy", "compress.enabled")))
+	compress_enabled = (strcmp(option, "true") == 0);
+
+    compress_minsize = 1024;
+    if ((option = pmIniFileLookup(proxy->config, "pmproxy", "compress.minsize")))
+	compress_minsize = strtoul(option, NULL, 0);
+
+    memset(preferred, 0, sizeof(preferred));
+    if ((option = pmIniFileLookup(proxy->config, "pmproxy", "compress.encodings"))) {
+	names = sdssplitlen(option, sdslen(option), ",", 1, &n);
+	for (i = 0; names && i < n; i++) {
+	    names[i] = sdstrim(names[i], " ");
+	    coding = http_supported_coding(names[i], sdslen(names[i]));
+	    if (coding && count < MAX_CODINGS &&
+		coding != preferred[0] && coding != preferred[1])
+		preferred[count++] = coding;
+	}
+	sdsfreesplitres(names, n);
+    } else {
+#ifdef HAVE_ZSTD
+	preferred[count++] = HTTP_CODING_ZSTD;
+#endif
+#ifdef HAVE_ZLIB
+	preferred[count++] = HTTP_CODING_GZIP;
+#endif
+    }
+    if (count == 0)
+	compress_enabled = 0;
+
+    if (compress_enabled)
+	compress_metrics(proxy);
+}
+
+void
+http_compress_close(struct proxy *proxy)
+{
+    (void)proxy;
+    compress_map = NULL;
+    memset(compress_values, 0, sizeof(compress_values));
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#ifndef PMPROXY_COMPRESS_H
+#define PMPROXY_COMPRESS_H
+
+#include "sds.h"
+
+struct proxy;
+struct http_encoder;
+
+/* HTTP response content codings (Accept-Encoding, Content-Encoding) */
+typedef enum http_coding {
+    HTTP_CODING_IDENTITY	= 0,
+    HTTP_CODING_GZIP		= (1<<0),
+    HTTP_CODING_ZSTD		= (1<<1),
+} http_coding;
+
+extern void http_compress_setup(struct proxy *);
+extern void http_compress_close(struct proxy *);
+
+/* parse an Accept-Encoding request header, return supported codings */
+extern http_coding http_accept_encoding(const char *, size_t);
+
+/* select the preferred coding for a response body of given length */
+extern http_coding http_select_encoding(http_coding, size_t);
+extern const char *http_coding_name(http_coding);
+extern int http_compress_enabled(void);
+
+/*
+ * Streaming encoder - each call compresses the given data and returns
+ * the (flushed) compressed form, completing the stream when finishing.
+ */
+extern struct http_encoder *http_encoder_create(http_coding);
+extern sds http_encoder_update(struct http_encoder *, const char *, size_t, int);
+extern void http_encoder_free(struct http_encoder *);
+
+#endif	/* PMPROXY_COMPRESS_H */
@@ -14,13 +14,19 @@
 #include <ctype.h>
 #include <assert.h>
 #include "server.h"
+#include "compress.h"
 #include "encoding.h"
 #include "dict.h"
 #include "util.h"
 
 static int chunked_transfer_size; /* pmproxy.chunksize, pagesize by default */
+static size_t maximum_write_backlog; /* pmproxy.maxbacklog, 1MB by default */
 static int smallest_buffer_size = 128;
 
+static unsigned int keepalive_timeout; /* pmproxy.keepalive.timeout (msec) */
+static unsigned int keepalive_requests; /* pmproxy.keepalive.requests */
+static uv_timer_t keepalive_timer;	/* idle HTTP connection reaper */
+
 /* https://tools.ietf.org/html/rfc7230#section-3.1.1 */
 #define MAX_URL_SIZE	8192
 #define MAX_PARAMS_SIZE 8000
@@ -228,6 +234,18 @@ http_set_buffer(struct client *client, sds buffer, http_flags flags)
     client->buffer = buffer;
 }
 
+/*
+ * Whether the connection remains open after the current response - honour
+ * the client request and also the limit on requests per connection.
+ */
+static int
+http_keep_alive(struct client *client)
+{
+    if (keepalive_requests && client->u.http.requests >= keepalive_requests)
+	return 0;
+    return http_should_keep_alive(&client->u.http.parser);
+}
+
 static sds
 http_response_header(struct client *client, unsigned int length, http_code sts, http_flags flags)
 {
@@ -240,9 +258,10 @@ http_response_header(struct client *client, unsigned int length, http_code sts,
 
     header = sdscatfmt(sdsempty(),
 		"HTTP/%u.%u %u %s\r\n"
-		"%S: Keep-Alive\r\n",
+		"%S: %s\r\n",
 		parser->http_major, parser->http_minor,
-		sts, http_status_mapping(sts), HEADER_CONNECTION);
+		sts, http_status_mapping(sts), HEADER_CONNECTION,
+		http_keep_alive(client) ? "Keep-Alive" : "close");
     header = sdscatfmt(header,
 		"%S: *\r\n"
 		"%S: %S\r\n"
@@ -264,6 +283,11 @@ http_response_header(struct client *client, unsigned int length, http_code sts,
 
     header = sdscatfmt(header, "Content-Type: %s%s\r\n",
 		http_content_type(flags), http_content_encoding(flags));
+    if (flags & HTTP_FLAG_COMPRESS)
+	header = sdscatfmt(header, "Content-Encoding: %s\r\n",
+		http_coding_name(client->u.http.coding));
+    if (http_compress_enabled())
+	header = sdscatfmt(header, "Vary: Accept-Encoding\r\n");
     header = sdscatfmt(header, "Date: %s\r\n\r\n",
 		http_date_string(time(NULL), date, sizeof(date)));
 
@@ -423,10 +447,28 @@ http_reply(struct client *client, sds message,
 		http_code sts, http_flags type, http_options options)
 {
     http_flags		flags = client->u.http.flags;
+    http_coding		coding;
+    struct http_encoder	*encoder;
     char		length[32]; /* hex length */
     sds			buffer, suffix;
 
     if (flags & HTTP_FLAG_STREAMING) {
+	if (client->u.http.encoder) {
+	    /* compress remaining data, completing the encoded stream */
+	    if (client->buffer == NULL)
+		client->buffer = message ? message : sdsempty();
+	    else if (message != NULL)
+		client->buffer = sdscatsds(client->buffer, message);
+	    if (message != client->buffer)
+		sdsfree(message);
+	    message = http_encoder_update(client->u.http.encoder,
+			client->buffer, sdslen(client->buffer), 1);
+	    sdsfree(client->buffer);
+	    client->buffer = NULL;
+	    http_encoder_free(client->u.http.encoder);
+	    client->u.http.encoder = NULL;
+	}
+
 	buffer = sdsempty();
 	if (client->buffer == NULL) {	/* no data currently accumulated */
 	    pmsprintf(length, sizeof(length), "%lX", (unsigned long)sdslen(message));
@@ -463,6 +505,16 @@ http_reply(struct client *client, sds message,
 	} else {
 	    suffix = sdsempty();
 	}
+	coding = http_select_encoding(client->u.http.accept, sdslen(suffix));
+	if (coding != HTTP_CODING_IDENTITY &&
+	    (encoder = http_encoder_create(coding)) != NULL) {
+	    message = http_encoder_update(encoder, suffix, sdslen(suffix), 1);
+	    http_encoder_free(encoder);
+	    sdsfree(suffix);
+	    suffix = message;
+	    client->u.http.coding = coding;
+	    type |= HTTP_FLAG_COMPRESS;
+	}
 	buffer = http_response_header(client, sdslen(suffix), sts, type);
     }
 
@@ -471,7 +523,7 @@ http_reply(struct client *client, sds message,
 			http_method_str(client->u.http.parser.method),
 			client, buffer, suffix ? suffix : "");
 
-    client_write(client, buffer, suffix);
+    client_write_final(client, buffer, suffix);
 }
 
 void
@@ -512,6 +564,7 @@ http_transfer(struct client *client)
 {
     struct http_parser	*parser = &client->u.http.parser;
     http_flags		flags = client->u.http.flags;
+    http_coding		coding;
     const char		*method;
     sds			buffer, suffix;
 
@@ -525,12 +578,26 @@ http_transfer(struct client *client)
 	    if (!(flags & HTTP_FLAG_STREAMING)) {
 		/* send headers (no content length) and initial content */
 		flags |= HTTP_FLAG_STREAMING;
+		coding = http_select_encoding(client->u.http.accept,
+					sdslen(client->buffer));
+		if (coding != HTTP_CODING_IDENTITY &&
+		    (client->u.http.encoder = http_encoder_create(coding))) {
+		    client->u.http.coding = coding;
+		    flags |= HTTP_FLAG_COMPRESS;
+		}
 		buffer = http_response_header(client, 0, HTTP_STATUS_OK, flags);
 		client->u.http.flags = flags;
 	    } else {
 		/* headers already sent, send the next chunk of content */
 		buffer = sdsempty();
 	    }
+	    if (client->u.http.encoder) {
+		/* compress and flush this chunk of content */
+		suffix = http_encoder_update(client->u.http.encoder,
+			client->buffer, sdslen(client->buffer), 0);
+		sdsfree(client->buffer);
+		client->buffer = suffix;
+	    }
 	    /* prepend a chunked transfer encoding message length (hex) */
 	    buffer = sdscatprintf(buffer, "%lX\r\n",
 				 (unsigned long)sdslen(client->buffer));
@@ -566,6 +633,13 @@ http_client_release(struct client *client)
     client->u.http.privdata = NULL;
     client->u.http.servlet = NULL;
     client->u.http.flags = 0;
+    client->u.http.accept = 0;
+    client->u.http.coding = 0;
+
+    if (client->u.http.encoder) {
+	http_encoder_free(client->u.http.encoder);
+	client->u.http.encoder = NULL;
+    }
 
     if (client->u.http.headers) {
 	dictRelease(client->u.http.headers);
@@ -587,6 +661,10 @@ http_client_release(struct client *client)
 	sdsfree(client->u.http.realm);
 	client->u.http.realm = NULL;
     }
+    if (client->u.http.url) {
+	sdsfree(client->u.http.url);
+	client->u.http.url = NULL;
+    }
 }
 
 static int
@@ -738,7 +816,8 @@ on_url(http_parser *request, const char *offset, size_t length)
 	http_error(client, sts, "request URL too long");
     }
     /* pass to servlets handling each of our internal request endpoints */
-    else if ((servlet = servlet_lookup(client, offset, length)) != NULL) {
+    else if ((client->u.http.url = sdsnewlen(offset, length)) != NULL &&
+	     (servlet = servlet_lookup(client, offset, length)) != NULL) {
 	client->u.http.servlet = servlet;
 	if ((sts = client->u.http.parser.status_code) != 0)
 	    http_error(client, sts, "failed to process URL");
@@ -830,6 +909,10 @@ on_header_value(http_parser *request, const char *offset, size_t length)
     dictSetVal(client->u.http.headers, entry, value);
     field = (sds)dictGetKey(entry);
 
+    /* response compression for all servlets */
+    if (strcasecmp(field, "Accept-Encoding") == 0)
+	client->u.http.accept = http_accept_encoding(value, sdslen(value));
+
     /* HTTP Basic Auth for all servlets */
     if (strncmp(field, "Authorization", 14) == 0 &&
 	strncmp(value, "Basic ", 6) == 0) {
@@ -911,21 +994,31 @@ on_message_complete(http_parser *request)
     if (pmDebugOptions.http)
 	fprintf(stderr, "HTTP message complete (client=%p)\n", client);
 
+    client->u.http.requests++;
+
     if (servlet) {
-	if (servlet->on_done)
+	if (servlet->on_done) {
+	    /*
+	     * Stop parsing any further (pipelined) requests until the
+	     * response to this one has been sent, resuming from the
+	     * on_http_client_write callback for its final write.
+	     */
+	    client->u.http.inflight = 1;
+	    http_parser_pause(request, 1);
 	    return servlet->on_done(client);
+	}
 	return 0;
     }
 
     sts = HTTP_STATUS_OK;
     if (client->u.http.parser.method == HTTP_OPTIONS) {
 	buffer = http_response_access(client, sts, HTTP_SERVER_OPTIONS);
-	client_write(client, buffer, NULL);
+	client_write_final(client, buffer, NULL);
 	return 0;
     }
     if (client->u.http.parser.method == HTTP_TRACE) {
 	buffer = http_response_trace(client, sts);
-	client_write(client, buffer, NULL);
+	client_write_final(client, buffer, NULL);
 	return 0;
     }
 
@@ -939,18 +1032,67 @@ on_http_client_close(struct client *client)
 	fprintf(stderr, "HTTP client close (client=%p)\n", client);
 
     http_client_release(client);
+    sdsfree(client->u.http.pipeline);
     memset(&client->u.http, 0, sizeof(client->u.http));
 }
 
+/*
+ * Report whether response data is being produced faster than this client
+ * is consuming it - servlets streaming large responses use this to pause
+ * until their on_drain callback indicates the write backlog has cleared.
+ */
+int
+http_write_backlog(struct client *client)
+{
+    size_t		pending;
+
+    if (client_is_closed(client))
+	return 0;
+    uv_mutex_lock(&client->mutex);
+    pending = client->pending;
+    uv_mutex_unlock(&client->mutex);
+    if (client->buffer)
+	pending += sdslen(client->buffer);
+    return pending >= maximum_write_backlog;
+}
+
+static void http_pipeline_resume(struct client *);
+
 void
-on_http_client_write(struct client *client)
+on_http_client_write(struct client *client, int final)
 {
+    struct servlet	*servlet;
+    size_t		pending;
+
     if (pmDebugOptions.http)
-	fprintf(stderr, "%s: client %p\n", "on_http_client_write", client);
+	fprintf(stderr, "%s: client %p%s\n", "on_http_client_write",
+			client, final ? " (final)" : "");
+
+    if (final) {
+	/* response sent, close connection if required */
+	if (http_keep_alive(client) == 0) {
+	    client_close(client);
+	    return;
+	}
+	client->u.http.lastused = uv_now(client->proxy->events);
 
-    /* write has been submitted now, close connection if required */
-    if (http_should_keep_alive(&client->u.http.parser) == 0)
-	client_close(client);
+	/* move onto any requests pipelined behind this response */
+	if (client->u.http.inflight) {
+	    client->u.http.inflight = 0;
+	    http_pipeline_resume(client);
+	}
+	return;
+    }
+
+    /* let a throttled response continue once the backlog has drained */
+    servlet = client->u.http.servlet;
+    if (servlet && servlet->on_drain && client->u.http.data) {
+	uv_mutex_lock(&client->mutex);
+	pending = client->pending;
+	uv_mutex_unlock(&client->mutex);
+	if (pending <= maximum_write_backlog / 2)
+	    servlet->on_drain(client);
+    }
 }
 
 static const http_parser_settings settings = {
@@ -963,12 +1105,53 @@ static const http_parser_settings settings = {
     .on_message_complete	= on_message_complete,
 };
 
+static void
+http_parse(struct client *client, const char *base, size_t length)
+{
+    http_parser		*parser = &client->u.http.parser;
+    size_t		bytes;
+
+    bytes = http_parser_execute(parser, &settings, base, length);
+    if (HTTP_PARSER_ERRNO(parser) == HPE_PAUSED) {
+	/* request in progress - hold any pipelined requests following it */
+	if (bytes < length) {
+	    if (client->u.http.pipeline == NULL)
+		client->u.http.pipeline = sdsempty();
+	    client->u.http.pipeline = sdscatlen(client->u.http.pipeline,
+					base + bytes, length - bytes);
+	}
+    } else if (pmDebugOptions.http && bytes != length) {
+	fprintf(stderr, "Error: %s (%s)\n",
+		http_errno_description(HTTP_PARSER_ERRNO(parser)),
+		http_errno_name(HTTP_PARSER_ERRNO(parser)));
+    }
+}
+
+static void
+http_pipeline_resume(struct client *client)
+{
+    sds			pipeline = client->u.http.pipeline;
+
+    /* parser may instead have failed on the request just completed */
+    if (HTTP_PARSER_ERRNO(&client->u.http.parser) == HPE_PAUSED)
+	http_parser_pause(&client->u.http.parser, 0);
+    if (pipeline == NULL)
+	return;
+    client->u.http.pipeline = NULL;
+
+    if (pmDebugOptions.http)
+	fprintf(stderr, "%s: %lu pipelined bytes from HTTP client %p\n",
+		"http_pipeline_resume", (unsigned long)sdslen(pipeline), client);
+
+    http_parse(client, pipeline, sdslen(pipeline));
+    sdsfree(pipeline);
+}
+
 void
 on_http_client_read(struct proxy *proxy, struct client *client,
 		ssize_t nread, const uv_buf_t *buf)
 {
     http_parser		*parser = &client->u.http.parser;
-    size_t		bytes;
 
     if (pmDebugOptions.http || pmDebugOptions.query)
 	fprintf(stderr, "%s: %lld bytes from HTTP client %p\n%.*s",
@@ -977,6 +1160,7 @@ on_http_client_read(struct proxy *proxy, struct client *client,
 
     if (nread <= 0)
 	return;
+    client->u.http.lastused = uv_now(proxy->events);
 
     /* first time setup for this request */
     if (parser->data == NULL) {
@@ -984,12 +1168,55 @@ on_http_client_read(struct proxy *proxy, struct client *client,
 	http_parser_init(parser, HTTP_REQUEST);
     }
 
-    bytes = http_parser_execute(parser, &settings, buf->base, nread);
-    if (pmDebugOptions.http && bytes != nread) {
-	fprintf(stderr, "Error: %s (%s)\n",
-		http_errno_description(HTTP_PARSER_ERRNO(parser)),
-		http_errno_name(HTTP_PARSER_ERRNO(parser)));
+    /* earlier request still in progress, queue until it has completed */
+    if (client->u.http.inflight) {
+	if (client->u.http.pipeline == NULL)
+	    client->u.http.pipeline = sdsempty();
+	client->u.http.pipeline = sdscatlen(client->u.http.pipeline,
+					buf->base, nread);
+	if (sdslen(client->u.http.pipeline) > maximum_write_backlog) {
+	    if (pmDebugOptions.http)
+		fprintf(stderr, "%s: pipeline limit exceeded by client %p\n",
+			"on_http_client_read", client);
+	    client_close(client);
+	}
+	return;
     }
+
+    http_parse(client, buf->base, nread);
+}
+
+/*
+ * Close HTTP connections idle beyond the keep-alive timeout, i.e. with
+ * no request in progress, no response data pending and no recent reads.
+ */
+static void
+http_keepalive_sweep(uv_timer_t *arg)
+{
+    uv_handle_t		*handle = (uv_handle_t *)arg;
+    struct proxy	*proxy = (struct proxy *)handle->data;
+    struct client	*client;
+    uint64_t		now = uv_now(proxy->events);
+    size_t		pending;
+
+    uv_mutex_lock(&proxy->mutex);
+    for (client = proxy->first; client != NULL; client = client->next) {
+	if (!(client->protocol & STREAM_HTTP) || client_is_closed(client))
+	    continue;
+	if (client->u.http.inflight ||
+	    now - client->u.http.lastused < keepalive_timeout)
+	    continue;
+	uv_mutex_lock(&client->mutex);
+	pending = client->pending;
+	uv_mutex_unlock(&client->mutex);
+	if (pending)
+	    continue;
+	if (pmDebugOptions.http)
+	    fprintf(stderr, "%s: closing idle HTTP client %p\n",
+			"http_keepalive_sweep", client);
+	client_close(client);
+    }
+    uv_mutex_unlock(&proxy->mutex);
 }
 
 static void
@@ -1028,6 +1255,29 @@ setup_http_module(struct proxy *proxy)
     if (chunked_transfer_size < smallest_buffer_size)
 	chunked_transfer_size = smallest_buffer_size;
 
+    if ((option = pmIniFileLookup(config, "pmproxy", "maxbacklog")) != NULL)
+	maximum_write_backlog = strtoul(option, NULL, 0);
+    else
+	maximum_write_backlog = 1024 * 1024;
+    if (maximum_write_backlog < (size_t)chunked_transfer_size)
+	maximum_write_backlog = chunked_transfer_size;
+
+    if ((option = pmIniFileLookup(config, "pmproxy", "keepalive.timeout")))
+	keepalive_timeout = strtoul(option, NULL, 0) * 1000;
+    else
+	keepalive_timeout = 300 * 1000;
+    if ((option = pmIniFileLookup(config, "pmproxy", "keepalive.requests")))
+	keepalive_requests = strtoul(option, NULL, 0);
+    else
+	keepalive_requests = 0;
+
+    if (keepalive_timeout) {
+	uv_timer_init(proxy->events, &keepalive_timer);
+	keepalive_timer.data = (void *)proxy;
+	uv_timer_start(&keepalive_timer, http_keepalive_sweep,
+			keepalive_timeout / 2, keepalive_timeout / 2);
+    }
+
     HEADER_ACCESS_CONTROL_REQUEST_HEADERS = sdsnew("Access-Control-Request-Headers");
     HEADER_ACCESS_CONTROL_REQUEST_METHOD = sdsnew("Access-Control-Request-Method");
     HEADER_ACCESS_CONTROL_ALLOW_METHODS = sdsnew("Access-Control-Allow-Methods");
@@ -1040,9 +1290,12 @@ setup_http_module(struct proxy *proxy)
     HEADER_ORIGIN = sdsnew("Origin");
     HEADER_WWW_AUTHENTICATE = sdsnew("WWW-Authenticate");
 
+    http_compress_setup(proxy);
+
     register_servlet(proxy, &pmsearch_servlet);
     register_servlet(proxy, &pmseries_servlet);
     register_servlet(proxy, &pmwebapi_servlet);
+    register_servlet(proxy, &pmremote_servlet);
 }
 
 void
@@ -1053,6 +1306,12 @@ close_http_module(struct proxy *proxy)
     for (servlet = proxy->servlets; servlet != NULL; servlet = servlet->next)
 	servlet->close(proxy);
 
+    if (keepalive_timeout) {
+	uv_timer_stop(&keepalive_timer);
+	uv_close((uv_handle_t *)&keepalive_timer, NULL);
+    }
+
+    http_compress_close(proxy);
     proxymetrics_close(proxy, METRICS_HTTP);
 
     sdsfree(HEADER_ACCESS_CONTROL_REQUEST_HEADERS);
@@ -70,6 +70,7 @@ extern const char *http_content_type(http_flags);
 
 extern sds http_get_buffer(struct client *);
 extern void http_set_buffer(struct client *, sds, http_flags);
+extern int http_write_backlog(struct client *);
 
 typedef void (*httpSetupCallBack)(struct proxy *);
 typedef void (*httpCloseCallBack)(struct proxy *);
@@ -78,6 +79,7 @@ typedef int (*httpUrlCallBack)(struct client *, sds, struct dict *);
 typedef int (*httpBodyCallBack)(struct client *, const char *, size_t);
 typedef int (*httpDoneCallBack)(struct client *);
 typedef void (*httpReleaseCallBack)(struct client *);
+typedef void (*httpDrainCallBack)(struct client *);
 
 typedef struct servlet {
     const char * const	name;
@@ -89,8 +91,10 @@ typedef struct servlet {
     httpBodyCallBack	on_body;
     httpDoneCallBack	on_done;
     httpReleaseCallBack	on_release;
+    httpDrainCallBack	on_drain;	/* write backlog cleared (optional) */
 } servlet;
 
+extern struct servlet pmremote_servlet;
 extern struct servlet pmsearch_servlet;
 extern struct servlet pmseries_servlet;
 extern struct servlet pmwebapi_servlet;
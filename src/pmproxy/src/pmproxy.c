@@ -31,6 +31,7 @@
 static void	*info;			/* opaque server information */
 static pmproxy	*server;		/* proxy server implementation */
 struct dict	*config;		/* configuration file settings */
+char		**restart_argv;		/* arguments for restarting workers */
 
 static char	*logfile = "pmproxy.log";	/* log file name */
 static int	run_mode = RUN_DAEMON;	/* style of execution, see -f and -F */
@@ -344,6 +345,7 @@ main(int argc, char *argv[])
     int		maxpending = MAXPENDING;
     int		env_warn = 0;
     int		timeseries;
+    int		worker;
     char	*envstr;
     pid_t	mainpid;
 
@@ -368,7 +370,11 @@ main(int argc, char *argv[])
     }
     timeseries = ParseOptions(argc, argv, &nport, &maxpending);
 
-    if (pmDebugOptions.appl1) {
+    /* restarted worker processes share the main process log and identity */
+    restart_argv = argv;
+    worker = (getenv("PMPROXY_WORKER") != NULL);
+
+    if (pmDebugOptions.appl1 && !worker) {
 	/*
 	 * -Dappl1 is desperate logging mode ... insert .<pid> into
 	 * the logfile name, just before the last ., so pmproxy.log
@@ -401,7 +407,7 @@ main(int argc, char *argv[])
 	}
 	pmOpenLog(pmGetProgname(), newlogfile, stderr, &sts);
     }
-    else
+    else if (!worker)
 	pmOpenLog(pmGetProgname(), logfile, stderr, &sts);
 
     /* close old stdout, and force stdout into same stream as stderr */
@@ -422,7 +428,7 @@ main(int argc, char *argv[])
     /* Advertise the service on the network if that is supported */
     __pmServerSetServiceSpec(PM_SERVER_PROXY_SPEC);
 
-    if (run_mode == RUN_DAEMON) {
+    if (run_mode == RUN_DAEMON && !worker) {
 	/* daemonize - fork and parent exits, setsid */
 	__pmServerStart(argc, argv, 1);
     }
@@ -442,7 +448,7 @@ main(int argc, char *argv[])
 	fprintf(stderr, "%s: maxpending=%d from PMPROXY_MAXPENDING=%s in environment\n",
 			"Warning", maxpending, getenv("PMPROXY_MAXPENDING"));
 
-    if (run_mode == RUN_DAEMON || run_mode == RUN_SYSTEMD) {
+    if (!worker && (run_mode == RUN_DAEMON || run_mode == RUN_SYSTEMD)) {
 	/* notify service manager, if any, we are ready */
 	__pmServerNotifyServiceManagerReady(mainpid);
 	if (__pmServerCreatePIDFile(PM_SERVER_PROXY_SPEC, PM_FATAL_ERR) < 0)
@@ -34,5 +34,6 @@ extern void *GetServerInfo(void);
 extern void Shutdown(void);
 
 extern struct dict *config;
+extern char **restart_argv;
 
 #endif /* PMPROXY_H */
@@ -166,6 +166,7 @@ on_redis_connected(void *arg)
 	pmDiscoverSetEventLoop(&redis_discover.module, proxy->events);
 	pmDiscoverSetConfiguration(&redis_discover.module, proxy->config);
 	pmDiscoverSetMetricRegistry(&redis_discover.module, discover_metric_registry);
+	pmDiscoverSetShard(&redis_discover.module, proxy->worker, proxy->nworkers);
 	pmDiscoverSetup(&redis_discover.module, &redis_discover.callbacks, proxy);
 	pmDiscoverSetSlots(&redis_discover.module, proxy->slots);
     }
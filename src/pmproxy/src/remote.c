@@ -0,0 +1,979 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#include <ctype.h>
+#include <limits.h>
+#include "server.h"
+#include "encoding.h"
+#include "util.h"
+
+/*
+ * Prometheus remote-write receiver.  Requests are snappy-compressed
+ * (block format) protobuf WriteRequest messages, each a batch of time
+ * series made up of labels and samples.  Series are grouped by their
+ * job and instance labels into sources, and written into the key server
+ * through the time series load interfaces (pmSeriesPushSamples) using
+ * the naming conventions of pmdaopenmetrics(1).
+ *
+ * Requests are decoded on a worker thread (uv_queue_work), as decoded
+ * messages can be large, then written from the event loop - the reply
+ * is sent once all writes for the request have been answered.
+ */
+#define DEFAULT_MAXSIZE		(16 * 1024 * 1024)
+#define DEFAULT_BACKLOG		100000
+#define MAX_DECODED		(256 * 1024 * 1024)
+#define MAX_EXPANSION		32	/* above best case snappy ratio (~21x) */
+#define MAX_FAMILIES		(1 << 16)	/* counter metric families */
+
+typedef enum remoteMetric {
+    REMOTE_REQUESTS,
+    REMOTE_SAMPLES,
+    REMOTE_DROPPED,
+    REMOTE_ERRORS,
+    REMOTE_REJECTED,
+    NUM_REMOTE_METRICS
+} remoteMetric;
+
+typedef struct remoteBaton {
+    struct client	*client;
+    sds			body;		/* compressed WriteRequest message */
+    uv_work_t		work;		/* decoding off the event loop */
+    struct dict		*sources;	/* decoded series, by source name */
+    unsigned int	dropped;	/* samples dropped while decoding */
+    unsigned int	samples;	/* samples accepted for writing */
+    unsigned int	pending;	/* pushes with writes in progress */
+    int			error;
+} remoteBaton;
+
+typedef struct remoteSource {
+    pmSeriesPush	push;
+    unsigned int	size;		/* allocated series entries */
+} remoteSource;
+
+typedef struct protobuf {
+    const unsigned char	*p;
+    const unsigned char	*end;
+} protobuf;
+
+typedef struct prompair {
+    const char		*name;
+    size_t		namelen;
+    const char		*value;
+    size_t		valuelen;
+} prompair;
+
+static struct {
+    unsigned int	enabled;	/* pmseries.remote.enabled */
+    size_t		maxsize;	/* pmseries.remote.maxsize */
+    unsigned int	backlog;	/* pmseries.remote.backlog */
+    struct dict		*counters;	/* metric family names of counters */
+    uv_mutex_t		lock;		/* counters, from decoding threads */
+    struct proxy	*proxy;
+    void		*map;
+    pmAtomValue		*values[NUM_REMOTE_METRICS];
+} remote;
+
+static const char	remote_url[] = "/api/v1/write";
+
+/* OpenMetrics types from MetricMetadata messages with counter semantics */
+enum { METADATA_COUNTER = 1, METADATA_HISTOGRAM = 3, METADATA_SUMMARY = 5 };
+
+static void
+remote_metric_inc(remoteMetric metric, double value)
+{
+    if (remote.values[metric])
+	mmv_inc_value(remote.map, remote.values[metric], value);
+}
+
+/*
+ * Decode a snappy block format buffer - uncompressed length (varint)
+ * followed by a sequence of literal and back-reference copy elements.
+ */
+static sds
+snappy_decode(const unsigned char *p, size_t length)
+{
+    const unsigned char	*end = p + length;
+    unsigned long long	size = 0;
+    size_t		count, offset, used;
+    unsigned int	shift, tag;
+    sds			result;
+    char		*out;
+
+    for (shift = 0; p < end && shift < 64; shift += 7) {
+	size |= (unsigned long long)(*p & 0x7f) << shift;
+	if ((*p++ & 0x80) == 0)
+	    break;
+    }
+    /* trust the claimed length only as far as the input could expand */
+    if (shift >= 64 || size > MAX_DECODED || size > length * MAX_EXPANSION)
+	return NULL;
+    if ((result = sdsnewlen(NULL, size)) == NULL)
+	return NULL;
+    out = result;
+    used = 0;
+
+    while (p < end) {
+	tag = *p++;
+	switch (tag & 0x3) {
+	case 0:		/* literal */
+	    count = tag >> 2;
+	    if (count >= 60) {		/* length in the next 1-4 bytes */
+		shift = count - 59;
+		if ((size_t)(end - p) < shift)
+		    goto fail;
+		for (count = 0; shift > 0; shift--)
+		    count = (count << 8) | p[shift - 1];
+		p += (tag >> 2) - 59;
+	    }
+	    count++;
+	    if ((size_t)(end - p) < count || size - used < count)
+		goto fail;
+	    memcpy(out + used, p, count);
+	    p += count;
+	    used += count;
+	    continue;
+	case 1:		/* copy, 1 byte offset */
+	    if (end - p < 1)
+		goto fail;
+	    count = 4 + ((tag >> 2) & 0x7);
+	    offset = ((tag >> 5) << 8) | p[0];
+	    p += 1;
+	    break;
+	case 2:		/* copy, 2 byte offset */
+	    if (end - p < 2)
+		goto fail;
+	    count = (tag >> 2) + 1;
+	    offset = p[0] | (p[1] << 8);
+	    p += 2;
+	    break;
+	default:	/* copy, 4 byte offset */
+	    if (end - p < 4)
+		goto fail;
+	    count = (tag >> 2) + 1;
+	    offset = p[0] | (p[1] << 8) | (p[2] << 16) | ((size_t)p[3] << 24);
+	    p += 4;
+	    break;
+	}
+	if (offset == 0 || offset > used || size - used < count)
+	    goto fail;
+	/* byte-at-a-time as source and destination may overlap */
+	for (; count > 0; count--, used++)
+	    out[used] = out[used - offset];
+    }
+    if (used == size)
+	return result;
+fail:
+    sdsfree(result);
+    return NULL;
+}
+
+static int
+protobuf_varint(protobuf *pb, unsigned long long *value)
+{
+    unsigned int	shift;
+
+    *value = 0;
+    for (shift = 0; pb->p < pb->end && shift < 64; shift += 7) {
+	*value |= (unsigned long long)(*pb->p & 0x7f) << shift;
+	if ((*pb->p++ & 0x80) == 0)
+	    return 0;
+    }
+    return -EINVAL;
+}
+
+/*
+ * Extract the next field from a protobuf message - length-delimited
+ * fields are returned as a nested message, scalar values in value.
+ * Returns the field number, zero at the end of message or a negative
+ * error code for malformed messages.
+ */
+static int
+protobuf_field(protobuf *pb, protobuf *nested, unsigned long long *value)
+{
+    unsigned long long	key, length;
+    unsigned int	shift;
+
+    if (pb->p >= pb->end)
+	return 0;
+    if (protobuf_varint(pb, &key) < 0)
+	return -EINVAL;
+
+    nested->p = nested->end = NULL;
+    switch (key & 0x7) {
+    case 0:	/* varint */
+	if (protobuf_varint(pb, value) < 0)
+	    return -EINVAL;
+	break;
+    case 1:	/* 64-bit, little endian */
+	if (pb->end - pb->p < 8)
+	    return -EINVAL;
+	for (*value = 0, shift = 8; shift > 0; shift--)
+	    *value = (*value << 8) | pb->p[shift - 1];
+	pb->p += 8;
+	break;
+    case 2:	/* length-delimited */
+	if (protobuf_varint(pb, &length) < 0 ||
+	    length > (unsigned long long)(pb->end - pb->p))
+	    return -EINVAL;
+	nested->p = pb->p;
+	nested->end = pb->p + length;
+	pb->p += length;
+	break;
+    case 5:	/* 32-bit */
+	if (pb->end - pb->p < 4)
+	    return -EINVAL;
+	pb->p += 4;
+	break;
+    default:
+	return -EINVAL;
+    }
+    return (key >> 3) ? (int)(key >> 3) : -EINVAL;
+}
+
+/* MetricMetadata - type (1), metric_family_name (2), help (4), unit (5) */
+static int
+remote_metadata(protobuf *pb)
+{
+    protobuf		field;
+    unsigned long long	value, type = 0;
+    const char		*name = NULL;
+    size_t		length = 0;
+    sds			key;
+    int			sts;
+
+    while ((sts = protobuf_field(pb, &field, &value)) > 0) {
+	if (sts == 1)
+	    type = value;
+	else if (sts == 2 && field.p) {
+	    name = (const char *)field.p;
+	    length = field.end - field.p;
+	}
+    }
+    if (sts < 0)
+	return sts;
+    if (name == NULL || length == 0)
+	return 0;
+
+    /*
+     * Family names are chosen by clients, so only a bounded number are
+     * kept - beyond that, families without the counter suffix (_total)
+     * are stored with instantaneous semantics.
+     */
+    key = sdsnewlen(name, length);
+    uv_mutex_lock(&remote.lock);
+    if (type == METADATA_COUNTER || type == METADATA_HISTOGRAM ||
+	type == METADATA_SUMMARY) {
+	if (dictFind(remote.counters, key) == NULL &&
+	    dictSize(remote.counters) < MAX_FAMILIES)
+	    dictAdd(remote.counters, key, NULL);
+    } else {
+	dictDelete(remote.counters, key);
+    }
+    uv_mutex_unlock(&remote.lock);
+    sdsfree(key);
+    return 0;
+}
+
+static int
+remote_suffix(const char *name, size_t length, const char *suffix)
+{
+    size_t		bytes = strlen(suffix);
+
+    return length > bytes && strncmp(name + length - bytes, suffix, bytes) == 0;
+}
+
+static int
+remote_semantics(const char *name, size_t length)
+{
+    static const char	*suffixes[] = { "_bucket", "_count", "_sum" };
+    unsigned int	i;
+    size_t		bytes;
+    sds			family;
+    int			sts;
+
+    if (remote_suffix(name, length, "_total"))
+	return PM_SEM_COUNTER;
+
+    /* histogram and summary series are named from their family name */
+    family = sdsnewlen(name, length);
+    uv_mutex_lock(&remote.lock);
+    sts = (dictFind(remote.counters, family) != NULL);
+    for (i = 0; sts == 0 && i < sizeof(suffixes)/sizeof(suffixes[0]); i++) {
+	if (!remote_suffix(name, length, suffixes[i]))
+	    continue;
+	bytes = length - strlen(suffixes[i]);
+	family = sdscpylen(family, name, bytes);
+	sts = (dictFind(remote.counters, family) != NULL);
+    }
+    uv_mutex_unlock(&remote.lock);
+    sdsfree(family);
+    return sts ? PM_SEM_COUNTER : PM_SEM_INSTANT;
+}
+
+static sds
+remote_name_component(sds result, const char *name, size_t length)
+{
+    size_t		i, offset = sdslen(result);
+
+    result = sdscatlen(result, name, length);
+    for (i = offset; i < sdslen(result); i++) {
+	if (!isalnum((int)result[i]) && result[i] != '_')
+	    result[i] = '_';
+    }
+    return result;
+}
+
+/* metric names as for pmdaopenmetrics(1), with the job as the source */
+static sds
+remote_metric_name(const char *job, size_t joblen,
+		const char *name, size_t length)
+{
+    sds			result = sdsnew("openmetrics.");
+
+    if (joblen == 0)
+	result = sdscat(result, "remote");
+    else
+	result = remote_name_component(result, job, joblen);
+    result = sdscatlen(result, ".", 1);
+    return remote_name_component(result, name, length);
+}
+
+/* PCP label names begin with a letter, then alphanumerics and underscore */
+static int
+remote_label_name(const char *name, size_t length)
+{
+    size_t		i;
+
+    if (length == 0 || !isalpha((int)name[0]))
+	return 0;
+    for (i = 1; i < length; i++)
+	if (!isalnum((int)name[i]) && name[i] != '_')
+	    return 0;
+    return 1;
+}
+
+static remoteSource *
+remote_source(struct dict *sources, const prompair *job, const prompair *inst)
+{
+    remoteSource	*source;
+    const char		*host;
+    size_t		hostlen;
+    sds			key, value;
+
+    key = sdscatlen(sdsempty(), job ? job->value : "", job ? job->valuelen : 0);
+    key = sdscatlen(key, "/", 1);
+    if (inst)
+	key = sdscatlen(key, inst->value, inst->valuelen);
+    if ((source = dictFetchValue(sources, key)) != NULL) {
+	sdsfree(key);
+	return source;
+    }
+    if ((source = calloc(1, sizeof(remoteSource))) == NULL) {
+	sdsfree(key);
+	return NULL;
+    }
+    source->push.source = key;
+
+    /* hostname is the instance label without any port */
+    if (inst && inst->valuelen > 0) {
+	host = inst->value;
+	hostlen = inst->valuelen;
+	if (host[0] == '[' && memchr(host, ']', hostlen))
+	    hostlen = (const char *)memchr(host, ']', hostlen) - host + 1;
+	else if (memchr(host, ':', hostlen))
+	    hostlen = (const char *)memchr(host, ':', hostlen) - host;
+	source->push.hostname = sdsnewlen(host, hostlen);
+    } else {
+	source->push.hostname = sdsnew(job ? "remote" : "localhost");
+    }
+
+    value = unicode_encode(source->push.hostname,
+			sdslen(source->push.hostname));
+    source->push.labels = sdscatfmt(sdsempty(), "{\"hostname\":%S", value);
+    sdsfree(value);
+    if (inst) {
+	value = unicode_encode(inst->value, inst->valuelen);
+	source->push.labels = sdscatfmt(source->push.labels,
+				",\"instance\":%S", value);
+	sdsfree(value);
+    }
+    if (job) {
+	value = unicode_encode(job->value, job->valuelen);
+	source->push.labels = sdscatfmt(source->push.labels,
+				",\"job\":%S", value);
+	sdsfree(value);
+    }
+    source->push.labels = sdscatlen(source->push.labels, "}", 1);
+
+    dictAdd(sources, key, source);
+    return source;
+}
+
+static void
+remote_source_free(remoteSource *source)
+{
+    pmSeriesPushed	*series;
+    unsigned int	i;
+
+    for (i = 0; i < source->push.nseries; i++) {
+	series = &source->push.series[i];
+	sdsfree(series->name);
+	sdsfree(series->instance);
+	sdsfree(series->labels);
+	free(series->samples);
+    }
+    free(source->push.series);
+    sdsfree(source->push.source);
+    sdsfree(source->push.hostname);
+    sdsfree(source->push.labels);
+    free(source);
+}
+
+/*
+ * TimeSeries - labels (1, each name (1) and value (2)) and samples (2,
+ * each value (1, double) and timestamp (2, milliseconds)).  Exemplars
+ * and native histograms are skipped.
+ */
+static int
+remote_series(protobuf *pb, struct dict *sources, unsigned int *dropped)
+{
+    pmSeriesPushed	*series;
+    pmSeriesSample	*samples = NULL;
+    remoteSource	*source;
+    prompair		*pairs = NULL, *name = NULL, *job = NULL, *inst = NULL;
+    protobuf		field, nested;
+    unsigned long long	value;
+    unsigned int	npairs = 0, nsamples = 0, i;
+    prompair		*tmp;
+    void		*p;
+    double		d;
+    sds			labels, key, quoted;
+    int			sts, item;
+
+    while ((sts = protobuf_field(pb, &field, &value)) > 0) {
+	if (sts == 1 && field.p) {
+	    if ((tmp = realloc(pairs, (npairs + 1) * sizeof(prompair))) == NULL) {
+		sts = -ENOMEM;
+		break;
+	    }
+	    pairs = tmp;
+	    memset(&pairs[npairs], 0, sizeof(prompair));
+	    while ((item = protobuf_field(&field, &nested, &value)) > 0) {
+		if (item == 1 && nested.p) {
+		    pairs[npairs].name = (const char *)nested.p;
+		    pairs[npairs].namelen = nested.end - nested.p;
+		} else if (item == 2 && nested.p) {
+		    pairs[npairs].value = (const char *)nested.p;
+		    pairs[npairs].valuelen = nested.end - nested.p;
+		}
+	    }
+	    if (item < 0) {
+		sts = item;
+		break;
+	    }
+	    if (pairs[npairs].name)
+		npairs++;
+	} else if (sts == 2 && field.p) {
+	    if ((p = realloc(samples, (nsamples + 1) * sizeof(pmSeriesSample))) == NULL) {
+		sts = -ENOMEM;
+		break;
+	    }
+	    samples = (pmSeriesSample *)p;
+	    memset(&samples[nsamples], 0, sizeof(pmSeriesSample));
+	    while ((item = protobuf_field(&field, &nested, &value)) > 0) {
+		if (item == 1) {
+		    memcpy(&d, &value, sizeof(d));
+		    samples[nsamples].value = d;
+		} else if (item == 2) {
+		    samples[nsamples].timestamp = (__int64_t)value;
+		}
+	    }
+	    if (item < 0) {
+		sts = item;
+		break;
+	    }
+	    nsamples++;
+	}
+    }
+    if (sts < 0)
+	goto done;
+
+    for (i = 0; i < npairs; i++) {
+	if (pairs[i].namelen == 8 && strncmp(pairs[i].name, "__name__", 8) == 0)
+	    name = &pairs[i];
+	else if (pairs[i].namelen == 3 && strncmp(pairs[i].name, "job", 3) == 0)
+	    job = &pairs[i];
+	else if (pairs[i].namelen == 8 && strncmp(pairs[i].name, "instance", 8) == 0)
+	    inst = &pairs[i];
+    }
+    if (name == NULL || name->valuelen == 0 || nsamples == 0) {
+	*dropped += nsamples;
+	goto done;
+    }
+    if ((source = remote_source(sources, job, inst)) == NULL) {
+	sts = -ENOMEM;
+	goto done;
+    }
+    if (source->push.nseries == source->size) {
+	i = source->size ? source->size * 2 : 16;
+	if ((p = realloc(source->push.series, i * sizeof(pmSeriesPushed))) == NULL) {
+	    sts = -ENOMEM;
+	    goto done;
+	}
+	source->push.series = (pmSeriesPushed *)p;
+	source->size = i;
+    }
+    series = &source->push.series[source->push.nseries++];
+    memset(series, 0, sizeof(*series));
+    series->name = remote_metric_name(job ? job->value : NULL,
+			job ? job->valuelen : 0, name->value, name->valuelen);
+    series->semantics = remote_semantics(name->value, name->valuelen);
+    series->samples = samples;
+    series->nsamples = nsamples;
+    samples = NULL;
+
+    /* instance name and labels from all remaining labels, as "key:value" */
+    for (i = 0, labels = key = NULL; i < npairs; i++) {
+	if (&pairs[i] == name || &pairs[i] == job || &pairs[i] == inst)
+	    continue;
+	if (!remote_label_name(pairs[i].name, pairs[i].namelen))
+	    continue;
+	if (key == NULL) {
+	    key = sdsempty();
+	    labels = sdsnewlen("{", 1);
+	} else {
+	    key = sdscatlen(key, " ", 1);
+	    labels = sdscatlen(labels, ",", 1);
+	}
+	key = sdscatlen(key, pairs[i].name, pairs[i].namelen);
+	key = sdscatlen(key, ":", 1);
+	key = sdscatlen(key, pairs[i].value, pairs[i].valuelen);
+	labels = sdscatlen(labels, "\"", 1);
+	labels = sdscatlen(labels, pairs[i].name, pairs[i].namelen);
+	labels = sdscatlen(labels, "\":", 2);
+	quoted = unicode_encode(pairs[i].value, pairs[i].valuelen);
+	labels = sdscatsds(labels, quoted);
+	sdsfree(quoted);
+    }
+    if (key) {
+	series->instance = key;
+	series->labels = sdscatlen(labels, "}", 1);
+    }
+
+done:
+    free(samples);
+    free(pairs);
+    return sts;
+}
+
+static void
+remote_setup(void *arg)
+{
+    if (pmDebugOptions.series)
+	fprintf(stderr, "remote module setup (arg=%p)\n", arg);
+}
+
+/* diagnostics are for the pushed source, not any one request */
+static void
+remote_log(pmLogLevel level, sds message, void *arg)
+{
+    (void)arg;
+    proxylog(level, message, remote.proxy);
+}
+
+static void remote_push_done(int, void *);
+
+static pmSeriesSettings remote_settings = {
+    .module.on_setup		= remote_setup,
+    .module.on_info		= remote_log,
+    .callbacks.on_done		= remote_push_done,
+};
+
+static void
+remote_sources_free(remoteBaton *baton)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+
+    if (baton->sources == NULL)
+	return;
+    iterator = dictGetSafeIterator(baton->sources);
+    while ((entry = dictNext(iterator)) != NULL)
+	remote_source_free((remoteSource *)dictGetVal(entry));
+    dictReleaseIterator(iterator);
+    dictRelease(baton->sources);
+    baton->sources = NULL;
+}
+
+/*
+ * Decode a WriteRequest - timeseries (1) and metadata (3) - into the
+ * series for each source.  Metadata is processed first as it is
+ * encoded after the series it describes.  Runs on a worker thread.
+ */
+static void
+remote_decode(uv_work_t *work)
+{
+    remoteBaton		*baton = (remoteBaton *)work->data;
+    protobuf		message, field;
+    unsigned long long	value;
+    sds			decoded;
+    int			sts;
+
+    if ((decoded = snappy_decode((unsigned char *)baton->body,
+				sdslen(baton->body))) == NULL) {
+	baton->error = -EINVAL;
+	return;
+    }
+
+    message.p = (unsigned char *)decoded;
+    message.end = message.p + sdslen(decoded);
+    while ((sts = protobuf_field(&message, &field, &value)) > 0) {
+	if (sts == 3 && field.p && (sts = remote_metadata(&field)) < 0)
+	    break;
+    }
+    if (sts < 0) {
+	sdsfree(decoded);
+	baton->error = sts;
+	return;
+    }
+
+    baton->sources = dictCreate(&sdsKeyDictCallBacks, NULL);
+    message.p = (unsigned char *)decoded;
+    while ((sts = protobuf_field(&message, &field, &value)) > 0) {
+	if (sts == 1 && field.p &&
+	    (sts = remote_series(&field, baton->sources, &baton->dropped)) < 0)
+	    break;
+    }
+    sdsfree(decoded);
+    baton->error = sts < 0 ? sts : 0;
+}
+
+static void
+remote_reply(remoteBaton *baton)
+{
+    struct client	*client = baton->client;
+    http_code		status;
+    char		errmsg[PM_MAXERRMSGLEN];
+
+    if (client_is_closed(client)) {
+	/* nobody left to tell */
+    } else if (baton->error < 0) {
+	remote_metric_inc(REMOTE_ERRORS, 1);
+	pmErrStr_r(baton->error, errmsg, sizeof(errmsg));
+	if (baton->error == -EINVAL)
+	    status = HTTP_STATUS_BAD_REQUEST;
+	else if (baton->error == -ENOTCONN || baton->error == -EAGAIN)
+	    status = HTTP_STATUS_SERVICE_UNAVAILABLE;
+	else
+	    status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+	http_error(client, status, errmsg);
+    } else {
+	if (pmDebugOptions.http)
+	    fprintf(stderr, "remote write of %u samples (client=%p)\n",
+			baton->samples, client);
+	http_reply(client, sdsempty(), HTTP_STATUS_NO_CONTENT,
+			HTTP_FLAG_TEXT, 0);
+    }
+    client_put(client);
+}
+
+/* all writes for one pushed source have been answered */
+static void
+remote_push_done(int status, void *arg)
+{
+    remoteBaton		*baton = (remoteBaton *)arg;
+
+    if (status < 0 && baton->error == 0)
+	baton->error = status;
+    if (--baton->pending == 0)
+	remote_reply(baton);
+}
+
+/* decoding completed, write the samples for each source */
+static void
+remote_decoded(uv_work_t *work, int status)
+{
+    remoteBaton		*baton = (remoteBaton *)work->data;
+    dictIterator	*iterator;
+    dictEntry		*entry;
+    remoteSource	*source;
+    unsigned int	i, total = 0;
+    int			sts;
+
+    (void)status;
+    baton->work.data = NULL;
+    sdsfree(baton->body);
+    baton->body = NULL;
+
+    /* held until all sources have been pushed, as completion can be immediate */
+    baton->pending = 1;
+
+    if (baton->sources) {
+	iterator = dictGetSafeIterator(baton->sources);
+	while ((entry = dictNext(iterator)) != NULL) {
+	    source = (remoteSource *)dictGetVal(entry);
+	    for (i = 0; i < source->push.nseries; i++)
+		total += source->push.series[i].nsamples;
+	    if (baton->error < 0)
+		continue;
+	    baton->pending++;
+	    if ((sts = pmSeriesPushSamples(&remote_settings,
+					&source->push, baton)) < 0) {
+		baton->pending--;
+		baton->error = sts;
+	    } else {
+		baton->samples += sts;
+	    }
+	}
+	dictReleaseIterator(iterator);
+	remote_sources_free(baton);
+    }
+
+    remote_metric_inc(REMOTE_SAMPLES, baton->samples);
+    remote_metric_inc(REMOTE_DROPPED, baton->dropped + total - baton->samples);
+    remote_push_done(0, baton);
+}
+
+static void
+remote_data_release(struct client *client)
+{
+    remoteBaton		*baton = (remoteBaton *)client->u.http.data;
+
+    if (pmDebugOptions.http)
+	fprintf(stderr, "%s: %p for client %p\n", "remote_data_release",
+			baton, client);
+
+    if (baton == NULL)
+	return;
+    remote_sources_free(baton);
+    sdsfree(baton->body);
+    memset(baton, 0, sizeof(*baton));
+    free(baton);
+}
+
+static int
+remote_request_url(struct client *client, sds url, dict *parameters)
+{
+    remoteBaton		*baton;
+
+    (void)parameters;
+    if (!remote.enabled || strcmp(url, remote_url) != 0)
+	return 0;
+
+    if ((baton = calloc(1, sizeof(*baton))) != NULL) {
+	client->u.http.data = baton;
+	baton->client = client;
+	if (client->u.http.parser.method != HTTP_POST &&
+	    client->u.http.parser.method != HTTP_OPTIONS)
+	    client->u.http.parser.status_code = HTTP_STATUS_METHOD_NOT_ALLOWED;
+    } else {
+	client->u.http.parser.status_code = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+    }
+    return 1;
+}
+
+static int
+remote_request_headers(struct client *client, struct dict *headers)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+    sds			field, value;
+    int			snappy = 0;
+
+    if (pmDebugOptions.http)
+	fprintf(stderr, "remote servlet headers (client=%p)\n", client);
+    if (client->u.http.parser.status_code ||
+	client->u.http.parser.method != HTTP_POST)
+	return 0;
+
+    iterator = dictGetSafeIterator(headers);
+    while ((entry = dictNext(iterator)) != NULL) {
+	field = (sds)dictGetKey(entry);
+	value = (sds)dictGetVal(entry);
+	if (value && strcasecmp(field, "Content-Encoding") == 0)
+	    snappy = (strcasecmp(value, "snappy") == 0);
+    }
+    dictReleaseIterator(iterator);
+
+    if (!snappy)
+	client->u.http.parser.status_code = HTTP_STATUS_UNSUPPORTED_MEDIA_TYPE;
+    else if (client->u.http.parser.content_length > remote.maxsize &&
+	     client->u.http.parser.content_length != ULLONG_MAX)
+	client->u.http.parser.status_code = HTTP_STATUS_PAYLOAD_TOO_LARGE;
+    return 0;
+}
+
+static int
+remote_request_body(struct client *client, const char *content, size_t length)
+{
+    remoteBaton		*baton = (remoteBaton *)client->u.http.data;
+
+    if (pmDebugOptions.http)
+	fprintf(stderr, "remote servlet body (client=%p)\n", client);
+    if (client->u.http.parser.status_code)
+	return 0;
+
+    if (baton->body == NULL)
+	baton->body = sdsempty();
+    if (sdslen(baton->body) + length > remote.maxsize) {
+	client->u.http.parser.status_code = HTTP_STATUS_PAYLOAD_TOO_LARGE;
+	sdsfree(baton->body);
+	baton->body = NULL;
+    } else {
+	baton->body = sdscatlen(baton->body, content, length);
+    }
+    return 0;
+}
+
+static int
+remote_request_done(struct client *client)
+{
+    remoteBaton		*baton = (remoteBaton *)client->u.http.data;
+    redisSlots		*slots = client->proxy->slots;
+    http_code		status;
+
+    remote_metric_inc(REMOTE_REQUESTS, 1);
+
+    if ((status = client->u.http.parser.status_code) != 0) {
+	remote_metric_inc(REMOTE_ERRORS, 1);
+	http_error(client, status, status == HTTP_STATUS_UNSUPPORTED_MEDIA_TYPE ?
+		"snappy Content-Encoding required" : "invalid remote write");
+	return 1;
+    }
+
+    if (client->u.http.parser.method == HTTP_OPTIONS) {
+	http_reply(client, sdsempty(), HTTP_STATUS_OK, HTTP_FLAG_TEXT,
+			HTTP_OPTIONS_POST);
+	return 0;
+    }
+
+    /* shed load rather than queueing unbounded key server requests */
+    if (slots && remote.backlog &&
+	slots->inflight_requests >= (int)remote.backlog) {
+	remote_metric_inc(REMOTE_REJECTED, 1);
+	http_error(client, HTTP_STATUS_TOO_MANY_REQUESTS,
+		"key server write backlog, retry later");
+	return 0;
+    }
+
+    if (baton->body == NULL)
+	baton->body = sdsempty();
+
+    /* take a reference on the client until the reply has been sent */
+    client_get(client);
+    baton->work.data = baton;
+    uv_queue_work(client->proxy->events, &baton->work,
+			remote_decode, remote_decoded);
+    return 0;
+}
+
+static void
+remote_metrics(struct proxy *proxy)
+{
+    mmv_registry_t	*registry = proxymetrics(proxy, METRICS_REMOTE);
+    pmUnits		units_count = MMV_UNITS(0, 0, 1, 0, 0, PM_COUNT_ONE);
+    pmInDom		noindom = MMV_INDOM_NULL;
+
+    if (registry == NULL)
+	return;
+
+    mmv_stats_add_metric(registry, "requests", 1,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_count, noindom,
+	"remote write requests",
+	"Number of Prometheus remote write requests received");
+    mmv_stats_add_metric(registry, "samples", 2,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_count, noindom,
+	"remote write samples stored",
+	"Number of remote write samples written to the key server");
+    mmv_stats_add_metric(registry, "dropped", 3,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_count, noindom,
+	"remote write samples dropped",
+	"Number of remote write samples not written - samples of series\n"
+	"without a metric name, out-of-order samples (older than the last\n"
+	"value written for any series of the same metric, or repeating the\n"
+	"time of the last value written for a series) and those conflicting\n"
+	"with metadata of the same metric from earlier requests.");
+    mmv_stats_add_metric(registry, "errors", 4,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_count, noindom,
+	"remote write requests failed",
+	"Number of remote write requests that could not be decoded or\n"
+	"written to the key server");
+    mmv_stats_add_metric(registry, "rejected", 5,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_count, noindom,
+	"remote write requests shed",
+	"Number of remote write requests refused with 429 Too Many Requests\n"
+	"as the key server write backlog (pmseries.remote.backlog) was full.");
+
+    if ((remote.map = mmv_stats_start(registry)) == NULL)
+	return;
+    remote.values[REMOTE_REQUESTS] = mmv_lookup_value_desc(remote.map, "requests", NULL);
+    remote.values[REMOTE_SAMPLES] = mmv_lookup_value_desc(remote.map, "samples", NULL);
+    remote.values[REMOTE_DROPPED] = mmv_lookup_value_desc(remote.map, "dropped", NULL);
+    remote.values[REMOTE_ERRORS] = mmv_lookup_value_desc(remote.map, "errors", NULL);
+    remote.values[REMOTE_REJECTED] = mmv_lookup_value_desc(remote.map, "rejected", NULL);
+}
+
+static void
+remote_servlet_setup(struct proxy *proxy)
+{
+    sds			option;
+
+    if ((option = pmIniFileLookup(proxy->config, "pmseries", "remote.enabled")))
+	remote.enabled = (strcmp(option, "true") == 0);
+    if (!remote.enabled)
+	return;
+
+    if ((option = pmIniFileLookup(proxy->config, "pmseries", "remote.maxsize")))
+	remote.maxsize = strtoul(option, NULL, 0);
+    else
+	remote.maxsize = DEFAULT_MAXSIZE;
+    if ((option = pmIniFileLookup(proxy->config, "pmseries", "remote.backlog")))
+	remote.backlog = strtoul(option, NULL, 0);
+    else
+	remote.backlog = DEFAULT_BACKLOG;
+
+    remote.counters = dictCreate(&sdsKeyDictCallBacks, NULL);
+    uv_mutex_init(&remote.lock);
+    remote.proxy = proxy;
+    remote_metrics(proxy);
+
+    pmSeriesSetSlots(&remote_settings.module, proxy->slots);
+    pmSeriesSetEventLoop(&remote_settings.module, proxy->events);
+    pmSeriesSetConfiguration(&remote_settings.module, proxy->config);
+
+    pmSeriesSetup(&remote_settings.module, proxy);
+}
+
+static void
+remote_servlet_close(struct proxy *proxy)
+{
+    if (!remote.enabled)
+	return;
+
+    pmSeriesClose(&remote_settings.module);
+    proxymetrics_close(proxy, METRICS_REMOTE);
+    dictRelease(remote.counters);
+    uv_mutex_destroy(&remote.lock);
+    memset(&remote, 0, sizeof(remote));
+}
+
+struct servlet pmremote_servlet = {
+    .name		= "remote",
+    .setup 		= remote_servlet_setup,
+    .close 		= remote_servlet_close,
+    .on_url		= remote_request_url,
+    .on_headers		= remote_request_headers,
+    .on_body		= remote_request_body,
+    .on_done		= remote_request_done,
+    .on_release		= remote_data_release,
+};
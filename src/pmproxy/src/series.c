@@ -40,6 +40,7 @@ typedef struct pmSeriesBaton {
     pmSeriesTimeWindow	window;
     uv_work_t		loading;
     unsigned int	working : 1;
+    unsigned int	paused : 1;	/* throttled, awaiting on_drain */
     unsigned int	options : 16;
     int			nsids;
     pmSID		*sids;
@@ -106,14 +107,8 @@ pmseries_lookup_rest_command(sds url)
 }
 
 static void
-pmseries_data_release(struct client *client)
+pmseries_data_free(pmSeriesBaton *baton)
 {
-    pmSeriesBaton	*baton = (pmSeriesBaton *)client->u.http.data;
-
-    if (pmDebugOptions.http)
-	fprintf(stderr, "%s: %p for client %p\n", "pmseries_data_release",
-			baton, client);
-
     if (baton->nsids)
 	sdsfreesplitres(baton->sids, baton->nsids);
     if (baton->names)
@@ -128,6 +123,43 @@ pmseries_data_release(struct client *client)
     free(baton);
 }
 
+static void
+pmseries_data_drain(struct client *client)
+{
+    pmSeriesBaton	*baton = (pmSeriesBaton *)client->u.http.data;
+
+    if (baton->paused) {
+	if (pmDebugOptions.http)
+	    fprintf(stderr, "%s: resuming %p for client %p\n",
+			    "pmseries_data_drain", baton, client);
+	baton->paused = 0;
+	pmSeriesResume(baton);
+    }
+}
+
+static void
+pmseries_data_release(struct client *client)
+{
+    pmSeriesBaton	*baton = (pmSeriesBaton *)client->u.http.data;
+
+    if (pmDebugOptions.http)
+	fprintf(stderr, "%s: %p for client %p\n", "pmseries_data_release",
+			baton, client);
+
+    if (baton->paused) {
+	/* paused values query - detach, resume to abandon the remaining */
+	/* values, and the baton is freed as the query completes */
+	if (pmDebugOptions.http)
+	    fprintf(stderr, "%s: cancelling %p for client %p\n",
+			    "pmseries_data_release", baton, client);
+	baton->client = NULL;
+	baton->paused = 0;
+	pmSeriesResume(baton);
+    } else {
+	pmseries_data_free(baton);
+    }
+}
+
 /*
  * If any request is accompanied by 'client', the client is using
  * this to identify responses.  Wrap the usual response using the
@@ -175,12 +207,15 @@ on_pmseries_value(pmSID sid, pmSeriesValue *value, void *arg)
     struct client	*client = baton->client;
     const char		*prefix;
     sds			timestamp, series, quoted;
-    sds			result = http_get_buffer(baton->client);
+    sds			result;
 
     if (pmDebugOptions.query && pmDebugOptions.desperate)
 	fprintf(stderr, "on_pmseries_value: arg=%p %s %s %s\n",
 	    arg, value->timestamp, value->data, value->series);
 
+    if (client == NULL)		/* detached, client has gone away */
+	return 0;
+    result = http_get_buffer(client);
 
     timestamp = value->timestamp;
     series = value->series;
@@ -530,18 +565,48 @@ on_pmseries_inst(pmSID sid, pmSeriesInst *inst, void *arg)
     return 0;
 }
 
+static int
+on_pmseries_backlog(void *arg)
+{
+    pmSeriesBaton	*baton = (pmSeriesBaton *)arg;
+
+    if (baton->client == NULL)	/* detached, client has gone away */
+	return -1;
+    return http_write_backlog(baton->client);
+}
+
+static void
+on_pmseries_paused(void *arg)
+{
+    pmSeriesBaton	*baton = (pmSeriesBaton *)arg;
+
+    if (pmDebugOptions.http)
+	fprintf(stderr, "%s: pausing %p for client %p\n", "on_pmseries_paused",
+			baton, baton->client);
+    baton->paused = 1;
+}
+
 static void
 on_pmseries_done(int status, void *arg)
 {
     pmSeriesBaton	*baton = (pmSeriesBaton *)arg;
     struct client	*client = baton->client;
     http_options	options = baton->options;
-    http_flags		flags = client->u.http.flags;
+    http_flags		flags;
     http_code		code;
     sds			msg;
 
     if (pmDebugOptions.query && pmDebugOptions.desperate)
 	fprintf(stderr, "on_pmseries_done: arg=%p status=%d\n", arg, status);
+
+    if (client == NULL) {	/* detached, client has gone away */
+	if (pmDebugOptions.http)
+	    fprintf(stderr, "%s: releasing detached %p\n",
+			    "on_pmseries_done", baton);
+	pmseries_data_free(baton);
+	return;
+    }
+    flags = client->u.http.flags;
     if (status == 0) {
 	code = HTTP_STATUS_OK;
 	/* complete current response with JSON suffix if needed */
@@ -629,6 +694,9 @@ pmseries_log(pmLogLevel level, sds message, void *arg)
 {
     pmSeriesBaton	*baton = (pmSeriesBaton *)arg;
 
+    if (baton->client == NULL)	/* detached, client has gone away */
+	return;
+
     /* locally log low priority diagnostics or when already responding */
     if (level <= PMLOG_INFO || baton->suffix)
 	proxylog(level, message, baton->client->proxy);
@@ -647,6 +715,8 @@ static pmSeriesSettings pmseries_settings = {
     .callbacks.on_value		= on_pmseries_value,
     .callbacks.on_label		= on_pmseries_label,
     .callbacks.on_done		= on_pmseries_done,
+    .callbacks.on_backlog	= on_pmseries_backlog,
+    .callbacks.on_paused	= on_pmseries_paused,
     .module.on_setup		= pmseries_setup,
     .module.on_info		= pmseries_log,
 };
@@ -1047,4 +1117,5 @@ struct servlet pmseries_servlet = {
     .on_body		= pmseries_request_body,
     .on_done		= pmseries_request_done,
     .on_release		= pmseries_data_release,
+    .on_drain		= pmseries_data_drain,
 };
@@ -13,10 +13,28 @@
  */
 #include "server.h"
 #include "uv_callback.h"
+#include <sys/wait.h>
 #include <assert.h>
 
+/* worker processes need SO_REUSEPORT listeners and uv_loop_fork */
+#if defined(SO_REUSEPORT) && UV_VERSION_HEX >= 0x010c00
+#define HAVE_PROXY_WORKERS 1
+#define WORKER_RESTART_DELAY	5	/* minimum worker lifetime, seconds */
+static uv_signal_t	sigchld;
+#endif
+
 static uv_signal_t	sighup, sigint, sigterm;
 
+typedef struct worker {
+    pid_t		pid;
+    time_t		start;
+} worker_t;
+
+static worker_t		*workers;	/* worker processes, in main process */
+static struct server	*inherited;	/* main process listeners, in workers */
+static sds		workerpath;	/* local socket path, in workers */
+static int		listen_backlog;	/* maxpending for worker listeners */
+
 static struct {
 	const char	*group;
 	char		*path;
@@ -30,6 +48,8 @@ static struct {
 	{ .group = "series" },		/* METRICS_SERIES */
 	{ .group = "webgroup" },	/* METRICS_WEBGROUP */
 	{ .group = "search" },          /* METRICS_SEARCH */
+	{ .group = "webpool" },	/* METRICS_WEBPOOL */
+	{ .group = "remote" },	/* METRICS_REMOTE */
 };
 
 void
@@ -74,12 +94,17 @@ proxymetrics(struct proxy *proxy, enum proxy_registry prid)
     if (proxy->metrics[prid] != NULL)	/* already setup */
 	return proxy->metrics[prid];
 
-    pmsprintf(path, sizeof(path), "%s%cpmproxy%c%s",
-	    pmGetConfig("PCP_TMP_DIR"), sep, sep, server_metrics[prid].group);
+    if (proxy->worker)	/* distinct metrics file for each worker */
+	pmsprintf(path, sizeof(path), "%s%cpmproxy%c%s_%u",
+		pmGetConfig("PCP_TMP_DIR"), sep, sep,
+		server_metrics[prid].group, proxy->worker);
+    else
+	pmsprintf(path, sizeof(path), "%s%cpmproxy%c%s",
+		pmGetConfig("PCP_TMP_DIR"), sep, sep, server_metrics[prid].group);
     if ((file = strdup(path)) == NULL)
 	return NULL;
 
-    if (prid == METRICS_SERVER)
+    if (prid == METRICS_SERVER && proxy->worker == 0)
 	flags |= MMV_FLAG_NOPREFIX;
     if ((registry = mmv_stats_registry(file, prid, flags)) != NULL)
 	server_metrics[prid].path = file;
@@ -112,7 +137,7 @@ server_init(int portcount, const char *localpath)
     struct server	*servers;
     struct proxy	*proxy;
     int			count;
-    mmv_registry_t	*registry;
+    sds			option;
 
     if ((proxy = calloc(1, sizeof(struct proxy))) == NULL) {
 	fprintf(stderr, "%s: out-of-memory in proxy server setup\n",
@@ -139,9 +164,29 @@ server_init(int portcount, const char *localpath)
     }
 
     proxy->config = config;
-
-    if ((registry = proxymetrics(proxy, METRICS_SERVER)) != NULL)
-	pmWebTimerSetMetricRegistry(registry);
+    proxy->localpath = localpath;
+
+    if ((option = pmIniFileLookup(config, "pmproxy", "workers")) != NULL)
+	proxy->nworkers = atoi(option);
+    if ((option = getenv("PMPROXY_WORKER")) != NULL)	/* restarted */
+	proxy->worker = atoi(option);
+    if (proxy->nworkers < 1)
+	proxy->nworkers = 1;
+#ifndef HAVE_PROXY_WORKERS
+    if (proxy->nworkers > 1) {
+	pmNotifyErr(LOG_WARNING, "%s: worker processes unsupported, using one\n",
+			pmGetProgname());
+	proxy->nworkers = 1;
+    }
+#endif
+    /* each worker indexes only its own share of series, so cannot use it */
+    if (proxy->nworkers > 1 &&
+	(option = pmIniFileLookup(config, "pmseries", "index.enabled")) &&
+	strcmp(option, "true") == 0) {
+	pmNotifyErr(LOG_WARNING, "%s: series index disabled with %u workers\n",
+			pmGetProgname(), proxy->nworkers);
+	pmIniFileUpdate(config, "pmseries", "index.enabled", sdsnew("false"));
+    }
 
     proxy->events = uv_default_loop();
 
@@ -154,9 +199,15 @@ signal_handler(uv_signal_t *sighandle, int signum)
     uv_handle_t		*handle = (uv_handle_t *)sighandle;
     struct proxy	*proxy = (struct proxy *)handle->data;
     uv_loop_t		*loop = proxy->events;
+    unsigned int	i;
 
-    if (signum == SIGHUP)
+    if (signum == SIGHUP) {	/* pass on to any worker processes */
+	pmNotifyErr(LOG_INFO, "pmproxy caught SIGHUP\n");
+	for (i = 1; workers && i < proxy->nworkers; i++)
+	    if (workers[i].pid > 0)
+		kill(workers[i].pid, SIGHUP);
 	return;
+    }
     pmNotifyErr(LOG_INFO, "pmproxy caught %s\n",
 		signum == SIGINT ? "SIGINT" : "SIGTERM");
     uv_signal_stop(&sigterm);
@@ -271,18 +322,26 @@ on_client_write(uv_write_t *writer, int status)
 {
     struct client	*client = (struct client *)writer->data;
     stream_write_baton	*request = (stream_write_baton *)writer;
+    size_t		bytes = 0;
+    unsigned int	i;
 
     if (pmDebugOptions.af)
 	fprintf(stderr, "%s: completed write [sts=%d] to client %p\n",
 			"on_client_write", status, client);
 
+    for (i = 0; i < request->nbuffers; i++)
+	bytes += request->buffer[i].len;
+    uv_mutex_lock(&client->mutex);
+    client->pending -= bytes;
+    uv_mutex_unlock(&client->mutex);
+
     if (status == 0) {
 	if (client->protocol & STREAM_SECURE)
 	    on_secure_client_write(client);
 	if (client->protocol & STREAM_PCP)
 	    on_pcp_client_write(client);
 	else if (client->protocol & STREAM_HTTP)
-	    on_http_client_write(client);
+	    on_http_client_write(client, request->final);
 	else if (client->protocol & STREAM_REDIS)
 	    on_redis_client_write(client);
     }
@@ -324,12 +383,13 @@ on_write_callback(uv_callback_t *handle, void *data)
     return 0;
 }
 
-void
-client_write(struct client *client, sds buffer, sds suffix)
+static void
+client_write_request(struct client *client, sds buffer, sds suffix, int final)
 {
     stream_write_baton	*request;
     struct proxy	*proxy = client->proxy;
     unsigned int	nbuffers = 0;
+    size_t		bytes;
 
     if (client_is_closed(client))
 	return;
@@ -346,15 +406,38 @@ client_write(struct client *client, sds buffer, sds suffix)
 	    request->buffer[nbuffers++] = uv_buf_init(suffix, sdslen(suffix));
 	}
 	request->nbuffers = nbuffers;
+	request->final = final;
 	request->writer.data = client;
 	request->callback = on_client_write;
 
+	bytes = request->buffer[0].len + (suffix ? request->buffer[1].len : 0);
+	uv_mutex_lock(&client->mutex);
+	client->pending += bytes;
+	uv_mutex_unlock(&client->mutex);
+
 	uv_callback_fire(&proxy->write_callbacks, request, NULL);
     } else {
 	client_close(client);
     }
 }
 
+void
+client_write(struct client *client, sds buffer, sds suffix)
+{
+    client_write_request(client, buffer, suffix, 0);
+}
+
+/*
+ * As for client_write, additionally marking this as the last write of a
+ * response - protocols with request pipelining resume parsing once this
+ * write has completed, such that responses are always sent in order.
+ */
+void
+client_write_final(struct client *client, sds buffer, sds suffix)
+{
+    client_write_request(client, buffer, suffix, 1);
+}
+
 static stream_protocol
 client_protocol(int key)
 {
@@ -504,6 +587,39 @@ on_client_connection(uv_stream_t *stream, int status)
     }
 }
 
+#ifdef HAVE_PROXY_WORKERS
+/*
+ * Listening sockets shared by worker processes each bind the same
+ * address using SO_REUSEPORT - the kernel then balances incoming
+ * connections across the set of listening workers.
+ */
+static int
+open_reuseport_socket(const struct sockaddr *addr, int flags)
+{
+    socklen_t		length;
+    int			fd, on = 1;
+
+    if (addr->sa_family == AF_INET6)
+	length = sizeof(struct sockaddr_in6);
+    else
+	length = sizeof(struct sockaddr_in);
+
+    if ((fd = socket(addr->sa_family, SOCK_STREAM, 0)) < 0)
+	return -oserror();
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0 ||
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+	setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 ||
+	((flags & UV_TCP_IPV6ONLY) &&
+	 setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on)) < 0) ||
+	bind(fd, addr, length) < 0) {
+	on = -oserror();
+	close(fd);
+	return on;
+    }
+    return fd;
+}
+#endif
+
 static int
 open_request_port(struct proxy *proxy, struct server *server, stream_family family,
 		const struct sockaddr *addr, int port, int maxpending)
@@ -512,6 +628,9 @@ open_request_port(struct proxy *proxy, struct server *server, stream_family fami
     uv_handle_t		*handle;
     sds			option;
     int			sts, flags = 0, keepalive = 45;
+#ifdef HAVE_PROXY_WORKERS
+    int			fd;
+#endif
 
     if ((option = pmIniFileLookup(proxy->config, "pmproxy", "keepalive")))
 	keepalive = atoi(option);
@@ -525,6 +644,17 @@ open_request_port(struct proxy *proxy, struct server *server, stream_family fami
     handle = (uv_handle_t *)&stream->u.tcp;
     handle->data = (void *)proxy;
 
+#ifdef HAVE_PROXY_WORKERS
+    if (proxy->nworkers > 1) {
+	if ((fd = open_reuseport_socket(addr, flags)) < 0 ||
+	    (fd = uv_tcp_open(&stream->u.tcp, fd)) < 0) {
+	    fprintf(stderr, "%s: socket reuseport error %s\n",
+			pmGetProgname(), pmErrStr(fd));
+	    uv_close(handle, NULL);
+	    return -ENOTCONN;
+	}
+    } else
+#endif
     uv_tcp_bind(&stream->u.tcp, addr, flags);
     uv_tcp_nodelay(&stream->u.tcp, 1);
     uv_tcp_keepalive(&stream->u.tcp, keepalive > 0, keepalive);
@@ -537,7 +667,7 @@ open_request_port(struct proxy *proxy, struct server *server, stream_family fami
 	return -ENOTCONN;
     }
     stream->active = 1;
-    if (__pmServerHasFeature(PM_SERVER_FEATURE_DISCOVERY))
+    if (proxy->worker == 0 && __pmServerHasFeature(PM_SERVER_FEATURE_DISCOVERY))
 	server->presence = __pmServerAdvertisePresence(PM_SERVER_PROXY_SPEC, port);
     return 0;
 }
@@ -572,6 +702,37 @@ open_request_local(struct proxy *proxy, struct server *server,
     return 0;
 }
 
+/*
+ * Local socket path of a worker process - the main process uses the
+ * usual local socket, other workers (when any) a suffixed variant.
+ */
+sds
+worker_local_path(struct proxy *proxy, unsigned int worker)
+{
+    if (proxy->localpath == NULL || *proxy->localpath == '\0')
+	return NULL;
+    if (worker == 0)
+	return sdsnew(proxy->localpath);
+    return sdscatfmt(sdsempty(), "%s.%u", proxy->localpath, worker);
+}
+
+#ifdef HAVE_PROXY_WORKERS
+/*
+ * Worker processes other than the main process each listen on a local
+ * socket of their own, so that REST API requests for contexts created
+ * by one worker can be passed on to it by the others.
+ */
+static int
+open_worker_local(struct proxy *proxy, struct server *server, int maxpending)
+{
+    if ((workerpath = worker_local_path(proxy, proxy->worker)) == NULL)
+	return -ENOTCONN;
+    unlink(workerpath);
+    server->stream.address = workerpath;
+    return open_request_local(proxy, server, workerpath, maxpending);
+}
+#endif
+
 static void
 setup_default_local_path(char *localpath, size_t localpathlen)
 {
@@ -659,13 +820,19 @@ open_request_ports(char *localpath, size_t localpathlen, int maxpending)
     signal_init(proxy);
 
     count = n = 0;
-    if (*localpath) {
+    if (*localpath && proxy->worker == 0) {
 	unlink(localpath);
 	server = &proxy->servers[n++];
 	server->stream.address = localpath;
 	if (open_request_local(proxy, server, localpath, maxpending) == 0)
 	    count++;
     }
+#ifdef HAVE_PROXY_WORKERS
+    else if (*localpath) {	/* restarted worker process */
+	server = &proxy->servers[n++];
+	open_worker_local(proxy, server, maxpending);
+    }
+#endif
 
     for (i = 0; i < total; i++) {
 	sockaddr = (const struct sockaddr *)addrlist[i].addr;
@@ -674,11 +841,12 @@ open_request_ports(char *localpath, size_t localpathlen, int maxpending)
 	port = __pmSockAddrGetPort(addrlist[i].addr);
 	server = &proxy->servers[n++];
 	server->stream.address = addrlist[i].address;
+	server->addr = addrlist[i].addr;
 	if (open_request_port(proxy, server, family, sockaddr, port, maxpending) == 0)
 	    count++;
-	__pmSockAddrFree(addrlist[i].addr);
     }
     free(addrlist);
+    listen_backlog = maxpending;
 
     if (count == 0) {
 	pmNotifyErr(LOG_ERR, "%s: can't open any request ports, exiting\n",
@@ -696,6 +864,185 @@ fail:
     return NULL;
 }
 
+#ifdef HAVE_PROXY_WORKERS
+/*
+ * Replace listening sockets inherited from the main process with
+ * our own - TCP ports are reopened (SO_REUSEPORT) and the local
+ * socket continues to be serviced by the main process alone, with
+ * a local socket of our own listening alongside it.
+ */
+static void
+worker_request_ports(struct proxy *proxy)
+{
+    struct server	*server;
+    struct stream	*stream;
+    unsigned int	i;
+
+    inherited = proxy->servers;
+    if ((proxy->servers = calloc(proxy->nservers, sizeof(struct server))) == NULL) {
+	pmNotifyErr(LOG_ERR, "%s: out-of-memory for worker %u ports\n",
+			pmGetProgname(), proxy->worker);
+	exit(1);
+    }
+
+    for (i = 0; i < proxy->nservers; i++) {
+	stream = &inherited[i].stream;
+	server = &proxy->servers[i];
+	server->stream.family = stream->family;
+	server->stream.address = stream->address;
+	server->addr = inherited[i].addr;
+	inherited[i].addr = NULL;
+	if (stream->active == 0)
+	    continue;
+	/* closing a bound pipe unlinks its path - still the main process's */
+	if (stream->family == STREAM_LOCAL)
+	    stream->u.local.pipe_fname = NULL;
+	uv_close((uv_handle_t *)&stream->u, NULL);
+	if (stream->family == STREAM_LOCAL) {
+	    open_worker_local(proxy, server, listen_backlog);
+	    continue;
+	}
+	open_request_port(proxy, server, stream->family,
+			(const struct sockaddr *)server->addr,
+			stream->port, listen_backlog);
+    }
+}
+
+/*
+ * Restart a worker process that has exited.  By now the main process
+ * has live module state (key server connections, REST API contexts,
+ * discovery), so rather than forking another copy of that a fresh
+ * pmproxy is executed with the original arguments.  PMPROXY_WORKER
+ * tells it to skip the local socket, daemon and log file setup, and
+ * gives it the index of the worker (and its discovery shard).
+ */
+static void
+restart_worker(struct proxy *proxy, unsigned int i)
+{
+    char		index[16];
+    pid_t		pid;
+
+    pmsprintf(index, sizeof(index), "%u", i);
+    setenv("PMPROXY_WORKER", index, 1);
+    if ((pid = fork()) == 0) {
+	execvp(restart_argv[0], restart_argv);
+	_exit(1);
+    }
+    unsetenv("PMPROXY_WORKER");
+
+    if (pid < 0) {
+	pmNotifyErr(LOG_ERR, "%s: cannot restart worker %u: %s\n",
+			pmGetProgname(), i, osstrerror());
+	workers[i].pid = 0;
+    } else {
+	workers[i].pid = pid;
+	workers[i].start = time(NULL);
+    }
+}
+
+/*
+ * Reap any worker processes that have exited and start replacements,
+ * unless a worker died very soon after starting (avoid restart loops).
+ */
+static void
+on_worker_exit(uv_signal_t *sighandle, int signum)
+{
+    uv_handle_t		*handle = (uv_handle_t *)sighandle;
+    struct proxy	*proxy = (struct proxy *)handle->data;
+    unsigned int	i;
+    pid_t		pid;
+    int			status;
+
+    for (i = 1; i < proxy->nworkers; i++) {
+	if ((pid = workers[i].pid) <= 0 ||
+	    waitpid(pid, &status, WNOHANG) != pid)
+	    continue;
+	if (WIFSIGNALED(status))
+	    pmNotifyErr(LOG_WARNING, "%s: worker %u (pid %" FMT_PID ") "
+			"killed by signal %d\n", pmGetProgname(), i, pid,
+			WTERMSIG(status));
+	else
+	    pmNotifyErr(LOG_WARNING, "%s: worker %u (pid %" FMT_PID ") "
+			"exited with status %d\n", pmGetProgname(), i, pid,
+			WEXITSTATUS(status));
+	if (time(NULL) - workers[i].start < WORKER_RESTART_DELAY) {
+	    pmNotifyErr(LOG_ERR, "%s: worker %u exited too quickly, "
+			"not restarted\n", pmGetProgname(), i);
+	    workers[i].pid = 0;
+	    continue;
+	}
+	restart_worker(proxy, i);
+    }
+}
+
+/*
+ * Start the configured number of worker processes, each running an
+ * independent copy of the main event loop with its own listeners,
+ * key server connections, REST API contexts and share of archives
+ * (by path hash) for discovery.  Must be called before any threads
+ * are started, and before the modules are setup in the main loop.
+ */
+static void
+start_workers(struct proxy *proxy)
+{
+    unsigned int	i;
+    pid_t		pid;
+
+    if (proxy->nworkers <= 1 || proxy->worker)
+	return;
+    if ((workers = calloc(proxy->nworkers, sizeof(worker_t))) == NULL) {
+	pmNotifyErr(LOG_ERR, "%s: out-of-memory for %u workers\n",
+			pmGetProgname(), proxy->nworkers);
+	return;
+    }
+
+    for (i = 1; i < proxy->nworkers; i++) {
+	if ((pid = fork()) < 0) {
+	    pmNotifyErr(LOG_ERR, "%s: cannot start worker %u: %s\n",
+			pmGetProgname(), i, osstrerror());
+	} else if (pid == 0) {
+	    free(workers);
+	    workers = NULL;
+	    proxy->worker = i;
+	    uv_loop_fork(proxy->events);
+	    worker_request_ports(proxy);
+	    return;
+	} else {
+	    workers[i].pid = pid;
+	    workers[i].start = time(NULL);
+	}
+    }
+    pmNotifyErr(LOG_INFO, "%s: started %u worker processes\n",
+			pmGetProgname(), proxy->nworkers - 1);
+
+    uv_signal_init(proxy->events, &sigchld);
+    sigchld.data = (void *)proxy;
+    uv_signal_start(&sigchld, on_worker_exit, SIGCHLD);
+}
+
+static void
+stop_workers(struct proxy *proxy)
+{
+    unsigned int	i;
+
+    if (workers == NULL)
+	return;
+    uv_signal_stop(&sigchld);
+    uv_close((uv_handle_t *)&sigchld, NULL);
+    for (i = 1; i < proxy->nworkers; i++)
+	if (workers[i].pid > 0)
+	    kill(workers[i].pid, SIGTERM);
+    for (i = 1; i < proxy->nworkers; i++)
+	if (workers[i].pid > 0)
+	    waitpid(workers[i].pid, NULL, 0);
+    free(workers);
+    workers = NULL;
+}
+#else
+#define start_workers(proxy)	do { (void)(proxy); } while (0)
+#define stop_workers(proxy)	do { (void)(proxy); } while (0)
+#endif
+
 static void
 close_proxy(struct proxy *proxy)
 {
@@ -713,9 +1060,13 @@ shutdown_ports(void *arg)
     struct stream	*stream;
     int			i;
 
+    stop_workers(proxy);
+
     for (i = 0; i < proxy->nservers; i++) {
 	server = &proxy->servers[i];
 	stream = &server->stream;
+	if (server->addr)
+	    __pmSockAddrFree(server->addr);
 	if (stream->active == 0)
 	    continue;
 	if (stream->family == STREAM_LOCAL) {
@@ -741,6 +1092,10 @@ shutdown_ports(void *arg)
 
     free(proxy->servers);
     proxy->servers = NULL;
+    free(inherited);
+    inherited = NULL;
+    sdsfree(workerpath);
+    workerpath = NULL;
 }
 
 static void
@@ -814,6 +1169,12 @@ main_loop(void *arg)
     uv_prepare_t	before_io;
     uv_check_t		after_io;
     uv_handle_t		*handle;
+    mmv_registry_t	*registry;
+
+    start_workers(proxy);
+
+    if ((registry = proxymetrics(proxy, METRICS_SERVER)) != NULL)
+	pmWebTimerSetMetricRegistry(registry);
 
     uv_timer_init(proxy->events, &initial_io);
     handle = (uv_handle_t *)&initial_io;
@@ -834,6 +1195,11 @@ main_loop(void *arg)
 		    on_write_callback, UV_DEFAULT);
 
     uv_run(proxy->events, UV_RUN_DEFAULT);
+
+    if (proxy->worker) {	/* main process handles service shutdown */
+	shutdown_ports(proxy);
+	exit(0);
+    }
 }
 
 struct pmproxy libuv_pmproxy = {
@@ -40,6 +40,8 @@ typedef enum proxy_registry {
     METRICS_SERIES,
     METRICS_WEBGROUP,
     METRICS_SEARCH,
+    METRICS_WEBPOOL,
+    METRICS_REMOTE,
     NUM_REGISTRY
 } proxy_registry;
 
@@ -47,6 +49,7 @@ typedef struct stream_write_baton {
     uv_write_t		writer;
     uv_buf_t		buffer[2];
     unsigned int	nbuffers;
+    unsigned int	final;		/* last write of a (HTTP) response */
     uv_write_cb		callback;
 } stream_write_baton;
 
@@ -89,10 +92,19 @@ typedef struct http_client {
     sds			username;	/* HTTP Basic Auth user name */
     sds			password;	/* HTTP Basic Auth passphrase */
     sds			realm;		/* optional Basic Auth realm */
+    sds			url;		/* request URL, as received */
     void		*privdata;	/* private HTTP parsing state */
     void		*data;		/* opaque servlet information */
+    struct http_encoder	*encoder;	/* streamed response compression */
     unsigned int	type : 16;	/* HTTP response content type */
     unsigned int	flags : 16;	/* request status flags field */
+    unsigned int	accept : 8;	/* accepted content codings */
+    unsigned int	coding : 8;	/* response content coding */
+    unsigned int	inflight : 1;	/* response to a request pending */
+    unsigned int	pad : 15;
+    unsigned int	requests;	/* requests made on this connection */
+    uint64_t		lastused;	/* time of last activity (msec) */
+    sds			pipeline;	/* pipelined requests, yet to parse */
 } http_client;
 
 typedef struct pcp_client {
@@ -127,6 +139,7 @@ typedef struct client {
     unsigned int	refcount;
     unsigned int	opened;
     uv_mutex_t		mutex;
+    size_t		pending;	/* bytes queued, not yet written */
 #ifdef HAVE_OPENSSL
     secure_client	secure;
 #endif
@@ -144,6 +157,7 @@ typedef struct client {
 typedef struct server {
     struct stream	stream;
     __pmServerPresence	*presence;
+    __pmSockAddr	*addr;		/* listen address, reopened by workers */
 } server;
 
 typedef struct proxy {
@@ -151,6 +165,9 @@ typedef struct proxy {
     struct server	*servers;	/* array of tcp/pipe socket servers */
     unsigned int	nservers;	/* count of entries in server array */
     unsigned int	redisetup;	/* is Redis slots information setup */
+    unsigned int	worker;		/* index of this worker process */
+    unsigned int	nworkers;	/* count of worker processes */
+    const char		*localpath;	/* main process local socket */
     struct client	*pending_writes;
 #ifdef HAVE_OPENSSL
     SSL_CTX		*ssl;
@@ -173,6 +190,7 @@ extern void on_client_write(uv_write_t *, int);
 extern void on_buffer_alloc(uv_handle_t *, size_t, uv_buf_t *);
 
 extern void client_write(struct client *, sds, sds);
+extern void client_write_final(struct client *, sds, sds);
 extern int client_is_closed(struct client *);
 extern void client_close(struct client *);
 extern void client_get(struct client *);
@@ -180,6 +198,8 @@ extern void client_put(struct client *);
 
 extern void on_protocol_read(uv_stream_t *, ssize_t, const uv_buf_t *);
 
+extern sds worker_local_path(struct proxy *, unsigned int);
+
 #ifdef HAVE_OPENSSL
 extern void secure_client_write(struct client *, stream_write_baton *);
 extern void on_secure_client_read(struct proxy *, struct client *,
@@ -200,7 +220,7 @@ extern void on_redis_client_close(struct client *);
 
 extern void on_http_client_read(struct proxy *, struct client *,
 				ssize_t, const uv_buf_t *);
-extern void on_http_client_write(struct client *);
+extern void on_http_client_write(struct client *, int);
 extern void on_http_client_close(struct client *);
 
 extern void on_pcp_client_read(struct proxy *, struct client *,
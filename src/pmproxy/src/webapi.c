@@ -15,7 +15,9 @@
 #include <ctype.h>
 #include "openmetrics.h"
 #include "server.h"
+#include "encoding.h"
 #include "util.h"
+#include "webpool.h"
 
 typedef enum pmWebRestKey {
     RESTKEY_CONTEXT	= 1,
@@ -45,6 +47,7 @@ typedef struct pmWebGroupBaton {
     sds			clientid;	/* user-supplied identifier */
     sds			username;	/* from basic auth header */
     sds			password;	/* from basic auth header */
+    sds			body;		/* for a context of another worker */
     unsigned int	times : 1;
     unsigned int	compat : 1;
     unsigned int	options : 16;
@@ -87,7 +90,8 @@ static pmWebRestCommand openmetrics[] = {
 
 static sds PARAM_NAMES, PARAM_NAME, PARAM_PMIDS, PARAM_PMID,
 	   PARAM_INDOM, PARAM_EXPR, PARAM_VALUE, PARAM_TIMES,
-	   PARAM_CONTEXT, PARAM_CLIENT;
+	   PARAM_CONTEXT, PARAM_CLIENT, PARAM_HOSTNAME, PARAM_HOSTSPEC,
+	   AUTH_USERNAME;
 
 
 static pmWebRestCommand *
@@ -133,6 +137,7 @@ pmwebapi_data_release(struct client *client)
 			baton, client);
 
     sdsfree(baton->name);
+    sdsfree(baton->body);
     sdsfree(baton->suffix);
     sdsfree(baton->context);
     sdsfree(baton->clientid);
@@ -483,14 +488,14 @@ on_pmwebapi_scrape(sds context, pmWebScrape *scrape, void *arg)
     long long		milliseconds;
     char		pmidstr[20], indomstr[20];
     sds			name = NULL, semantics = NULL, labels = NULL;
-    sds			s, result, quoted = NULL;
+    sds			s, result, header, prefix, quoted = NULL;
+    int			cached = (baton->compat == 0);	/* reuse templates */
 
     pmwebapi_set_context(baton, context);
     if (open_metrics_type_check(metric->type) < 0)
 	return 0;
 
     result = http_get_buffer(baton->client);
-    name = open_metrics_name(metric->name, baton->compat);
 
     if (baton->name == NULL)
 	baton->name = sdsempty();
@@ -504,51 +509,78 @@ on_pmwebapi_scrape(sds context, pmWebScrape *scrape, void *arg)
 	goto value;	/* metric header already done */
     }
 
+    if (cached && scrape->header && *scrape->header) {
+	result = sdscatsds(result, *scrape->header);
+	goto value;
+    }
+
+    name = open_metrics_name(metric->name, baton->compat);
     if (baton->compat == 0) {	/* include pmid, indom and type */
 	pmIDStr_r(metric->pmid, pmidstr, sizeof(pmidstr));
 	pmInDomStr_r(metric->indom, indomstr, sizeof(indomstr));
-	result = sdscatfmt(result, "# PCP5 %S %s %S %s %S %S\n",
+	header = sdscatfmt(sdsempty(), "# PCP5 %S %s %S %s %S %S\n",
 			metric->name, pmidstr, metric->type,
 			indomstr, metric->sem, metric->units);
     } else {
-	result = sdscatfmt(result, "# PCP %S %S %S\n",
+	header = sdscatfmt(sdsempty(), "# PCP %S %S %S\n",
 			metric->name, metric->sem, metric->units);
     }
 
     if (metric->oneline)
-	result = sdscatfmt(result, "# HELP %S %S\n", name, metric->oneline);
+	header = sdscatfmt(header, "# HELP %S %S\n", name, metric->oneline);
     semantics = open_metrics_semantics(metric->sem);
-    result = sdscatfmt(result, "# TYPE %S %S\n", name, semantics);
+    header = sdscatfmt(header, "# TYPE %S %S\n", name, semantics);
+
+    result = sdscatsds(result, header);
+    if (cached && scrape->header)
+	*scrape->header = header;	/* library now owns the template */
+    else
+	sdsfree(header);
 
 value:
+    if (cached && scrape->prefix && *scrape->prefix) {
+	result = sdscatsds(result, *scrape->prefix);
+	goto done;
+    }
+
     if (metric->indom != PM_INDOM_NULL)
 	labels = instance->labels;
     if (labels == NULL)
 	labels = metric->labels;
 
-    result = sdscatsds(result, name);
+    if (name == NULL)
+	name = open_metrics_name(metric->name, baton->compat);
+    prefix = sdsdup(name);
     if (metric->indom != PM_INDOM_NULL || labels) {
 	if (metric->indom != PM_INDOM_NULL) {
 	    quoted = sdscatrepr(sdsempty(), instance->name, sdslen(instance->name));
-	    result = sdscatfmt(result, "{instname=%S,instid=\"%u\"",
+	    prefix = sdscatfmt(prefix, "{instname=%S,instid=\"%u\"",
 					quoted, instance->inst);
 	    sdsfree(quoted);
 	    if (labels)
-		result = sdscatfmt(result, ",%S} %S", labels, value->value);
+		prefix = sdscatfmt(prefix, ",%S} ", labels);
 	    else
-		result = sdscatfmt(result, "} %S", value->value);
+		prefix = sdscatlen(prefix, "} ", 2);
 	} else {
-	    result = sdscatfmt(result, "{%S} %S", labels, value->value);
+	    prefix = sdscatfmt(prefix, "{%S} ", labels);
 	}
     } else {
-	result = sdscatfmt(result, " %S", value->value);
+	prefix = sdscatlen(prefix, " ", 1);
     }
 
+    result = sdscatsds(result, prefix);
+    if (cached && scrape->prefix)
+	*scrape->prefix = prefix;	/* library now owns the template */
+    else
+	sdsfree(prefix);
+
+done:
+    result = sdscatsds(result, value->value);
     if (baton->times) {
 	milliseconds = (scrape->seconds * 1000) + (scrape->nanoseconds / 1000);
 	result = sdscatfmt(result, " %I\n", milliseconds);
     } else {
-	result = sdscatfmt(result, "\n");
+	result = sdscatlen(result, "\n", 1);
     }
 
     sdsfree(semantics);
@@ -826,11 +858,39 @@ pmwebapi_request_url(struct client *client, sds url, dict *parameters)
     return 1;
 }
 
+/*
+ * Contexts belong to the worker process that created it - identifiers
+ * modulo the number of workers give the owner.  Returns the owning
+ * worker if that is not this process, else -1 (handled locally).
+ */
+static int
+pmwebapi_context_owner(struct client *client, pmWebGroupBaton *baton)
+{
+    struct proxy	*proxy = client->proxy;
+    unsigned long	id;
+    char		*endptr = NULL;
+
+    if (proxy->nworkers <= 1 || baton->context == NULL)
+	return -1;
+    id = strtoul(baton->context, &endptr, 10);
+    if (endptr == baton->context || *endptr != '\0')
+	return -1;
+    if (id % proxy->nworkers == proxy->worker)
+	return -1;
+    return id % proxy->nworkers;
+}
+
 static int
 pmwebapi_request_body(struct client *client, const char *content, size_t length)
 {
     pmWebGroupBaton	*baton = (pmWebGroupBaton *)client->u.http.data;
 
+    if (pmwebapi_context_owner(client, baton) >= 0) {
+	if (baton->body == NULL)
+	    baton->body = sdsempty();
+	baton->body = sdscatlen(baton->body, content, length);
+	return 0;
+    }
     if (baton->restkey == RESTKEY_DERIVE &&
 	client->u.http.parser.method == HTTP_POST) {
 	if (client->u.http.parameters == NULL)
@@ -851,36 +911,36 @@ pmwebapi_request_body(struct client *client, const char *content, size_t length)
 }
 
 static void
-pmwebapi_fetch(uv_work_t *work)
+pmwebapi_fetch(void *arg)
 {
-    pmWebGroupBaton	*baton = (pmWebGroupBaton *)work->data;
+    pmWebGroupBaton	*baton = (pmWebGroupBaton *)arg;
     struct dict		*params = baton->client->u.http.parameters;
 
     pmWebGroupFetch(&pmwebapi_settings, baton->context, params, baton);
 }
 
 static void
-pmwebapi_indom(uv_work_t *work)
+pmwebapi_indom(void *arg)
 {
-    pmWebGroupBaton	*baton = (pmWebGroupBaton *)work->data;
+    pmWebGroupBaton	*baton = (pmWebGroupBaton *)arg;
     struct dict		*params = baton->client->u.http.parameters;
 
     pmWebGroupInDom(&pmwebapi_settings, baton->context, params, baton);
 }
 
 static void
-pmwebapi_metric(uv_work_t *work)
+pmwebapi_metric(void *arg)
 {
-    pmWebGroupBaton	*baton = (pmWebGroupBaton *)work->data;
+    pmWebGroupBaton	*baton = (pmWebGroupBaton *)arg;
     struct dict		*params = baton->client->u.http.parameters;
 
     pmWebGroupMetric(&pmwebapi_settings, baton->context, params, baton);
 }
 
 static void
-pmwebapi_children(uv_work_t *work)
+pmwebapi_children(void *arg)
 {
-    pmWebGroupBaton	*baton = (pmWebGroupBaton *)work->data;
+    pmWebGroupBaton	*baton = (pmWebGroupBaton *)arg;
     struct dict		*params = baton->client->u.http.parameters;
 
     pmWebGroupChildren(&pmwebapi_settings, baton->context, params, baton);
@@ -888,63 +948,305 @@ pmwebapi_children(uv_work_t *work)
 
 
 static void
-pmwebapi_store(uv_work_t *work)
+pmwebapi_store(void *arg)
 {
-    pmWebGroupBaton	*baton = (pmWebGroupBaton *)work->data;
+    pmWebGroupBaton	*baton = (pmWebGroupBaton *)arg;
     struct dict		*params = baton->client->u.http.parameters;
 
     pmWebGroupStore(&pmwebapi_settings, baton->context, params, baton);
 }
 
 static void
-pmwebapi_derive(uv_work_t *work)
+pmwebapi_derive(void *arg)
 {
-    pmWebGroupBaton	*baton = (pmWebGroupBaton *)work->data;
+    pmWebGroupBaton	*baton = (pmWebGroupBaton *)arg;
     struct dict		*params = baton->client->u.http.parameters;
 
     pmWebGroupDerive(&pmwebapi_settings, baton->context, params, baton);
 }
 
 static void
-pmwebapi_profile(uv_work_t *work)
+pmwebapi_profile(void *arg)
 {
-    pmWebGroupBaton	*baton = (pmWebGroupBaton *)work->data;
+    pmWebGroupBaton	*baton = (pmWebGroupBaton *)arg;
     struct dict		*params = baton->client->u.http.parameters;
 
     pmWebGroupProfile(&pmwebapi_settings, baton->context, params, baton);
 }
 
 static void
-pmwebapi_scrape(uv_work_t *work)
+pmwebapi_scrape(void *arg)
 {
-    pmWebGroupBaton	*baton = (pmWebGroupBaton *)work->data;
+    pmWebGroupBaton	*baton = (pmWebGroupBaton *)arg;
     struct dict		*params = baton->client->u.http.parameters;
     
     pmWebGroupScrape(&pmwebapi_settings, baton->context, params, baton);
 }
 
 static void
-pmwebapi_context(uv_work_t *work)
+pmwebapi_context(void *arg)
 {
-    pmWebGroupBaton	*baton = (pmWebGroupBaton *)work->data;
+    pmWebGroupBaton	*baton = (pmWebGroupBaton *)arg;
     struct dict		*params = baton->client->u.http.parameters;
 
     pmWebGroupContext(&pmwebapi_settings, baton->context, params, baton);
 }
 
+/* request dropped from the worker queue on shutdown */
 static void
-pmwebapi_work_done(uv_work_t *work, int status)
+pmwebapi_cancel(void *arg)
 {
-    (void)status;
-    free(work);
+    pmWebGroupBaton	*baton = (pmWebGroupBaton *)arg;
+    struct client	*client = baton->client;
+    sds			msg;
+
+    client->u.http.parser.status_code = HTTP_STATUS_SERVICE_UNAVAILABLE;
+    msg = sdsnew("server shutting down");
+    on_pmwebapi_done(NULL, -EBUSY, msg, baton);
+    sdsfree(msg);
+}
+
+/*
+ * Anonymous scrapes (no context parameter) all share one cached context
+ * per host and user, so these are serialized under a key of their own.
+ */
+static sds
+pmwebapi_scrape_key(dict *parameters)
+{
+    sds		key, value = NULL;
+
+    if (parameters && (value = dictFetchValue(parameters, PARAM_HOSTSPEC)) == NULL)
+	value = dictFetchValue(parameters, PARAM_HOSTNAME);
+    key = sdsnew("scrape\n");
+    key = sdscat(key, value ? value : "local:");
+    if (parameters && (value = dictFetchValue(parameters, AUTH_USERNAME)) != NULL)
+	key = sdscatfmt(key, "\n%S", value);
+    return key;
+}
+
+/*
+ * Requests for a context created by another worker process are passed
+ * on to that worker via its local socket, and the response it sends is
+ * replied to the client from here.
+ */
+typedef struct pmWebForward {
+    struct client	*client;
+    http_options	options;
+    http_flags		flags;
+    http_parser		parser;
+    unsigned int	complete;
+    sds			field;		/* current response header name */
+    sds			request;
+    sds			response;
+    uv_pipe_t		pipe;
+    uv_connect_t	connect;
+    uv_write_t		writer;
+} pmWebForward;
+
+static int
+on_forward_header_field(http_parser *parser, const char *offset, size_t length)
+{
+    pmWebForward	*fp = (pmWebForward *)parser->data;
+
+    sdsfree(fp->field);
+    fp->field = sdsnewlen(offset, length);
+    return 0;
+}
+
+static int
+on_forward_header_value(http_parser *parser, const char *offset, size_t length)
+{
+    pmWebForward	*fp = (pmWebForward *)parser->data;
+
+    if (fp->field == NULL || strcasecmp(fp->field, "Content-Type") != 0)
+	return 0;
+    fp->flags &= ~(HTTP_FLAG_JSON | HTTP_FLAG_TEXT | HTTP_FLAG_HTML);
+    if (length >= 16 && strncmp(offset, "application/json", 16) == 0)
+	fp->flags |= HTTP_FLAG_JSON;
+    else if (length >= 10 && strncmp(offset, "text/plain", 10) == 0)
+	fp->flags |= HTTP_FLAG_TEXT;
+    else if (length >= 9 && strncmp(offset, "text/html", 9) == 0)
+	fp->flags |= HTTP_FLAG_HTML;
+    return 0;
+}
+
+static int
+on_forward_body(http_parser *parser, const char *offset, size_t length)
+{
+    pmWebForward	*fp = (pmWebForward *)parser->data;
+
+    fp->response = sdscatlen(fp->response, offset, length);
+    return 0;
+}
+
+static int
+on_forward_complete(http_parser *parser)
+{
+    pmWebForward	*fp = (pmWebForward *)parser->data;
+
+    fp->complete = 1;
+    return 0;
+}
+
+static const http_parser_settings forward_settings = {
+    .on_header_field	= on_forward_header_field,
+    .on_header_value	= on_forward_header_value,
+    .on_body		= on_forward_body,
+    .on_message_complete = on_forward_complete,
+};
+
+static void
+on_forward_close(uv_handle_t *handle)
+{
+    pmWebForward	*fp = (pmWebForward *)handle->data;
+
+    sdsfree(fp->field);
+    sdsfree(fp->request);
+    sdsfree(fp->response);
+    free(fp);
+}
+
+static void
+pmwebapi_forward_done(pmWebForward *fp, int close)
+{
+    struct client	*client = fp->client;
+    http_code		code;
+    sds			msg;
+
+    if (fp->complete) {
+	code = fp->parser.status_code;
+	msg = fp->response;
+	fp->response = NULL;
+    } else {
+	code = HTTP_STATUS_BAD_GATEWAY;
+	fp->flags = (fp->flags & ~(HTTP_FLAG_TEXT | HTTP_FLAG_HTML)) |
+			HTTP_FLAG_JSON;
+	msg = sdsnew("{\"message\":\"context worker unavailable\","
+			"\"success\":false}\r\n");
+    }
+    if (pmDebugOptions.http)
+	fprintf(stderr, "%s: client %p status %u\n", "pmwebapi_forward_done",
+			client, code);
+
+    if (client_is_closed(client))
+	sdsfree(msg);
+    else
+	http_reply(client, msg, code, fp->flags, fp->options);
+    client_put(client);
+
+    if (close)
+	uv_close((uv_handle_t *)&fp->pipe, on_forward_close);
+    else
+	on_forward_close((uv_handle_t *)&fp->pipe);
+}
+
+static void
+on_forward_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf)
+{
+    pmWebForward	*fp = (pmWebForward *)stream->data;
+
+    if (nread > 0 && fp->complete == 0)
+	http_parser_execute(&fp->parser, &forward_settings, buf->base, nread);
+    if (buf->base)
+	sdsfree(buf->base);
+    if (nread < 0 || fp->complete) {
+	uv_read_stop(stream);
+	if (nread == UV_EOF && fp->complete == 0)	/* no length, EOF ends */
+	    http_parser_execute(&fp->parser, &forward_settings, NULL, 0);
+	pmwebapi_forward_done(fp, 1);
+    }
+}
+
+static void
+on_forward_write(uv_write_t *writer, int status)
+{
+    pmWebForward	*fp = (pmWebForward *)writer->data;
+
+    if (status < 0) {
+	uv_read_stop((uv_stream_t *)&fp->pipe);
+	pmwebapi_forward_done(fp, 1);
+    }
+}
+
+static void
+on_forward_connect(uv_connect_t *connect, int status)
+{
+    pmWebForward	*fp = (pmWebForward *)connect->data;
+    uv_buf_t		buf;
+
+    if (status < 0) {
+	if (pmDebugOptions.http)
+	    fprintf(stderr, "%s: %s\n", "on_forward_connect", uv_strerror(status));
+	pmwebapi_forward_done(fp, 1);
+	return;
+    }
+    buf.base = fp->request;
+    buf.len = sdslen(fp->request);
+    fp->writer.data = fp;
+    uv_write(&fp->writer, (uv_stream_t *)&fp->pipe, &buf, 1, on_forward_write);
+    uv_read_start((uv_stream_t *)&fp->pipe, on_buffer_alloc, on_forward_read);
+}
+
+static void
+pmwebapi_forward(struct client *client, pmWebGroupBaton *baton, int owner)
+{
+    struct proxy	*proxy = client->proxy;
+    pmWebForward	*fp;
+    sds			path, credentials;
+
+    if (pmDebugOptions.http)
+	fprintf(stderr, "%s: context %s to worker %d for client %p\n",
+			"pmwebapi_forward", baton->context, owner, client);
+
+    if ((fp = calloc(1, sizeof(*fp))) == NULL) {
+	client->u.http.parser.status_code = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+	on_pmwebapi_done(NULL, -ENOMEM, NULL, baton);
+	return;
+    }
+    fp->client = client;
+    fp->options = baton->options;
+    fp->flags = client->u.http.flags;
+    fp->response = sdsempty();
+    http_parser_init(&fp->parser, HTTP_RESPONSE);
+    fp->parser.data = fp;
+
+    /* request for the owning worker, which closes after replying */
+    fp->request = sdscatfmt(sdsempty(), "%s %S HTTP/1.1\r\n"
+		"Host: localhost\r\nConnection: close\r\n",
+		http_method_str(client->u.http.parser.method),
+		client->u.http.url);
+    if (client->u.http.username) {
+	credentials = sdscatfmt(sdsempty(), "%S:%S", client->u.http.username,
+		client->u.http.password ? client->u.http.password : "");
+	path = base64_encode(credentials, sdslen(credentials));
+	fp->request = sdscatfmt(fp->request, "Authorization: Basic %S\r\n", path);
+	sdsfree(credentials);
+	sdsfree(path);
+    }
+    if (baton->body)
+	fp->request = sdscatfmt(fp->request, "Content-Length: %U\r\n\r\n%S",
+		(unsigned long long)sdslen(baton->body), baton->body);
+    else
+	fp->request = sdscat(fp->request, "\r\n");
+
+    uv_pipe_init(proxy->events, &fp->pipe, 0);
+    fp->pipe.data = fp;
+    fp->connect.data = fp;
+    if ((path = worker_local_path(proxy, owner)) == NULL) {
+	pmwebapi_forward_done(fp, 1);
+	return;
+    }
+    uv_pipe_connect(&fp->connect, &fp->pipe, path, on_forward_connect);
+    sdsfree(path);
 }
 
 static int
 pmwebapi_request_done(struct client *client)
 {
     pmWebGroupBaton	*baton = (pmWebGroupBaton *)client->u.http.data;
-    uv_loop_t		*loop = client->proxy->events;
-    uv_work_t		*work;
+    webpool_func	func;
+    sds			key, msg;
+    int			sts;
 
     /* take a reference on the client to prevent freeing races on close */
     client_get(client);
@@ -961,47 +1263,62 @@ pmwebapi_request_done(struct client *client)
 	return 0;
     }
 
-    if ((work = (uv_work_t *)calloc(1, sizeof(uv_work_t))) == NULL) {
-	client_put(client);
-	return 1;
+    /* pass on requests for contexts of other worker processes */
+    if ((sts = pmwebapi_context_owner(client, baton)) >= 0) {
+	pmwebapi_forward(client, baton, sts);
+	return 0;
     }
-    work->data = baton;
 
     /* submit command request to worker thread */
     switch (baton->restkey) {
     case RESTKEY_CONTEXT:
-	uv_queue_work(loop, work, pmwebapi_context, pmwebapi_work_done);
+	func = pmwebapi_context;
 	break;
     case RESTKEY_PROFILE:
-	uv_queue_work(loop, work, pmwebapi_profile, pmwebapi_work_done);
+	func = pmwebapi_profile;
 	break;
     case RESTKEY_METRIC:
-	uv_queue_work(loop, work, pmwebapi_metric, pmwebapi_work_done);
+	func = pmwebapi_metric;
 	break;
     case RESTKEY_FETCH:
-	uv_queue_work(loop, work, pmwebapi_fetch, pmwebapi_work_done);
+	func = pmwebapi_fetch;
 	break;
     case RESTKEY_INDOM:
-	uv_queue_work(loop, work, pmwebapi_indom, pmwebapi_work_done);
+	func = pmwebapi_indom;
 	break;
     case RESTKEY_CHILD:
-	uv_queue_work(loop, work, pmwebapi_children, pmwebapi_work_done);
+	func = pmwebapi_children;
 	break;
     case RESTKEY_STORE:
-	uv_queue_work(loop, work, pmwebapi_store, pmwebapi_work_done);
+	func = pmwebapi_store;
 	break;
     case RESTKEY_DERIVE:
-	uv_queue_work(loop, work, pmwebapi_derive, pmwebapi_work_done);
+	func = pmwebapi_derive;
 	break;
     case RESTKEY_SCRAPE:
-	uv_queue_work(loop, work, pmwebapi_scrape, pmwebapi_work_done);
+	func = pmwebapi_scrape;
 	break;
     default:
-	pmwebapi_work_done(work, -EINVAL);
 	client->u.http.parser.status_code = HTTP_STATUS_BAD_REQUEST;
 	on_pmwebapi_done(NULL, -EINVAL, NULL, baton);
 	return 1;
     }
+
+    /* requests on one context run in order, shed load when saturated */
+    if (baton->restkey == RESTKEY_SCRAPE && baton->context == NULL) {
+	key = pmwebapi_scrape_key(client->u.http.parameters);
+	sts = webpool_submit(key, func, pmwebapi_cancel, baton);
+	sdsfree(key);
+    } else {
+	sts = webpool_submit(baton->context, func, pmwebapi_cancel, baton);
+    }
+    if (sts < 0) {
+	client->u.http.parser.status_code = HTTP_STATUS_SERVICE_UNAVAILABLE;
+	msg = sdsnew("request queue full, retry later");
+	on_pmwebapi_done(NULL, -EBUSY, msg, baton);
+	sdsfree(msg);
+	return 1;
+    }
     return 0;
 }
 
@@ -1020,16 +1337,23 @@ pmwebapi_servlet_setup(struct proxy *proxy)
     PARAM_TIMES = sdsnew("times");
     PARAM_CLIENT = sdsnew("client");
     PARAM_CONTEXT = sdsnew("context");
+    PARAM_HOSTNAME = sdsnew("hostname");
+    PARAM_HOSTSPEC = sdsnew("hostspec");
+    AUTH_USERNAME = sdsnew("auth.username");
 
     pmWebGroupSetup(&pmwebapi_settings.module);
     pmWebGroupSetEventLoop(&pmwebapi_settings.module, proxy->events);
     pmWebGroupSetConfiguration(&pmwebapi_settings.module, proxy->config);
     pmWebGroupSetMetricRegistry(&pmwebapi_settings.module, metric_registry);
+    pmWebGroupSetWorker(&pmwebapi_settings.module, proxy->worker, proxy->nworkers);
+
+    webpool_setup(proxy);
 }
 
 static void
 pmwebapi_servlet_close(struct proxy *proxy)
 {
+    webpool_close(proxy);
     pmWebGroupClose(&pmwebapi_settings.module);
     proxymetrics_close(proxy, METRICS_WEBGROUP);
 
@@ -1043,6 +1367,9 @@ pmwebapi_servlet_close(struct proxy *proxy)
     sdsfree(PARAM_TIMES);
     sdsfree(PARAM_CLIENT);
     sdsfree(PARAM_CONTEXT);
+    sdsfree(PARAM_HOSTNAME);
+    sdsfree(PARAM_HOSTSPEC);
+    sdsfree(AUTH_USERNAME);
 }
 
 struct servlet pmwebapi_servlet = {
@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#include "server.h"
+#include "webpool.h"
+#include "util.h"
+
+/*
+ * Dedicated worker threads for PMWEBAPI(3) requests.  These may block
+ * for long periods in PMAPI calls to slow or unreachable pmcd servers,
+ * so are kept apart from the (shared, small) libuv threadpool used for
+ * filesystem and DNS work.  Requests for any one context are serialized
+ * and queue lengths are bounded - beyond the limits requests are shed,
+ * which the REST API reports to clients as 503 Service Unavailable.
+ */
+#define DEFAULT_THREADS		4
+#define DEFAULT_QUEUE_MAX	1024
+#define DEFAULT_QUEUE_CONTEXT	64
+
+typedef struct webjob {
+    struct webjob	*next;
+    webpool_func	func;
+    webpool_func	cancel;		/* completes a request never run */
+    void		*data;
+    sds			key;		/* context key for serialization */
+    uint64_t		queued;		/* submission time (nanoseconds) */
+} webjob;
+
+typedef struct webqueue {		/* requests for one busy context */
+    webjob		*head;
+    webjob		*tail;
+    unsigned int	count;		/* queued (or running) for context */
+} webqueue;
+
+enum {
+    WEBPOOL_THREADS,
+    WEBPOOL_REQUESTS,
+    WEBPOOL_REJECTED,
+    WEBPOOL_QUEUED,
+    WEBPOOL_ACTIVE,
+    WEBPOOL_QUEUE_TIME,
+    WEBPOOL_SERVICE_TIME,
+    NUM_WEBPOOL_METRICS
+};
+
+static struct webpool {
+    uv_mutex_t		lock;
+    uv_cond_t		cond;
+    uv_thread_t		*threads;
+    unsigned int	nthreads;
+    unsigned int	maxqueue;	/* pmwebapi.queue.max */
+    unsigned int	maxcontext;	/* pmwebapi.queue.context */
+    unsigned int	queued;		/* requests not yet running */
+    unsigned int	active;		/* requests currently running */
+    unsigned int	shutdown;
+    webjob		*head;		/* runnable requests */
+    webjob		*tail;
+    dict		*contexts;	/* context key -> webqueue */
+    void		*map;
+    pmAtomValue		*values[NUM_WEBPOOL_METRICS];
+} pool;
+
+static void
+webpool_metric_set(int metric, double value)
+{
+    if (pool.values[metric])
+	mmv_set_value(pool.map, pool.values[metric], value);
+}
+
+static void
+webpool_metric_inc(int metric, double value)
+{
+    if (pool.values[metric])
+	mmv_inc_value(pool.map, pool.values[metric], value);
+}
+
+/* append to the runnable queue - caller holds the pool lock */
+static void
+webpool_runnable(webjob *job)
+{
+    job->next = NULL;
+    if (pool.tail)
+	pool.tail->next = job;
+    else
+	pool.head = job;
+    pool.tail = job;
+    uv_cond_signal(&pool.cond);
+}
+
+/* context request completed, start next - caller holds the pool lock */
+static void
+webpool_release(webjob *job)
+{
+    webqueue		*queue;
+    webjob		*next;
+
+    if (job->key == NULL ||
+	(queue = (webqueue *)dictFetchValue(pool.contexts, job->key)) == NULL)
+	return;
+
+    queue->count--;
+    if ((next = queue->head) != NULL) {
+	if ((queue->head = next->next) == NULL)
+	    queue->tail = NULL;
+	webpool_runnable(next);
+    } else {
+	dictDelete(pool.contexts, job->key);
+	free(queue);
+    }
+}
+
+static void
+webpool_free(webjob *job)
+{
+    sdsfree(job->key);
+    free(job);
+}
+
+/* request discarded on shutdown - let the submitter complete it */
+static void
+webpool_cancel(webjob *job)
+{
+    if (job->cancel)
+	job->cancel(job->data);
+    webpool_free(job);
+}
+
+static void
+webpool_worker(void *arg)
+{
+    webjob		*job;
+    uint64_t		start, finish;
+
+    (void)arg;
+    uv_mutex_lock(&pool.lock);
+    for (;;) {
+	while (pool.head == NULL && pool.shutdown == 0)
+	    uv_cond_wait(&pool.cond, &pool.lock);
+	if (pool.shutdown)
+	    break;
+
+	job = pool.head;
+	if ((pool.head = job->next) == NULL)
+	    pool.tail = NULL;
+	pool.queued--;
+	pool.active++;
+
+	start = uv_hrtime();
+	webpool_metric_inc(WEBPOOL_QUEUE_TIME, (start - job->queued) / 1000);
+	webpool_metric_set(WEBPOOL_QUEUED, pool.queued);
+	webpool_metric_set(WEBPOOL_ACTIVE, pool.active);
+	uv_mutex_unlock(&pool.lock);
+
+	job->func(job->data);
+
+	finish = uv_hrtime();
+	uv_mutex_lock(&pool.lock);
+	pool.active--;
+	webpool_metric_inc(WEBPOOL_SERVICE_TIME, (finish - start) / 1000);
+	webpool_metric_set(WEBPOOL_ACTIVE, pool.active);
+	webpool_release(job);
+	webpool_free(job);
+    }
+    uv_mutex_unlock(&pool.lock);
+}
+
+int
+webpool_submit(sds key, webpool_func func, webpool_func cancel, void *data)
+{
+    webqueue		*queue = NULL;
+    webjob		*job;
+
+    uv_mutex_lock(&pool.lock);
+    if (pool.nthreads == 0 || pool.shutdown)
+	goto reject;
+    if (pool.maxqueue && pool.queued >= pool.maxqueue)
+	goto reject;
+    if (key && (queue = (webqueue *)dictFetchValue(pool.contexts, key)) &&
+	pool.maxcontext && queue->count >= pool.maxcontext)
+	goto reject;
+    if ((job = (webjob *)calloc(1, sizeof(webjob))) == NULL)
+	goto reject;
+
+    job->func = func;
+    job->cancel = cancel;
+    job->data = data;
+    job->queued = uv_hrtime();
+
+    if (key == NULL) {
+	webpool_runnable(job);
+    } else {
+	job->key = sdsdup(key);
+	if (queue == NULL) {	/* context idle, request can run */
+	    if ((queue = (webqueue *)calloc(1, sizeof(webqueue))) == NULL) {
+		webpool_free(job);
+		goto reject;
+	    }
+	    queue->count = 1;
+	    dictAdd(pool.contexts, key, queue);
+	    webpool_runnable(job);
+	} else {		/* wait for earlier context requests */
+	    queue->count++;
+	    if (queue->tail)
+		queue->tail->next = job;
+	    else
+		queue->head = job;
+	    queue->tail = job;
+	}
+    }
+    pool.queued++;
+    webpool_metric_inc(WEBPOOL_REQUESTS, 1);
+    webpool_metric_set(WEBPOOL_QUEUED, pool.queued);
+    uv_mutex_unlock(&pool.lock);
+    return 0;
+
+reject:
+    webpool_metric_inc(WEBPOOL_REJECTED, 1);
+    uv_mutex_unlock(&pool.lock);
+    return -EBUSY;
+}
+
+static void
+webpool_metrics(struct proxy *proxy)
+{
+    mmv_registry_t	*registry = proxymetrics(proxy, METRICS_WEBPOOL);
+    pmUnits		units_count = MMV_UNITS(0, 0, 1, 0, 0, PM_COUNT_ONE);
+    pmUnits		units_usec = MMV_UNITS(0, 1, 0, 0, PM_TIME_USEC, 0);
+    pmInDom		noindom = MMV_INDOM_NULL;
+
+    if (registry == NULL)
+	return;
+
+    mmv_stats_add_metric(registry, "threads", 1,
+	MMV_TYPE_U32, MMV_SEM_DISCRETE, units_count, noindom,
+	"number of REST API worker threads",
+	"Number of dedicated threads servicing PMWEBAPI requests");
+    mmv_stats_add_metric(registry, "requests", 2,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_count, noindom,
+	"REST API requests queued",
+	"Number of PMWEBAPI requests accepted onto the worker queue");
+    mmv_stats_add_metric(registry, "rejected", 3,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_count, noindom,
+	"REST API requests shed",
+	"Number of PMWEBAPI requests refused with 503 Service Unavailable\n"
+	"as the worker queue (pmwebapi.queue.max) or the queue for a single\n"
+	"context (pmwebapi.queue.context) was full.");
+    mmv_stats_add_metric(registry, "queued", 4,
+	MMV_TYPE_U32, MMV_SEM_INSTANT, units_count, noindom,
+	"REST API requests waiting",
+	"Number of PMWEBAPI requests waiting for a worker thread or for\n"
+	"an earlier request on the same context to complete.");
+    mmv_stats_add_metric(registry, "active", 5,
+	MMV_TYPE_U32, MMV_SEM_INSTANT, units_count, noindom,
+	"REST API requests running",
+	"Number of PMWEBAPI requests currently running on worker threads");
+    mmv_stats_add_metric(registry, "queue.time", 6,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_usec, noindom,
+	"total REST API request queueing latency",
+	"Total time PMWEBAPI requests spent queued before running.  The\n"
+	"average queue latency is queue.time / requests.");
+    mmv_stats_add_metric(registry, "service.time", 7,
+	MMV_TYPE_U64, MMV_SEM_COUNTER, units_usec, noindom,
+	"total REST API request service time",
+	"Total time PMWEBAPI requests spent running on worker threads");
+
+    if ((pool.map = mmv_stats_start(registry)) == NULL)
+	return;
+    pool.values[WEBPOOL_THREADS] = mmv_lookup_value_desc(pool.map, "threads", NULL);
+    pool.values[WEBPOOL_REQUESTS] = mmv_lookup_value_desc(pool.map, "requests", NULL);
+    pool.values[WEBPOOL_REJECTED] = mmv_lookup_value_desc(pool.map, "rejected", NULL);
+    pool.values[WEBPOOL_QUEUED] = mmv_lookup_value_desc(pool.map, "queued", NULL);
+    pool.values[WEBPOOL_ACTIVE] = mmv_lookup_value_desc(pool.map, "active", NULL);
+    pool.values[WEBPOOL_QUEUE_TIME] = mmv_lookup_value_desc(pool.map, "queue.time", NULL);
+    pool.values[WEBPOOL_SERVICE_TIME] = mmv_lookup_value_desc(pool.map, "service.time", NULL);
+}
+
+static unsigned int
+webpool_option(struct proxy *proxy, const char *name, unsigned int value)
+{
+    sds			option;
+    char		*endnum;
+    unsigned long	number;
+
+    if ((option = pmIniFileLookup(proxy->config, "pmwebapi", name)) != NULL) {
+	number = strtoul(option, &endnum, 0);
+	if (*endnum == '\0')
+	    return (unsigned int)number;
+	pmNotifyErr(LOG_WARNING, "invalid pmwebapi.%s setting: %s\n",
+			name, option);
+    }
+    return value;
+}
+
+void
+webpool_setup(struct proxy *proxy)
+{
+    unsigned int	i, nthreads;
+
+    nthreads = webpool_option(proxy, "threads", DEFAULT_THREADS);
+    if (nthreads == 0)
+	nthreads = 1;
+    pool.maxqueue = webpool_option(proxy, "queue.max", DEFAULT_QUEUE_MAX);
+    pool.maxcontext = webpool_option(proxy, "queue.context", DEFAULT_QUEUE_CONTEXT);
+
+    uv_mutex_init(&pool.lock);
+    uv_cond_init(&pool.cond);
+    pool.contexts = dictCreate(&sdsKeyDictCallBacks, NULL);
+
+    webpool_metrics(proxy);
+
+    if ((pool.threads = calloc(nthreads, sizeof(uv_thread_t))) == NULL) {
+	pmNotifyErr(LOG_ERR, "%s: out of memory for %u threads\n",
+			"webpool_setup", nthreads);
+	return;
+    }
+    for (i = 0; i < nthreads; i++) {
+	if (uv_thread_create(&pool.threads[i], webpool_worker, NULL) < 0)
+	    break;
+	pool.nthreads++;
+    }
+    webpool_metric_set(WEBPOOL_THREADS, pool.nthreads);
+}
+
+void
+webpool_close(struct proxy *proxy)
+{
+    dictIterator	*iterator;
+    dictEntry		*entry;
+    webqueue		*queue;
+    webjob		*job;
+    unsigned int	i;
+
+    if (pool.contexts == NULL)
+	return;
+
+    uv_mutex_lock(&pool.lock);
+    pool.shutdown = 1;
+    uv_cond_broadcast(&pool.cond);
+    uv_mutex_unlock(&pool.lock);
+
+    /* running requests complete, queued requests are cancelled */
+    for (i = 0; i < pool.nthreads; i++)
+	uv_thread_join(&pool.threads[i]);
+    free(pool.threads);
+
+    while ((job = pool.head) != NULL) {
+	pool.head = job->next;
+	webpool_cancel(job);
+    }
+    iterator = dictGetSafeIterator(pool.contexts);
+    while ((entry = dictNext(iterator)) != NULL) {
+	queue = (webqueue *)dictGetVal(entry);
+	while ((job = queue->head) != NULL) {
+	    queue->head = job->next;
+	    webpool_cancel(job);
+	}
+	free(queue);
+    }
+    dictReleaseIterator(iterator);
+    dictRelease(pool.contexts);
+
+    uv_cond_destroy(&pool.cond);
+    uv_mutex_destroy(&pool.lock);
+    memset(&pool, 0, sizeof(pool));
+
+    proxymetrics_close(proxy, METRICS_WEBPOOL);
+}
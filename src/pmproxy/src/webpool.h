@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#ifndef PMPROXY_WEBPOOL_H
+#define PMPROXY_WEBPOOL_H
+
+#include "sds.h"
+
+struct proxy;
+
+typedef void (*webpool_func)(void *);
+
+extern void webpool_setup(struct proxy *);
+extern void webpool_close(struct proxy *);
+
+/*
+ * Queue PMWEBAPI(3) work for the dedicated worker threads.  Requests
+ * with the same (non-NULL) context key are run one at a time, in the
+ * order submitted.  Returns -EBUSY if the request was shed due to the
+ * pool (or context) queue limits, in which case it will not be run.
+ * Requests still queued when the pool is closed are not run either;
+ * instead the (optional) cancel function is called to complete them.
+ */
+extern int webpool_submit(sds, webpool_func, webpool_func, void *);
+
+#endif	/* PMPROXY_WEBPOOL_H */
@@ -94,6 +94,12 @@ typedef struct series_data {
     unsigned int        ninsts;		/* instances for the current series */
     series_inst		*insts;		/* instances for the current series */
     pmSID		*iseries;	/* series identifiers for instances */
+
+    unsigned int	jobs;		/* concurrent archive (host) loads */
+    unsigned int	nloads;		/* number of queued archive loads */
+    unsigned int	nextload;	/* next queued archive load to start */
+    unsigned int	active;		/* archive loads currently underway */
+    sds			*loads;		/* queued archive load expressions */
 } series_data;
 
 static void on_series_done(int, void *);
@@ -225,6 +231,9 @@ series_data_free(series_data *dp)
 
     series_data_reset(dp);
 
+    if (dp->nloads)
+	series_free(dp->nloads, dp->loads);
+
     sdsfree(dp->series);
     sdsfree(dp->source);
     sdsfree(dp->query);
@@ -322,15 +331,50 @@ series_type_phrase(const char *type_word)
     return "???";
 }
 
-static void
-series_load(series_data *dp)
+/*
+ * Start the next queued archive load.  Each queued load holds all of
+ * the archives of one host, which are loaded in time order (as one
+ * multi-archive context), and up to dp->jobs hosts are loaded
+ * concurrently - with a load rate summary reported for each host.
+ * Returns non-zero if a load was started.
+ */
+static int
+series_load_next(series_data *dp)
 {
-    pmSeriesFlags	meta = dp->flags & PMSERIES_FAST ?
+    pmSeriesFlags	flags = dp->flags & PMSERIES_FAST ?
 				PM_SERIES_FLAG_METADATA : 0;
+    sds			query;
     int			sts;
 
-    if ((sts = pmSeriesLoad(&dp->settings, dp->query, meta, dp)) < 0)
+    if (dp->nextload >= dp->nloads)
+	return 0;
+    query = dp->loads[dp->nextload++];
+    dp->active++;
+    if (dp->nloads > 1 || dp->jobs > 1)
+	flags |= PM_SERIES_FLAG_SUMMARY;
+    sts = pmSeriesLoad(&dp->settings, query, flags, dp);
+    if (sts < 0)
 	on_series_done(sts, dp);
+    return 1;
+}
+
+static void
+series_load(series_data *dp)
+{
+    unsigned int	i;
+
+    if (dp->nloads == 0) {	/* single load expression */
+	dp->loads = calloc(1, sizeof(sds));
+	if (dp->loads == NULL) {
+	    on_series_done(-ENOMEM, dp);
+	    return;
+	}
+	dp->loads[0] = sdsdup(dp->query);
+	dp->nloads = 1;
+    }
+    for (i = 0; i < dp->jobs; i++)
+	if (series_load_next(dp) == 0)
+	    break;
 }
 
 static int
@@ -799,6 +843,13 @@ on_series_done(int sts, void *arg)
 	dp->status = 1;
     }
 
+    /* concurrent archive loads complete only once all have finished */
+    if (dp->active > 0) {
+	dp->active--;
+	if (series_load_next(dp) || dp->active > 0)
+	    return;
+    }
+
     if ((entry = dp->next) != NULL) {
 	dp->next = entry->next;
 	func = entry->func;
@@ -1106,6 +1157,69 @@ heuristic_archive_query(sds query)
     return query;
 }
 
+/*
+ * Several archive paths given to --load are queued as separate load
+ * expressions, one per host - all archives of a host are written to
+ * the same series, so these are loaded in time order as a single
+ * multi-archive context, while different hosts can be loaded
+ * concurrently (see --jobs).  Returns zero if any argument is not
+ * an archive path, in which case the arguments are treated as one
+ * load expression.
+ */
+static int
+heuristic_archive_loads(series_data *dp, int argc, char **argv)
+{
+    pmLogLabel	label;
+    sds		*hosts, *paths, expr;
+    int		i, j, ctx, sts, nhosts = 0;
+
+    if (argc < 2)
+	return 0;
+    for (i = 0; i < argc; i++)
+	if (argv[i][0] == '{' || access(argv[i], F_OK) != 0)
+	    return 0;
+    if ((hosts = calloc(argc, sizeof(sds))) == NULL)
+	return 0;
+    if ((paths = calloc(argc, sizeof(sds))) == NULL) {
+	free(hosts);
+	return 0;
+    }
+    for (i = 0; i < argc; i++) {
+	if ((ctx = pmNewContext(PM_CONTEXT_ARCHIVE, argv[i])) < 0)
+	    break;
+	sts = pmGetArchiveLabel(&label);
+	pmDestroyContext(ctx);
+	if (sts < 0)
+	    break;
+	for (j = 0; j < nhosts; j++)
+	    if (strcmp(hosts[j], label.ll_hostname) == 0)
+		break;
+	if (j == nhosts) {
+	    hosts[nhosts++] = sdsnew(label.ll_hostname);
+	    paths[j] = sdsnew(argv[i]);
+	} else {
+	    paths[j] = sdscatfmt(paths[j], ",%s", argv[i]);
+	}
+    }
+    for (j = 0; j < nhosts; j++)
+	sdsfree(hosts[j]);
+    free(hosts);
+    if (i < argc) {		/* not all archives - single load expression */
+	for (j = 0; j < nhosts; j++)
+	    sdsfree(paths[j]);
+	free(paths);
+	return 0;
+    }
+    for (j = 0; j < nhosts; j++) {
+	expr = sdscatfmt(sdsempty(), "{source.path: \"%S\"}", paths[j]);
+	sdsfree(paths[j]);
+	paths[j] = expr;
+    }
+    dp->loads = paths;
+    dp->nloads = nhosts;
+    return nhosts;
+}
+
 static int
 pmseries_overrides(int opt, pmOptions *opts)
 {
@@ -1123,6 +1237,7 @@ static pmLongOptions longopts[] = {
     { "host", 1, 'h', "HOST", "connect to Redis using given host name" },
     { "port", 1, 'p', "PORT", "connect to Redis using given TCP/IP port" },
     PMAPI_OPTIONS_HEADER("General Options"),
+    { "jobs", 1, 'j', "N", "number of hosts whose archives are loaded concurrently" },
     { "load", 0, 'L', 0, "load time series values and metadata" },
     { "query", 0, 'q', 0, "perform a time series query (default)" },
     { "values", 0, 'v', 0, "all known values for given label name(s)" },
@@ -1149,7 +1264,7 @@ static pmLongOptions longopts[] = {
 
 static pmOptions opts = {
     .flags = PM_OPTFLAG_BOUNDARIES,
-    .short_options = "ac:dD:eFg:h:iIlLmMnqp:sStvVZ:?",
+    .short_options = "ac:dD:eFg:h:iIj:lLmMnqp:sStvVZ:?",
     .long_options = longopts,
     .short_usage = "[options] [query ... | labels ... | series ... | source ...]",
     .override = pmseries_overrides,
@@ -1166,6 +1281,8 @@ main(int argc, char *argv[])
     const char		*redis_host = NULL;
     static char		tzbuffer[128];
     unsigned int	redis_port = 6379;	/* default Redis port */
+    unsigned int	jobs = 1;
+    char		*endnum;
     struct dict		*config;
     series_flags	flags = 0;
     series_data		*dp;
@@ -1209,6 +1326,15 @@ main(int argc, char *argv[])
 	    flags |= PMSERIES_OPT_LABELS;
 	    break;
 
+	case 'j':	/* number of concurrent archive loads */
+	    jobs = (unsigned int)strtoul(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || jobs == 0) {
+		pmprintf("%s: -j requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+
 	case 'L':	/* command line contains source load string */
 	    flags |= PMSERIES_OPT_LOAD;
 	    split = space;
@@ -1374,6 +1500,10 @@ main(int argc, char *argv[])
     dp = series_data_init(flags, query);
     dp->loop = uv_default_loop();
     dp->args.pattern = match;
+    dp->jobs = jobs;
+
+    if (flags & PMSERIES_OPT_LOAD)
+	heuristic_archive_loads(dp, argc - opts.optind, &argv[opts.optind]);
 
     dp->settings.callbacks.on_match = on_series_match;
     dp->settings.callbacks.on_desc = on_series_desc;